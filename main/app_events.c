@@ -0,0 +1,47 @@
+#include "app_events.h"
+#include "esp_log.h"
+#include "metrics.h"
+
+#define APP_EVENTS_QUEUE_SIZE 16
+
+#define TAG "app_events"
+
+ESP_EVENT_DEFINE_BASE(APP_EVENTS);
+
+static esp_event_loop_handle_t app_loop = NULL;
+
+esp_err_t app_events_init(void) {
+  esp_event_loop_args_t loop_args = {
+      .queue_size = APP_EVENTS_QUEUE_SIZE,
+      .task_name = "app events",
+      .task_priority = 6,
+      .task_stack_size = 3072,
+      .task_core_id = tskNO_AFFINITY,
+  };
+  esp_err_t err = esp_event_loop_create(&loop_args, &app_loop);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "esp_event_loop_create failed: %s", esp_err_to_name(err));
+  }
+  return err;
+}
+
+esp_err_t app_events_post(app_event_id_t id, const void *data, size_t size) {
+  if (!app_loop)
+    return ESP_ERR_INVALID_STATE;
+
+  esp_err_t err =
+      esp_event_post_to(app_loop, APP_EVENTS, id, data, size, 0);
+  if (err != ESP_OK) {
+    metrics_counter_inc(METRIC_APP_EVENT_DROPS);
+    ESP_LOGW(TAG, "drop event %d: %s", id, esp_err_to_name(err));
+  }
+  return err;
+}
+
+esp_err_t app_events_register(int32_t id, esp_event_handler_t handler,
+                              void *arg) {
+  if (!app_loop)
+    return ESP_ERR_INVALID_STATE;
+  return esp_event_handler_register_with(app_loop, APP_EVENTS, id, handler,
+                                         arg);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+/*
+ * アプリ全体の状態遷移を通知するイベントループ。
+ * 各タスクはsleepで定期的に確認する代わりに、ここからの通知を待つ。
+ */
+
+ESP_EVENT_DECLARE_BASE(APP_EVENTS);
+
+typedef enum {
+  APP_EVENT_SSM_STATUS_CHANGED = 0, // data: uint8_t(device_status_t)
+  APP_EVENT_CMD_ARRIVED,            // firebaseのコマンドキューが更新された
+  APP_EVENT_NETWORK_UP,             // IPを取得した
+  APP_EVENT_NETWORK_DOWN,           // WiFiが切断された
+  APP_EVENT_TOKEN_REFRESH_DUE,      // id_tokenの更新時刻になった
+  APP_EVENT_TOKEN_REFRESHED,        // id_tokenを更新した
+  APP_EVENT_TIME_SYNC_DUE,          // sesameの時計を合わせる時刻になった
+  APP_EVENT_SSM_MECH_CHANGED,       // 角度の設定が届いた、または校正が終わった
+  APP_EVENT_LOCAL_CMD_DONE,         // LANから受け付けたコマンドの結果を溜めた
+  APP_EVENT_SSM_MECH_STATUS,        // data: mech_status_t(受信したMECH_STATUS)
+} app_event_id_t;
+
+/**
+ * @brief イベントループを作成する(最初のapp_events_postより前に呼ぶ)
+ * @return esp_err_t
+ */
+esp_err_t app_events_init(void);
+
+/**
+ * @brief イベントを送信する(待たずに返るのでBLEのコールバックからも呼べる)
+ * @param id イベントID
+ * @param data イベントデータ(コピーされる、NULL可)
+ * @param size dataのサイズ
+ * @return キューが満杯の場合はESP_ERR_TIMEOUT
+ */
+esp_err_t app_events_post(app_event_id_t id, const void *data, size_t size);
+
+/**
+ * @brief イベントハンドラを登録する
+ * @param id イベントID(ESP_EVENT_ANY_IDで全て)
+ * @param handler イベントループのタスクで呼ばれるので、重い処理はしない
+ * @param arg handlerへ渡す引数
+ * @return esp_err_t
+ */
+esp_err_t app_events_register(int32_t id, esp_event_handler_t handler,
+                              void *arg);
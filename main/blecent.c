@@ -2,8 +2,10 @@
 #include "candy.h"
 #include "esp_central.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "host/ble_gap.h"
 #include "host/ble_hs.h"
+#include "metrics.h"
 #include "nimble/nimble_port.h"
 #include "nimble/nimble_port_freertos.h"
 #include "services/gap/ble_svc_gap.h"
@@ -21,6 +23,8 @@ static const ble_uuid_t *ssm_ntf_uuid =
 
 static int ble_gap_connect_event(struct ble_gap_event *event, void *arg);
 
+static int64_t disc_start_us; // サービス探索の開始時刻
+
 static int ssm_enable_notify(uint16_t conn_handle) {
   const struct peer_dsc *dsc;
   const struct peer *peer = peer_find(conn_handle);
@@ -54,6 +58,8 @@ static void service_disc_complete(const struct peer *peer, int status,
     ble_gap_terminate(peer->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
     return;
   }
+  metrics_hist_observe(METRIC_HIST_BLE_DISCOVERY,
+                       esp_timer_get_time() - disc_start_us);
   ESP_LOGI(TAG, "Service discovery complete conn_handle=%d\n",
            peer->conn_handle);
   ssm_enable_notify(peer->conn_handle);
@@ -74,11 +80,16 @@ static int ble_gap_event_connect_handle(struct ble_gap_event *event) {
     ESP_LOGE(TAG, "Failed to add peer; rc=%d\n", rc);
     return ESP_FAIL;
   }
+  // 通知の受信時に接続ハンドルからsesameを引けるようにする
+  peer_set_ctx(event->connect.conn_handle, &p_ssms_env->ssm);
   p_ssms_env->ssm.device_status = SSM_CONNECTED; // set the device status
   p_ssms_env->ssm.conn_id =
       event->connect.conn_handle; // save the connection handle
   ESP_LOGW(TAG, "Connect SSM success handle=%d", p_ssms_env->ssm.conn_id);
-  rc = peer_disc_all(event->connect.conn_handle, service_disc_complete, NULL);
+  // sesameのサービス(0xFD81)だけを探索する
+  disc_start_us = esp_timer_get_time();
+  rc = peer_disc_svc_by_uuid(event->connect.conn_handle, ssm_svc_uuid,
+                             service_disc_complete, NULL);
   if (rc != 0) {
     ESP_LOGE(TAG, "Failed to discover services; rc=%d\n", rc);
     return ESP_FAIL;
@@ -87,6 +98,7 @@ static int ble_gap_event_connect_handle(struct ble_gap_event *event) {
 }
 
 static void reconnect_ssm(void) {
+  metrics_counter_inc(METRIC_BLE_RECONNECTS);
   ble_addr_t addr;
   addr.type = BLE_ADDR_RANDOM;
   memcpy(addr.val, p_ssms_env->ssm.addr, 6);
@@ -126,10 +138,15 @@ static int ble_gap_connect_event(struct ble_gap_event *event, void *arg) {
     *event->conn_update_req.self_params = *event->conn_update_req.peer_params;
     return ESP_OK;
 
-  case BLE_GAP_EVENT_NOTIFY_RX:
-    ssm_ble_receiver(&p_ssms_env->ssm, event->notify_rx.om->om_data,
+  case BLE_GAP_EVENT_NOTIFY_RX: {
+    sesame *ssm = peer_ctx(event->notify_rx.conn_handle);
+    if (ssm == NULL) {
+      return ESP_OK; // 探索前や切断後の通知
+    }
+    ssm_ble_receiver(ssm, event->notify_rx.om->om_data,
                      event->notify_rx.om->om_len);
     return ESP_OK;
+  }
 
   default:
     return ESP_OK;
@@ -215,13 +232,14 @@ static void blecent_host_task(void *param) {
   nimble_port_freertos_deinit();
 }
 
-void esp_ble_gatt_write(sesame *ssm, uint8_t *value, uint16_t length) {
+int esp_ble_gatt_write(sesame *ssm, const uint8_t *value, uint16_t length) {
   const struct peer *peer = peer_find(ssm->conn_id);
   const struct peer_chr *chr =
       peer_chr_find_uuid(peer, ssm_svc_uuid, ssm_chr_uuid);
   if (chr == NULL) {
     ESP_LOGE(TAG, "Error: Peer doesn't have the subscribable characteristic\n");
-    return;
+    metrics_counter_inc(METRIC_GATT_WRITE_FAILURES);
+    return BLE_HS_ENOENT;
   }
   int rc = ble_gattc_write_flat(ssm->conn_id, chr->chr.val_handle, value,
                                 length, NULL, NULL);
@@ -230,7 +248,15 @@ void esp_ble_gatt_write(sesame *ssm, uint8_t *value, uint16_t length) {
         TAG,
         "Error: Failed to write to the subscribable characteristic; rc=%d\n",
         rc);
+    metrics_counter_inc(METRIC_GATT_WRITE_FAILURES);
   }
+  return rc;
+}
+
+int esp_ble_disconnect(sesame *ssm) {
+  if (ssm->conn_id == 0xFF)
+    return 0; // 接続していない
+  return ble_gap_terminate(ssm->conn_id, BLE_ERR_REM_USER_CONN_TERM);
 }
 
 void esp_ble_init(void) {
@@ -240,8 +266,9 @@ void esp_ble_init(void) {
     return;
   }
   ble_hs_cfg.sync_cb = blecent_scan;
-  int rc = peer_init(SSM_MAX_NUM, 64, 64, 64);
+  int rc = peer_init(SSM_MAX_NUM);
   assert(rc == 0);
+  ESP_LOGI(TAG, "peer store: %u bytes/peer", (unsigned)sizeof(struct peer));
   nimble_port_freertos_init(blecent_host_task);
   ESP_LOGI(TAG, "[esp_ble_init][SUCCESS]");
 }
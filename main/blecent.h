@@ -10,7 +10,9 @@ extern "C" {
 
 #include "ssm.h"
 
-void esp_ble_gatt_write(sesame * ssm, uint8_t * value, uint16_t length);
+int esp_ble_gatt_write(sesame * ssm, const uint8_t * value, uint16_t length);
+
+int esp_ble_disconnect(sesame * ssm);
 
 void esp_ble_init(void);
 
@@ -0,0 +1,72 @@
+#include "boot.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define TAG "boot"
+
+static const char *phase_names[BOOT_PHASE_NUM] = {
+    [BOOT_PHASE_WIFI_UP] = "wifi_up",
+    [BOOT_PHASE_SSM_LOGIN] = "ssm_login",
+    [BOOT_PHASE_FIREBASE_AUTH] = "firebase_auth",
+};
+
+static EventGroupHandle_t boot_events = NULL;
+static int64_t boot_start_us;
+// 各フェーズの完了時刻(起動開始からのms、0は未完了)
+static atomic_uint_least32_t phase_done_ms[BOOT_PHASE_NUM];
+
+void boot_init(void) {
+  boot_events = xEventGroupCreate();
+  boot_start_us = esp_timer_get_time();
+}
+
+void boot_mark(boot_phase_t phase) {
+  if (!boot_events || phase >= BOOT_PHASE_NUM)
+    return;
+
+  uint32_t elapsed_ms =
+      (uint32_t)((esp_timer_get_time() - boot_start_us) / 1000) + 1;
+  uint32_t expected = 0;
+  if (atomic_compare_exchange_strong(&phase_done_ms[phase], &expected,
+                                     elapsed_ms)) {
+    ESP_LOGI(TAG, "[%s] done at %" PRIu32 " ms", phase_names[phase],
+             elapsed_ms);
+  }
+  xEventGroupSetBits(boot_events, BOOT_BIT(phase));
+}
+
+EventBits_t boot_wait(EventBits_t bits, TickType_t timeout) {
+  if (!boot_events)
+    return 0;
+  return xEventGroupWaitBits(boot_events, bits, pdFALSE, pdTRUE, timeout) &
+         BOOT_BITS_ALL;
+}
+
+cJSON *boot_to_json(void) {
+  cJSON *json = cJSON_CreateObject();
+  if (!json)
+    return NULL;
+
+  // 全フェーズが完了した時刻を起動時間とする
+  uint32_t total_ms = 0;
+  bool complete = true;
+  for (int i = 0; i < BOOT_PHASE_NUM; i++) {
+    uint32_t done_ms = atomic_load(&phase_done_ms[i]);
+    if (done_ms == 0) {
+      cJSON_AddNullToObject(json, phase_names[i]);
+      complete = false;
+      continue;
+    }
+    cJSON_AddNumberToObject(json, phase_names[i], done_ms);
+    if (done_ms > total_ms)
+      total_ms = done_ms;
+  }
+  if (complete)
+    cJSON_AddNumberToObject(json, "total", total_ms);
+  else
+    cJSON_AddNullToObject(json, "total");
+  return json;
+}
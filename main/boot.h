@@ -0,0 +1,46 @@
+#pragma once
+
+#include "cJSON.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+/*
+ * 起動処理の依存関係をイベントグループで管理する。
+ * WiFi接続とBLEのスキャン/接続は同時に開始し、
+ * firebaseの認証はIP取得後すぐに開始する。
+ */
+
+typedef enum {
+  BOOT_PHASE_WIFI_UP = 0,   // IPを取得
+  BOOT_PHASE_SSM_LOGIN,     // sesameへのログイン完了
+  BOOT_PHASE_FIREBASE_AUTH, // firebaseの認証完了
+  BOOT_PHASE_NUM,
+} boot_phase_t;
+
+#define BOOT_BIT(phase) ((EventBits_t)1 << (phase))
+#define BOOT_BITS_ALL (BOOT_BIT(BOOT_PHASE_NUM) - 1)
+
+/**
+ * @brief イベントグループを作成し、起動の開始時刻を記録する
+ */
+void boot_init(void);
+
+/**
+ * @brief フェーズの完了を記録する(2回目以降の呼び出しでは時刻を更新しない)
+ * @param phase 完了したフェーズ
+ */
+void boot_mark(boot_phase_t phase);
+
+/**
+ * @brief 指定したフェーズがすべて完了するまで待機
+ * @param bits BOOT_BIT()の論理和
+ * @param timeout 最大待ち時間
+ * @return 待機終了時点で完了しているフェーズのビット
+ */
+EventBits_t boot_wait(EventBits_t bits, TickType_t timeout);
+
+/**
+ * @brief 起動開始から各フェーズ完了までの時間(ms)をJSONで取得する
+ * @return cJSON* 呼び出し側でcJSON_Deleteする
+ */
+cJSON *boot_to_json(void);
@@ -8,24 +8,6 @@ extern "C" {
 #endif
 
 #define SSM_OP_CODE_STR(op_code) ((op_code) == 7 ? "response" : (op_code) == 8 ? "publish" : "unknown")
-#define SSM_ITEM_CODE_STR(code)                                                                                                                                                                                                                               \
-    ((code) == SSM_ITEM_CODE_NONE                        ? "SSM_ITEM_CODE_NONE"                                                                                                                                                                               \
-         : (code) == SSM_ITEM_CODE_REGISTRATION          ? "SSM_ITEM_CODE_REGISTRATION"                                                                                                                                                                       \
-         : (code) == SSM_ITEM_CODE_LOGIN                 ? "SSM_ITEM_CODE_LOGIN"                                                                                                                                                                              \
-         : (code) == SSM_ITEM_CODE_USER                  ? "SSM_ITEM_CODE_USER"                                                                                                                                                                               \
-         : (code) == SSM_ITEM_CODE_HISTORY               ? "SSM_ITEM_CODE_HISTORY"                                                                                                                                                                            \
-         : (code) == SSM_ITEM_CODE_VERSION_DETAIL        ? "SSM_ITEM_CODE_VERSION_DETAIL"                                                                                                                                                                     \
-         : (code) == SSM_ITEM_CODE_DISCONNECT_REBOOT_NOW ? "SSM_ITEM_CODE_DISCONNECT_REBOOT_NOW"                                                                                                                                                              \
-         : (code) == SSM_ITEM_CODE_ENABLE_DFU            ? "SSM_ITEM_CODE_ENABLE_DFU"                                                                                                                                                                         \
-         : (code) == SSM_ITEM_CODE_TIME                  ? "SSM_ITEM_CODE_TIME"                                                                                                                                                                               \
-         : (code) == SSM_ITEM_CODE_INITIAL               ? "SSM_ITEM_CODE_INITIAL"                                                                                                                                                                            \
-         : (code) == SSM_ITEM_CODE_MAGNET                ? "SSM_ITEM_CODE_MAGNET"                                                                                                                                                                             \
-         : (code) == SSM_ITEM_CODE_MECH_SETTING          ? "SSM_ITEM_CODE_MECH_SETTING"                                                                                                                                                                       \
-         : (code) == SSM_ITEM_CODE_MECH_STATUS           ? "SSM_ITEM_CODE_MECH_STATUS"                                                                                                                                                                        \
-         : (code) == SSM_ITEM_CODE_LOCK                  ? "SSM_ITEM_CODE_LOCK"                                                                                                                                                                               \
-         : (code) == SSM_ITEM_CODE_UNLOCK                ? "SSM_ITEM_CODE_UNLOCK"                                                                                                                                                                             \
-         : (code) == SSM2_ITEM_OPS_TIMER_SETTING         ? "SSM2_ITEM_OPS_TIMER_SETTING"                                                                                                                                                                      \
-                                                         : "UNKNOWN_ITEM_CODE")
 #define SSM_STATUS_STR(status)                                                                                                                                                                                                                                \
     ((status) == SSM_NOUSE              ? "NOUSE"                                                                                                                                                                                                             \
          : (status) == SSM_DISCONNECTED ? "DISCONNECTED"                                                                                                                                                                                                      \
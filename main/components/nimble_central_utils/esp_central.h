@@ -25,27 +25,42 @@ void print_adv_fields(const struct ble_hs_adv_fields *fields);
 void ext_print_adv_report(const void *param);
 
 /** Peer. */
+
+/**
+ * Discovery store profile: the number of attributes kept per peer.  A SESAME
+ * exposes one service (0xFD81) with a write and a notify characteristic, and
+ * a CCCD on the notify characteristic; the margin covers firmware that adds
+ * an attribute.  Define these before including this header to change them.
+ */
+#ifndef PEER_MAX_SVCS
+#define PEER_MAX_SVCS                                       2
+#endif
+#ifndef PEER_MAX_CHRS
+#define PEER_MAX_CHRS                                       4
+#endif
+#ifndef PEER_MAX_DSCS
+#define PEER_MAX_DSCS                                       4
+#endif
+
+/**
+ * Slots in the connection handle -> peer table (a power of two).  At most
+ * half of them may be used, which keeps open-addressing probes short.
+ */
+#ifndef PEER_CONN_TABLE_SIZE
+#define PEER_CONN_TABLE_SIZE                                16
+#endif
+
 struct peer_dsc {
-    SLIST_ENTRY(peer_dsc) next;
     struct ble_gatt_dsc dsc;
 };
-SLIST_HEAD(peer_dsc_list, peer_dsc);
 
 struct peer_chr {
-    SLIST_ENTRY(peer_chr) next;
     struct ble_gatt_chr chr;
-
-    struct peer_dsc_list dscs;
 };
-SLIST_HEAD(peer_chr_list, peer_chr);
 
 struct peer_svc {
-    SLIST_ENTRY(peer_svc) next;
     struct ble_gatt_svc svc;
-
-    struct peer_chr_list chrs;
 };
-SLIST_HEAD(peer_svc_list, peer_svc);
 
 struct peer;
 typedef void peer_disc_fn(const struct peer *peer, int status, void *arg);
@@ -61,13 +76,24 @@ typedef void peer_disc_fn(const struct peer *peer, int status, void *arg);
 typedef int peer_traverse_fn(const struct peer *peer, void *arg);
 
 struct peer {
-    SLIST_ENTRY(peer) next;
     uint16_t conn_handle;
 
+    /** Application context bound to this connection (e.g. a sesame). */
+    void *ctx;
+
     uint8_t peer_addr[PEER_ADDR_VAL_SIZE];
 
-    /** List of discovered GATT services. */
-    struct peer_svc_list svcs;
+    /**
+     * Discovered GATT attributes.  Each array is sorted by handle
+     * (svc.start_handle, chr.def_handle, dsc.handle); ownership follows from
+     * the handle ranges.
+     */
+    uint8_t num_svcs;
+    uint8_t num_chrs;
+    uint8_t num_dscs;
+    struct peer_svc svcs[PEER_MAX_SVCS];
+    struct peer_chr chrs[PEER_MAX_CHRS];
+    struct peer_dsc dscs[PEER_MAX_DSCS];
 
     /** Keeps track of where we are in the service discovery process. */
     uint16_t disc_prev_chr_val;
@@ -93,9 +119,11 @@ peer_chr_find_uuid(const struct peer *peer, const ble_uuid_t *svc_uuid,
                    const ble_uuid_t *chr_uuid);
 const struct peer_svc *
 peer_svc_find_uuid(const struct peer *peer, const ble_uuid_t *uuid);
+int peer_set_ctx(uint16_t conn_handle, void *ctx);
+void *peer_ctx(uint16_t conn_handle);
 int peer_delete(uint16_t conn_handle);
 int peer_add(uint16_t conn_handle);
-int peer_init(int max_peers, int max_svcs, int max_chrs, int max_dscs);
+int peer_init(int max_peers);
 struct peer *
 peer_find(uint16_t conn_handle);
 #if MYNEWT_VAL(ENC_ADV_DATA)
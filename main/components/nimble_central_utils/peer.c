@@ -5,38 +5,26 @@
  */
 
 #include <assert.h>
+#include <stddef.h>
 #include <string.h>
 #include "host/ble_hs.h"
 #include "esp_central.h"
 
-static void *peer_svc_mem;
-static struct os_mempool peer_svc_pool;
-
-static void *peer_chr_mem;
-static struct os_mempool peer_chr_pool;
-
-static void *peer_dsc_mem;
-static struct os_mempool peer_dsc_pool;
+#define PEER_CONN_TABLE_MASK    (PEER_CONN_TABLE_SIZE - 1)
 
 static void *peer_mem;
 static struct os_mempool peer_pool;
-static SLIST_HEAD(, peer) peers;
 
-static struct peer_svc *
-peer_svc_find_range(struct peer *peer, uint16_t attr_handle);
-static struct peer_svc *
-peer_svc_find(struct peer *peer, uint16_t svc_start_handle,
-              struct peer_svc **out_prev);
-int
-peer_svc_is_empty(const struct peer_svc *svc);
+/**
+ * Open-addressing table keyed by connection handle (linear probing).  Every
+ * lookup by handle, including the one on each GATT write, is a direct index
+ * plus at most a few probes instead of a list walk.
+ */
+static struct peer *conn_table[PEER_CONN_TABLE_SIZE];
+
+_Static_assert((PEER_CONN_TABLE_SIZE & PEER_CONN_TABLE_MASK) == 0,
+               "PEER_CONN_TABLE_SIZE must be a power of two");
 
-uint16_t
-chr_end_handle(const struct peer_svc *svc, const struct peer_chr *chr);
-int
-chr_is_empty(const struct peer_svc *svc, const struct peer_chr *chr);
-static struct peer_chr *
-peer_chr_find(const struct peer_svc *svc, uint16_t chr_def_handle,
-              struct peer_chr **out_prev);
 static void
 peer_disc_chrs(struct peer *peer);
 
@@ -45,20 +33,147 @@ peer_dsc_disced(uint16_t conn_handle, const struct ble_gatt_error *error,
                 uint16_t chr_val_handle, const struct ble_gatt_dsc *dsc,
                 void *arg);
 
+/** Returns the slot holding conn_handle, or -1. */
+static int
+peer_conn_slot(uint16_t conn_handle)
+{
+    struct peer *peer;
+    int slot;
+    int i;
+
+    slot = conn_handle & PEER_CONN_TABLE_MASK;
+    for (i = 0; i < PEER_CONN_TABLE_SIZE; i++) {
+        peer = conn_table[slot];
+        if (peer == NULL) {
+            return -1;
+        }
+        if (peer->conn_handle == conn_handle) {
+            return slot;
+        }
+        slot = (slot + 1) & PEER_CONN_TABLE_MASK;
+    }
+
+    return -1;
+}
+
+static int
+peer_conn_insert(struct peer *peer)
+{
+    int slot;
+    int i;
+
+    slot = peer->conn_handle & PEER_CONN_TABLE_MASK;
+    for (i = 0; i < PEER_CONN_TABLE_SIZE; i++) {
+        if (conn_table[slot] == NULL) {
+            conn_table[slot] = peer;
+            return 0;
+        }
+        slot = (slot + 1) & PEER_CONN_TABLE_MASK;
+    }
+
+    return BLE_HS_ENOMEM;
+}
+
+/**
+ * Empties slot and shifts back the entries after it that would otherwise
+ * become unreachable from their home slot.
+ */
+static void
+peer_conn_remove(int slot)
+{
+    struct peer *peer;
+    int next;
+    int home;
+
+    conn_table[slot] = NULL;
+    next = (slot + 1) & PEER_CONN_TABLE_MASK;
+    while ((peer = conn_table[next]) != NULL) {
+        home = peer->conn_handle & PEER_CONN_TABLE_MASK;
+        /* Move the entry if its home is not in (slot, next]. */
+        if (((next - home) & PEER_CONN_TABLE_MASK) >=
+                ((next - slot) & PEER_CONN_TABLE_MASK)) {
+            conn_table[slot] = peer;
+            conn_table[next] = NULL;
+            slot = next;
+        }
+        next = (next + 1) & PEER_CONN_TABLE_MASK;
+    }
+}
+
 struct peer *
 peer_find(uint16_t conn_handle)
 {
-    struct peer *peer;
+    int slot;
 
-    SLIST_FOREACH(peer, &peers, next) {
-        if (peer->conn_handle == conn_handle) {
-            return peer;
+    slot = peer_conn_slot(conn_handle);
+    if (slot < 0) {
+        return NULL;
+    }
+
+    return conn_table[slot];
+}
+
+/**
+ * Returns the index of the first element whose handle (the uint16_t at
+ * key_off) is >= handle, or num if there is none.
+ */
+static int
+peer_lower_bound(const void *base, int num, size_t size, size_t key_off,
+                 uint16_t handle)
+{
+    const uint8_t *elems;
+    uint16_t key;
+    int mid;
+    int lo;
+    int hi;
+
+    elems = base;
+    lo = 0;
+    hi = num;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        memcpy(&key, elems + mid * size + key_off, sizeof key);
+        if (key < handle) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
 
-    return NULL;
+    return lo;
+}
+
+/** Inserts elem at idx, keeping the array sorted. */
+static int
+peer_insert(void *base, uint8_t *num, int max, size_t size, int idx,
+            const void *elem)
+{
+    uint8_t *elems;
+
+    if (*num >= max) {
+        /* Profile too small for this peer. */
+        return BLE_HS_ENOMEM;
+    }
+
+    elems = base;
+    memmove(elems + (idx + 1) * size, elems + idx * size,
+            (*num - idx) * size);
+    memcpy(elems + idx * size, elem, size);
+    (*num)++;
+
+    return 0;
 }
 
+#define PEER_SVC_LOWER(p, h)                                                \
+    peer_lower_bound((p)->svcs, (p)->num_svcs, sizeof (struct peer_svc),    \
+                     offsetof(struct peer_svc, svc.start_handle), (h))
+#define PEER_CHR_LOWER(p, h)                                                \
+    peer_lower_bound((p)->chrs, (p)->num_chrs, sizeof (struct peer_chr),    \
+                     offsetof(struct peer_chr, chr.def_handle), (h))
+#define PEER_DSC_LOWER(p, h)                                                \
+    peer_lower_bound((p)->dscs, (p)->num_dscs, sizeof (struct peer_dsc),    \
+                     offsetof(struct peer_dsc, dsc.handle), (h))
+
 static void
 peer_disc_complete(struct peer *peer, int rc)
 {
@@ -70,59 +185,100 @@ peer_disc_complete(struct peer *peer, int rc)
     }
 }
 
-static struct peer_dsc *
-peer_dsc_find_prev(const struct peer_chr *chr, uint16_t dsc_handle)
+static void
+peer_undisc_all(struct peer *peer)
 {
-    struct peer_dsc *prev;
-    struct peer_dsc *dsc;
+    peer->num_svcs = 0;
+    peer->num_chrs = 0;
+    peer->num_dscs = 0;
+    peer->cur_svc = NULL;
+}
 
-    prev = NULL;
-    SLIST_FOREACH(dsc, &chr->dscs, next) {
-        if (dsc->dsc.handle >= dsc_handle) {
-            break;
-        }
+static int
+peer_svc_is_empty(const struct peer_svc *svc)
+{
+    return svc->svc.end_handle <= svc->svc.start_handle;
+}
 
-        prev = dsc;
+static const struct peer_svc *
+peer_svc_find_range(const struct peer *peer, uint16_t attr_handle)
+{
+    const struct peer_svc *svc;
+    int idx;
+
+    /* Last service starting at or before attr_handle. */
+    idx = attr_handle == 0xffff ? peer->num_svcs - 1 :
+          PEER_SVC_LOWER(peer, attr_handle + 1) - 1;
+    if (idx < 0) {
+        return NULL;
+    }
+
+    svc = &peer->svcs[idx];
+    if (svc->svc.end_handle < attr_handle) {
+        return NULL;
     }
 
-    return prev;
+    return svc;
 }
 
-static struct peer_dsc *
-peer_dsc_find(const struct peer_chr *chr, uint16_t dsc_handle,
-              struct peer_dsc **out_prev)
+/** Characteristics of svc are chrs[*out_first .. *out_first + count). */
+static int
+peer_svc_chrs(const struct peer *peer, const struct peer_svc *svc,
+              int *out_first)
 {
-    struct peer_dsc *prev;
-    struct peer_dsc *dsc;
+    int first;
+    int last;
 
-    prev = peer_dsc_find_prev(chr, dsc_handle);
-    if (prev == NULL) {
-        dsc = SLIST_FIRST(&chr->dscs);
+    first = PEER_CHR_LOWER(peer, svc->svc.start_handle);
+    last = svc->svc.end_handle == 0xffff ? peer->num_chrs :
+           PEER_CHR_LOWER(peer, svc->svc.end_handle + 1);
+
+    *out_first = first;
+    return last - first;
+}
+
+static uint16_t
+chr_end_handle(const struct peer *peer, const struct peer_svc *svc, int idx)
+{
+    if (idx + 1 < peer->num_chrs &&
+            peer->chrs[idx + 1].chr.def_handle <= svc->svc.end_handle) {
+        return peer->chrs[idx + 1].chr.def_handle - 1;
     } else {
-        dsc = SLIST_NEXT(prev, next);
+        return svc->svc.end_handle;
     }
+}
 
-    if (dsc != NULL && dsc->dsc.handle != dsc_handle) {
-        dsc = NULL;
-    }
+static int
+chr_is_empty(const struct peer *peer, const struct peer_svc *svc, int idx)
+{
+    return chr_end_handle(peer, svc, idx) <= peer->chrs[idx].chr.val_handle;
+}
 
-    if (out_prev != NULL) {
-        *out_prev = prev;
-    }
-    return dsc;
+/** Descriptors of a characteristic lie in (val_handle, end_handle]. */
+static int
+chr_dscs(const struct peer *peer, const struct peer_svc *svc, int idx,
+         int *out_first)
+{
+    uint16_t end;
+    int first;
+    int last;
+
+    end = chr_end_handle(peer, svc, idx);
+    first = PEER_DSC_LOWER(peer, peer->chrs[idx].chr.val_handle + 1);
+    last = end == 0xffff ? peer->num_dscs : PEER_DSC_LOWER(peer, end + 1);
+
+    *out_first = first;
+    return last - first;
 }
 
 static int
 peer_dsc_add(struct peer *peer, uint16_t chr_val_handle,
              const struct ble_gatt_dsc *gatt_dsc)
 {
-    struct peer_dsc *prev;
-    struct peer_dsc *dsc;
-    struct peer_svc *svc;
-    struct peer_chr *chr;
+    struct peer_dsc dsc;
+    int idx;
 
-    svc = peer_svc_find_range(peer, chr_val_handle);
-    if (svc == NULL) {
+    if (peer_svc_find_range(peer, chr_val_handle) == NULL) {
         /* Can't find service for discovered descriptor; this shouldn't
          * happen.
          */
@@ -130,59 +286,47 @@ peer_dsc_add(struct peer *peer, uint16_t chr_val_handle,
         return BLE_HS_EUNKNOWN;
     }
 
-    chr = peer_chr_find(svc, chr_val_handle, NULL);
-    if (chr == NULL) {
-        /* Can't find characteristic for discovered descriptor; this shouldn't
-         * happen.
-         */
-        assert(0);
-        return BLE_HS_EUNKNOWN;
-    }
-
-    dsc = peer_dsc_find(chr, gatt_dsc->handle, &prev);
-    if (dsc != NULL) {
+    idx = PEER_DSC_LOWER(peer, gatt_dsc->handle);
+    if (idx < peer->num_dscs && peer->dscs[idx].dsc.handle == gatt_dsc->handle) {
         /* Descriptor already discovered. */
         return 0;
     }
 
-    dsc = os_memblock_get(&peer_dsc_pool);
-    if (dsc == NULL) {
-        /* Out of memory. */
-        return BLE_HS_ENOMEM;
-    }
-    memset(dsc, 0, sizeof * dsc);
+    memset(&dsc, 0, sizeof dsc);
+    dsc.dsc = *gatt_dsc;
 
-    dsc->dsc = *gatt_dsc;
-
-    if (prev == NULL) {
-        SLIST_INSERT_HEAD(&chr->dscs, dsc, next);
-    } else {
-        SLIST_NEXT(prev, next) = dsc;
-    }
-
-    return 0;
+    return peer_insert(peer->dscs, &peer->num_dscs, PEER_MAX_DSCS,
+                       sizeof dsc, idx, &dsc);
 }
 
 static void
 peer_disc_dscs(struct peer *peer)
 {
-    struct peer_chr *chr;
-    struct peer_svc *svc;
+    const struct peer_svc *svc;
+    const struct peer_chr *chr;
+    int first_chr;
+    int num_chrs;
+    int first_dsc;
+    int i;
+    int j;
     int rc;
 
-    /* Search through the list of discovered characteristics for the first
+    /* Search through the discovered characteristics for the first
      * characteristic that contains undiscovered descriptors.  Then, discover
      * all descriptors belonging to that characteristic.
      */
-    SLIST_FOREACH(svc, &peer->svcs, next) {
-        SLIST_FOREACH(chr, &svc->chrs, next) {
-            if (!chr_is_empty(svc, chr) &&
-                    SLIST_EMPTY(&chr->dscs) &&
+    for (i = 0; i < peer->num_svcs; i++) {
+        svc = &peer->svcs[i];
+        num_chrs = peer_svc_chrs(peer, svc, &first_chr);
+        for (j = first_chr; j < first_chr + num_chrs; j++) {
+            chr = &peer->chrs[j];
+            if (!chr_is_empty(peer, svc, j) &&
+                    chr_dscs(peer, svc, j, &first_dsc) == 0 &&
                     peer->disc_prev_chr_val <= chr->chr.def_handle) {
 
                 rc = ble_gattc_disc_all_dscs(peer->conn_handle,
                                              chr->chr.val_handle,
-                                             chr_end_handle(svc, chr),
+                                             chr_end_handle(peer, svc, j),
                                              peer_dsc_disced, peer);
                 if (rc != 0) {
                     peer_disc_complete(peer, rc);
@@ -238,119 +382,34 @@ peer_dsc_disced(uint16_t conn_handle, const struct ble_gatt_error *error,
     return rc;
 }
 
-uint16_t
-chr_end_handle(const struct peer_svc *svc, const struct peer_chr *chr)
-{
-    const struct peer_chr *next_chr;
-
-    next_chr = SLIST_NEXT(chr, next);
-    if (next_chr != NULL) {
-        return next_chr->chr.def_handle - 1;
-    } else {
-        return svc->svc.end_handle;
-    }
-}
-
-int
-chr_is_empty(const struct peer_svc *svc, const struct peer_chr *chr)
-{
-    return chr_end_handle(svc, chr) <= chr->chr.val_handle;
-}
-
-static struct peer_chr *
-peer_chr_find_prev(const struct peer_svc *svc, uint16_t chr_val_handle)
-{
-    struct peer_chr *prev;
-    struct peer_chr *chr;
-
-    prev = NULL;
-    SLIST_FOREACH(chr, &svc->chrs, next) {
-        if (chr->chr.val_handle >= chr_val_handle) {
-            break;
-        }
-
-        prev = chr;
-    }
-
-    return prev;
-}
-
-static struct peer_chr *
-peer_chr_find(const struct peer_svc *svc, uint16_t chr_val_handle,
-              struct peer_chr **out_prev)
-{
-    struct peer_chr *prev;
-    struct peer_chr *chr;
-
-    prev = peer_chr_find_prev(svc, chr_val_handle);
-    if (prev == NULL) {
-        chr = SLIST_FIRST(&svc->chrs);
-    } else {
-        chr = SLIST_NEXT(prev, next);
-    }
-
-    if (chr != NULL && chr->chr.val_handle != chr_val_handle) {
-        chr = NULL;
-    }
-
-    if (out_prev != NULL) {
-        *out_prev = prev;
-    }
-    return chr;
-}
-
-static void
-peer_chr_delete(struct peer_chr *chr)
-{
-    struct peer_dsc *dsc;
-
-    while ((dsc = SLIST_FIRST(&chr->dscs)) != NULL) {
-        SLIST_REMOVE_HEAD(&chr->dscs, next);
-        os_memblock_put(&peer_dsc_pool, dsc);
-    }
-
-    os_memblock_put(&peer_chr_pool, chr);
-}
-
 static int
-peer_chr_add(struct peer *peer,  uint16_t svc_start_handle,
+peer_chr_add(struct peer *peer, const struct peer_svc *svc,
              const struct ble_gatt_chr *gatt_chr)
 {
-    struct peer_chr *prev;
-    struct peer_chr *chr;
-    struct peer_svc *svc;
+    struct peer_chr chr;
+    int idx;
 
-    svc = peer_svc_find(peer, svc_start_handle, NULL);
-    if (svc == NULL) {
-        /* Can't find service for discovered characteristic; this shouldn't
-         * happen.
+    if (gatt_chr->def_handle < svc->svc.start_handle ||
+            gatt_chr->def_handle > svc->svc.end_handle) {
+        /* Characteristic outside the service being discovered; this
+         * shouldn't happen.
          */
         assert(0);
         return BLE_HS_EUNKNOWN;
     }
 
-    chr = peer_chr_find(svc, gatt_chr->def_handle, &prev);
-    if (chr != NULL) {
+    idx = PEER_CHR_LOWER(peer, gatt_chr->def_handle);
+    if (idx < peer->num_chrs &&
+            peer->chrs[idx].chr.def_handle == gatt_chr->def_handle) {
         /* Characteristic already discovered. */
         return 0;
     }
 
-    chr = os_memblock_get(&peer_chr_pool);
-    if (chr == NULL) {
-        /* Out of memory. */
-        return BLE_HS_ENOMEM;
-    }
-    memset(chr, 0, sizeof * chr);
-
-    chr->chr = *gatt_chr;
+    memset(&chr, 0, sizeof chr);
+    chr.chr = *gatt_chr;
 
-    if (prev == NULL) {
-        SLIST_INSERT_HEAD(&svc->chrs, chr, next);
-    } else {
-        SLIST_NEXT(prev, next) = chr;
-    }
-
-    return 0;
+    return peer_insert(peer->chrs, &peer->num_chrs, PEER_MAX_CHRS,
+                       sizeof chr, idx, &chr);
 }
 
 static int
@@ -365,7 +424,7 @@ peer_chr_disced(uint16_t conn_handle, const struct ble_gatt_error *error,
 
     switch (error->status) {
     case 0:
-        rc = peer_chr_add(peer, peer->cur_svc->svc.start_handle, chr);
+        rc = peer_chr_add(peer, peer->cur_svc, chr);
         break;
 
     case BLE_HS_EDONE:
@@ -395,14 +454,22 @@ static void
 peer_disc_chrs(struct peer *peer)
 {
     struct peer_svc *svc;
+    int first_chr;
+    int i;
     int rc;
 
-    /* Search through the list of discovered service for the first service that
+    /* Search through the discovered services for the first service that
      * contains undiscovered characteristics.  Then, discover all
      * characteristics belonging to that service.
      */
-    SLIST_FOREACH(svc, &peer->svcs, next) {
-        if (!peer_svc_is_empty(svc) && SLIST_EMPTY(&svc->chrs)) {
+    /* Services are visited in handle order, so resume after the one whose
+     * characteristics were discovered last.
+     */
+    i = peer->cur_svc == NULL ? 0 : peer->cur_svc - peer->svcs + 1;
+    for (; i < peer->num_svcs; i++) {
+        svc = &peer->svcs[i];
+        if (!peer_svc_is_empty(svc) &&
+                peer_svc_chrs(peer, svc, &first_chr) == 0) {
             peer->cur_svc = svc;
             rc = ble_gattc_disc_all_chrs(peer->conn_handle,
                                          svc->svc.start_handle,
@@ -419,78 +486,18 @@ peer_disc_chrs(struct peer *peer)
     peer_disc_dscs(peer);
 }
 
-int
-peer_svc_is_empty(const struct peer_svc *svc)
-{
-    return svc->svc.end_handle <= svc->svc.start_handle;
-}
-
-static struct peer_svc *
-peer_svc_find_prev(struct peer *peer, uint16_t svc_start_handle)
-{
-    struct peer_svc *prev;
-    struct peer_svc *svc;
-
-    prev = NULL;
-    SLIST_FOREACH(svc, &peer->svcs, next) {
-        if (svc->svc.start_handle >= svc_start_handle) {
-            break;
-        }
-
-        prev = svc;
-    }
-
-    return prev;
-}
-
-static struct peer_svc *
-peer_svc_find(struct peer *peer, uint16_t svc_start_handle,
-              struct peer_svc **out_prev)
-{
-    struct peer_svc *prev;
-    struct peer_svc *svc;
-
-    prev = peer_svc_find_prev(peer, svc_start_handle);
-    if (prev == NULL) {
-        svc = SLIST_FIRST(&peer->svcs);
-    } else {
-        svc = SLIST_NEXT(prev, next);
-    }
-
-    if (svc != NULL && svc->svc.start_handle != svc_start_handle) {
-        svc = NULL;
-    }
-
-    if (out_prev != NULL) {
-        *out_prev = prev;
-    }
-    return svc;
-}
-
-static struct peer_svc *
-peer_svc_find_range(struct peer *peer, uint16_t attr_handle)
-{
-    struct peer_svc *svc;
-
-    SLIST_FOREACH(svc, &peer->svcs, next) {
-        if (svc->svc.start_handle <= attr_handle &&
-                svc->svc.end_handle >= attr_handle) {
-
-            return svc;
-        }
-    }
-
-    return NULL;
-}
-
 const struct peer_svc *
 peer_svc_find_uuid(const struct peer *peer, const ble_uuid_t *uuid)
 {
-    const struct peer_svc *svc;
+    int i;
 
-    SLIST_FOREACH(svc, &peer->svcs, next) {
-        if (ble_uuid_cmp(&svc->svc.uuid.u, uuid) == 0) {
-            return svc;
+    if (peer == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < peer->num_svcs; i++) {
+        if (ble_uuid_cmp(&peer->svcs[i].svc.uuid.u, uuid) == 0) {
+            return &peer->svcs[i];
         }
     }
 
@@ -502,16 +509,19 @@ peer_chr_find_uuid(const struct peer *peer, const ble_uuid_t *svc_uuid,
                    const ble_uuid_t *chr_uuid)
 {
     const struct peer_svc *svc;
-    const struct peer_chr *chr;
+    int first;
+    int num;
+    int i;
 
     svc = peer_svc_find_uuid(peer, svc_uuid);
     if (svc == NULL) {
         return NULL;
     }
 
-    SLIST_FOREACH(chr, &svc->chrs, next) {
-        if (ble_uuid_cmp(&chr->chr.uuid.u, chr_uuid) == 0) {
-            return chr;
+    num = peer_svc_chrs(peer, svc, &first);
+    for (i = first; i < first + num; i++) {
+        if (ble_uuid_cmp(&peer->chrs[i].chr.uuid.u, chr_uuid) == 0) {
+            return &peer->chrs[i];
         }
     }
 
@@ -522,17 +532,22 @@ const struct peer_dsc *
 peer_dsc_find_uuid(const struct peer *peer, const ble_uuid_t *svc_uuid,
                    const ble_uuid_t *chr_uuid, const ble_uuid_t *dsc_uuid)
 {
+    const struct peer_svc *svc;
     const struct peer_chr *chr;
-    const struct peer_dsc *dsc;
+    int first;
+    int num;
+    int i;
 
     chr = peer_chr_find_uuid(peer, svc_uuid, chr_uuid);
     if (chr == NULL) {
         return NULL;
     }
 
-    SLIST_FOREACH(dsc, &chr->dscs, next) {
-        if (ble_uuid_cmp(&dsc->dsc.uuid.u, dsc_uuid) == 0) {
-            return dsc;
+    svc = peer_svc_find_range(peer, chr->chr.def_handle);
+    num = chr_dscs(peer, svc, chr - peer->chrs, &first);
+    for (i = first; i < first + num; i++) {
+        if (ble_uuid_cmp(&peer->dscs[i].dsc.uuid.u, dsc_uuid) == 0) {
+            return &peer->dscs[i];
         }
     }
 
@@ -542,45 +557,21 @@ peer_dsc_find_uuid(const struct peer *peer, const ble_uuid_t *svc_uuid,
 static int
 peer_svc_add(struct peer *peer, const struct ble_gatt_svc *gatt_svc)
 {
-    struct peer_svc *prev;
-    struct peer_svc *svc;
+    struct peer_svc svc;
+    int idx;
 
-    svc = peer_svc_find(peer, gatt_svc->start_handle, &prev);
-    if (svc != NULL) {
+    idx = PEER_SVC_LOWER(peer, gatt_svc->start_handle);
+    if (idx < peer->num_svcs &&
+            peer->svcs[idx].svc.start_handle == gatt_svc->start_handle) {
         /* Service already discovered. */
         return 0;
     }
 
-    svc = os_memblock_get(&peer_svc_pool);
-    if (svc == NULL) {
-        /* Out of memory. */
-        return BLE_HS_ENOMEM;
-    }
-    memset(svc, 0, sizeof * svc);
-
-    svc->svc = *gatt_svc;
-    SLIST_INIT(&svc->chrs);
-
-    if (prev == NULL) {
-        SLIST_INSERT_HEAD(&peer->svcs, svc, next);
-    } else {
-        SLIST_INSERT_AFTER(prev, svc, next);
-    }
+    memset(&svc, 0, sizeof svc);
+    svc.svc = *gatt_svc;
 
-    return 0;
-}
-
-static void
-peer_svc_delete(struct peer_svc *svc)
-{
-    struct peer_chr *chr;
-
-    while ((chr = SLIST_FIRST(&svc->chrs)) != NULL) {
-        SLIST_REMOVE_HEAD(&svc->chrs, next);
-        peer_chr_delete(chr);
-    }
-
-    os_memblock_put(&peer_svc_pool, svc);
+    return peer_insert(peer->svcs, &peer->num_svcs, PEER_MAX_SVCS,
+                       sizeof svc, idx, &svc);
 }
 
 static int
@@ -623,7 +614,6 @@ int
 peer_disc_svc_by_uuid(uint16_t conn_handle, const ble_uuid_t *uuid, peer_disc_fn *disc_cb,
                       void *disc_cb_arg)
 {
-    struct peer_svc *svc;
     struct peer *peer;
     int rc;
 
@@ -633,10 +623,7 @@ peer_disc_svc_by_uuid(uint16_t conn_handle, const ble_uuid_t *uuid, peer_disc_fn
     }
 
     /* Undiscover everything first. */
-    while ((svc = SLIST_FIRST(&peer->svcs)) != NULL) {
-        SLIST_REMOVE_HEAD(&peer->svcs, next);
-        peer_svc_delete(svc);
-    }
+    peer_undisc_all(peer);
 
     peer->disc_prev_chr_val = 1;
     peer->disc_cb = disc_cb;
@@ -653,7 +640,6 @@ peer_disc_svc_by_uuid(uint16_t conn_handle, const ble_uuid_t *uuid, peer_disc_fn
 int
 peer_disc_all(uint16_t conn_handle, peer_disc_fn *disc_cb, void *disc_cb_arg)
 {
-    struct peer_svc *svc;
     struct peer *peer;
     int rc;
 
@@ -663,10 +649,7 @@ peer_disc_all(uint16_t conn_handle, peer_disc_fn *disc_cb, void *disc_cb_arg)
     }
 
     /* Undiscover everything first. */
-    while ((svc = SLIST_FIRST(&peer->svcs)) != NULL) {
-        SLIST_REMOVE_HEAD(&peer->svcs, next);
-        peer_svc_delete(svc);
-    }
+    peer_undisc_all(peer);
 
     peer->disc_prev_chr_val = 1;
     peer->disc_cb = disc_cb;
@@ -681,24 +664,47 @@ peer_disc_all(uint16_t conn_handle, peer_disc_fn *disc_cb, void *disc_cb_arg)
 }
 
 int
-peer_delete(uint16_t conn_handle)
+peer_set_ctx(uint16_t conn_handle, void *ctx)
 {
-    struct peer_svc *svc;
     struct peer *peer;
-    int rc;
 
     peer = peer_find(conn_handle);
     if (peer == NULL) {
         return BLE_HS_ENOTCONN;
     }
 
-    SLIST_REMOVE(&peers, peer, peer, next);
+    peer->ctx = ctx;
+    return 0;
+}
+
+void *
+peer_ctx(uint16_t conn_handle)
+{
+    struct peer *peer;
 
-    while ((svc = SLIST_FIRST(&peer->svcs)) != NULL) {
-        SLIST_REMOVE_HEAD(&peer->svcs, next);
-        peer_svc_delete(svc);
+    peer = peer_find(conn_handle);
+    if (peer == NULL) {
+        return NULL;
     }
 
+    return peer->ctx;
+}
+
+int
+peer_delete(uint16_t conn_handle)
+{
+    struct peer *peer;
+    int slot;
+    int rc;
+
+    slot = peer_conn_slot(conn_handle);
+    if (slot < 0) {
+        return BLE_HS_ENOTCONN;
+    }
+
+    peer = conn_table[slot];
+    peer_conn_remove(slot);
+
     rc = os_memblock_put(&peer_pool, peer);
     if (rc != 0) {
         return BLE_HS_EOS;
@@ -727,7 +733,10 @@ peer_add(uint16_t conn_handle)
     memset(peer, 0, sizeof * peer);
     peer->conn_handle = conn_handle;
 
-    SLIST_INSERT_HEAD(&peers, peer, next);
+    if (peer_conn_insert(peer) != 0) {
+        os_memblock_put(&peer_pool, peer);
+        return BLE_HS_ENOMEM;
+    }
 
     return 0;
 }
@@ -735,14 +744,14 @@ peer_add(uint16_t conn_handle)
 void
 peer_traverse_all(peer_traverse_fn *trav_cb, void *arg)
 {
-    struct peer *peer;
+    int i;
 
     if (!trav_cb) {
         return;
     }
 
-    SLIST_FOREACH(peer, &peers, next) {
-        if (trav_cb(peer, arg)) {
+    for (i = 0; i < PEER_CONN_TABLE_SIZE; i++) {
+        if (conn_table[i] != NULL && trav_cb(conn_table[i], arg)) {
             return;
         }
     }
@@ -769,25 +778,25 @@ peer_free_mem(void)
 {
     free(peer_mem);
     peer_mem = NULL;
-
-    free(peer_svc_mem);
-    peer_svc_mem = NULL;
-
-    free(peer_chr_mem);
-    peer_chr_mem = NULL;
-
-    free(peer_dsc_mem);
-    peer_dsc_mem = NULL;
 }
 
 int
-peer_init(int max_peers, int max_svcs, int max_chrs, int max_dscs)
+peer_init(int max_peers)
 {
     int rc;
 
+    /* Keep the connection table at most half full. */
+    if (max_peers > PEER_CONN_TABLE_SIZE / 2) {
+        return BLE_HS_EINVAL;
+    }
+
     /* Free memory first in case this function gets called more than once. */
     peer_free_mem();
+    memset(conn_table, 0, sizeof conn_table);
 
+    /* Services, characteristics and descriptors live inside each peer, so
+     * one pool sized by the profile in esp_central.h covers everything.
+     */
     peer_mem = malloc(
                    OS_MEMPOOL_BYTES(max_peers, sizeof (struct peer)));
     if (peer_mem == NULL) {
@@ -803,51 +812,6 @@ peer_init(int max_peers, int max_svcs, int max_chrs, int max_dscs)
         goto err;
     }
 
-    peer_svc_mem = malloc(
-                       OS_MEMPOOL_BYTES(max_svcs, sizeof (struct peer_svc)));
-    if (peer_svc_mem == NULL) {
-        rc = BLE_HS_ENOMEM;
-        goto err;
-    }
-
-    rc = os_mempool_init(&peer_svc_pool, max_svcs,
-                         sizeof (struct peer_svc), peer_svc_mem,
-                         "peer_svc_pool");
-    if (rc != 0) {
-        rc = BLE_HS_EOS;
-        goto err;
-    }
-
-    peer_chr_mem = malloc(
-                       OS_MEMPOOL_BYTES(max_chrs, sizeof (struct peer_chr)));
-    if (peer_chr_mem == NULL) {
-        rc = BLE_HS_ENOMEM;
-        goto err;
-    }
-
-    rc = os_mempool_init(&peer_chr_pool, max_chrs,
-                         sizeof (struct peer_chr), peer_chr_mem,
-                         "peer_chr_pool");
-    if (rc != 0) {
-        rc = BLE_HS_EOS;
-        goto err;
-    }
-
-    peer_dsc_mem = malloc(
-                       OS_MEMPOOL_BYTES(max_dscs, sizeof (struct peer_dsc)));
-    if (peer_dsc_mem == NULL) {
-        rc = BLE_HS_ENOMEM;
-        goto err;
-    }
-
-    rc = os_mempool_init(&peer_dsc_pool, max_dscs,
-                         sizeof (struct peer_dsc), peer_dsc_mem,
-                         "peer_dsc_pool");
-    if (rc != 0) {
-        rc = BLE_HS_EOS;
-        goto err;
-    }
-
     return 0;
 
 err:
@@ -0,0 +1,188 @@
+#include "dlog.h"
+#include "candy.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+#include "ssm_codec.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DLOG_RING_SIZE 64 // 2のべき乗
+#define DLOG_RING_MASK (DLOG_RING_SIZE - 1)
+#define DLOG_MAX_ARGS 3
+#define DLOG_LINE_MAX 96 // 整形後の1行の最大長
+
+typedef enum {
+  DLOG_ARG_NONE = 0,
+  DLOG_ARG_INT,
+  DLOG_ARG_OP_CODE,   // SSM_OP_CODE_STRで変換
+  DLOG_ARG_ITEM_CODE, // ssm_item_code_nameで変換
+} dlog_arg_kind_t;
+
+// 書式は引数をすべて文字列に変換してから出力するので%sのみを使う
+// (使わない引数は余分な可変長引数として無視される)
+typedef struct {
+  const char *tag;
+  const char *fmt;
+  uint8_t kinds[DLOG_MAX_ARGS];
+} dlog_fmt_desc_t;
+
+static const dlog_fmt_desc_t fmt_descs[DLOG_FMT_NUM] = {
+    [DLOG_FMT_SSM_RX] = {"ssm.c",
+                         "[ssm][say][%s][%s][%s]",
+                         {DLOG_ARG_INT, DLOG_ARG_OP_CODE, DLOG_ARG_ITEM_CODE}},
+    [DLOG_FMT_SSM_TX] = {"ssm.c",
+                         "[esp32][say][%s][%s]",
+                         {DLOG_ARG_INT, DLOG_ARG_ITEM_CODE, DLOG_ARG_NONE}},
+    [DLOG_FMT_HTTP_RESULT] = {"firebase_database",
+                              "HTTP Status = %s, response_code = %s",
+                              {DLOG_ARG_INT, DLOG_ARG_INT, DLOG_ARG_NONE}},
+    [DLOG_FMT_HTTP_PATCH_RESULT] = {"firebase_database",
+                                    "PATCH HTTP Status = %s, response_code = %s",
+                                    {DLOG_ARG_INT, DLOG_ARG_INT,
+                                     DLOG_ARG_NONE}},
+};
+
+// 複数の書き込みタスクと1つの読み出しタスクで使う有界リング
+// 各スロットのseqで書き込み済みかどうかを判定する
+typedef struct {
+  atomic_uint_least32_t seq;
+  uint8_t fmt;
+  uint32_t args[DLOG_MAX_ARGS];
+} dlog_record_t;
+
+static dlog_record_t ring[DLOG_RING_SIZE];
+static atomic_uint_least32_t enqueue_pos;
+static uint32_t dequeue_pos; // 整形タスクのみが触る
+static atomic_bool initialized;
+static TaskHandle_t drain_task;
+// 整形タスクへ通知済みで、まだ読み出しを始めていない間true
+// (書き込みが続いても通知は1回にまとめる)
+static atomic_bool drain_wake_pending;
+
+static const char *arg_to_str(uint8_t kind, uint32_t arg, char *buf,
+                              size_t len) {
+  switch (kind) {
+  case DLOG_ARG_INT:
+    snprintf(buf, len, "%" PRId32, (int32_t)arg);
+    return buf;
+  case DLOG_ARG_OP_CODE:
+    return SSM_OP_CODE_STR(arg);
+  case DLOG_ARG_ITEM_CODE:
+    return ssm_item_code_name(arg);
+  default:
+    return "";
+  }
+}
+
+static void format_and_print(uint8_t fmt, const uint32_t *args) {
+  if (fmt >= DLOG_FMT_NUM)
+    return;
+
+  uint32_t start = esp_cpu_get_cycle_count();
+  const dlog_fmt_desc_t *desc = &fmt_descs[fmt];
+  char bufs[DLOG_MAX_ARGS][12];
+  const char *strs[DLOG_MAX_ARGS];
+  for (int i = 0; i < DLOG_MAX_ARGS; i++) {
+    strs[i] = arg_to_str(desc->kinds[i], args[i], bufs[i], sizeof(bufs[i]));
+  }
+  // ESP_LOGxはfmtをリテラルと連結するので、実行時の書式は先に整形する
+  char line[DLOG_LINE_MAX];
+  snprintf(line, sizeof(line), desc->fmt, strs[0], strs[1], strs[2]);
+  ESP_LOGI(desc->tag, "%s", line);
+  metrics_counter_add(METRIC_DLOG_FORMAT_CYCLES,
+                      esp_cpu_get_cycle_count() - start);
+}
+
+#if CONFIG_SSM_DEFERRED_LOG
+static bool ring_pop(dlog_record_t *out) {
+  dlog_record_t *slot = &ring[dequeue_pos & DLOG_RING_MASK];
+  uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+  if ((int32_t)(seq - (dequeue_pos + 1)) < 0)
+    return false; // 空
+
+  out->fmt = slot->fmt;
+  memcpy(out->args, slot->args, sizeof(out->args));
+  atomic_store_explicit(&slot->seq, dequeue_pos + DLOG_RING_SIZE,
+                        memory_order_release);
+  dequeue_pos++;
+  return true;
+}
+
+// 書き込みの通知を待って溜まった分を出力する(空の間は起床しない)
+static void task_dlog_drain(void *pvParameters) {
+  dlog_record_t record;
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    metrics_counter_inc(METRIC_WAKEUPS_DLOG_TASK);
+    // 読み出しの前に下ろすので、この後に書き込まれた分は再度通知される
+    atomic_store_explicit(&drain_wake_pending, false, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst); // 下ろしてからseqを読む
+    while (ring_pop(&record)) {
+      format_and_print(record.fmt, record.args);
+    }
+  }
+}
+#endif
+
+void dlog_init(void) {
+#if CONFIG_SSM_DEFERRED_LOG
+  for (uint32_t i = 0; i < DLOG_RING_SIZE; i++) {
+    atomic_init(&ring[i].seq, i);
+  }
+  atomic_store(&enqueue_pos, 0);
+  dequeue_pos = 0;
+  atomic_store(&drain_wake_pending, false);
+  if (xTaskCreate(task_dlog_drain, "dlog drain task", 3072, NULL,
+                  tskIDLE_PRIORITY + 1, &drain_task) != pdPASS) {
+    return; // 初期化できなければその場で出力し続ける
+  }
+  metrics_register_task(drain_task);
+  atomic_store(&initialized, true);
+#endif
+}
+
+void dlog_write(dlog_fmt_t fmt, uint32_t arg0, uint32_t arg1, uint32_t arg2) {
+  uint32_t args[DLOG_MAX_ARGS] = {arg0, arg1, arg2};
+  if (!atomic_load_explicit(&initialized, memory_order_acquire)) {
+    format_and_print(fmt, args);
+    return;
+  }
+
+  uint32_t start = esp_cpu_get_cycle_count();
+  dlog_record_t *slot;
+  uint32_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+  while (1) {
+    slot = &ring[pos & DLOG_RING_MASK];
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    int32_t diff = (int32_t)(seq - pos);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      metrics_counter_inc(METRIC_DLOG_DROPPED); // リングが満杯
+      return;
+    } else {
+      pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    }
+  }
+  slot->fmt = (uint8_t)fmt;
+  memcpy(slot->args, args, sizeof(args));
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+  atomic_thread_fence(memory_order_seq_cst); // 書き込んでからフラグを見る
+  if (!atomic_exchange_explicit(&drain_wake_pending, true,
+                                memory_order_seq_cst))
+    xTaskNotifyGive(drain_task);
+
+  metrics_counter_inc(METRIC_DLOG_RECORDS);
+  metrics_counter_add(METRIC_DLOG_PRODUCER_CYCLES,
+                      esp_cpu_get_cycle_count() - start);
+}
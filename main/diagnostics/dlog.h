@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * BLEやHTTPSのホットパスから呼ぶための遅延ログ。
+ * 呼び出し側は書式IDと生の引数だけをロックフリーのリングへ書き込み、
+ * 文字列への変換と出力は優先度の低いタスクでまとめて行う。
+ * CONFIG_SSM_DEFERRED_LOGが無効の場合はその場で整形して出力する。
+ */
+
+typedef enum {
+  DLOG_FMT_SSM_RX = 0,      // sesameからの受信(conn_id, op_code, item_code)
+  DLOG_FMT_SSM_TX,          // sesameへの送信(conn_id, item_code)
+  DLOG_FMT_HTTP_RESULT,     // GET/PUTの結果(err, status_code)
+  DLOG_FMT_HTTP_PATCH_RESULT, // PATCHの結果(err, status_code)
+  DLOG_FMT_NUM,
+} dlog_fmt_t;
+
+/**
+ * @brief リングと整形タスクを初期化する
+ * 初期化前に呼ばれたdlog_writeはその場で整形して出力する
+ */
+void dlog_init(void);
+
+/**
+ * @brief ログをリングへ書き込む(満杯の場合は捨てる)
+ * @param fmt 書式ID
+ * @param arg0 引数(書式で使わないものは0)
+ */
+void dlog_write(dlog_fmt_t fmt, uint32_t arg0, uint32_t arg1, uint32_t arg2);
@@ -0,0 +1,254 @@
+#include "metrics.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include <string.h>
+
+#define TAG "metrics"
+
+// ヒストグラムの各バケットの上限(ms)。最後のバケットはそれ以上
+static const uint32_t bucket_bounds_ms[METRICS_HIST_BUCKET_NUM - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000};
+
+static const char *counter_names[METRIC_COUNTER_NUM] = {
+    [METRIC_BLE_RECONNECTS] = "ble_reconnects",
+    [METRIC_GATT_WRITE_FAILURES] = "gatt_write_failures",
+    [METRIC_CCM_AUTH_FAILURES] = "ccm_auth_failures",
+    [METRIC_HTTP_2XX] = "http_2xx",
+    [METRIC_HTTP_4XX] = "http_4xx",
+    [METRIC_HTTP_5XX] = "http_5xx",
+    [METRIC_HTTP_OTHER] = "http_other",
+    [METRIC_HTTP_TRANSPORT_ERRORS] = "http_transport_errors",
+    [METRIC_WIFI_DISCONNECTS] = "wifi_disconnects",
+    [METRIC_RADIO_DEFERRALS] = "radio_deferrals",
+    [METRIC_APP_EVENT_DROPS] = "app_event_drops",
+    [METRIC_CMD_STREAM_RECONNECTS] = "cmd_stream_reconnects",
+    [METRIC_WAKEUPS_CMD_TASK] = "wakeups_cmd_task",
+    [METRIC_WAKEUPS_STATUS_TASK] = "wakeups_status_task",
+    [METRIC_WAKEUPS_DLOG_TASK] = "wakeups_dlog_task",
+    [METRIC_PM_BLE_LOCK_MS] = "pm_ble_lock_ms",
+    [METRIC_PM_HTTPS_LOCK_MS] = "pm_https_lock_ms",
+    [METRIC_DLOG_RECORDS] = "dlog_records",
+    [METRIC_DLOG_DROPPED] = "dlog_dropped",
+    [METRIC_DLOG_PRODUCER_CYCLES] = "dlog_producer_cycles",
+    [METRIC_DLOG_FORMAT_CYCLES] = "dlog_format_cycles",
+    [METRIC_SSM_TIME_PUSHES] = "ssm_time_pushes",
+    [METRIC_HISTORY_RECORDS] = "history_records",
+    [METRIC_HISTORY_DROPPED] = "history_dropped",
+    [METRIC_HISTORY_UPLOADED] = "history_uploaded",
+    [METRIC_SCHED_COMPLETED] = "sched_completed",
+    [METRIC_SCHED_FAILED] = "sched_failed",
+    [METRIC_SCHED_EXPIRED] = "sched_expired",
+    [METRIC_SCHED_CANCELLED] = "sched_cancelled",
+    [METRIC_CCM_RESYNCS] = "ccm_resyncs",
+    [METRIC_CCM_RECONNECTS] = "ccm_reconnects",
+    [METRIC_OTA_RESUMES] = "ota_resumes",
+    [METRIC_OTA_THROTTLED] = "ota_throttled",
+    [METRIC_LOCAL_COMMANDS] = "local_commands",
+    [METRIC_LOCAL_AUTH_FAILURES] = "local_auth_failures",
+    [METRIC_OUTBOX_DROPPED] = "outbox_dropped",
+    [METRIC_TASKS_UNREGISTERED] = "tasks_unregistered",
+};
+
+static const char *gauge_names[METRIC_GAUGE_NUM] = {
+    [METRIC_GAUGE_HEAP_FREE] = "heap_free",
+    [METRIC_GAUGE_HEAP_MIN_FREE] = "heap_min_free",
+    [METRIC_GAUGE_SSM_CLOCK_DRIFT_S] = "ssm_clock_drift_s",
+    [METRIC_GAUGE_HISTORY_RATE] = "history_rate",
+};
+
+static const char *hist_names[METRIC_HIST_NUM] = {
+    [METRIC_HIST_HTTPS_MUTEX_WAIT] = "https_mutex_wait",
+    [METRIC_HIST_HTTP_REQUEST] = "http_request",
+    [METRIC_HIST_RADIO_DEFER] = "radio_defer",
+    [METRIC_HIST_WIFI_CONNECT_COLD] = "wifi_connect_cold",
+    [METRIC_HIST_WIFI_CONNECT_FAST] = "wifi_connect_fast",
+    [METRIC_HIST_WIFI_CONNECT_WARM] = "wifi_connect_warm",
+    [METRIC_HIST_BLE_DISCOVERY] = "ble_discovery",
+    [METRIC_HIST_SCHED_QUEUE_WAIT] = "sched_queue_wait",
+    [METRIC_HIST_SCHED_CONFIRM] = "sched_confirm",
+    [METRIC_HIST_CCM_RECOVER] = "ccm_recover",
+    [METRIC_HIST_CMD_FIREBASE] = "cmd_firebase",
+    [METRIC_HIST_CMD_LOCAL] = "cmd_local",
+};
+
+static atomic_uint_least32_t counters[METRIC_COUNTER_NUM];
+static atomic_int_least32_t gauges[METRIC_GAUGE_NUM];
+static metrics_hist_t hists[METRIC_HIST_NUM];
+
+// 登録はタスク生成時のみなので、空きスロットをCASで確保する
+static _Atomic(TaskHandle_t) tasks[METRICS_MAX_TASKS];
+
+void metrics_counter_add(metric_counter_t id, uint32_t n) {
+  if (id >= METRIC_COUNTER_NUM)
+    return;
+  atomic_fetch_add_explicit(&counters[id], n, memory_order_relaxed);
+}
+
+void metrics_gauge_set(metric_gauge_t id, int32_t value) {
+  if (id >= METRIC_GAUGE_NUM)
+    return;
+  atomic_store_explicit(&gauges[id], value, memory_order_relaxed);
+}
+
+void metrics_hist_observe(metric_hist_id_t id, int64_t elapsed_us) {
+  if (id >= METRIC_HIST_NUM)
+    return;
+  metrics_hist_record(&hists[id], elapsed_us);
+}
+
+void metrics_record_http(esp_err_t err, int status_code) {
+  if (status_code <= 0) {
+    if (err != ESP_OK)
+      metrics_counter_inc(METRIC_HTTP_TRANSPORT_ERRORS);
+    return;
+  }
+
+  if (status_code >= 200 && status_code < 300) {
+    metrics_counter_inc(METRIC_HTTP_2XX);
+  } else if (status_code >= 400 && status_code < 500) {
+    metrics_counter_inc(METRIC_HTTP_4XX);
+  } else if (status_code >= 500 && status_code < 600) {
+    metrics_counter_inc(METRIC_HTTP_5XX);
+  } else {
+    metrics_counter_inc(METRIC_HTTP_OTHER);
+  }
+}
+
+void metrics_register_task(TaskHandle_t task) {
+  if (!task)
+    return;
+
+  for (int i = 0; i < METRICS_MAX_TASKS; i++) {
+    TaskHandle_t expected = NULL;
+    if (atomic_compare_exchange_strong(&tasks[i], &expected, task))
+      return;
+  }
+  ESP_LOGW(TAG, "too many tasks, %s is not monitored", pcTaskGetName(task));
+  metrics_counter_inc(METRIC_TASKS_UNREGISTERED);
+}
+
+int metrics_hist_bucket_index(int64_t elapsed_us) {
+  int idx = 0;
+  while (idx < METRICS_HIST_BUCKET_NUM - 1 &&
+         elapsed_us > (int64_t)bucket_bounds_ms[idx] * 1000) {
+    idx++;
+  }
+  return idx;
+}
+
+void metrics_hist_record(metrics_hist_t *hist, int64_t elapsed_us) {
+  if (elapsed_us < 0)
+    elapsed_us = 0;
+  if (elapsed_us > UINT32_MAX)
+    elapsed_us = UINT32_MAX;
+
+  uint32_t us = (uint32_t)elapsed_us;
+  atomic_fetch_add_explicit(&hist->buckets[metrics_hist_bucket_index(us)], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->sum_us, us, memory_order_relaxed);
+
+  uint32_t max = atomic_load_explicit(&hist->max_us, memory_order_relaxed);
+  while (us > max && !atomic_compare_exchange_weak_explicit(
+                         &hist->max_us, &max, us, memory_order_relaxed,
+                         memory_order_relaxed)) {
+  }
+}
+
+uint32_t metrics_hist_percentile_ms(const metrics_hist_t *hist,
+                                    uint32_t percentile) {
+  // countとbucketsは別々に更新されるので、bucketsの合計から順位を求める
+  uint32_t counts[METRICS_HIST_BUCKET_NUM];
+  uint64_t total = 0;
+  for (int i = 0; i < METRICS_HIST_BUCKET_NUM; i++) {
+    counts[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0)
+    return 0;
+  if (percentile > 100)
+    percentile = 100;
+
+  uint64_t rank = (total * percentile + 99) / 100;
+  if (rank == 0)
+    rank = 1;
+  uint32_t max_ms =
+      (atomic_load_explicit(&hist->max_us, memory_order_relaxed) + 999) / 1000;
+  uint64_t seen = 0;
+  for (int i = 0; i < METRICS_HIST_BUCKET_NUM - 1; i++) {
+    seen += counts[i];
+    if (seen >= rank)
+      return bucket_bounds_ms[i] < max_ms ? bucket_bounds_ms[i] : max_ms;
+  }
+  return max_ms;
+}
+
+cJSON *metrics_hist_to_json(const metrics_hist_t *hist) {
+  cJSON *json = cJSON_CreateObject();
+  if (!json)
+    return NULL;
+
+  cJSON_AddNumberToObject(json, "count", atomic_load(&hist->count));
+  cJSON_AddNumberToObject(json, "sum_ms",
+                          (double)atomic_load(&hist->sum_us) / 1000.0);
+  cJSON_AddNumberToObject(json, "max_ms",
+                          (double)atomic_load(&hist->max_us) / 1000.0);
+  cJSON_AddNumberToObject(json, "p50_ms", metrics_hist_percentile_ms(hist, 50));
+  cJSON_AddNumberToObject(json, "p99_ms", metrics_hist_percentile_ms(hist, 99));
+  cJSON *buckets = cJSON_AddArrayToObject(json, "buckets");
+  for (int i = 0; buckets && i < METRICS_HIST_BUCKET_NUM; i++) {
+    cJSON_AddItemToArray(buckets,
+                         cJSON_CreateNumber(atomic_load(&hist->buckets[i])));
+  }
+  return json;
+}
+
+cJSON *metrics_hist_bounds_to_json(void) {
+  cJSON *bounds = cJSON_CreateArray();
+  for (int i = 0; bounds && i < METRICS_HIST_BUCKET_NUM - 1; i++) {
+    cJSON_AddItemToArray(bounds, cJSON_CreateNumber(bucket_bounds_ms[i]));
+  }
+  return bounds;
+}
+
+cJSON *metrics_to_json(void) {
+  metrics_gauge_set(METRIC_GAUGE_HEAP_FREE, esp_get_free_heap_size());
+  metrics_gauge_set(METRIC_GAUGE_HEAP_MIN_FREE,
+                    esp_get_minimum_free_heap_size());
+
+  cJSON *root = cJSON_CreateObject();
+  if (!root)
+    return NULL;
+
+  cJSON_AddNumberToObject(root, "uptime_s", esp_timer_get_time() / 1000000);
+
+  cJSON *json = cJSON_AddObjectToObject(root, "counters");
+  for (int i = 0; json && i < METRIC_COUNTER_NUM; i++) {
+    cJSON_AddNumberToObject(json, counter_names[i], atomic_load(&counters[i]));
+  }
+
+  json = cJSON_AddObjectToObject(root, "gauges");
+  for (int i = 0; json && i < METRIC_GAUGE_NUM; i++) {
+    cJSON_AddNumberToObject(json, gauge_names[i], atomic_load(&gauges[i]));
+  }
+
+  // スタックの残量(byte)
+  json = cJSON_AddObjectToObject(root, "stack_hwm");
+  for (int i = 0; json && i < METRICS_MAX_TASKS; i++) {
+    TaskHandle_t task = atomic_load(&tasks[i]);
+    if (!task)
+      continue;
+    cJSON_AddNumberToObject(json, pcTaskGetName(task),
+                            uxTaskGetStackHighWaterMark(task));
+  }
+
+  json = cJSON_AddObjectToObject(root, "hists");
+  if (json) {
+    cJSON_AddItemToObject(json, "bounds_ms", metrics_hist_bounds_to_json());
+    for (int i = 0; i < METRIC_HIST_NUM; i++) {
+      cJSON_AddItemToObject(json, hist_names[i], metrics_hist_to_json(&hists[i]));
+    }
+  }
+  return root;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "cJSON.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * 運用状況を把握するための軽量なメトリクス。
+ * カウンタ/ゲージ/ヒストグラムはすべてatomic変数で、どのタスク(NimBLEの
+ * hostタスクを含む)からもロックを取らずに更新できる。
+ */
+
+#define METRICS_HIST_BUCKET_NUM 14
+// 既定の設定で登録するタスクは10個(dlog, sched, history, cmd, status,
+// cmd_stream, mech_stream, diagnostics, ota, local_ctrl)
+#define METRICS_MAX_TASKS 16
+
+typedef enum {
+  METRIC_BLE_RECONNECTS = 0,
+  METRIC_GATT_WRITE_FAILURES,
+  METRIC_CCM_AUTH_FAILURES,
+  METRIC_HTTP_2XX,
+  METRIC_HTTP_4XX,
+  METRIC_HTTP_5XX,
+  METRIC_HTTP_OTHER,           // 1xx/3xx等
+  METRIC_HTTP_TRANSPORT_ERRORS, // 接続失敗・タイムアウト等でステータスなし
+  METRIC_WIFI_DISCONNECTS,      // 接続中の切断回数
+  METRIC_RADIO_DEFERRALS,       // BLEのやり取り中のため待たせたHTTPS
+  METRIC_APP_EVENT_DROPS,       // キューが満杯で送れなかったapp_events
+  METRIC_CMD_STREAM_RECONNECTS, // コマンドキューのストリームの再接続
+  METRIC_WAKEUPS_CMD_TASK,      // コマンド取得タスクが起床した回数
+  METRIC_WAKEUPS_STATUS_TASK,   // 状態監視タスクが起床した回数
+  METRIC_WAKEUPS_DLOG_TASK,     // 遅延ログの整形タスクが起床した回数
+  METRIC_PM_BLE_LOCK_MS,        // BLEのやり取りでPMロックを保持した時間
+  METRIC_PM_HTTPS_LOCK_MS,      // HTTPSの通信でPMロックを保持した時間
+  METRIC_DLOG_RECORDS,          // 遅延ログへ書き込んだ件数
+  METRIC_DLOG_DROPPED,          // リングが満杯で捨てた件数
+  METRIC_DLOG_PRODUCER_CYCLES,  // 呼び出し側で消費したCPUサイクル
+  METRIC_DLOG_FORMAT_CYCLES,    // 整形・出力で消費したCPUサイクル
+  METRIC_SSM_TIME_PUSHES,       // sesameへ時刻を書き込んだ回数
+  METRIC_HISTORY_RECORDS,       // フラッシュのログへ追記した履歴
+  METRIC_HISTORY_DROPPED,       // キューやログが満杯で捨てた履歴
+  METRIC_HISTORY_UPLOADED,      // Firebaseへアップロードした履歴
+  METRIC_SCHED_COMPLETED,       // 目的の状態になったコマンド
+  METRIC_SCHED_FAILED,          // 未ログインや応答なしで失敗したコマンド
+  METRIC_SCHED_EXPIRED,         // 期限までに送信できなかったコマンド
+  METRIC_SCHED_CANCELLED,       // 送信前に取り消されたコマンド
+  METRIC_CCM_RESYNCS,           // 先のカウンタで復号して追従した回数
+  METRIC_CCM_RECONNECTS,        // 復号の失敗が続いて切断した回数
+  METRIC_OTA_RESUMES,           // 切断後にRangeで続きから再開した回数
+  METRIC_OTA_THROTTLED,         // コマンドの処理中のため読み出しを止めた回数
+  METRIC_LOCAL_COMMANDS,        // LANから受け付けて実行したコマンド
+  METRIC_LOCAL_AUTH_FAILURES,   // 署名や時刻が合わず拒否したコマンド
+  METRIC_OUTBOX_DROPPED,        // 送信待ちが満杯で捨てた結果
+  METRIC_TASKS_UNREGISTERED,    // METRICS_MAX_TASKSを超えて登録できなかったタスク
+  METRIC_COUNTER_NUM,
+} metric_counter_t;
+
+typedef enum {
+  METRIC_GAUGE_HEAP_FREE = 0,
+  METRIC_GAUGE_HEAP_MIN_FREE,
+  METRIC_GAUGE_SSM_CLOCK_DRIFT_S, // ログイン時のsesameの時計のずれ(秒)
+  METRIC_GAUGE_HISTORY_RATE,      // 直近の履歴の読み出し速度(件/秒)
+  METRIC_GAUGE_NUM,
+} metric_gauge_t;
+
+typedef enum {
+  METRIC_HIST_HTTPS_MUTEX_WAIT = 0, // firebase_https_mutexの待ち時間
+  METRIC_HIST_HTTP_REQUEST,         // esp_http_client_performの所要時間
+  METRIC_HIST_RADIO_DEFER,          // BLEのやり取りでHTTPSを待たせた時間
+  METRIC_HIST_WIFI_CONNECT_COLD,    // IP取得までの時間(スキャンあり)
+  METRIC_HIST_WIFI_CONNECT_FAST,    // IP取得までの時間(BSSID/チャンネル指定)
+  METRIC_HIST_WIFI_CONNECT_WARM,    // IP取得までの時間(切断からの再接続)
+  METRIC_HIST_BLE_DISCOVERY,        // 接続からGATTの探索完了までの時間
+  METRIC_HIST_SCHED_QUEUE_WAIT,     // コマンドがキューで送信を待った時間
+  METRIC_HIST_SCHED_CONFIRM,        // 送信からMECH_STATUSで確認するまでの時間
+  METRIC_HIST_CCM_RECOVER,          // 復号の失敗から復旧するまでの時間
+  METRIC_HIST_CMD_FIREBASE,         // コマンドの作成(push ID)から確認までの時間
+  METRIC_HIST_CMD_LOCAL,            // コマンドの作成(ts)から確認までの時間
+  METRIC_HIST_NUM,
+} metric_hist_id_t;
+
+// 固定バケットのレイテンシヒストグラム(バケットの上限はmetrics.cを参照)
+typedef struct {
+  atomic_uint_least32_t count;
+  atomic_uint_least64_t sum_us; // 1件ごとにmsへ丸めると短い処理の合計が消える
+  atomic_uint_least32_t max_us;
+  atomic_uint_least32_t buckets[METRICS_HIST_BUCKET_NUM];
+} metrics_hist_t;
+
+void metrics_counter_add(metric_counter_t id, uint32_t n);
+static inline void metrics_counter_inc(metric_counter_t id) {
+  metrics_counter_add(id, 1);
+}
+
+void metrics_gauge_set(metric_gauge_t id, int32_t value);
+
+void metrics_hist_observe(metric_hist_id_t id, int64_t elapsed_us);
+
+// HTTPの結果をステータスコードごとのカウンタへ加算する
+void metrics_record_http(esp_err_t err, int status_code);
+
+// スタックの残量(high water mark)を記録するタスクを登録する
+// 満杯の場合は警告を出してtasks_unregisteredを数える
+void metrics_register_task(TaskHandle_t task);
+
+// 経過時間(us)が入るバケットの番号を返す
+int metrics_hist_bucket_index(int64_t elapsed_us);
+
+// 任意のヒストグラムに値を記録する(ssm_trace等、レジストリ外で持つもの用)
+void metrics_hist_record(metrics_hist_t *hist, int64_t elapsed_us);
+
+// 記録した値のうちpercentile(%)番目が入るバケットの上限(ms)を返す
+// 最後のバケットや最大値がバケットの上限より小さい場合は最大値を返す
+// 記録が無い場合は0
+uint32_t metrics_hist_percentile_ms(const metrics_hist_t *hist,
+                                    uint32_t percentile);
+
+// ヒストグラムをJSONへ変換する
+cJSON *metrics_hist_to_json(const metrics_hist_t *hist);
+
+// バケットの上限値(ms)の配列をJSONで取得する
+cJSON *metrics_hist_bounds_to_json(void);
+
+// ヒープ・スタックを計測した上で全メトリクスのスナップショットをJSONで取得する
+cJSON *metrics_to_json(void);
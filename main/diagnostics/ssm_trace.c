@@ -0,0 +1,92 @@
+#include "ssm_trace.h"
+#include "metrics.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <inttypes.h>
+#include <string.h>
+
+#define TAG "ssm_trace"
+
+// 前の段階からの所要時間に付ける名前(SSM_TRACE_FETCHEDは起点なので無し)
+static const char *stage_names[SSM_TRACE_STAGE_NUM] = {
+    [SSM_TRACE_DISPATCHED] = "fetched_to_dispatched",
+    [SSM_TRACE_WRITTEN] = "dispatched_to_written",
+    [SSM_TRACE_MECH_STATUS] = "written_to_mech_status",
+    [SSM_TRACE_REPORTED] = "mech_status_to_reported",
+};
+
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool trace_active = false;
+static int64_t stamps[SSM_TRACE_STAGE_NUM];
+static metrics_hist_t stage_hists[SSM_TRACE_STAGE_NUM];
+static metrics_hist_t total_hist; // FETCHEDからREPORTEDまで
+
+void ssm_trace_begin(void) {
+  int64_t now = esp_timer_get_time();
+  taskENTER_CRITICAL(&trace_mux);
+  memset(stamps, 0, sizeof(stamps));
+  stamps[SSM_TRACE_FETCHED] = now;
+  trace_active = true;
+  taskEXIT_CRITICAL(&trace_mux);
+}
+
+void ssm_trace_stamp(ssm_trace_stage_t stage) {
+  if (stage >= SSM_TRACE_STAGE_NUM)
+    return;
+
+  int64_t now = esp_timer_get_time();
+  taskENTER_CRITICAL(&trace_mux);
+  if (trace_active && stamps[stage] == 0) {
+    stamps[stage] = now;
+  }
+  taskEXIT_CRITICAL(&trace_mux);
+}
+
+void ssm_trace_end(void) {
+  int64_t now = esp_timer_get_time();
+  int64_t elapsed[SSM_TRACE_STAGE_NUM] = {0};
+
+  taskENTER_CRITICAL(&trace_mux);
+  if (!trace_active) {
+    taskEXIT_CRITICAL(&trace_mux);
+    return;
+  }
+  trace_active = false;
+  stamps[SSM_TRACE_REPORTED] = now;
+
+  // 記録されなかった段階(既に目的の状態だった等)は飛ばして前の段階と比較する
+  int64_t prev = stamps[SSM_TRACE_FETCHED];
+  for (int stage = SSM_TRACE_DISPATCHED; stage < SSM_TRACE_STAGE_NUM;
+       stage++) {
+    if (stamps[stage] == 0)
+      continue;
+    elapsed[stage] = stamps[stage] - prev;
+    metrics_hist_record(&stage_hists[stage], elapsed[stage]);
+    prev = stamps[stage];
+  }
+  metrics_hist_record(&total_hist, now - stamps[SSM_TRACE_FETCHED]);
+  taskEXIT_CRITICAL(&trace_mux);
+
+  ESP_LOGI(TAG,
+           "dispatch=%" PRId64 "us write=%" PRId64 "us mech=%" PRId64
+           "us report=%" PRId64 "us total=%" PRId64 "us",
+           elapsed[SSM_TRACE_DISPATCHED], elapsed[SSM_TRACE_WRITTEN],
+           elapsed[SSM_TRACE_MECH_STATUS], elapsed[SSM_TRACE_REPORTED],
+           now - stamps[SSM_TRACE_FETCHED]);
+}
+
+cJSON *ssm_trace_to_json(void) {
+  cJSON *root = cJSON_CreateObject();
+  if (!root)
+    return NULL;
+
+  cJSON_AddItemToObject(root, "bounds_ms", metrics_hist_bounds_to_json());
+  for (int stage = SSM_TRACE_DISPATCHED; stage < SSM_TRACE_STAGE_NUM;
+       stage++) {
+    cJSON_AddItemToObject(root, stage_names[stage],
+                          metrics_hist_to_json(&stage_hists[stage]));
+  }
+  cJSON_AddItemToObject(root, "total", metrics_hist_to_json(&total_hist));
+  return root;
+}
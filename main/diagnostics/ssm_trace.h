@@ -0,0 +1,31 @@
+#pragma once
+
+#include "cJSON.h"
+#include <stdint.h>
+
+/*
+ * lock/unlockコマンド1件ごとの各段階の時刻(esp_timer_get_time)を記録し、
+ * 段階間の所要時間をヒストグラムとして集計する。
+ * コマンドはssm_tasksで1件ずつ処理されるので、同時に追跡するのは1件のみ。
+ */
+
+typedef enum {
+  SSM_TRACE_FETCHED = 0,   // Firebaseからコマンドを取得
+  SSM_TRACE_DISPATCHED,    // ssm_lock/ssm_unlockを呼び出し
+  SSM_TRACE_WRITTEN,       // talk_to_ssmで全セグメントを書き込み
+  SSM_TRACE_MECH_STATUS,   // ssm_parse_publishでMECH_STATUSを受信
+  SSM_TRACE_REPORTED,      // Firebaseへ結果を報告
+  SSM_TRACE_STAGE_NUM,
+} ssm_trace_stage_t;
+
+// コマンドの追跡を開始する(SSM_TRACE_FETCHEDを記録)
+void ssm_trace_begin(void);
+
+// 追跡中であれば段階の時刻を記録する(同じ段階は最初の1回のみ)
+void ssm_trace_stamp(ssm_trace_stage_t stage);
+
+// SSM_TRACE_REPORTEDを記録し、段階ごとの所要時間をヒストグラムへ加算する
+void ssm_trace_end(void);
+
+// ヒストグラムをJSONで取得する(呼び出し側でcJSON_Deleteする)
+cJSON *ssm_trace_to_json(void);
@@ -2,14 +2,19 @@
 #include "esp_err.h"
 #include "esp_http_client.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "app_events.h"
 #include "firebase_auth.h"
 #include "firebase_common.h"
 #include "firebase_config.h"
+#include "firebase_database.h"
 #include "firebase_internal.h"
+#include "metrics.h"
+#include "power.h"
 #include "utils/utils.h"
 
 #define TAG "firebase_auth"
@@ -189,7 +194,7 @@ static esp_err_t firebase_auth_post(const firebase_auth_info_t *auth,
 
   esp_http_client_config_t config = {
       .url = url,
-      .cert_pem = root_cert_pem_start,
+      .cert_pem = firebase_cert_pem_for_url(url),
       .event_handler = _http_event_handler,
       .user_data = ctx,
       .timeout_ms = 20000, // 20秒
@@ -204,7 +209,12 @@ static esp_err_t firebase_auth_post(const firebase_auth_info_t *auth,
   esp_http_client_set_method(client, HTTP_METHOD_POST);
   esp_http_client_set_post_field(client, post_data, strlen(post_data));
 
+  power_lock_acquire(POWER_LOCK_HTTPS);
+  int64_t start = esp_timer_get_time();
   err = esp_http_client_perform(client);
+  power_lock_release(POWER_LOCK_HTTPS);
+  metrics_hist_observe(METRIC_HIST_HTTP_REQUEST, esp_timer_get_time() - start);
+  metrics_record_http(err, esp_http_client_get_status_code(client));
 
   // handlerでのエラー
   if (ctx->handler_err != ESP_OK)
@@ -287,6 +297,31 @@ esp_err_t firebase_perform_auth(firebase_auth_info_t *auth) {
   return ESP_ERR_INVALID_ARG;
 }
 
+esp_err_t firebase_refresh_auth(firebase_auth_info_t *auth) {
+  if (!auth)
+    return ESP_ERR_INVALID_ARG;
+
+  // 他のタスクがid_tokenを使ってURLを組み立てている間は書き換えない
+  if (xSemaphoreTake(firebase_https_mutex, pdMS_TO_TICKS(20000)) != pdTRUE)
+    return ESP_ERR_TIMEOUT;
+
+  // 起動時にサインインできなかった場合はrefresh_tokenが無い
+  esp_err_t err = str_is_null_or_empty(auth->refresh_token)
+                      ? ESP_ERR_INVALID_STATE
+                      : refresh_id_token(auth);
+  if (err != ESP_OK) {
+    // refresh_tokenが失効している場合はサインインからやり直す
+    ESP_LOGW(TAG, "token refresh failed (%s), sign in again",
+             esp_err_to_name(err));
+    err = get_auth_info(auth);
+  }
+
+  xSemaphoreGive(firebase_https_mutex);
+  if (err == ESP_OK)
+    app_events_post(APP_EVENT_TOKEN_REFRESHED, NULL, 0);
+  return err;
+}
+
 firebase_auth_info_t *firebase_setup_auth(const char *email,
                                           const char *password,
                                           const char *api_key,
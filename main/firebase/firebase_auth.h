@@ -13,6 +13,10 @@ void firebase_auth_info_set_refresh_token(firebase_auth_info_t *auth,
 
 esp_err_t firebase_perform_auth(firebase_auth_info_t *auth);
 
+// firebase_https_mutexを取得した上でid_tokenを更新する(失敗時は再サインイン)
+// サインインしていない(refresh_tokenが無い)場合はサインインする
+esp_err_t firebase_refresh_auth(firebase_auth_info_t *auth);
+
 firebase_auth_info_t *firebase_setup_auth(const char *email,
                                           const char *password,
                                           const char *api_key,
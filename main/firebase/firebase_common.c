@@ -1,5 +1,7 @@
 #include "esp_http_client.h"
+#include "firebase_config.h"
 #include "firebase_internal.h"
+#include <string.h>
 
 /* firebase_response_ctx_tの操作を行う関数群 */
 firebase_response_ctx_t *
@@ -21,6 +23,7 @@ void firebase_free_response_ctx(firebase_response_ctx_t *ctx) {
     return;
   if (ctx->buf)
     free(ctx->buf);
+  free(ctx->body); // イベントハンドラで連結したレスポンスボディ
   free(ctx);
 }
 
@@ -32,3 +35,9 @@ char *build_api_url(const char *base, const char *api_key) {
 
   return url;
 }
+
+const char *firebase_cert_pem_for_url(const char *url) {
+  if (url && strncmp(url, "https://", 8) == 0)
+    return root_cert_pem_start;
+  return NULL;
+}
@@ -7,3 +7,5 @@ firebase_create_response_ctx(firebase_auth_info_t *auth,
                              firebase_request_type_t type);
 void firebase_free_response_ctx(firebase_response_ctx_t *ctx);
 char *build_api_url(const char *base, const char *api_key);
+// https以外(ローカルのスタンドイン等)の場合は証明書を使わない
+const char *firebase_cert_pem_for_url(const char *url);
@@ -2,16 +2,26 @@
 #include "esp_log.h"
 
 #include "esp_http_client.h"
+#include "esp_timer.h"
 #include "firebase/firebase_common.h"
 #include "firebase/firebase_config.h"
 #include "firebase/firebase_internal.h"
 #include "firebase_database.h"
 #include "freertos/idf_additions.h"
 #include "freertos/projdefs.h"
+#include "dlog.h"
+#include "metrics.h"
+#include "power.h"
+#include "radio_sched.h"
+#include <string.h>
 
 const char *TAG = "firebase_database";
 SemaphoreHandle_t firebase_https_mutex = NULL;
 
+#define RADIO_SCHED_MAX_DEFER_MS 3000
+#define FIREBASE_STREAM_READ_TIMEOUT_MS 45000 // keep-aliveは30秒ごとに届く
+#define FIREBASE_STREAM_LINE_MAX 512
+
 static char *build_database_url(const char *url_base, const char *path,
                                 const char *id_token_optional) {
   int len = strlen(url_base) + strlen(path) + 1; // +1はNULL終端用
@@ -27,13 +37,28 @@ static char *build_database_url(const char *url_base, const char *path,
   strcat(url, path);
 
   if (id_token_optional) {
-    strcat(url, "?auth=");
+    // クエリ(?orderBy=...)付きのパスには&で続ける
+    strcat(url, strchr(path, '?') ? "&auth=" : "?auth=");
     strcat(url, id_token_optional);
   }
 
   return url;
 }
 
+// firebase_https_mutexを取得し、待ち時間をメトリクスに記録する
+// 急がないリクエストはBLEのやり取りが終わるまで送信を遅らせる
+static BaseType_t _take_https_mutex(const firebase_request_param_t *param) {
+  if (!param->urgent)
+    radio_sched_wait_idle(pdMS_TO_TICKS(RADIO_SCHED_MAX_DEFER_MS));
+
+  int64_t start = esp_timer_get_time();
+  BaseType_t taken =
+      xSemaphoreTake(firebase_https_mutex, pdMS_TO_TICKS(20000));
+  metrics_hist_observe(METRIC_HIST_HTTPS_MUTEX_WAIT,
+                       esp_timer_get_time() - start);
+  return taken;
+}
+
 static esp_err_t
 _firebase_database_http_event_handler(esp_http_client_event_t *evt) {
   firebase_response_ctx_t *ctx = (firebase_response_ctx_t *)evt->user_data;
@@ -80,7 +105,7 @@ esp_err_t firebase_database_get(const firebase_auth_info_t *auth,
   firebase_response_ctx_t *ctx = NULL;
   esp_http_client_handle_t client = NULL;
 
-  if (xSemaphoreTake(firebase_https_mutex, pdMS_TO_TICKS(20000)) == pdTRUE) {
+  if (_take_https_mutex(param) == pdTRUE) {
     const char *id_token = auth ? auth->id_token : NULL;
     url = build_database_url(param->url_base, param->path, id_token);
     if (!url) {
@@ -97,7 +122,7 @@ esp_err_t firebase_database_get(const firebase_auth_info_t *auth,
 
     esp_http_client_config_t config = {
         .url = url,
-        .cert_pem = root_cert_pem_start,
+        .cert_pem = firebase_cert_pem_for_url(url),
         .event_handler = _firebase_database_http_event_handler,
         .user_data = ctx,
         .timeout_ms = 15000, // 15秒
@@ -111,13 +136,19 @@ esp_err_t firebase_database_get(const firebase_auth_info_t *auth,
     }
 
     esp_http_client_set_method(client, HTTP_METHOD_GET);
+    power_lock_acquire(POWER_LOCK_HTTPS);
+    int64_t start = esp_timer_get_time();
     err = esp_http_client_perform(client);
+    power_lock_release(POWER_LOCK_HTTPS);
+    metrics_hist_observe(METRIC_HIST_HTTP_REQUEST,
+                         esp_timer_get_time() - start);
 
     if (ctx->handler_err != ESP_OK)
       err = ctx->handler_err;
 
-    ESP_LOGI(TAG, "HTTP Status = %d, response_code = %d", err,
-             esp_http_client_get_status_code(client));
+    int status_code = esp_http_client_get_status_code(client);
+    metrics_record_http(err, status_code);
+    dlog_write(DLOG_FMT_HTTP_RESULT, err, status_code, 0);
 
     if (response_out && ctx->body)
       *response_out = strdup(ctx->body);
@@ -143,7 +174,7 @@ esp_err_t firebase_database_put(const firebase_auth_info_t *auth,
   firebase_response_ctx_t *ctx = NULL;
   esp_http_client_handle_t client = NULL;
 
-  if (xSemaphoreTake(firebase_https_mutex, pdMS_TO_TICKS(20000)) == pdTRUE) {
+  if (_take_https_mutex(param) == pdTRUE) {
     const char *id_token = auth ? auth->id_token : NULL;
     url = build_database_url(param->url_base, param->path, id_token);
     if (!url) {
@@ -160,7 +191,7 @@ esp_err_t firebase_database_put(const firebase_auth_info_t *auth,
 
     esp_http_client_config_t config = {
         .url = url,
-        .cert_pem = root_cert_pem_start,
+        .cert_pem = firebase_cert_pem_for_url(url),
         .event_handler = _firebase_database_http_event_handler,
         .user_data = ctx,
         .timeout_ms = 15000, // 15秒
@@ -178,13 +209,19 @@ esp_err_t firebase_database_put(const firebase_auth_info_t *auth,
     esp_http_client_set_post_field(client, json_body, strlen(json_body));
     esp_http_client_set_header(client, "Content-Type", "application/json");
 
+    power_lock_acquire(POWER_LOCK_HTTPS);
+    int64_t start = esp_timer_get_time();
     err = esp_http_client_perform(client);
+    power_lock_release(POWER_LOCK_HTTPS);
+    metrics_hist_observe(METRIC_HIST_HTTP_REQUEST,
+                         esp_timer_get_time() - start);
 
     if (ctx->handler_err != ESP_OK)
       err = ctx->handler_err;
 
-    ESP_LOGI(TAG, "HTTP Status = %d, response_code = %d", err,
-             esp_http_client_get_status_code(client));
+    int status_code = esp_http_client_get_status_code(client);
+    metrics_record_http(err, status_code);
+    dlog_write(DLOG_FMT_HTTP_RESULT, err, status_code, 0);
 
     xSemaphoreGive(firebase_https_mutex);
   }
@@ -206,7 +243,7 @@ esp_err_t firebase_database_patch(const firebase_auth_info_t *auth,
   firebase_response_ctx_t *ctx = NULL;
   esp_http_client_handle_t client = NULL;
 
-  if (xSemaphoreTake(firebase_https_mutex, pdMS_TO_TICKS(20000)) == pdTRUE) {
+  if (_take_https_mutex(param) == pdTRUE) {
     const char *id_token = auth ? auth->id_token : NULL;
     url = build_database_url(param->url_base, param->path, id_token);
     if (!url) {
@@ -223,7 +260,7 @@ esp_err_t firebase_database_patch(const firebase_auth_info_t *auth,
 
     esp_http_client_config_t config = {
         .url = url,
-        .cert_pem = root_cert_pem_start,
+        .cert_pem = firebase_cert_pem_for_url(url),
         .event_handler = _firebase_database_http_event_handler,
         .user_data = ctx,
         .timeout_ms = 15000,
@@ -240,13 +277,19 @@ esp_err_t firebase_database_patch(const firebase_auth_info_t *auth,
     esp_http_client_set_header(client, "Content-Type", "application/json");
     esp_http_client_set_post_field(client, patch_data, strlen(patch_data));
 
+    power_lock_acquire(POWER_LOCK_HTTPS);
+    int64_t start = esp_timer_get_time();
     err = esp_http_client_perform(client);
+    power_lock_release(POWER_LOCK_HTTPS);
+    metrics_hist_observe(METRIC_HIST_HTTP_REQUEST,
+                         esp_timer_get_time() - start);
 
     if (ctx->handler_err != ESP_OK)
       err = ctx->handler_err;
 
-    ESP_LOGI(TAG, "PATCH HTTP Status = %d, response_code = %d", err,
-             esp_http_client_get_status_code(client));
+    int status_code = esp_http_client_get_status_code(client);
+    metrics_record_http(err, status_code);
+    dlog_write(DLOG_FMT_HTTP_PATCH_RESULT, err, status_code, 0);
 
     xSemaphoreGive(firebase_https_mutex);
   }
@@ -259,3 +302,124 @@ cleanup:
   firebase_free_response_ctx(ctx);
   return err;
 }
+
+// SSEの1行を処理する(空行でイベントを確定する)
+static void _stream_handle_line(char *line, char *event, size_t event_size,
+                                firebase_stream_cb_t cb, void *arg,
+                                bool *closed) {
+  if (line[0] == '\0') {
+    return;
+  }
+  if (strncmp(line, "event:", 6) == 0) {
+    const char *value = line + 6;
+    while (*value == ' ')
+      value++;
+    strlcpy(event, value, event_size);
+    // サーバー側から切断される(トークン失効・権限変更)
+    if (strcmp(event, "auth_revoked") == 0 || strcmp(event, "cancel") == 0)
+      *closed = true;
+  } else if (strncmp(line, "data:", 5) == 0) {
+    const char *value = line + 5;
+    while (*value == ' ')
+      value++;
+    if (event[0] != '\0' && strcmp(event, "keep-alive") != 0)
+      cb(event, value, arg);
+    event[0] = '\0';
+  }
+}
+
+esp_err_t firebase_database_stream(const firebase_auth_info_t *auth,
+                                   const firebase_request_param_t *param,
+                                   firebase_stream_cb_t cb, void *arg) {
+  if (!param || !cb)
+    return ESP_ERR_INVALID_ARG;
+
+  esp_err_t err = ESP_FAIL;
+  char *url = NULL;
+  char *line = NULL;
+  esp_http_client_handle_t client = NULL;
+
+  // id_tokenは更新中に書き換わるのでmutex内でURLを組み立てる
+  // 接続は長時間続くのでmutexは保持しない
+  if (_take_https_mutex(param) != pdTRUE)
+    return ESP_ERR_TIMEOUT;
+  url = build_database_url(param->url_base, param->path,
+                           auth ? auth->id_token : NULL);
+  xSemaphoreGive(firebase_https_mutex);
+  if (!url)
+    return ESP_ERR_NO_MEM;
+
+  line = malloc(FIREBASE_STREAM_LINE_MAX);
+  if (!line) {
+    err = ESP_ERR_NO_MEM;
+    goto cleanup;
+  }
+
+  esp_http_client_config_t config = {
+      .url = url,
+      .cert_pem = firebase_cert_pem_for_url(url),
+      .timeout_ms = FIREBASE_STREAM_READ_TIMEOUT_MS,
+      .buffer_size = 1024,
+      .buffer_size_tx = 2048,
+  };
+  client = esp_http_client_init(&config);
+  if (!client)
+    goto cleanup;
+
+  esp_http_client_set_method(client, HTTP_METHOD_GET);
+  esp_http_client_set_header(client, "Accept", "text/event-stream");
+
+  // RTDBは担当サーバーへリダイレクトすることがある
+  int status_code = 0;
+  for (int redirect = 0; redirect < 2; redirect++) {
+    err = esp_http_client_open(client, 0);
+    if (err != ESP_OK)
+      break;
+    esp_http_client_fetch_headers(client);
+    status_code = esp_http_client_get_status_code(client);
+    if (status_code != 301 && status_code != 302 && status_code != 307)
+      break;
+    esp_http_client_set_redirection(client);
+    esp_http_client_close(client);
+  }
+  metrics_record_http(err, status_code);
+  if (err != ESP_OK)
+    goto cleanup;
+  if (status_code != 200) {
+    ESP_LOGW(TAG, "stream rejected: response_code = %d", status_code);
+    err = ESP_ERR_INVALID_RESPONSE;
+    goto cleanup;
+  }
+
+  ESP_LOGI(TAG, "stream connected: %s", param->path);
+  char event[32] = "";
+  size_t line_len = 0;
+  bool closed = false;
+  char chunk[256];
+  while (!closed) {
+    int n = esp_http_client_read(client, chunk, sizeof(chunk));
+    if (n <= 0) {
+      // 切断またはkeep-aliveが届かずタイムアウト
+      err = n == 0 ? ESP_OK : ESP_FAIL;
+      break;
+    }
+    for (int i = 0; i < n && !closed; i++) {
+      if (chunk[i] == '\n') {
+        line[line_len] = '\0';
+        _stream_handle_line(line, event, sizeof(event), cb, arg, &closed);
+        line_len = 0;
+      } else if (chunk[i] != '\r' && line_len < FIREBASE_STREAM_LINE_MAX - 1) {
+        line[line_len++] = chunk[i]; // 長すぎる行は先頭だけを渡す
+      }
+    }
+  }
+
+cleanup:
+  if (client) {
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+  }
+  free(line);
+  free(url);
+  return err;
+}
@@ -3,6 +3,10 @@
 #include "firebase_internal.h"
 #include "freertos/semphr.h"
 
+// ストリームのイベント(put/patch等)を受け取るコールバック
+typedef void (*firebase_stream_cb_t)(const char *event, const char *data,
+                                     void *arg);
+
 extern SemaphoreHandle_t firebase_https_mutex;
 
 esp_err_t firebase_database_get(const firebase_auth_info_t *auth,
@@ -14,3 +18,8 @@ esp_err_t firebase_database_put(const firebase_auth_info_t *auth,
 esp_err_t firebase_database_patch(const firebase_auth_info_t *auth,
                                   const firebase_request_param_t *param,
                                   const char *patch_data);
+
+// パスの変更をServer-Sent Eventsで受け取る。切断されるまで戻らない
+esp_err_t firebase_database_stream(const firebase_auth_info_t *auth,
+                                   const firebase_request_param_t *param,
+                                   firebase_stream_cb_t cb, void *arg);
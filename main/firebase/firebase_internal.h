@@ -2,6 +2,7 @@
 
 #include "esp_err.h"
 #include "esp_http_client.h"
+#include <stdbool.h>
 
 #define ID_TOKEN_MAX_LEN 2048
 #define REFRESH_TOKEN_MAX_LEN 256
@@ -30,6 +31,7 @@ typedef struct {
   firebase_request_type_t type;    // リクエストの種類
   esp_http_client_method_t method; // HTTPメソッド
   const char *path;                // Firebaseのパス(/usrs/uid123.json等)
+  bool urgent; // trueの場合、BLEのやり取り中でも待たずに送信する
   union {
     struct {
       const char *content_type;     // Content-Type(application/json等)
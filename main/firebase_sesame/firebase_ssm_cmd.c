@@ -2,23 +2,65 @@
 #include "cJSON.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_mac.h"
 #include "firebase/firebase_database.h"
 #include "firebase/firebase_internal.h"
+#include <string.h>
 
-#define SSM_COMMAND_PATH "sesami5pro/commands/command.json"
+#define SSM_COMMAND_QUEUE_PATH "sesami5pro/commands/queue"
+// 未完了のコマンドだけを古い順に取得する(limitToFirstは呼び出し側で付ける)
+// RTDBのルールでキューに ".indexOn": ["is_finished"] を定義しておくこと
+// (無い場合は400 "Index not defined"になる)
+#define SSM_COMMAND_QUEUE_QUERY "orderBy=%22is_finished%22&equalTo=false"
 #define SSM_CURRENT_STATUS_PATH "sesami5pro/status.json"
+#define SSM_DIAGNOSTICS_PATH "sesami5pro/diagnostics"
+#define SSM_HISTORY_PATH "sesami5pro/history"
+#define SSM_MECH_CONFIG_PATH "sesami5pro/config/mech_setting.json"
+#define SSM_MECH_SETTING_PATH "sesami5pro/mech_setting.json"
+#define SSM_OTA_PATH "sesami5pro/ota.json"
+#define SSM_LOCAL_RESULT_PATH "sesami5pro/commands/local"
 
 #define TAG "sesame_command"
 
-static firebase_ssm_cmd_type_t _parse_cmd_type(const char *name) {
+firebase_ssm_cmd_type_t firebase_ssm_parse_cmd_type(const char *name) {
   if (!strcmp(name, "lock"))
     return SSM_CMD_LOCK;
   if (!strcmp(name, "unlock"))
     return SSM_CMD_UNLOCK;
+  if (!strcmp(name, "emergency_unlock"))
+    return SSM_CMD_EMERGENCY_UNLOCK;
   // else
   return SSM_CMD_NONE;
 }
 
+const char *firebase_ssm_cmd_type_name(firebase_ssm_cmd_type_t cmd_type) {
+  switch (cmd_type) {
+  case SSM_CMD_LOCK:
+    return "lock";
+  case SSM_CMD_UNLOCK:
+    return "unlock";
+  case SSM_CMD_EMERGENCY_UNLOCK:
+    return "emergency_unlock";
+  default:
+    return "none";
+  }
+}
+
+bool firebase_ssm_push_id_time_ms(const char *id, int64_t *out_ms) {
+  // push IDの先頭8文字は作成時刻(ms)を次の64文字で表した上位桁から順の値
+  static const char alphabet[] =
+      "-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz";
+  int64_t ms = 0;
+  for (int i = 0; i < 8; i++) {
+    const char *p = id[i] ? strchr(alphabet, id[i]) : NULL;
+    if (!p)
+      return false;
+    ms = ms * 64 + (p - alphabet);
+  }
+  *out_ms = ms;
+  return true;
+}
+
 esp_err_t firebase_ssm_get_current_status(const firebase_auth_info_t *auth,
                                           firebase_ssm_status_t *out_status) {
   if (!auth || !out_status)
@@ -93,49 +135,111 @@ esp_err_t firebase_ssm_update_current_status(const firebase_auth_info_t *auth,
       .type = FIREBASE_USE_REALTIME_DATABASE,
       .method = HTTP_METHOD_PUT,
       .path = SSM_CURRENT_STATUS_PATH,
+      .urgent = true, // 状態の反映は遅らせない
   };
 
   // status.jsonには "locked" のような文字列（ダブルクォート必須）を書き込む
   return firebase_database_put(auth, &req, status_str);
 }
 
+// 未完了のコマンドを古い順にlimit件まで返すクエリ付きのパス
+static void _command_queue_query_path(char *path, size_t size, size_t limit) {
+  snprintf(path, size, "%s.json?%s&limitToFirst=%u", SSM_COMMAND_QUEUE_PATH,
+           SSM_COMMAND_QUEUE_QUERY, (unsigned)limit);
+}
+
+// push IDをキーとした未完了コマンドを古い順に並べてout_cmdsへ挿入する
+static void _insert_sorted(firebase_ssm_cmd_t *cmds, size_t max_cmds,
+                           size_t *count, const firebase_ssm_cmd_t *cmd) {
+  size_t pos = *count;
+  while (pos > 0 && strcmp(cmds[pos - 1].id, cmd->id) > 0) {
+    pos--;
+  }
+  if (pos >= max_cmds) {
+    return; // より新しいコマンドは次回の取得で処理する
+  }
+
+  size_t last = *count < max_cmds ? *count : max_cmds - 1;
+  memmove(&cmds[pos + 1], &cmds[pos], (last - pos) * sizeof(*cmds));
+  cmds[pos] = *cmd;
+  if (*count < max_cmds) {
+    (*count)++;
+  }
+}
+
 esp_err_t firebase_ssm_get_commands(const firebase_auth_info_t *auth,
-                                    firebase_ssm_cmd_t *out_cmd) {
+                                    firebase_ssm_cmd_t *out_cmds,
+                                    size_t max_cmds, size_t *out_count) {
+  if (!auth || !out_cmds || !out_count || max_cmds == 0)
+    return ESP_ERR_INVALID_ARG;
+
+  *out_count = 0;
+
   char *response = NULL;
+  char path[sizeof(SSM_COMMAND_QUEUE_PATH SSM_COMMAND_QUEUE_QUERY) + 32];
+  _command_queue_query_path(path, sizeof(path), max_cmds);
   firebase_request_param_t req = {
       .url_base = auth->database_url,
       .type = FIREBASE_USE_REALTIME_DATABASE,
       .method = HTTP_METHOD_GET,
-      .path = SSM_COMMAND_PATH,
+      .path = path,
   };
 
   esp_err_t err = firebase_database_get(auth, &req, &response);
   if (err != ESP_OK || response == NULL)
-    return err;
+    return err != ESP_OK ? err : ESP_FAIL;
 
+  /*
+   * レスポンス例:
+   * {"-NxA...": {"name": "lock", "user_name": "...", "is_finished": false}, ...}
+   * 未完了のコマンドが無い場合は null
+   * .indexOnが無い等でクエリが拒否された場合は {"error": "..."}
+   */
   cJSON *root = cJSON_Parse(response);
   if (!root) {
     free(response);
-    return ESP_FAIL;
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  cJSON *jerror = cJSON_GetObjectItem(root, "error");
+  if (cJSON_IsString(jerror)) {
+    ESP_LOGE(TAG, "command queue query rejected: %s", jerror->valuestring);
+    // "Auth token is expired", "Unauthorized request."等はid_tokenの問題
+    err = strstr(jerror->valuestring, "token") ||
+                  strstr(jerror->valuestring, "Unauthorized")
+              ? ESP_ERR_INVALID_STATE
+              : ESP_ERR_INVALID_RESPONSE;
+    cJSON_Delete(root);
+    free(response);
+    return err;
   }
 
-  cJSON *jname = cJSON_GetObjectItem(root, "name");
-  cJSON *juser = cJSON_GetObjectItem(root, "user_name");
-  cJSON *jfin = cJSON_GetObjectItem(root, "is_finished");
-  cJSON *jsucc = cJSON_GetObjectItem(root, "is_success");
+  cJSON *item = NULL;
+  cJSON_ArrayForEach(item, root) {
+    if (!cJSON_IsObject(item) || !item->string ||
+        strlen(item->string) >= FIREBASE_SSM_CMD_ID_LEN)
+      continue;
 
-  if (jname && cJSON_IsString(jname)) {
-    out_cmd->cmd_type = _parse_cmd_type(jname->valuestring);
-  } else {
-    out_cmd->cmd_type = SSM_CMD_NONE;
+    cJSON *jname = cJSON_GetObjectItem(item, "name");
+    cJSON *juser = cJSON_GetObjectItem(item, "user_name");
+    cJSON *jfin = cJSON_GetObjectItem(item, "is_finished");
+    cJSON *jsucc = cJSON_GetObjectItem(item, "is_success");
+
+    firebase_ssm_cmd_t cmd = {0};
+    strlcpy(cmd.id, item->string, sizeof(cmd.id));
+    cmd.cmd_type = jname && cJSON_IsString(jname)
+                       ? firebase_ssm_parse_cmd_type(jname->valuestring)
+                       : SSM_CMD_NONE;
+    strlcpy(cmd.user_name,
+            juser && cJSON_IsString(juser) ? juser->valuestring : "",
+            sizeof(cmd.user_name));
+    cmd.is_finished = jfin && cJSON_IsBool(jfin) ? cJSON_IsTrue(jfin) : false;
+    cmd.is_success = jsucc && cJSON_IsBool(jsucc) ? cJSON_IsTrue(jsucc) : false;
+
+    if (cmd.is_finished)
+      continue;
+
+    _insert_sorted(out_cmds, max_cmds, out_count, &cmd);
   }
-  strncpy(out_cmd->user_name,
-          juser && cJSON_IsString(juser) ? juser->valuestring : "",
-          sizeof(out_cmd->user_name));
-  out_cmd->is_finished =
-      jfin && cJSON_IsBool(jfin) ? cJSON_IsTrue(jfin) : false;
-  out_cmd->is_success =
-      jsucc && cJSON_IsBool(jsucc) ? cJSON_IsTrue(jsucc) : false;
 
   cJSON_Delete(root);
   free(response);
@@ -144,11 +248,18 @@ esp_err_t firebase_ssm_get_commands(const firebase_auth_info_t *auth,
 
 esp_err_t firebase_ssm_update_status(const firebase_auth_info_t *auth,
                                      const firebase_ssm_cmd_t *cmd) {
+  if (!auth || !cmd || cmd->id[0] == '\0')
+    return ESP_ERR_INVALID_ARG;
+
+  char path[sizeof(SSM_COMMAND_QUEUE_PATH) + FIREBASE_SSM_CMD_ID_LEN + 8];
+  snprintf(path, sizeof(path), "%s/%s.json", SSM_COMMAND_QUEUE_PATH, cmd->id);
+
   firebase_request_param_t req = {
       .url_base = auth->database_url,
       .type = FIREBASE_USE_REALTIME_DATABASE,
       .method = HTTP_METHOD_PATCH,
-      .path = SSM_COMMAND_PATH,
+      .path = path,
+      .urgent = true, // コマンド結果の報告は遅らせない
   };
 
   char status_json[128];
@@ -159,3 +270,286 @@ esp_err_t firebase_ssm_update_status(const firebase_auth_info_t *auth,
 
   return firebase_database_patch(auth, &req, status_json);
 }
+
+esp_err_t firebase_ssm_stream_commands(const firebase_auth_info_t *auth,
+                                       firebase_stream_cb_t cb, void *arg) {
+  if (!auth || !cb)
+    return ESP_ERR_INVALID_ARG;
+
+  // 取得(firebase_ssm_get_commands)と同じ範囲の変更だけを受け取る
+  char path[sizeof(SSM_COMMAND_QUEUE_PATH SSM_COMMAND_QUEUE_QUERY) + 32];
+  _command_queue_query_path(path, sizeof(path), FIREBASE_SSM_CMD_QUEUE_MAX);
+  firebase_request_param_t req = {
+      .url_base = auth->database_url,
+      .type = FIREBASE_USE_REALTIME_DATABASE,
+      .method = HTTP_METHOD_GET,
+      .path = path,
+  };
+
+  return firebase_database_stream(auth, &req, cb, arg);
+}
+
+esp_err_t firebase_ssm_stream_mech_config(const firebase_auth_info_t *auth,
+                                          firebase_stream_cb_t cb, void *arg) {
+  if (!auth || !cb)
+    return ESP_ERR_INVALID_ARG;
+
+  firebase_request_param_t req = {
+      .url_base = auth->database_url,
+      .type = FIREBASE_USE_REALTIME_DATABASE,
+      .method = HTTP_METHOD_GET,
+      .path = SSM_MECH_CONFIG_PATH,
+  };
+
+  return firebase_database_stream(auth, &req, cb, arg);
+}
+
+// 複数のゲートウェイを区別するためにWi-FiのMACアドレスをIDとして使う
+static const char *_device_id(void) {
+  static char device_id[13];
+  if (device_id[0] == '\0') {
+    uint8_t mac[6] = {0};
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(device_id, sizeof(device_id), "%02x%02x%02x%02x%02x%02x", mac[0],
+             mac[1], mac[2], mac[3], mac[4], mac[5]);
+  }
+  return device_id;
+}
+
+esp_err_t firebase_ssm_put_diagnostics(const firebase_auth_info_t *auth,
+                                       const char *name, const char *json) {
+  if (!auth || !name || !json)
+    return ESP_ERR_INVALID_ARG;
+
+  char path[96];
+  int len = snprintf(path, sizeof(path), "%s/%s/%s.json",
+                     SSM_DIAGNOSTICS_PATH, _device_id(), name);
+  if (len < 0 || (size_t)len >= sizeof(path))
+    return ESP_ERR_INVALID_SIZE;
+
+  firebase_request_param_t req = {
+      .url_base = auth->database_url,
+      .type = FIREBASE_USE_REALTIME_DATABASE,
+      .method = HTTP_METHOD_PUT,
+      .path = path,
+  };
+
+  return firebase_database_put(auth, &req, json);
+}
+
+esp_err_t firebase_ssm_patch_history(const firebase_auth_info_t *auth,
+                                     const char *json) {
+  if (!auth || !json)
+    return ESP_ERR_INVALID_ARG;
+
+  char path[64];
+  snprintf(path, sizeof(path), "%s/%s.json", SSM_HISTORY_PATH, _device_id());
+
+  firebase_request_param_t req = {
+      .url_base = auth->database_url,
+      .type = FIREBASE_USE_REALTIME_DATABASE,
+      .method = HTTP_METHOD_PATCH,
+      .path = path,
+  };
+
+  return firebase_database_patch(auth, &req, json);
+}
+
+// int16に収まる整数の角度だけを受け付ける
+static bool _get_position(const cJSON *root, const char *name, int16_t *out) {
+  const cJSON *item = cJSON_GetObjectItem(root, name);
+  if (!item || !cJSON_IsNumber(item) || item->valuedouble < INT16_MIN ||
+      item->valuedouble > INT16_MAX || item->valuedouble != item->valueint)
+    return false;
+  *out = (int16_t)item->valueint;
+  return true;
+}
+
+esp_err_t firebase_ssm_get_mech_config(const firebase_auth_info_t *auth,
+                                       firebase_ssm_mech_config_t *out_config) {
+  if (!auth || !out_config)
+    return ESP_ERR_INVALID_ARG;
+
+  memset(out_config, 0, sizeof(*out_config));
+
+  char *response = NULL;
+  firebase_request_param_t req = {
+      .url_base = auth->database_url,
+      .type = FIREBASE_USE_REALTIME_DATABASE,
+      .method = HTTP_METHOD_GET,
+      .path = SSM_MECH_CONFIG_PATH,
+  };
+
+  esp_err_t err = firebase_database_get(auth, &req, &response);
+  if (err != ESP_OK || response == NULL)
+    return err != ESP_OK ? err : ESP_FAIL;
+
+  /*
+   * レスポンス例:
+   * {"lock": -120, "unlock": 150, "calibrate": false}
+   * 未設定の場合は null
+   */
+  cJSON *root = cJSON_Parse(response);
+  free(response);
+  if (!root)
+    return ESP_ERR_INVALID_RESPONSE;
+
+  if (cJSON_IsObject(root)) {
+    mech_setting_t setting;
+    out_config->has_setting =
+        _get_position(root, "lock", &setting.lock_position) &&
+        _get_position(root, "unlock", &setting.unlock_position) &&
+        setting.lock_position != setting.unlock_position;
+    if (out_config->has_setting)
+      out_config->setting = setting;
+    out_config->calibrate =
+        cJSON_IsTrue(cJSON_GetObjectItem(root, "calibrate"));
+  }
+
+  cJSON_Delete(root);
+  return ESP_OK;
+}
+
+esp_err_t firebase_ssm_clear_mech_calibrate(const firebase_auth_info_t *auth) {
+  if (!auth)
+    return ESP_ERR_INVALID_ARG;
+
+  firebase_request_param_t req = {
+      .url_base = auth->database_url,
+      .type = FIREBASE_USE_REALTIME_DATABASE,
+      .method = HTTP_METHOD_PATCH,
+      .path = SSM_MECH_CONFIG_PATH,
+  };
+
+  return firebase_database_patch(auth, &req, "{ \"calibrate\": false }");
+}
+
+esp_err_t firebase_ssm_put_mech_setting(const firebase_auth_info_t *auth,
+                                        const char *json) {
+  if (!auth || !json)
+    return ESP_ERR_INVALID_ARG;
+
+  firebase_request_param_t req = {
+      .url_base = auth->database_url,
+      .type = FIREBASE_USE_REALTIME_DATABASE,
+      .method = HTTP_METHOD_PUT,
+      .path = SSM_MECH_SETTING_PATH,
+  };
+
+  return firebase_database_put(auth, &req, json);
+}
+
+// 16進数の文字列をちょうどlen bytesに変換する
+static bool _parse_hex(const char *hex, uint8_t *out, size_t len) {
+  if (strlen(hex) != len * 2)
+    return false;
+  for (size_t i = 0; i < len * 2; i++) {
+    char c = hex[i];
+    uint8_t v;
+    if (c >= '0' && c <= '9')
+      v = c - '0';
+    else if (c >= 'a' && c <= 'f')
+      v = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      v = c - 'A' + 10;
+    else
+      return false;
+    out[i / 2] = (i % 2) ? (out[i / 2] | v) : (uint8_t)(v << 4);
+  }
+  return true;
+}
+
+esp_err_t firebase_ssm_get_ota(const firebase_auth_info_t *auth,
+                               firebase_ssm_ota_t *out_ota,
+                               bool *out_available) {
+  if (!auth || !out_ota || !out_available)
+    return ESP_ERR_INVALID_ARG;
+
+  memset(out_ota, 0, sizeof(*out_ota));
+  *out_available = false;
+
+  char *response = NULL;
+  firebase_request_param_t req = {
+      .url_base = auth->database_url,
+      .type = FIREBASE_USE_REALTIME_DATABASE,
+      .method = HTTP_METHOD_GET,
+      .path = SSM_OTA_PATH,
+  };
+
+  esp_err_t err = firebase_database_get(auth, &req, &response);
+  if (err != ESP_OK || response == NULL)
+    return err != ESP_OK ? err : ESP_FAIL;
+
+  /*
+   * レスポンス例:
+   * {"version": "1.2.0", "url": "https://.../sesami.bin", "size": 1234567,
+   *  "signature": "<r||sの16進数128文字>"}
+   * 配布していない場合は null
+   */
+  cJSON *root = cJSON_Parse(response);
+  free(response);
+  if (!root)
+    return ESP_ERR_INVALID_RESPONSE;
+
+  if (cJSON_IsObject(root)) {
+    const cJSON *version = cJSON_GetObjectItem(root, "version");
+    const cJSON *url = cJSON_GetObjectItem(root, "url");
+    const cJSON *size = cJSON_GetObjectItem(root, "size");
+    const cJSON *signature = cJSON_GetObjectItem(root, "signature");
+    if (cJSON_IsString(version) && cJSON_IsString(url) &&
+        cJSON_IsNumber(size) && cJSON_IsString(signature) &&
+        strlen(version->valuestring) < sizeof(out_ota->version) &&
+        strlen(url->valuestring) < sizeof(out_ota->url) &&
+        size->valuedouble > 0 && size->valuedouble <= UINT32_MAX &&
+        _parse_hex(signature->valuestring, out_ota->signature,
+                   sizeof(out_ota->signature))) {
+      strlcpy(out_ota->version, version->valuestring,
+              sizeof(out_ota->version));
+      strlcpy(out_ota->url, url->valuestring, sizeof(out_ota->url));
+      out_ota->size = (uint32_t)size->valuedouble;
+      *out_available = true;
+    } else {
+      ESP_LOGW(TAG, "invalid ota manifest");
+    }
+  }
+
+  cJSON_Delete(root);
+  return ESP_OK;
+}
+
+esp_err_t firebase_ssm_put_local_result(const firebase_auth_info_t *auth,
+                                        const firebase_ssm_cmd_t *cmd,
+                                        int64_t executed_at) {
+  if (!auth || !cmd || cmd->id[0] == '\0')
+    return ESP_ERR_INVALID_ARG;
+
+  char path[sizeof(SSM_LOCAL_RESULT_PATH) + 13 + FIREBASE_SSM_CMD_ID_LEN + 8];
+  snprintf(path, sizeof(path), "%s/%s/%s.json", SSM_LOCAL_RESULT_PATH,
+           _device_id(), cmd->id);
+
+  firebase_request_param_t req = {
+      .url_base = auth->database_url,
+      .type = FIREBASE_USE_REALTIME_DATABASE,
+      .method = HTTP_METHOD_PUT,
+      .path = path,
+  };
+
+  cJSON *root = cJSON_CreateObject();
+  if (!root)
+    return ESP_ERR_NO_MEM;
+  cJSON_AddStringToObject(root, "command",
+                          firebase_ssm_cmd_type_name(cmd->cmd_type));
+  cJSON_AddStringToObject(root, "user_name", cmd->user_name);
+  cJSON_AddBoolToObject(root, "is_finished", cmd->is_finished);
+  cJSON_AddBoolToObject(root, "is_success", cmd->is_success);
+  if (executed_at > 0)
+    cJSON_AddNumberToObject(root, "executed_at", (double)executed_at);
+  char *json = cJSON_PrintUnformatted(root);
+  cJSON_Delete(root);
+  if (!json)
+    return ESP_ERR_NO_MEM;
+
+  esp_err_t err = firebase_database_put(auth, &req, json);
+  free(json);
+  return err;
+}
@@ -1,26 +1,73 @@
 #pragma once
 
+#include "firebase/firebase_database.h" // firebase_stream_cb_t
 #include "firebase/firebase_internal.h" // firebase_auth_info_t等
+#include "sesame/ssm.h"                 // mech_setting_t
+
+#define FIREBASE_SSM_CMD_ID_LEN 32 // push ID(20文字)+余裕
+#define FIREBASE_SSM_CMD_QUEUE_MAX 8 // 1回の取得で処理するコマンドの最大数
 
 typedef enum {
   SSM_CMD_NONE = 0,
   SSM_CMD_LOCK,
   SSM_CMD_UNLOCK,
+  SSM_CMD_EMERGENCY_UNLOCK, // 他のコマンドより先に開錠する
 } firebase_ssm_cmd_type_t;
 
 typedef struct {
+  char id[FIREBASE_SSM_CMD_ID_LEN]; // Firebaseのpush ID(時系列順にソート可能)
   firebase_ssm_cmd_type_t cmd_type;
   char user_name[32];
   bool is_finished;
   bool is_success;
 } firebase_ssm_cmd_t;
 
+typedef struct {
+  bool has_setting;       // lock/unlockが両方とも有効な値
+  mech_setting_t setting; // sesameへ書き込む角度
+  bool calibrate;         // 校正の開始を要求されている
+} firebase_ssm_mech_config_t;
+
+#define FIREBASE_SSM_OTA_VERSION_LEN 32 // esp_app_desc_t.versionと同じ
+#define FIREBASE_SSM_OTA_URL_LEN 256
+#define FIREBASE_SSM_OTA_SIGNATURE_LEN 64 // ECDSA(P-256)のr||s
+
+typedef struct {
+  char version[FIREBASE_SSM_OTA_VERSION_LEN]; // 実行中のversionより新しければ更新
+  char url[FIREBASE_SSM_OTA_URL_LEN];         // イメージのURL(https)
+  uint32_t size;                              // イメージのバイト数
+  // イメージのSHA-256に対する署名(big endian)
+  uint8_t signature[FIREBASE_SSM_OTA_SIGNATURE_LEN];
+} firebase_ssm_ota_t;
+
 typedef enum {
   SSM_STATUS_UNKNOWN = 0,
   SSM_STATUS_LOCKED,
   SSM_STATUS_UNLOCKED
 } firebase_ssm_status_t;
 
+/**
+ * @brief コマンド名(lock/unlock/emergency_unlock)を変換する
+ * @param name コマンド名
+ * @return 不明な場合はSSM_CMD_NONE
+ */
+firebase_ssm_cmd_type_t firebase_ssm_parse_cmd_type(const char *name);
+
+/**
+ * @brief コマンドの種類をコマンド名に変換する
+ * @param cmd_type コマンドの種類
+ * @return コマンド名(SSM_CMD_NONEは"none")
+ */
+const char *firebase_ssm_cmd_type_name(firebase_ssm_cmd_type_t cmd_type);
+
+/**
+ * @brief push IDから作成時刻を取り出す
+ * @param id コマンドID(push ID)
+ * @param out_ms 作成時刻(unix time, ms)を保存する
+ * @return push IDの形式でない場合はfalse
+ */
+bool firebase_ssm_push_id_time_ms(const char *id, int64_t *out_ms);
+
 /**
  * @brief Firebaseから現在のsesame 5 proの状態を取得
  * @param auth Firebase認証情報
@@ -40,20 +87,117 @@ esp_err_t firebase_ssm_update_current_status(const firebase_auth_info_t *auth,
                                              firebase_ssm_status_t status);
 
 /**
- * @brief Firebaseからコマンドを取得
+ * @brief Firebaseのコマンドキューから未完了のコマンドを取得
+ * (orderBy="is_finished"&equalTo=false&limitToFirst=max_cmdsのクエリで取得する。
+ * コマンドはis_finished: falseを付けて作成し、RTDBのルールでキューに
+ * ".indexOn": ["is_finished"]を定義しておくこと)
  * @param auth Firebaes認証情報
- * @param out_cmd 取得したコマンドの情報を保存する
+ * @param out_cmds 取得したコマンドをpush IDの昇順(古い順)で保存する
+ * @param max_cmds out_cmdsの要素数
+ * @param out_count 取得したコマンド数
  * @return esp_err_t
+ *         id_tokenが失効している等で拒否された場合はESP_ERR_INVALID_STATE
  */
 esp_err_t firebase_ssm_get_commands(const firebase_auth_info_t *auth,
-                                    firebase_ssm_cmd_t *out_cmd);
+                                    firebase_ssm_cmd_t *out_cmds,
+                                    size_t max_cmds, size_t *out_count);
 
-// コマンドの実行結果を更新（PATCH、is_finished等書き換え）
 /**
  * @brief コマンドの実行結果を更新(PATCH, is_finished等を置き換え)
  * @param auth Firebase認証情報
- * @param cmd この値をもとに更新する。更新後のデータを渡す。
+ * @param cmd この値をもとに更新する。更新後のデータを渡す。cmd->idで対象を特定する
  * @return esp_err_t
  */
 esp_err_t firebase_ssm_update_status(const firebase_auth_info_t *auth,
                                      const firebase_ssm_cmd_t *cmd);
+
+/**
+ * @brief コマンドキューの変更をストリームで受け取る(切断されるまで戻らない)
+ * firebase_ssm_get_commandsと同じクエリで、古い未完了のコマンドの変更だけを受け取る
+ * @param auth Firebase認証情報
+ * @param cb キューが変更されるたびに呼ばれる(接続直後にも1回呼ばれる)
+ * @param arg cbへ渡す引数
+ * @return esp_err_t
+ */
+esp_err_t firebase_ssm_stream_commands(const firebase_auth_info_t *auth,
+                                       firebase_stream_cb_t cb, void *arg);
+
+/**
+ * @brief 角度の設定(sesami5pro/config/mech_setting)の変更をストリームで受け取る
+ * (切断されるまで戻らない)
+ * @param auth Firebase認証情報
+ * @param cb 設定が変更されるたびに呼ばれる(接続直後にも1回呼ばれる)
+ * @param arg cbへ渡す引数
+ * @return esp_err_t
+ */
+esp_err_t firebase_ssm_stream_mech_config(const firebase_auth_info_t *auth,
+                                          firebase_stream_cb_t cb, void *arg);
+
+/**
+ * @brief 診断情報(JSON)をFirebaseのdiagnostics以下に書き込む(PUT)
+ * @param auth Firebase認証情報
+ * @param name 書き込み先の名前
+ *             (sesami5pro/diagnostics/<MACアドレス>/<name>.json)
+ * @param json 書き込むJSON文字列
+ * @return esp_err_t
+ */
+esp_err_t firebase_ssm_put_diagnostics(const firebase_auth_info_t *auth,
+                                       const char *name, const char *json);
+
+/**
+ * @brief sesameの履歴をまとめてFirebaseへ書き込む(PATCH)
+ * @param auth Firebase認証情報
+ * @param json record_idをキーとしたオブジェクト
+ *             (sesami5pro/history/<MACアドレス>.jsonへマージする)
+ * @return esp_err_t
+ */
+esp_err_t firebase_ssm_patch_history(const firebase_auth_info_t *auth,
+                                     const char *json);
+
+/**
+ * @brief 角度の設定(sesami5pro/config/mech_setting)を取得
+ * @param auth Firebase認証情報
+ * @param out_config 取得した設定(未設定の項目はhas_setting等がfalse)
+ * @return esp_err_t
+ */
+esp_err_t firebase_ssm_get_mech_config(const firebase_auth_info_t *auth,
+                                       firebase_ssm_mech_config_t *out_config);
+
+/**
+ * @brief 角度の設定の校正要求(calibrate)をfalseに戻す(PATCH)
+ * @param auth Firebase認証情報
+ * @return esp_err_t
+ */
+esp_err_t firebase_ssm_clear_mech_calibrate(const firebase_auth_info_t *auth);
+
+/**
+ * @brief 現在の角度と校正の結果を書き込む(PUT, sesami5pro/mech_setting.json)
+ * @param auth Firebase認証情報
+ * @param json 書き込むJSON文字列
+ * @return esp_err_t
+ */
+esp_err_t firebase_ssm_put_mech_setting(const firebase_auth_info_t *auth,
+                                        const char *json);
+
+/**
+ * @brief 配布中のファームウェア(sesami5pro/ota)を取得
+ * @param auth Firebase認証情報
+ * @param out_ota 取得した内容
+ * @param out_available 配布中でない(null)か、内容が不正な場合はfalse
+ * @return esp_err_t
+ */
+esp_err_t firebase_ssm_get_ota(const firebase_auth_info_t *auth,
+                               firebase_ssm_ota_t *out_ota,
+                               bool *out_available);
+
+/**
+ * @brief ゲートウェイで直接受け付けたコマンドの結果を書き込む(PUT)
+ * @param auth Firebase認証情報
+ * @param cmd 実行したコマンド
+ *            (sesami5pro/commands/local/<MACアドレス>/<cmd->id>.json)
+ * @param executed_at 実行した時刻(unix time)。不明な場合は0
+ * @return esp_err_t
+ */
+esp_err_t firebase_ssm_put_local_result(const firebase_auth_info_t *auth,
+                                        const firebase_ssm_cmd_t *cmd,
+                                        int64_t executed_at);
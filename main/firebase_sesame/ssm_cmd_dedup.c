@@ -0,0 +1,120 @@
+#include "ssm_cmd_dedup.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "nvs.h"
+#include <string.h>
+
+#define SSM_CMD_DEDUP_NVS_NAMESPACE "ssm_cmd"
+#define SSM_CMD_DEDUP_NVS_KEY "dedup"
+
+#define TAG "ssm_cmd_dedup"
+
+typedef struct {
+  char id[FIREBASE_SSM_CMD_ID_LEN];
+  uint8_t result; // ssm_cmd_dedup_result_t
+} ssm_cmd_dedup_entry_t;
+
+// NVSにそのまま保存するリングバッファ
+typedef struct {
+  uint8_t head; // 次に書き込む位置
+  ssm_cmd_dedup_entry_t entries[SSM_CMD_DEDUP_WINDOW];
+} ssm_cmd_dedup_ring_t;
+
+static ssm_cmd_dedup_ring_t dedup_ring;
+// コマンド取得タスクとローカルの受付(local_ctrl)の両方から使う
+static SemaphoreHandle_t dedup_mutex = NULL;
+
+static ssm_cmd_dedup_entry_t *_find(const char *id) {
+  for (int i = 0; i < SSM_CMD_DEDUP_WINDOW; i++) {
+    ssm_cmd_dedup_entry_t *entry = &dedup_ring.entries[i];
+    if (entry->id[0] != '\0' && strcmp(entry->id, id) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static esp_err_t _save(void) {
+  nvs_handle_t handle;
+  esp_err_t err =
+      nvs_open(SSM_CMD_DEDUP_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK)
+    return err;
+
+  err = nvs_set_blob(handle, SSM_CMD_DEDUP_NVS_KEY, &dedup_ring,
+                     sizeof(dedup_ring));
+  if (err == ESP_OK)
+    err = nvs_commit(handle);
+
+  nvs_close(handle);
+  return err;
+}
+
+esp_err_t ssm_cmd_dedup_init(void) {
+  memset(&dedup_ring, 0, sizeof(dedup_ring));
+  if (!dedup_mutex)
+    dedup_mutex = xSemaphoreCreateMutex();
+  if (!dedup_mutex)
+    return ESP_ERR_NO_MEM;
+
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(SSM_CMD_DEDUP_NVS_NAMESPACE, NVS_READONLY, &handle);
+  if (err == ESP_ERR_NVS_NOT_FOUND)
+    return ESP_OK; // 初回起動
+  if (err != ESP_OK)
+    return err;
+
+  size_t len = sizeof(dedup_ring);
+  err = nvs_get_blob(handle, SSM_CMD_DEDUP_NVS_KEY, &dedup_ring, &len);
+  nvs_close(handle);
+
+  if (err == ESP_ERR_NVS_NOT_FOUND)
+    return ESP_OK;
+  if (err != ESP_OK || len != sizeof(dedup_ring) ||
+      dedup_ring.head >= SSM_CMD_DEDUP_WINDOW) {
+    // サイズ変更等で読めない場合は空から始める
+    ESP_LOGW(TAG, "discard stored dedup window: %s", esp_err_to_name(err));
+    memset(&dedup_ring, 0, sizeof(dedup_ring));
+    return ESP_OK;
+  }
+  return ESP_OK;
+}
+
+bool ssm_cmd_dedup_lookup(const char *id, ssm_cmd_dedup_result_t *out_result) {
+  if (!id || id[0] == '\0')
+    return false;
+
+  if (!dedup_mutex)
+    return false;
+  xSemaphoreTake(dedup_mutex, portMAX_DELAY);
+  const ssm_cmd_dedup_entry_t *entry = _find(id);
+  if (entry && out_result)
+    *out_result = (ssm_cmd_dedup_result_t)entry->result;
+  xSemaphoreGive(dedup_mutex);
+  return entry != NULL;
+}
+
+esp_err_t ssm_cmd_dedup_record(const char *id, ssm_cmd_dedup_result_t result) {
+  if (!id || id[0] == '\0' || strlen(id) >= FIREBASE_SSM_CMD_ID_LEN)
+    return ESP_ERR_INVALID_ARG;
+  if (!dedup_mutex)
+    return ESP_ERR_INVALID_STATE;
+
+  xSemaphoreTake(dedup_mutex, portMAX_DELAY);
+  ssm_cmd_dedup_entry_t *entry = _find(id);
+  if (!entry) {
+    // 一番古いエントリを上書きする
+    entry = &dedup_ring.entries[dedup_ring.head];
+    dedup_ring.head = (dedup_ring.head + 1) % SSM_CMD_DEDUP_WINDOW;
+    strlcpy(entry->id, id, sizeof(entry->id));
+  }
+  entry->result = (uint8_t)result;
+
+  esp_err_t err = _save();
+  xSemaphoreGive(dedup_mutex);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "failed to save dedup window: %s", esp_err_to_name(err));
+  }
+  return err;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "esp_err.h"
+#include "firebase_ssm_cmd.h"
+#include <stdbool.h>
+
+#define SSM_CMD_DEDUP_WINDOW 16 // 直近で実行したコマンドIDの保持数
+
+typedef enum {
+  SSM_CMD_DEDUP_RESULT_PENDING = 0, // 実行開始済み(結果未確定)
+  SSM_CMD_DEDUP_RESULT_SUCCESS,
+  SSM_CMD_DEDUP_RESULT_FAILURE,
+} ssm_cmd_dedup_result_t;
+
+/**
+ * @brief NVSから直近の実行済みコマンドIDを読み込む
+ * @return esp_err_t
+ */
+esp_err_t ssm_cmd_dedup_init(void);
+
+/**
+ * @brief コマンドIDが実行済みかを確認
+ * @param id コマンドID(push ID)
+ * @param out_result 実行済みの場合、記録されている結果を保存する(NULL可)
+ * @return 実行済みならtrue
+ */
+bool ssm_cmd_dedup_lookup(const char *id, ssm_cmd_dedup_result_t *out_result);
+
+/**
+ * @brief コマンドIDの実行結果を記録しNVSへ保存する
+ * 実行前にSSM_CMD_DEDUP_RESULT_PENDINGで記録することで、
+ * 再起動やPATCH失敗時にも同じコマンドが2回実行されないようにする
+ * @param id コマンドID(push ID)
+ * @param result 実行結果
+ * @return esp_err_t
+ */
+esp_err_t ssm_cmd_dedup_record(const char *id, ssm_cmd_dedup_result_t result);
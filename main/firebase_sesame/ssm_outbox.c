@@ -0,0 +1,82 @@
+#include "ssm_outbox.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "metrics.h"
+#include <string.h>
+
+#define TAG "ssm_outbox"
+
+typedef struct {
+  uint32_t seq; // 送信中に捨てられたかを見分ける
+  int64_t executed_at;
+  firebase_ssm_cmd_t cmd;
+} ssm_outbox_entry_t;
+
+static ssm_outbox_entry_t entries[SSM_OUTBOX_MAX];
+static size_t head = 0; // 一番古い結果の位置
+static size_t count = 0;
+static uint32_t next_seq = 0;
+static portMUX_TYPE outbox_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void ssm_outbox_push(const firebase_ssm_cmd_t *cmd, int64_t executed_at) {
+  bool dropped = false;
+  taskENTER_CRITICAL(&outbox_mux);
+  if (count == SSM_OUTBOX_MAX) {
+    head = (head + 1) % SSM_OUTBOX_MAX;
+    count--;
+    dropped = true;
+  }
+  ssm_outbox_entry_t *entry = &entries[(head + count) % SSM_OUTBOX_MAX];
+  entry->seq = next_seq++;
+  entry->executed_at = executed_at;
+  entry->cmd = *cmd;
+  count++;
+  taskEXIT_CRITICAL(&outbox_mux);
+
+  if (dropped) {
+    metrics_counter_inc(METRIC_OUTBOX_DROPPED);
+    ESP_LOGW(TAG, "outbox full, dropped the oldest result");
+  }
+}
+
+// 一番古い結果を写す
+static bool peek(ssm_outbox_entry_t *out) {
+  taskENTER_CRITICAL(&outbox_mux);
+  bool found = count > 0;
+  if (found)
+    *out = entries[head];
+  taskEXIT_CRITICAL(&outbox_mux);
+  return found;
+}
+
+// 送信した結果がまだ先頭にあれば取り除く
+static void pop(uint32_t seq) {
+  taskENTER_CRITICAL(&outbox_mux);
+  if (count > 0 && entries[head].seq == seq) {
+    head = (head + 1) % SSM_OUTBOX_MAX;
+    count--;
+  }
+  taskEXIT_CRITICAL(&outbox_mux);
+}
+
+esp_err_t ssm_outbox_flush(const firebase_auth_info_t *auth) {
+  ssm_outbox_entry_t entry;
+  while (peek(&entry)) {
+    esp_err_t err =
+        firebase_ssm_put_local_result(auth, &entry.cmd, entry.executed_at);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "flush stopped at %s: %s", entry.cmd.id,
+               esp_err_to_name(err));
+      return err;
+    }
+    pop(entry.seq);
+  }
+  return ESP_OK;
+}
+
+size_t ssm_outbox_count(void) {
+  taskENTER_CRITICAL(&outbox_mux);
+  size_t n = count;
+  taskEXIT_CRITICAL(&outbox_mux);
+  return n;
+}
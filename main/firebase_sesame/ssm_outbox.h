@@ -0,0 +1,35 @@
+#pragma once
+
+#include "esp_err.h"
+#include "firebase_ssm_cmd.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Firebaseを経由せずに実行したコマンド(local_ctrl)の結果の送信待ち。
+ * 通信できない間は古い順に溜め、繋がった時に同じ順でFirebaseへ書き込む。
+ * 満杯になった場合は一番古いものを捨てる(再起動すると失われる)。
+ */
+
+#define SSM_OUTBOX_MAX 16 // 保持できる結果の数
+
+/**
+ * @brief 実行結果を追加する
+ * @param cmd 実行したコマンド(is_finished/is_successを設定済みのもの)
+ * @param executed_at 実行した時刻(unix time)。不明な場合は0
+ */
+void ssm_outbox_push(const firebase_ssm_cmd_t *cmd, int64_t executed_at);
+
+/**
+ * @brief 溜まっている結果を古い順にFirebaseへ書き込む
+ * 失敗した時点で止め、残りは次回に同じ順で送る
+ * @param auth Firebase認証情報
+ * @return 全て書き込めた(または空の)場合はESP_OK
+ */
+esp_err_t ssm_outbox_flush(const firebase_auth_info_t *auth);
+
+/**
+ * @brief 送信待ちの結果の数
+ * @return 件数
+ */
+size_t ssm_outbox_count(void);
@@ -0,0 +1,414 @@
+#include "local_ctrl.h"
+#include "aes-cbc-cmac.h"
+#include "app_events.h"
+#include "cJSON.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "firebase_sesame/firebase_ssm_cmd.h"
+#include "firebase_sesame/ssm_cmd_dedup.h"
+#include "firebase_sesame/ssm_outbox.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+#include "sesame/ssm.h"
+#include "sesame/ssm_tasks.h"
+#include "time_sync.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LOCAL_CTRL_BODY_MAX 256
+#define LOCAL_CTRL_KEY_LEN 16
+#define LOCAL_CTRL_NONCE_LEN 16
+#define LOCAL_CTRL_NONCE_MAX 8 // 同時に発行しておけるnonceの数
+#define LOCAL_CTRL_NONCE_TTL_US (30 * 1000 * 1000LL) // nonceの有効期限
+#define LOCAL_CTRL_WS_MAX 4 // 同時に接続できるWebSocketの数
+#define LOCAL_CTRL_QUERY_MAX 96
+#define LOCAL_CTRL_JOB_MAX 4 // 実行待ちにできるコマンドの数
+
+#define TAG "local_ctrl"
+
+#if CONFIG_SSM_LOCAL_CTRL
+static uint8_t ctrl_key[LOCAL_CTRL_KEY_LEN];
+static httpd_handle_t server = NULL;
+
+// 受け付けたコマンド(httpdのタスクを止めないよう別のタスクで実行する)
+typedef struct {
+  httpd_req_t *req; // httpd_req_async_handler_beginで複製したもの
+  firebase_ssm_cmd_t cmd;
+  int64_t issued_ms; // クライアントがコマンドを作成した時刻
+} local_cmd_job_t;
+
+static QueueHandle_t job_queue = NULL;
+
+// 発行したnonce(ハンドラは全てhttpdのタスクで動くので排他は不要)
+typedef struct {
+  uint8_t value[LOCAL_CTRL_NONCE_LEN];
+  int64_t expires_us; // 0は未使用
+} local_nonce_t;
+
+static local_nonce_t nonces[LOCAL_CTRL_NONCE_MAX];
+
+// MECH_STATUSを送るWebSocket(認証済みのもののみ)
+static int ws_fds[LOCAL_CTRL_WS_MAX] = {-1, -1, -1, -1};
+static mech_status_t latest_status;
+static bool has_status = false;
+static bool broadcast_queued = false; // 送信をhttpdのキューに入れた
+static portMUX_TYPE ws_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool parse_hex(const char *hex, uint8_t *out, size_t len) {
+  if (strlen(hex) != len * 2)
+    return false;
+  for (size_t i = 0; i < len; i++) {
+    unsigned int byte;
+    if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+      return false;
+    out[i] = (uint8_t)byte;
+  }
+  return true;
+}
+
+// 比較にかかる時間が一致した長さに依存しないようにする
+static bool equal_ct(const uint8_t *a, const uint8_t *b, size_t len) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i < len; i++)
+    diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+static esp_err_t reply(httpd_req_t *req, const char *status,
+                       const char *result) {
+  char body[64];
+  snprintf(body, sizeof(body), "{\"result\":\"%s\"}", result);
+  httpd_resp_set_status(req, status);
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, body);
+}
+
+static void to_hex(const uint8_t *in, size_t len, char *out) {
+  for (size_t i = 0; i < len; i++)
+    sprintf(out + i * 2, "%02x", in[i]);
+}
+
+// 時計に依存せず再送を防ぐため、リクエストごとに使い捨てのnonceを発行する
+// (時刻同期前や再起動後でも、一度使った署名は通らない)
+static esp_err_t nonce_get_handler(httpd_req_t *req) {
+  int64_t now = esp_timer_get_time();
+  // 空きか期限切れを使い、無ければ最も早く切れるものを置き換える
+  local_nonce_t *slot = &nonces[0];
+  for (int i = 0; i < LOCAL_CTRL_NONCE_MAX; i++) {
+    if (nonces[i].expires_us <= now) {
+      slot = &nonces[i];
+      break;
+    }
+    if (nonces[i].expires_us < slot->expires_us)
+      slot = &nonces[i];
+  }
+  esp_fill_random(slot->value, sizeof(slot->value));
+  slot->expires_us = now + LOCAL_CTRL_NONCE_TTL_US;
+
+  char hex[LOCAL_CTRL_NONCE_LEN * 2 + 1];
+  char body[64];
+  to_hex(slot->value, sizeof(slot->value), hex);
+  snprintf(body, sizeof(body), "{\"nonce\":\"%s\"}", hex);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+  return httpd_resp_sendstr(req, body);
+}
+
+// 署名を確認し、署名に含まれるnonceを使用済みにする
+// (msgはnonce_hexで始まる署名対象の文字列)
+static bool verify(const char *msg, const char *nonce_hex,
+                   const char *mac_hex) {
+  uint8_t mac[16];
+  uint8_t nonce[LOCAL_CTRL_NONCE_LEN];
+  if (!parse_hex(mac_hex, mac, sizeof(mac)) ||
+      !parse_hex(nonce_hex, nonce, sizeof(nonce)))
+    return false;
+
+  uint8_t expected[16];
+  AES_CMAC(ctrl_key, (const unsigned char *)msg, strlen(msg), expected);
+  if (!equal_ct(mac, expected, sizeof(mac)))
+    return false;
+
+  // 鍵を持たない相手にnonceを消費させないよう、署名の確認後に探す
+  int64_t now = esp_timer_get_time();
+  for (int i = 0; i < LOCAL_CTRL_NONCE_MAX; i++) {
+    if (nonces[i].expires_us > now &&
+        equal_ct(nonces[i].value, nonce, sizeof(nonce))) {
+      nonces[i].expires_us = 0;
+      return true;
+    }
+  }
+  return false; // 未発行、期限切れ、使用済み
+}
+
+static esp_err_t command_post_handler(httpd_req_t *req) {
+  char body[LOCAL_CTRL_BODY_MAX];
+  if (req->content_len == 0 || req->content_len >= sizeof(body))
+    return reply(req, "400 Bad Request", "bad_request");
+  size_t received = 0;
+  while (received < req->content_len) {
+    int n = httpd_req_recv(req, body + received, req->content_len - received);
+    if (n == HTTPD_SOCK_ERR_TIMEOUT)
+      continue;
+    if (n <= 0)
+      return ESP_FAIL; // 接続を閉じる
+    received += n;
+  }
+  body[received] = '\0';
+
+  cJSON *root = cJSON_Parse(body);
+  const cJSON *id = cJSON_GetObjectItem(root, "id");
+  const cJSON *command = cJSON_GetObjectItem(root, "command");
+  const cJSON *ts = cJSON_GetObjectItem(root, "ts");
+  const cJSON *nonce = cJSON_GetObjectItem(root, "nonce");
+  const cJSON *mac = cJSON_GetObjectItem(root, "mac");
+  firebase_ssm_cmd_t cmd = {0};
+  if (!cJSON_IsString(id) || !cJSON_IsString(command) || !cJSON_IsNumber(ts) ||
+      !cJSON_IsString(nonce) ||
+      !cJSON_IsString(mac) || id->valuestring[0] == '\0' ||
+      strlen(id->valuestring) >= sizeof(cmd.id) ||
+      strchr(id->valuestring, ':') ||
+      (cmd.cmd_type = firebase_ssm_parse_cmd_type(command->valuestring)) ==
+          SSM_CMD_NONE) {
+    cJSON_Delete(root);
+    return reply(req, "400 Bad Request", "bad_request");
+  }
+  char msg[FIREBASE_SSM_CMD_ID_LEN + 96];
+  int64_t issued_ms = (int64_t)ts->valuedouble;
+  snprintf(msg, sizeof(msg), "%s:%s:%s:%lld", nonce->valuestring,
+           id->valuestring, command->valuestring, (long long)issued_ms);
+  if (!verify(msg, nonce->valuestring, mac->valuestring)) {
+    cJSON_Delete(root);
+    metrics_counter_inc(METRIC_LOCAL_AUTH_FAILURES);
+    ESP_LOGW(TAG, "rejected command %s", command->valuestring);
+    return reply(req, "401 Unauthorized", "unauthorized");
+  }
+  strcpy(cmd.id, id->valuestring);
+  cJSON_Delete(root);
+
+  // 再送やFirebase側と同じidは記録済みの結果を返す
+  ssm_cmd_dedup_result_t recorded;
+  if (ssm_cmd_dedup_lookup(cmd.id, &recorded)) {
+    return reply(req, "409 Conflict",
+                 recorded == SSM_CMD_DEDUP_RESULT_SUCCESS   ? "success"
+                 : recorded == SSM_CMD_DEDUP_RESULT_FAILURE ? "failure"
+                                                            : "pending");
+  }
+  // キューに入れるのはこのタスクだけなので、空きがあれば必ず入る
+  if (uxQueueSpacesAvailable(job_queue) == 0)
+    return reply(req, "503 Service Unavailable", "busy");
+  if (ssm_cmd_dedup_record(cmd.id, SSM_CMD_DEDUP_RESULT_PENDING) != ESP_OK)
+    return reply(req, "500 Internal Server Error", "failure");
+
+  local_cmd_job_t job = {.cmd = cmd, .issued_ms = issued_ms};
+  if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK) {
+    ssm_cmd_dedup_record(cmd.id, SSM_CMD_DEDUP_RESULT_FAILURE);
+    return reply(req, "500 Internal Server Error", "failure");
+  }
+  xQueueSend(job_queue, &job, 0);
+  return ESP_OK;
+}
+
+// 受け付けたコマンドを順に実行し、完了してから応答する
+static void task_local_cmd(void *pvParameters) {
+  local_cmd_job_t job;
+  while (1) {
+    xQueueReceive(job_queue, &job, portMAX_DELAY);
+    metrics_counter_inc(METRIC_LOCAL_COMMANDS);
+    ESP_LOGI(TAG, "local command %s (%s)",
+             firebase_ssm_cmd_type_name(job.cmd.cmd_type), job.cmd.id);
+    bool ok = ssm_execute_command(job.cmd.cmd_type);
+    ssm_observe_cmd_latency(METRIC_HIST_CMD_LOCAL, job.issued_ms);
+    ssm_cmd_dedup_record(job.cmd.id, ok ? SSM_CMD_DEDUP_RESULT_SUCCESS
+                                        : SSM_CMD_DEDUP_RESULT_FAILURE);
+
+    strcpy(job.cmd.user_name, "local");
+    job.cmd.is_finished = true;
+    job.cmd.is_success = ok;
+    ssm_outbox_push(&job.cmd, time_sync_is_valid() ? (int64_t)time(NULL) : 0);
+    app_events_post(APP_EVENT_LOCAL_CMD_DONE, NULL, 0);
+
+    if (ok)
+      reply(job.req, "200 OK", "success");
+    else
+      reply(job.req, "500 Internal Server Error", "failure");
+    httpd_req_async_handler_complete(job.req);
+  }
+}
+
+// httpdのタスクで最新のMECH_STATUSを全てのWebSocketへ送る
+static void broadcast_mech_status(void *arg) {
+  taskENTER_CRITICAL(&ws_mux);
+  broadcast_queued = false;
+  mech_status_t status = latest_status;
+  int fds[LOCAL_CTRL_WS_MAX];
+  memcpy(fds, ws_fds, sizeof(fds));
+  taskEXIT_CRITICAL(&ws_mux);
+
+  char json[160];
+  int len = snprintf(
+      json, sizeof(json),
+      "{\"type\":\"mech_status\",\"position\":%d,\"target\":%d,"
+      "\"battery\":%u,\"locked\":%s,\"unlocked\":%s,\"stop\":%s}",
+      status.position, status.target, status.battery,
+      status.is_lock_range ? "true" : "false",
+      status.is_unlock_range ? "true" : "false",
+      status.is_stop ? "true" : "false");
+  httpd_ws_frame_t frame = {
+      .type = HTTPD_WS_TYPE_TEXT,
+      .payload = (uint8_t *)json,
+      .len = len,
+  };
+  for (int i = 0; i < LOCAL_CTRL_WS_MAX; i++) {
+    if (fds[i] < 0)
+      continue;
+    // 切断済み(または別の接続に再利用された)ものは外す
+    if (httpd_ws_get_fd_info(server, fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET ||
+        httpd_ws_send_frame_async(server, fds[i], &frame) != ESP_OK) {
+      taskENTER_CRITICAL(&ws_mux);
+      if (ws_fds[i] == fds[i])
+        ws_fds[i] = -1;
+      taskEXIT_CRITICAL(&ws_mux);
+    }
+  }
+}
+
+// 送信待ちでなければhttpdのキューに入れる
+static void queue_broadcast(void) {
+  bool queue = false;
+  taskENTER_CRITICAL(&ws_mux);
+  if (has_status && !broadcast_queued) {
+    for (int i = 0; i < LOCAL_CTRL_WS_MAX; i++) {
+      if (ws_fds[i] >= 0)
+        queue = true;
+    }
+    broadcast_queued = queue;
+  }
+  taskEXIT_CRITICAL(&ws_mux);
+
+  if (queue &&
+      httpd_queue_work(server, broadcast_mech_status, NULL) != ESP_OK) {
+    taskENTER_CRITICAL(&ws_mux);
+    broadcast_queued = false;
+    taskEXIT_CRITICAL(&ws_mux);
+  }
+}
+
+// 接続時(GET)に認証し、その後に届いたフレームは読み捨てる
+static esp_err_t status_ws_handler(httpd_req_t *req) {
+  int fd = httpd_req_to_sockfd(req);
+  if (req->method != HTTP_GET) {
+    // 送信専用なので、大きなフレームは読まずに接続を閉じる
+    uint8_t discard[32];
+    httpd_ws_frame_t frame = {0};
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK || frame.len == 0)
+      return err;
+    if (frame.len > sizeof(discard))
+      return ESP_FAIL;
+    frame.payload = discard;
+    return httpd_ws_recv_frame(req, &frame, sizeof(discard));
+  }
+
+  char query[LOCAL_CTRL_QUERY_MAX];
+  char nonce[LOCAL_CTRL_NONCE_LEN * 2 + 8];
+  char mac[40];
+  char msg[64];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+      httpd_query_key_value(query, "nonce", nonce, sizeof(nonce)) != ESP_OK ||
+      httpd_query_key_value(query, "mac", mac, sizeof(mac)) != ESP_OK) {
+    return ESP_FAIL; // 接続を閉じる
+  }
+  snprintf(msg, sizeof(msg), "%s:status", nonce);
+  if (!verify(msg, nonce, mac)) {
+    metrics_counter_inc(METRIC_LOCAL_AUTH_FAILURES);
+    ESP_LOGW(TAG, "rejected status stream");
+    return ESP_FAIL;
+  }
+
+  bool added = false;
+  taskENTER_CRITICAL(&ws_mux);
+  for (int i = 0; i < LOCAL_CTRL_WS_MAX && !added; i++) {
+    if (ws_fds[i] < 0 || ws_fds[i] == fd) {
+      ws_fds[i] = fd;
+      added = true;
+    }
+  }
+  taskEXIT_CRITICAL(&ws_mux);
+  if (!added) {
+    ESP_LOGW(TAG, "too many status streams");
+    return ESP_FAIL;
+  }
+  queue_broadcast(); // 接続直後に現在の状態を送る
+  return ESP_OK;
+}
+
+// 最新のMECH_STATUSを接続中のWebSocketへ送る
+// 送信はHTTPサーバーのタスクで行い、間に合わない分は最新のものだけを送る
+static void mech_status_handler(void *arg, esp_event_base_t base, int32_t id,
+                                void *data) {
+  taskENTER_CRITICAL(&ws_mux);
+  latest_status = *(const mech_status_t *)data;
+  has_status = true;
+  taskEXIT_CRITICAL(&ws_mux);
+  queue_broadcast();
+}
+#endif
+
+void local_ctrl_start(void) {
+#if CONFIG_SSM_LOCAL_CTRL
+  if (!parse_hex(CONFIG_SSM_LOCAL_CTRL_KEY, ctrl_key, sizeof(ctrl_key))) {
+    ESP_LOGE(TAG, "CONFIG_SSM_LOCAL_CTRL_KEY must be 32 hex characters");
+    return;
+  }
+
+  job_queue = xQueueCreate(LOCAL_CTRL_JOB_MAX, sizeof(local_cmd_job_t));
+  TaskHandle_t task;
+  if (!job_queue || xTaskCreate(task_local_cmd, "local command task", 4096,
+                                NULL, 5, &task) != pdPASS) {
+    ESP_LOGE(TAG, "failed to create local command task");
+    return;
+  }
+  metrics_register_task(task);
+
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.server_port = CONFIG_SSM_LOCAL_CTRL_PORT;
+  esp_err_t err = httpd_start(&server, &config);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "httpd_start failed: %s", esp_err_to_name(err));
+    return;
+  }
+
+  static const httpd_uri_t nonce_uri = {
+      .uri = "/api/nonce",
+      .method = HTTP_GET,
+      .handler = nonce_get_handler,
+  };
+  httpd_register_uri_handler(server, &nonce_uri);
+  static const httpd_uri_t command_uri = {
+      .uri = "/api/command",
+      .method = HTTP_POST,
+      .handler = command_post_handler,
+  };
+  httpd_register_uri_handler(server, &command_uri);
+  static const httpd_uri_t status_uri = {
+      .uri = "/api/status",
+      .method = HTTP_GET,
+      .handler = status_ws_handler,
+      .is_websocket = true,
+  };
+  httpd_register_uri_handler(server, &status_uri);
+  err = app_events_register(APP_EVENT_SSM_MECH_STATUS, mech_status_handler,
+                            NULL);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "app_events_register failed: %s", esp_err_to_name(err));
+  }
+  ESP_LOGI(TAG, "listening on port %d", CONFIG_SSM_LOCAL_CTRL_PORT);
+#endif
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+/*
+ * LANからのlock/unlockの受付(Firebaseを経由しないので数十msで送信できる)。
+ * GET /api/nonce で使い捨てのnonce({"nonce":"<32桁の16進>"}、30秒で失効)を
+ * 受け取り、POST /api/command に {"id","command","ts","nonce","mac"} を送る。
+ * tsはクライアントがコマンドを作成した時刻(unix time, ms)で、
+ * macは "<nonce>:<id>:<command>:<ts>" に対するCONFIG_SSM_LOCAL_CTRL_KEYでの
+ * AES-CMAC(16進)。nonceは1回しか使えないので、時刻同期の前や再起動後でも
+ * 同じリクエストの再送は受け付けない。同じidは実行済みのコマンドと同様に
+ * 2回実行しない。結果はssm_outboxに溜め、Firebaseに繋がった時に古い順で
+ * 書き込む。
+ *
+ * GET /api/status?nonce=<nonce>&mac=<"<nonce>:status"のmac> はWebSocketで、
+ * 受信したMECH_STATUS(APP_EVENT_SSM_MECH_STATUS)をJSONで送り続ける。
+ * tsから確認までの時間はmetricsのcmd_localに記録し、push IDの時刻から
+ * 数えるFirebase経由のcmd_firebaseと比べられるようにする(どちらも
+ * クライアントの時計が起点)。
+ */
+
+/**
+ * @brief HTTPサーバーを開始する(CONFIG_SSM_LOCAL_CTRLが無効な場合は何もしない)
+ * start_sesame_tasksの後に呼ぶ
+ */
+void local_ctrl_start(void);
@@ -2,31 +2,39 @@
 #include "freertos/idf_additions.h"
 #include "nvs_flash.h"
 
+#include "app_events.h"
 #include "blecent.h"
+#include "boot.h"
+#include "diagnostics/dlog.h"
 #include "firebase/firebase_auth.h"
 #include "firebase/firebase_config.h"
 #include "firebase/firebase_database.h"
 #include "firebase_sesame/firebase_ssm_cmd.h"
+#include "local_ctrl.h"
+#include "ota.h"
+#include "power.h"
+#include "radio_sched.h"
+#include "sesame/ssm_sched.h"
 #include "sesame/ssm_tasks.h"
+#include "time_sync.h"
 #include "wifi.h"
 
 // マクロ定義
 #define TAG "main.c"
-
-// Global変数
-static firebase_auth_info_t *auth_info;
-static bool ssm_connected = false;
+#define BOOT_REPORT_TIMEOUT_MS 60000
 
 static void ssm_action_handle(sesame *ssm) {
   ESP_LOGI(TAG, "[ssm_action_handle][ssm status: %s]",
            SSM_STATUS_STR(ssm->device_status));
 
-  if (ssm->device_status == SSM_UNLOCKED) {
-    firebase_ssm_update_current_status(auth_info, SSM_STATUS_UNLOCKED);
-  } else if (ssm->device_status == SSM_LOCKED) {
-    firebase_ssm_update_current_status(auth_info, SSM_STATUS_LOCKED);
-  } else if (ssm->device_status == SSM_LOGGIN) {
-    ssm_connected = true;
+  ssm_sched_on_status(ssm); // 実行中のコマンドの完了を確認する
+
+  // BLEのタスクなのでHTTPSは使わず、firebaseへの反映はタスクに任せる
+  uint8_t device_status = ssm->device_status;
+  app_events_post(APP_EVENT_SSM_STATUS_CHANGED, &device_status,
+                  sizeof(device_status));
+  if (device_status == SSM_LOGGIN) {
+    boot_mark(BOOT_PHASE_SSM_LOGIN);
   }
 }
 
@@ -40,29 +48,56 @@ void app_main(void) {
   }
   ESP_ERROR_CHECK(ret);
 
-  // wifiの初期化
-  wifi_init();
+  // ホットパス用の遅延ログを開始
+  dlog_init();
+  boot_init();
+  radio_sched_init();
+  ESP_ERROR_CHECK(app_events_init());
+  time_sync_init();
 
-  // sesame, espの初期化
+  // mutexの初期化(BLEのコールバックからHTTPSを使う可能性があるので先に作る)
+  firebase_https_mutex = xSemaphoreCreateMutex();
+
+  // wifiとBLEは互いに依存しないので同時に開始する
+  wifi_init();
+  power_init();
   ssm_init(ssm_action_handle);
+  ESP_ERROR_CHECK(ssm_sched_init());
+  ssm_set_transport(esp_ble_gatt_write, esp_ble_disconnect);
   esp_ble_init();
 
-  // ssmが接続するまで待機
-  while (!ssm_connected) {
-    ESP_LOGI(TAG, "Waiting for ssm connecting...");
-    vTaskDelay(pdMS_TO_TICKS(1000));
-  }
-
-  // mutexの初期化
-  firebase_https_mutex = xSemaphoreCreateMutex();
+  // IPを取得したらsesameのログインを待たずに認証する
+  boot_wait(BOOT_BIT(BOOT_PHASE_WIFI_UP), portMAX_DELAY);
 
   // init firebase_auth_info_t
-  auth_info = firebase_setup_auth(FIREBASE_EMAIL, FIREBASE_PASSWORD,
-                                  FIREBASE_API_KEY, FIREBASE_DB_URL_BASE, 5);
-
+  firebase_auth_info_t *auth_info =
+      firebase_setup_auth(FIREBASE_EMAIL, FIREBASE_PASSWORD, FIREBASE_API_KEY,
+                          FIREBASE_DB_URL_BASE, 5);
   if (!auth_info) {
-    ESP_LOGE(TAG, "firebase auth setup failed");
+    // 通信が戻った時にコマンドのタスクがサインインをやり直す
+    ESP_LOGE(TAG, "firebase auth setup failed, retry in command task");
+    auth_info = malloc(sizeof(firebase_auth_info_t));
+    ESP_ERROR_CHECK(auth_info ? ESP_OK : ESP_ERR_NO_MEM);
+    firebase_auth_info_init(auth_info, FIREBASE_EMAIL, FIREBASE_PASSWORD,
+                            FIREBASE_API_KEY, FIREBASE_DB_URL_BASE);
+  } else {
+    boot_mark(BOOT_PHASE_FIREBASE_AUTH);
   }
 
+  // コマンド実行時にログイン状態を確認するので、ここではログインを待たない
   start_sesame_tasks(auth_info);
+  // Firebaseの認証に失敗してもLANからは操作できるようにする
+  local_ctrl_start();
+  ota_start(auth_info);
+
+  if (boot_wait(BOOT_BITS_ALL, pdMS_TO_TICKS(BOOT_REPORT_TIMEOUT_MS)) !=
+      BOOT_BITS_ALL) {
+    ESP_LOGW(TAG, "boot did not complete within %d ms",
+             BOOT_REPORT_TIMEOUT_MS);
+  }
+  cJSON *report = boot_to_json();
+  char *json = report ? cJSON_PrintUnformatted(report) : NULL;
+  ESP_LOGI(TAG, "boot time(ms): %s", json ? json : "unknown");
+  free(json);
+  cJSON_Delete(report);
 }
@@ -0,0 +1,397 @@
+#include "ota.h"
+#include "cJSON.h"
+#include "esp_app_desc.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "firebase/firebase_common.h"
+#include "firebase_sesame/firebase_ssm_cmd.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include "metrics.h"
+#include "power.h"
+#include "radio_sched.h"
+#include "sdkconfig.h"
+#include "sesame/ssm_sched.h"
+#include "uECC.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OTA_CHUNK_SIZE 1024
+#define OTA_HTTP_TIMEOUT_MS 15000
+#define OTA_MAX_STALLS 8 // 1 byteも進まずに接続し直せる回数
+#define OTA_BACKOFF_MIN_MS 2000
+#define OTA_BACKOFF_MAX_MS 60000
+#define OTA_THROTTLE_POLL_MS 200
+#define OTA_RADIO_DEFER_MS 3000
+#define OTA_RESTART_WAIT_MS 30000 // 再起動の前にコマンドの完了を待つ最大時間
+#define OTA_VERSION_PARTS 4 // 比べるversionの数字の数(1.2.3.4まで)
+
+#define TAG "ota"
+
+#if CONFIG_SSM_OTA
+// 受信中の更新(接続し直しても同じものを使い続ける)
+typedef struct {
+  const firebase_ssm_ota_t *manifest;
+  const esp_partition_t *partition;
+  esp_ota_handle_t handle;
+  mbedtls_sha256_context sha;
+  uint32_t written; // 書き込んでハッシュに加えたバイト数
+} ota_session_t;
+
+static char chunk[OTA_CHUNK_SIZE];
+// 検証に失敗したversion(配布が差し替わるまで再試行しない)
+static char rejected_version[FIREBASE_SSM_OTA_VERSION_LEN];
+
+static void report(firebase_auth_info_t *auth_info, const char *state,
+                   const firebase_ssm_ota_t *manifest, esp_err_t err) {
+  cJSON *root = cJSON_CreateObject();
+  if (!root)
+    return;
+  cJSON_AddStringToObject(root, "state", state);
+  cJSON_AddStringToObject(root, "running", esp_app_get_description()->version);
+  cJSON_AddStringToObject(root, "version", manifest->version);
+  cJSON_AddNumberToObject(root, "size", manifest->size);
+  if (err != ESP_OK)
+    cJSON_AddStringToObject(root, "error", esp_err_to_name(err));
+
+  char *json = cJSON_PrintUnformatted(root);
+  cJSON_Delete(root);
+  if (!json)
+    return;
+  esp_err_t status = firebase_ssm_put_diagnostics(auth_info, "ota", json);
+  if (status != ESP_OK) {
+    ESP_LOGE(TAG, "firebase_ssm_put_diagnostics(ota) failed: %s",
+             esp_err_to_name(status));
+  }
+  free(json);
+}
+
+// big endianの値をuECC(uECC_VLI_NATIVE_LITTLE_ENDIAN)の語の並びへ変換する
+static void to_native(uint8_t *native, const uint8_t *big_endian, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    native[i] = big_endian[len - 1 - i];
+}
+
+static bool parse_public_key(uint8_t *out) {
+  const char *hex = CONFIG_SSM_OTA_PUBLIC_KEY;
+  if (strlen(hex) != 128)
+    return false;
+  for (int i = 0; i < 64; i++) {
+    unsigned int byte;
+    if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+      return false;
+    out[i] = (uint8_t)byte;
+  }
+  return true;
+}
+
+// "v1.2.3"や"1.2.3-4-gabcdef"(git describe)の先頭の数字を取り出す
+// 数字で始まらない場合はfalse
+static bool parse_version(const char *version, uint32_t *parts) {
+  memset(parts, 0, sizeof(uint32_t) * OTA_VERSION_PARTS);
+  const char *p = version;
+  if (*p == 'v')
+    p++;
+  if (*p < '0' || *p > '9')
+    return false;
+  for (int i = 0; i < OTA_VERSION_PARTS; i++) {
+    char *end;
+    parts[i] = strtoul(p, &end, 10);
+    if (*end != '.' || end[1] < '0' || end[1] > '9')
+      break;
+    p = end + 1;
+  }
+  return true;
+}
+
+// 古いversionへの更新(署名済みの古いイメージの再配布)を受け付けない
+static bool is_newer(const char *candidate, const char *running) {
+  uint32_t a[OTA_VERSION_PARTS], b[OTA_VERSION_PARTS];
+  if (!parse_version(candidate, a) || !parse_version(running, b))
+    return false;
+  for (int i = 0; i < OTA_VERSION_PARTS; i++) {
+    if (a[i] != b[i])
+      return a[i] > b[i];
+  }
+  return false;
+}
+
+// ECDSA(P-256)の署名を検証する
+// 署名の対象はSHA-256(イメージのSHA-256 || version)で、versionを
+// 書き換えて古いイメージを新しいものとして配布することはできない
+static bool verify_signature(const uint8_t *image_digest, const char *version,
+                             const uint8_t *signature) {
+  uint8_t digest[32];
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  mbedtls_sha256_update(&sha, image_digest, 32);
+  mbedtls_sha256_update(&sha, (const unsigned char *)version,
+                        strlen(version));
+  mbedtls_sha256_finish(&sha, digest);
+  mbedtls_sha256_free(&sha);
+
+  uint8_t public_key[64];
+  // uECCは語単位で読むので、4 bytes境界に置く
+  uint32_t native_key[16], native_sig[16], native_digest[8];
+  if (!parse_public_key(public_key)) {
+    ESP_LOGE(TAG, "CONFIG_SSM_OTA_PUBLIC_KEY is not set");
+    return false;
+  }
+  to_native((uint8_t *)native_key, public_key, 32);
+  to_native((uint8_t *)native_key + 32, public_key + 32, 32);
+  to_native((uint8_t *)native_sig, signature, 32);
+  to_native((uint8_t *)native_sig + 32, signature + 32, 32);
+  to_native((uint8_t *)native_digest, digest, 32);
+
+  uECC_Curve curve = uECC_secp256r1();
+  return uECC_valid_public_key((const uint8_t *)native_key, curve) &&
+         uECC_verify((const uint8_t *)native_key,
+                     (const uint8_t *)native_digest, 32,
+                     (const uint8_t *)native_sig, curve);
+}
+
+static esp_err_t session_begin(ota_session_t *session) {
+  session->written = 0;
+  mbedtls_sha256_init(&session->sha);
+  mbedtls_sha256_starts(&session->sha, 0);
+  // 書き込む位置の直前だけを消去するので、開始時に全体を消去して待たない
+  esp_err_t err = esp_ota_begin(session->partition, OTA_WITH_SEQUENTIAL_WRITES,
+                                &session->handle);
+  if (err != ESP_OK)
+    mbedtls_sha256_free(&session->sha);
+  return err;
+}
+
+static void session_abort(ota_session_t *session) {
+  esp_ota_abort(session->handle);
+  mbedtls_sha256_free(&session->sha);
+}
+
+// lock/unlockの処理中は読み出しを止める
+// (受信バッファが埋まるとTCPのウィンドウでサーバーからの送信も止まる)
+static void throttle(void) {
+  if (ssm_sched_is_busy()) {
+    metrics_counter_inc(METRIC_OTA_THROTTLED);
+    while (ssm_sched_is_busy())
+      vTaskDelay(pdMS_TO_TICKS(OTA_THROTTLE_POLL_MS));
+  }
+  radio_sched_wait_idle(pdMS_TO_TICKS(OTA_RADIO_DEFER_MS));
+}
+
+// 1回の接続で受け取れるところまで書き込む(続きはRangeで要求する)
+// 通信が途切れた場合はESP_FAIL、イメージが不正な場合はそれ以外を返す
+static esp_err_t fetch(ota_session_t *session) {
+  const firebase_ssm_ota_t *manifest = session->manifest;
+  esp_http_client_config_t config = {
+      .url = manifest->url,
+      .cert_pem = firebase_cert_pem_for_url(manifest->url),
+      .timeout_ms = OTA_HTTP_TIMEOUT_MS,
+      .buffer_size = OTA_CHUNK_SIZE,
+      .buffer_size_tx = 1024,
+  };
+  // 長時間の接続になるのでfirebase_https_mutexは保持しない(ストリームと同じ)
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  if (!client)
+    return ESP_ERR_NO_MEM;
+
+  if (session->written > 0) {
+    char range[32];
+    snprintf(range, sizeof(range), "bytes=%" PRIu32 "-", session->written);
+    esp_http_client_set_header(client, "Range", range);
+    metrics_counter_inc(METRIC_OTA_RESUMES);
+  }
+
+  power_lock_acquire(POWER_LOCK_HTTPS);
+  esp_err_t err = esp_http_client_open(client, 0);
+  int status_code = 0;
+  if (err == ESP_OK) {
+    esp_http_client_fetch_headers(client);
+    status_code = esp_http_client_get_status_code(client);
+  }
+  metrics_record_http(err, status_code);
+  if (err != ESP_OK) {
+    err = ESP_FAIL;
+    goto cleanup;
+  }
+
+  if (status_code == 200 && session->written > 0) {
+    // Rangeに対応していないサーバーは最初から送ってくるので書き直す
+    ESP_LOGW(TAG, "range not supported, restart from 0");
+    session_abort(session);
+    err = session_begin(session);
+    if (err != ESP_OK)
+      goto cleanup;
+  } else if (status_code != 200 && status_code != 206) {
+    ESP_LOGW(TAG, "download rejected: response_code = %d", status_code);
+    err = status_code >= 500 ? ESP_FAIL : ESP_ERR_INVALID_RESPONSE;
+    goto cleanup;
+  }
+
+  while (session->written < manifest->size) {
+    throttle();
+    int n = esp_http_client_read(client, chunk, sizeof(chunk));
+    if (n <= 0) {
+      // 最後まで受け取ったのに足りない場合は配布の内容が誤っている
+      err = n == 0 && esp_http_client_is_complete_data_received(client)
+                ? ESP_ERR_INVALID_SIZE
+                : ESP_FAIL;
+      break;
+    }
+    if (session->written + n > manifest->size) {
+      err = ESP_ERR_INVALID_SIZE;
+      break;
+    }
+    err = esp_ota_write(session->handle, chunk, n);
+    if (err != ESP_OK)
+      break;
+    mbedtls_sha256_update(&session->sha, (const unsigned char *)chunk, n);
+    session->written += n;
+  }
+
+cleanup:
+  power_lock_release(POWER_LOCK_HTTPS);
+  esp_http_client_close(client);
+  esp_http_client_cleanup(client);
+  return err;
+}
+
+// イメージを受け取って検証し、次回の起動先にする
+static esp_err_t download(firebase_auth_info_t *auth_info,
+                          const firebase_ssm_ota_t *manifest) {
+  ota_session_t session = {.manifest = manifest};
+  session.partition = esp_ota_get_next_update_partition(NULL);
+  if (!session.partition)
+    return ESP_ERR_NOT_FOUND;
+  if (manifest->size > session.partition->size)
+    return ESP_ERR_INVALID_SIZE;
+
+  esp_err_t err = session_begin(&session);
+  if (err != ESP_OK)
+    return err;
+  ESP_LOGI(TAG, "download %s (%" PRIu32 " bytes) to %s", manifest->version,
+           manifest->size, session.partition->label);
+  report(auth_info, "downloading", manifest, ESP_OK);
+
+  int stalls = 0;
+  uint32_t backoff_ms = OTA_BACKOFF_MIN_MS;
+  while (session.written < manifest->size) {
+    uint32_t before = session.written;
+    err = fetch(&session);
+    if (err != ESP_OK && err != ESP_FAIL)
+      break; // 接続し直しても直らない
+    if (session.written > before) {
+      stalls = 0;
+      backoff_ms = OTA_BACKOFF_MIN_MS;
+    } else if (++stalls > OTA_MAX_STALLS) {
+      break;
+    }
+    if (session.written < manifest->size) {
+      ESP_LOGW(TAG, "download interrupted at %" PRIu32 ", resume in %" PRIu32
+                    " ms", session.written, backoff_ms);
+      vTaskDelay(pdMS_TO_TICKS(backoff_ms));
+      backoff_ms = backoff_ms * 2 > OTA_BACKOFF_MAX_MS ? OTA_BACKOFF_MAX_MS
+                                                       : backoff_ms * 2;
+    }
+  }
+  if (session.written < manifest->size) {
+    session_abort(&session);
+    return err != ESP_OK ? err : ESP_FAIL;
+  }
+
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&session.sha, digest);
+  mbedtls_sha256_free(&session.sha);
+  if (!verify_signature(digest, manifest->version, manifest->signature)) {
+    ESP_LOGE(TAG, "signature verification failed");
+    esp_ota_abort(session.handle);
+    return ESP_ERR_INVALID_CRC;
+  }
+  // イメージのヘッダやチェックサムはesp_ota_endが確認する
+  err = esp_ota_end(session.handle);
+  if (err != ESP_OK)
+    return err;
+  // 署名したversionとイメージに埋め込まれたversionが一致すること
+  esp_app_desc_t desc;
+  err = esp_ota_get_partition_description(session.partition, &desc);
+  if (err != ESP_OK)
+    return err;
+  if (strcmp(desc.version, manifest->version) != 0) {
+    ESP_LOGE(TAG, "image version %s does not match %s", desc.version,
+             manifest->version);
+    return ESP_ERR_INVALID_VERSION;
+  }
+  return esp_ota_set_boot_partition(session.partition);
+}
+
+static void check_for_update(firebase_auth_info_t *auth_info) {
+  static firebase_ssm_ota_t manifest;
+  bool available = false;
+  esp_err_t err = firebase_ssm_get_ota(auth_info, &manifest, &available);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "firebase_ssm_get_ota failed: %s", esp_err_to_name(err));
+    return;
+  }
+  if (!available || strcmp(manifest.version, rejected_version) == 0)
+    return;
+  const char *running = esp_app_get_description()->version;
+  if (!is_newer(manifest.version, running)) {
+    if (strcmp(manifest.version, running) != 0) {
+      ESP_LOGW(TAG, "ignore %s: not newer than %s", manifest.version,
+               running);
+      strlcpy(rejected_version, manifest.version, sizeof(rejected_version));
+    }
+    return;
+  }
+
+  err = download(auth_info, &manifest);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "update to %s failed: %s", manifest.version,
+             esp_err_to_name(err));
+    // 通信の失敗は次の確認で最初からやり直す
+    if (err != ESP_FAIL)
+      strlcpy(rejected_version, manifest.version, sizeof(rejected_version));
+    report(auth_info, "failed", &manifest, err);
+    return;
+  }
+
+  ESP_LOGI(TAG, "update to %s ready, restart", manifest.version);
+  report(auth_info, "restarting", &manifest, ESP_OK);
+  // 実行中のlock/unlockを途中で止めない
+  for (int waited = 0; ssm_sched_is_busy() && waited < OTA_RESTART_WAIT_MS;
+       waited += OTA_THROTTLE_POLL_MS)
+    vTaskDelay(pdMS_TO_TICKS(OTA_THROTTLE_POLL_MS));
+  esp_restart();
+}
+
+// 配布中のversionを定期的に確認するタスク
+static void task_ota(void *pvParameters) {
+  firebase_auth_info_t *auth_info = (firebase_auth_info_t *)pvParameters;
+  while (1) {
+    check_for_update(auth_info);
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_SSM_OTA_CHECK_INTERVAL_MIN * 60 * 1000));
+  }
+}
+#endif
+
+void ota_start(firebase_auth_info_t *auth_info) {
+  // firebaseまで届いたので、更新後の初回起動であれば確定する
+  esp_ota_img_states_t state;
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  if (esp_ota_get_state_partition(running, &state) == ESP_OK &&
+      state == ESP_OTA_IMG_PENDING_VERIFY) {
+    ESP_LOGI(TAG, "mark %s valid", running->label);
+    esp_ota_mark_app_valid_cancel_rollback();
+  }
+
+#if CONFIG_SSM_OTA
+  TaskHandle_t task;
+  if (xTaskCreate(task_ota, "ota task", 8192, auth_info, 1, &task) == pdPASS)
+    metrics_register_task(task);
+#endif
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "firebase/firebase_internal.h"
+
+/*
+ * ファームウェアの更新(A/Bのota_0/ota_1パーティション)。
+ * sesami5pro/otaに配布中のversionが実行中と異なる場合、イメージを
+ * HTTPで受け取りながらesp_ota_writeで直接書き込む(全体を溜めない)。
+ * WiFiが切れた場合は書き込み済みの位置からRangeで再開し、
+ * SHA-256を逐次計算して最後にCONFIG_SSM_OTA_PUBLIC_KEYで署名を検証する。
+ * lock/unlockの処理中は読み出しを止める。
+ */
+
+/**
+ * @brief 起動したイメージを正常とし、更新の確認を行うタスクを開始する
+ * firebaseの認証後に呼ぶ(ロールバックが有効な場合、呼ばれないまま
+ * 再起動すると前のイメージに戻る)
+ * @param auth_info Firebase認証情報
+ */
+void ota_start(firebase_auth_info_t *auth_info);
@@ -0,0 +1,91 @@
+#include "power.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+#include <stdatomic.h>
+#if CONFIG_SSM_POWER_SAVE
+#include "esp_pm.h"
+#include "esp_wifi.h"
+#endif
+
+#define TAG "power"
+
+static const metric_counter_t held_ms_counters[POWER_LOCK_NUM] = {
+    [POWER_LOCK_BLE_CMD] = METRIC_PM_BLE_LOCK_MS,
+    [POWER_LOCK_HTTPS] = METRIC_PM_HTTPS_LOCK_MS,
+};
+
+// 保持数が0から1になった時刻(保持時間の計測用)
+static atomic_int_least32_t holders[POWER_LOCK_NUM];
+static atomic_uint_least32_t held_since_ms[POWER_LOCK_NUM];
+
+#if CONFIG_SSM_POWER_SAVE
+static esp_pm_lock_handle_t pm_locks[POWER_LOCK_NUM];
+static const char *lock_names[POWER_LOCK_NUM] = {
+    [POWER_LOCK_BLE_CMD] = "ssm_ble_cmd",
+    [POWER_LOCK_HTTPS] = "firebase_https",
+};
+#endif
+
+static uint32_t now_ms(void) { return (uint32_t)(esp_timer_get_time() / 1000); }
+
+void power_init(void) {
+#if CONFIG_SSM_POWER_SAVE
+  for (int i = 0; i < POWER_LOCK_NUM; i++) {
+    // 暗号処理と応答の組み立てを速く終わらせるため最大周波数で動かす
+    esp_err_t err =
+        esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, lock_names[i], &pm_locks[i]);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "esp_pm_lock_create(%s) failed: %s", lock_names[i],
+               esp_err_to_name(err));
+      pm_locks[i] = NULL;
+    }
+  }
+
+  esp_pm_config_t pm_config = {
+      .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+      .min_freq_mhz = CONFIG_XTAL_FREQ,
+      .light_sleep_enable = true,
+  };
+  esp_err_t err = esp_pm_configure(&pm_config);
+  if (err != ESP_OK) {
+    // CONFIG_PM_ENABLE/CONFIG_FREERTOS_USE_TICKLESS_IDLEが必要
+    ESP_LOGE(TAG, "esp_pm_configure failed: %s", esp_err_to_name(err));
+  }
+
+  // DTIMのlisten_interval(wifi.cで設定)ごとにだけ起きてビーコンを受信する
+  err = esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "esp_wifi_set_ps failed: %s", esp_err_to_name(err));
+  }
+  ESP_LOGI(TAG, "power save enabled (light sleep, listen interval %d)",
+           CONFIG_SSM_POWER_WIFI_LISTEN_INTERVAL);
+#endif
+}
+
+void power_lock_acquire(power_lock_t lock) {
+  if (lock >= POWER_LOCK_NUM)
+    return;
+
+#if CONFIG_SSM_POWER_SAVE
+  if (pm_locks[lock])
+    esp_pm_lock_acquire(pm_locks[lock]);
+#endif
+  if (atomic_fetch_add(&holders[lock], 1) == 0)
+    atomic_store(&held_since_ms[lock], now_ms());
+}
+
+void power_lock_release(power_lock_t lock) {
+  if (lock >= POWER_LOCK_NUM)
+    return;
+
+  if (atomic_fetch_sub(&holders[lock], 1) == 1) {
+    metrics_counter_add(held_ms_counters[lock],
+                        now_ms() - atomic_load(&held_since_ms[lock]));
+  }
+#if CONFIG_SSM_POWER_SAVE
+  if (pm_locks[lock])
+    esp_pm_lock_release(pm_locks[lock]);
+#endif
+}
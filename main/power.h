@@ -0,0 +1,31 @@
+#pragma once
+
+/*
+ * 省電力モード(CONFIG_SSM_POWER_SAVE)。
+ * 通常は自動light sleepとWiFiのmodem sleepで待機し、
+ * BLEのコマンドのやり取り中とHTTPSの通信中だけPMロックで起こしておく。
+ * 無効の場合、ロックの取得/解放は時間の計測だけを行う。
+ */
+
+typedef enum {
+  POWER_LOCK_BLE_CMD = 0, // talk_to_ssmから応答まで
+  POWER_LOCK_HTTPS,       // esp_http_client_performの間
+  POWER_LOCK_NUM,
+} power_lock_t;
+
+/**
+ * @brief esp_pmとWiFiの省電力設定を行う(wifi_initの後に呼ぶ)
+ */
+void power_init(void);
+
+/**
+ * @brief PMロックを取得する(クリティカルセクション内からも呼べる)
+ * @param lock ロックの種類
+ */
+void power_lock_acquire(power_lock_t lock);
+
+/**
+ * @brief PMロックを解放し、保持していた時間をメトリクスに加算する
+ * @param lock ロックの種類
+ */
+void power_lock_release(power_lock_t lock);
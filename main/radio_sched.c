@@ -0,0 +1,109 @@
+#include "radio_sched.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+#include "metrics.h"
+#include "power.h"
+#include "sdkconfig.h"
+#if CONFIG_SSM_RADIO_SCHED_COEX_PREFER
+#include "esp_coexist.h"
+#endif
+
+#define RADIO_SCHED_IDLE_BIT BIT0
+#define RADIO_SCHED_BLE_TIMEOUT_MS 3000 // 応答が来ない場合に待機を解除するまでの時間
+
+#define TAG "radio_sched"
+
+static EventGroupHandle_t radio_events = NULL;
+static esp_timer_handle_t failsafe_timer = NULL;
+static portMUX_TYPE busy_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool busy = false; // begin/endの呼び出し元のタスクが異なるのでbusy_muxで守る
+
+// 状態が変わった場合のみtrueを返す
+// PMロックの取得/解放が入れ替わらないよう、状態と同じ区間で行う
+static bool set_busy(bool value) {
+  taskENTER_CRITICAL(&busy_mux);
+  bool changed = busy != value;
+  if (changed) {
+    busy = value;
+    if (value) {
+      power_lock_acquire(POWER_LOCK_BLE_CMD); // やり取りの間はlight sleepしない
+    } else {
+      power_lock_release(POWER_LOCK_BLE_CMD);
+    }
+  }
+  taskEXIT_CRITICAL(&busy_mux);
+  return changed;
+}
+
+static void set_idle(void) {
+  if (!set_busy(false))
+    return;
+  xEventGroupSetBits(radio_events, RADIO_SCHED_IDLE_BIT);
+#if CONFIG_SSM_RADIO_SCHED_COEX_PREFER
+  esp_coex_preference_set(ESP_COEX_PREFER_BALANCE);
+#endif
+}
+
+static void failsafe_timer_cb(void *arg) {
+  ESP_LOGW(TAG, "no response within %d ms", RADIO_SCHED_BLE_TIMEOUT_MS);
+  set_idle();
+}
+
+void radio_sched_init(void) {
+  radio_events = xEventGroupCreate();
+  const esp_timer_create_args_t timer_args = {
+      .callback = failsafe_timer_cb,
+      .name = "radio_sched",
+  };
+  if (esp_timer_create(&timer_args, &failsafe_timer) != ESP_OK) {
+    ESP_LOGE(TAG, "failed to create failsafe timer");
+    failsafe_timer = NULL;
+  }
+  xEventGroupSetBits(radio_events, RADIO_SCHED_IDLE_BIT);
+}
+
+void radio_sched_ble_begin(void) {
+  if (!radio_events)
+    return;
+
+  if (set_busy(true)) {
+#if CONFIG_SSM_RADIO_SCHED_COEX_PREFER
+    // やり取りの間はBLEを優先する
+    esp_coex_preference_set(ESP_COEX_PREFER_BT);
+#endif
+    xEventGroupClearBits(radio_events, RADIO_SCHED_IDLE_BIT);
+  }
+  if (failsafe_timer) {
+    esp_timer_stop(failsafe_timer);
+    esp_timer_start_once(failsafe_timer,
+                         (uint64_t)RADIO_SCHED_BLE_TIMEOUT_MS * 1000);
+  }
+}
+
+void radio_sched_ble_end(void) {
+  if (!radio_events)
+    return;
+
+  if (failsafe_timer)
+    esp_timer_stop(failsafe_timer);
+  set_idle();
+}
+
+bool radio_sched_wait_idle(TickType_t timeout) {
+#if !CONFIG_SSM_RADIO_SCHED
+  return true;
+#else
+  if (!radio_events)
+    return true;
+  if (xEventGroupGetBits(radio_events) & RADIO_SCHED_IDLE_BIT)
+    return true;
+
+  int64_t start = esp_timer_get_time();
+  EventBits_t bits = xEventGroupWaitBits(radio_events, RADIO_SCHED_IDLE_BIT,
+                                         pdFALSE, pdTRUE, timeout);
+  metrics_counter_inc(METRIC_RADIO_DEFERRALS);
+  metrics_hist_observe(METRIC_HIST_RADIO_DEFER, esp_timer_get_time() - start);
+  return bits & RADIO_SCHED_IDLE_BIT;
+#endif
+}
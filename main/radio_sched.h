@@ -0,0 +1,34 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include <stdbool.h>
+
+/*
+ * WiFiとBLEは1つの無線を共有するので、sesameとのコマンドのやり取り中
+ * (talk_to_ssmから応答を受け取るまで)は急がないHTTPSを後回しにする。
+ */
+
+/**
+ * @brief スケジューラを初期化する
+ * CONFIG_SSM_RADIO_SCHEDが無効の場合もやり取り中かどうかの管理
+ * (PMロック)は行い、HTTPSを待たせることだけをしない
+ */
+void radio_sched_init(void);
+
+/**
+ * @brief BLEのコマンド送信開始を通知する(talk_to_ssmから呼ぶ)
+ * 応答が来ない場合もRADIO_SCHED_BLE_TIMEOUT_MSで自動的に終了する
+ */
+void radio_sched_ble_begin(void);
+
+/**
+ * @brief BLEのコマンドに対する応答の受信を通知する
+ */
+void radio_sched_ble_end(void);
+
+/**
+ * @brief BLEのやり取りが終わるまで待機する
+ * @param timeout 最大待ち時間(超えた場合はそのまま進める)
+ * @return 待たずに済んだ、または時間内に終わった場合はtrue
+ */
+bool radio_sched_wait_idle(TickType_t timeout);
@@ -1,7 +1,17 @@
 #include "ssm.h"
-#include "blecent.h"
 #include "c_ccm.h"
+#include "dlog.h"
+#include "esp_log.h"
+#include "app_events.h"
+#include "radio_sched.h"
 #include "ssm_cmd.h"
+#include "ssm_codec.h"
+#include "ssm_history.h"
+#include "ssm_mech.h"
+#include "ssm_session.h"
+#include "ssm_trace.h"
+#include "time_sync.h"
+#include <string.h>
 
 static const char * TAG = "ssm.c";
 
@@ -9,13 +19,15 @@ static uint8_t additional_data[] = { 0x00 };
 
 struct ssm_env_tag * p_ssms_env = NULL;
 
-static void ssm_initial_handle(sesame * ssm, uint8_t cmd_it_code) {
+static ssm_transport_write transport_write = NULL;
+static ssm_transport_disconnect transport_disconnect = NULL;
+
+static void ssm_initial_handle(sesame * ssm) { // get 4 bytes random_code
     ssm->cipher.encrypt.nouse = 0; // reset cipher
     ssm->cipher.decrypt.nouse = 0;
     memcpy(ssm->cipher.encrypt.random_code, ssm->b_buf, 4);
     memcpy(ssm->cipher.decrypt.random_code, ssm->b_buf, 4);
-    ssm->cipher.encrypt.count = 0;
-    ssm->cipher.decrypt.count = 0;
+    ssm_session_reset(ssm); // カウンタを0に戻す
 
     if (p_ssms_env->ssm.device_secret[0] == 0) {
         ESP_LOGI(TAG, "[ssm][no device_secret]");
@@ -25,87 +37,149 @@ static void ssm_initial_handle(sesame * ssm, uint8_t cmd_it_code) {
     send_login_cmd_to_ssm(ssm);
 }
 
-static void ssm_parse_publish(sesame * ssm, uint8_t cmd_it_code) {
-    switch (cmd_it_code) {
-    case SSM_ITEM_CODE_INITIAL: // get 4 bytes random_code
-        ssm_initial_handle(ssm, cmd_it_code);
-        break;
-    case SSM_ITEM_CODE_MECH_STATUS:
-        memcpy((void *) &(ssm->mech_status), ssm->b_buf, 7);
-        device_status_t lockStatus = ssm->mech_status.is_lock_range ? SSM_LOCKED : (ssm->mech_status.is_unlock_range ? SSM_UNLOCKED : SSM_MOVED);
-        if (ssm->device_status != lockStatus) {
-            ssm->device_status = lockStatus;
-            p_ssms_env->ssm_cb__(ssm); // callback: ssm_action_handle
-        }
-        break;
-    default:
-        break;
+static void ssm_mech_status_handle(sesame * ssm) {
+    ssm_trace_stamp(SSM_TRACE_MECH_STATUS);
+    memcpy((void *) &(ssm->mech_status), ssm->b_buf, sizeof(mech_status_t));
+    device_status_t lockStatus = ssm->mech_status.is_lock_range ? SSM_LOCKED : (ssm->mech_status.is_unlock_range ? SSM_UNLOCKED : SSM_MOVED);
+    if (ssm->device_status != lockStatus) {
+        ssm->device_status = lockStatus;
+        p_ssms_env->ssm_cb__(ssm); // callback: ssm_action_handle
     }
+    ssm_mech_on_status(&ssm->mech_status);
+    app_events_post(APP_EVENT_SSM_MECH_STATUS, &ssm->mech_status, sizeof(mech_status_t));
 }
 
-static void ssm_parse_response(sesame * ssm, uint8_t cmd_it_code) {
-    ssm->c_offset = ssm->c_offset - 1;
-    memcpy(ssm->b_buf, ssm->b_buf + 1, ssm->c_offset);
-    switch (cmd_it_code) {
-    case SSM_ITEM_CODE_REGISTRATION:
-        handle_reg_data_from_ssm(ssm);
-        break;
-    case SSM_ITEM_CODE_LOGIN:
-        ESP_LOGI(TAG, "[%d][ssm][login][ok]", ssm->conn_id);
-        ssm->device_status = SSM_LOGGIN;
-        p_ssms_env->ssm_cb__(ssm); // callback: ssm_action_handle
-        break;
-    case SSM_ITEM_CODE_HISTORY:
-        ESP_LOGI(TAG, "[%d][ssm][hisdataLength: %d]", ssm->conn_id, ssm->c_offset);
-        if (ssm->c_offset == 0) { //循環讀取 避免沒取完歷史
-            return;
-        }
+static void ssm_mech_setting_handle(sesame * ssm) {
+    mech_setting_t setting;
+    memcpy(&setting, ssm->b_buf, sizeof(setting));
+    ESP_LOGI(TAG, "[%d][ssm][mech setting][lock: %d][unlock: %d]", ssm->conn_id, setting.lock_position, setting.unlock_position);
+    ssm_mech_on_setting(&setting);
+}
+
+static void ssm_login_handle(sesame * ssm) {
+    ESP_LOGI(TAG, "[%d][ssm][login][ok]", ssm->conn_id);
+    if (ssm->c_offset >= 4) { // 先頭4bytesはsesameの時刻(unix time, little endian)
+        uint32_t lock_time;
+        memcpy(&lock_time, ssm->b_buf, sizeof(lock_time));
+        time_sync_observe_lock_time(lock_time);
+    }
+    ssm_session_on_login(ssm);
+    ssm->device_status = SSM_LOGGIN;
+    p_ssms_env->ssm_cb__(ssm); // callback: ssm_action_handle
+}
+
+static void ssm_history_handle(sesame * ssm) {
+    ESP_LOGD(TAG, "[%d][ssm][hisdataLength: %d]", ssm->conn_id, ssm->c_offset);
+    if (ssm_history_on_response(ssm->b_buf, ssm->c_offset)) { //循環讀取 避免沒取完歷史
         send_read_history_cmd_to_ssm(ssm);
-        break;
-    default:
-        break;
     }
 }
 
+// 書き込み系のコマンドの応答(TIME, MECH_SETTING)
+static void ssm_write_ack_handle(sesame * ssm) {
+    ESP_LOGI(TAG, "[%d][ssm][write][ok]", ssm->conn_id);
+}
+
+typedef struct {
+    void (*handle)(sesame * ssm);
+    uint8_t min_len; // ハンドラが読むb_bufの最小長
+} ssm_item_route;
+
+// item codeで直接引く. 未登録のitem codeはhandleがNULL
+static const ssm_item_route publish_routes[SSM_ITEM_CODE_TABLE_SIZE] = {
+    [SSM_ITEM_CODE_INITIAL] = { ssm_initial_handle, 4 },
+    [SSM_ITEM_CODE_MECH_SETTING] = { ssm_mech_setting_handle, sizeof(mech_setting_t) },
+    [SSM_ITEM_CODE_MECH_STATUS] = { ssm_mech_status_handle, sizeof(mech_status_t) },
+};
+
+// responseのb_bufは結果コードを除いた後の内容
+static const ssm_item_route response_routes[SSM_ITEM_CODE_TABLE_SIZE] = {
+    [SSM_ITEM_CODE_REGISTRATION] = { handle_reg_data_from_ssm, 13 + 64 },
+    [SSM_ITEM_CODE_LOGIN] = { ssm_login_handle, 0 },
+    [SSM_ITEM_CODE_HISTORY] = { ssm_history_handle, 0 },
+    [SSM_ITEM_CODE_TIME] = { ssm_write_ack_handle, 0 },
+    [SSM_ITEM_CODE_MECH_SETTING] = { ssm_write_ack_handle, 0 }, // 新しい角度はpublishで届く
+};
+
+static void ssm_dispatch(sesame * ssm, const ssm_item_route * routes, uint8_t cmd_it_code) {
+    if (cmd_it_code >= SSM_ITEM_CODE_TABLE_SIZE || routes[cmd_it_code].handle == NULL) {
+        return;
+    }
+    if (ssm->c_offset < routes[cmd_it_code].min_len) {
+        ESP_LOGW(TAG, "[%d][ssm][%s][short payload: %d]", ssm->conn_id, ssm_item_code_name(cmd_it_code), ssm->c_offset);
+        return;
+    }
+    routes[cmd_it_code].handle(ssm);
+}
+
 void ssm_ble_receiver(sesame * ssm, const uint8_t * p_data, uint16_t len) {
+    if (len == 0) {
+        return;
+    }
     if (p_data[0] & 1u) {
         ssm->c_offset = 0;
     }
+    if (ssm->c_offset + len - 1 > sizeof(ssm->b_buf)) {
+        ESP_LOGE(TAG, "[%d][ssm][segment overflow]", ssm->conn_id);
+        ssm->c_offset = 0;
+        return;
+    }
     memcpy(&ssm->b_buf[ssm->c_offset], p_data + 1, len - 1);
     ssm->c_offset += len - 1;
     if (p_data[0] >> 1u == SSM_SEG_PARSING_TYPE_APPEND_ONLY) {
         return;
     }
+    if (ssm->c_offset < 2 + (p_data[0] >> 1u == SSM_SEG_PARSING_TYPE_CIPHERTEXT ? CCM_TAG_LENGTH : 0)) {
+        ssm->c_offset = 0; // op code/item codeが読めない
+        return;
+    }
     if (p_data[0] >> 1u == SSM_SEG_PARSING_TYPE_CIPHERTEXT) {
         ssm->c_offset = ssm->c_offset - CCM_TAG_LENGTH;
-        aes_ccm_auth_decrypt(ssm->cipher.token, (const unsigned char *) &ssm->cipher.decrypt, 13, additional_data, 1, ssm->b_buf, ssm->c_offset, ssm->b_buf, ssm->b_buf + ssm->c_offset, CCM_TAG_LENGTH);
-        ssm->cipher.decrypt.count++;
+        if (!ssm_session_decrypt(ssm, ssm->b_buf, ssm->c_offset)) {
+            ESP_LOGW(TAG, "[%d][ssm][auth failed]", ssm->conn_id);
+            ssm->c_offset = 0; // 復号できない内容は処理しない
+            return;
+        }
     }
 
     uint8_t cmd_op_code = ssm->b_buf[0];
     uint8_t cmd_it_code = ssm->b_buf[1];
     ssm->c_offset = ssm->c_offset - 2;
-    memcpy(ssm->b_buf, ssm->b_buf + 2, ssm->c_offset);
-    ESP_LOGI(TAG, "[ssm][say][%d][%s][%s]", ssm->conn_id, SSM_OP_CODE_STR(cmd_op_code), SSM_ITEM_CODE_STR(cmd_it_code));
+    memmove(ssm->b_buf, ssm->b_buf + 2, ssm->c_offset);
+    dlog_write(DLOG_FMT_SSM_RX, ssm->conn_id, cmd_op_code, cmd_it_code);
     if (cmd_op_code == SSM_OP_CODE_PUBLISH) {
-        ssm_parse_publish(ssm, cmd_it_code);
+        if (cmd_it_code == SSM_ITEM_CODE_MECH_STATUS) {
+            radio_sched_ble_end();
+        }
+        ssm_dispatch(ssm, publish_routes, cmd_it_code);
     } else if (cmd_op_code == SSM_OP_CODE_RESPONSE) {
-        ssm_parse_response(ssm, cmd_it_code);
+        radio_sched_ble_end(); // コールバック内のHTTPSを待たせないよう先に解除
+        if (ssm->c_offset == 0) {
+            return;
+        }
+        ssm->c_offset = ssm->c_offset - 1; // 結果コードを除く
+        memmove(ssm->b_buf, ssm->b_buf + 1, ssm->c_offset);
+        ssm_dispatch(ssm, response_routes, cmd_it_code);
     }
     ssm->c_offset = 0;
 }
 
-void talk_to_ssm(sesame * ssm, uint8_t parsing_type) {
-    ESP_LOGI(TAG, "[esp32][say][%d][%s]", ssm->conn_id, SSM_ITEM_CODE_STR(ssm->b_buf[0]));
+void talk_to_ssm(sesame * ssm, uint8_t parsing_type, uint8_t * buf, uint16_t len) {
+    // 2つのメッセージのセグメントが混ざるとsesameは組み立てられず、
+    // encrypt.countもずれるので、暗号化から最後のセグメントまでを排他する
+    if (ssm->tx_mutex) {
+        xSemaphoreTake(ssm->tx_mutex, portMAX_DELAY);
+    }
+    radio_sched_ble_begin();
+    dlog_write(DLOG_FMT_SSM_TX, ssm->conn_id, buf[0], 0);
     if (parsing_type == SSM_SEG_PARSING_TYPE_CIPHERTEXT) {
-        aes_ccm_encrypt_and_tag(ssm->cipher.token, (const unsigned char *) &ssm->cipher.encrypt, 13, additional_data, 1, ssm->b_buf, ssm->c_offset, ssm->b_buf, ssm->b_buf + ssm->c_offset, CCM_TAG_LENGTH);
+        aes_ccm_encrypt_and_tag(ssm->cipher.token, (const unsigned char *) &ssm->cipher.encrypt, 13, additional_data, 1, buf, len, buf, buf + len, CCM_TAG_LENGTH);
         ssm->cipher.encrypt.count++;
-        ssm->c_offset = ssm->c_offset + CCM_TAG_LENGTH;
+        len = len + CCM_TAG_LENGTH;
     }
 
-    uint8_t * data = ssm->b_buf;
-    uint16_t remain = ssm->c_offset;
-    uint16_t len = remain;
+    uint8_t * data = buf;
+    uint16_t remain = len;
     uint8_t tmp_v[20] = { 0 };
     uint16_t len_l;
 
@@ -121,16 +195,40 @@ void talk_to_ssm(sesame * ssm, uint8_t parsing_type) {
             tmp_v[0] |= 1u;
         }
         memcpy(&tmp_v[1], data, len_l - 1);
-        esp_ble_gatt_write(ssm, tmp_v, len_l);
+        if (transport_write == NULL || transport_write(ssm, tmp_v, len_l) != 0) {
+            ESP_LOGE(TAG, "[talk_to_ssm][write failed]");
+            // sesameは組み立てられないメッセージを復号しないので、カウンタを戻して揃える
+            if (parsing_type == SSM_SEG_PARSING_TYPE_CIPHERTEXT) {
+                ssm->cipher.encrypt.count--;
+            }
+            break; // 残りのセグメントを送っても組み立てられないので中断
+        }
         remain -= (len_l - 1);
         data += (len_l - 1);
     }
+    if (ssm->tx_mutex) {
+        xSemaphoreGive(ssm->tx_mutex);
+    }
+    if (remain == 0) {
+        ssm_trace_stamp(SSM_TRACE_WRITTEN);
+    }
 }
 
 void ssm_mem_deinit(void) {
     free(p_ssms_env);
 }
 
+void ssm_set_transport(ssm_transport_write write_cb, ssm_transport_disconnect disconnect_cb) {
+    transport_write = write_cb;
+    transport_disconnect = disconnect_cb;
+}
+
+void ssm_disconnect(sesame * ssm) {
+    if (transport_disconnect == NULL || transport_disconnect(ssm) != 0) {
+        ESP_LOGE(TAG, "[%d][ssm_disconnect][failed]", ssm->conn_id);
+    }
+}
+
 void ssm_init(ssm_action ssm_action_cb) {
     p_ssms_env = (struct ssm_env_tag *) calloc(1, sizeof(struct ssm_env_tag));
     if (p_ssms_env == NULL) {
@@ -139,5 +237,9 @@ void ssm_init(ssm_action ssm_action_cb) {
     p_ssms_env->ssm_cb__ = ssm_action_cb; // callback: ssm_action_handle
     p_ssms_env->ssm.conn_id = 0xFF;       // 0xFF: not connected
     p_ssms_env->ssm.device_status = SSM_NOUSE;
+    p_ssms_env->ssm.tx_mutex = xSemaphoreCreateMutex();
+    if (p_ssms_env->ssm.tx_mutex == NULL) {
+        ESP_LOGE(TAG, "[ssm_init][tx mutex][FAIL]");
+    }
     ESP_LOGI(TAG, "[ssm_init][SUCCESS]");
 }
@@ -2,6 +2,8 @@
 #define __SSM_H__
 
 #include "candy.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -39,6 +41,17 @@ typedef struct mech_status_s {
     uint8_t is_clockwise : 1;     // 馬達轉動方向
 } mech_status_t;                  // total 7 bytes
 
+typedef struct mech_setting_s {
+    int16_t lock_position;   // 施錠と判定する角度
+    int16_t unlock_position; // 開錠と判定する角度
+} mech_setting_t;            // total 4 bytes
+
+typedef struct {
+    uint8_t state;   // ssm_session_state_t
+    uint8_t fails;   // 続けて復号に失敗した回数
+    int64_t fail_us; // 復旧していない最初の失敗の時刻(0は失敗なし)
+} ssm_session_t;
+
 typedef struct {
     uint8_t device_uuid[16];
     uint8_t public_key[64];
@@ -46,14 +59,25 @@ typedef struct {
     uint8_t addr[6];
     volatile uint8_t device_status;
     SesameBleCipher cipher;
+    ssm_session_t session;
     mech_status_t mech_status;
     uint16_t c_offset;
-    uint8_t b_buf[80]; /// max command size is register(80 Bytes).
+    uint8_t b_buf[80]; /// max command size is register(80 Bytes). 受信の組み立て専用
     uint8_t conn_id;
+    // 送信(暗号化から最後のセグメントの書き込みまで)の排他
+    // コマンド、スケジューラ、LANの受付の各タスクとBLEのコールバックから送る
+    SemaphoreHandle_t tx_mutex;
 } sesame;
 
 typedef void (*ssm_action)(sesame * ssm);
 
+// 1セグメント(最大20bytes)を書き込むトランスポート. 成功時は0を返す
+// 実機ではblecentのGATT write、ホスト上のテストでは偽のトランスポートを登録する
+typedef int (*ssm_transport_write)(sesame * ssm, const uint8_t * value, uint16_t length);
+
+// 接続を切る. 再接続とINITIALからやり直すのに使う
+typedef int (*ssm_transport_disconnect)(sesame * ssm);
+
 struct ssm_env_tag {
     sesame ssm;
     ssm_action ssm_cb__;
@@ -65,12 +89,17 @@ extern struct ssm_env_tag * p_ssms_env;
 
 void ssm_ble_receiver(sesame * ssm, const uint8_t * p_data, uint16_t len);
 
-void talk_to_ssm(sesame * ssm, uint8_t parsing_type);
+// bufは暗号化する場合、lenの後ろにCCM_TAG_LENGTHの空きが必要
+void talk_to_ssm(sesame * ssm, uint8_t parsing_type, uint8_t * buf, uint16_t len);
 
 void ssm_mem_deinit(void);
 
 void ssm_init(ssm_action ssm_action_cb);
 
+void ssm_set_transport(ssm_transport_write write_cb, ssm_transport_disconnect disconnect_cb);
+
+void ssm_disconnect(sesame * ssm);
+
 #ifdef __cplusplus
 }
 #endif
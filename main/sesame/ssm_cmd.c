@@ -2,7 +2,10 @@
 #include "aes-cbc-cmac.h"
 #include "esp_log.h"
 #include "esp_random.h"
+#include "ssm_codec.h"
+#include "ssm_trace.h"
 #include "uECC.h"
+#include <inttypes.h>
 #include <string.h>
 
 static const char *TAG = "ssm_cmd.c";
@@ -18,12 +21,9 @@ static int crypto_backend_micro_ecc_rng_callback(uint8_t *dest, unsigned size) {
 void send_reg_cmd_to_ssm(sesame *ssm) {
   ESP_LOGW(TAG, "[esp32->ssm][register]");
   uECC_set_rng(crypto_backend_micro_ecc_rng_callback);
-  uint8_t ecc_public_esp32[64];
-  uECC_make_key_lit(ecc_public_esp32, ecc_private_esp32, uECC_secp256r1());
-  ssm->c_offset = sizeof(ecc_public_esp32) + 1;
-  ssm->b_buf[0] = SSM_ITEM_CODE_REGISTRATION;
-  memcpy(ssm->b_buf + 1, ecc_public_esp32, sizeof(ecc_public_esp32));
-  talk_to_ssm(ssm, SSM_SEG_PARSING_TYPE_PLAINTEXT);
+  ssm_reg_req_t req;
+  uECC_make_key_lit(req.public_key, ecc_private_esp32, uECC_secp256r1());
+  ssm_send(ssm, SSM_ITEM_CODE_REGISTRATION, &req, sizeof(req));
 }
 
 void handle_reg_data_from_ssm(sesame *ssm) {
@@ -43,53 +43,55 @@ void handle_reg_data_from_ssm(sesame *ssm) {
 
 void send_login_cmd_to_ssm(sesame *ssm) {
   ESP_LOGW(TAG, "[esp32->ssm][login]");
-  ssm->b_buf[0] = SSM_ITEM_CODE_LOGIN;
   AES_CMAC(ssm->device_secret,
            (const unsigned char *)ssm->cipher.decrypt.random_code, 4,
            ssm->cipher.token);
-  memcpy(&ssm->b_buf[1], ssm->cipher.token, 4);
-  ssm->c_offset = 5;
-  talk_to_ssm(ssm, SSM_SEG_PARSING_TYPE_PLAINTEXT);
+  ssm_login_req_t req;
+  memcpy(req.token, ssm->cipher.token, sizeof(req.token));
+  ssm_send(ssm, SSM_ITEM_CODE_LOGIN, &req, sizeof(req));
 }
 
 void send_read_history_cmd_to_ssm(sesame *ssm) {
   ESP_LOGI(TAG, "[send_read_history_cmd_to_ssm]");
-  ssm->c_offset = 2;
-  ssm->b_buf[0] = SSM_ITEM_CODE_HISTORY;
-  ssm->b_buf[1] = 1;
-  talk_to_ssm(ssm, SSM_SEG_PARSING_TYPE_CIPHERTEXT);
+  ssm_history_req_t req = {.count = 1};
+  ssm_send(ssm, SSM_ITEM_CODE_HISTORY, &req, sizeof(req));
 }
 
-void ssm_lock(uint8_t *tag, uint8_t tag_length) {
-  // ESP_LOGI(TAG, "[ssm][ssm_lock][%s]",
-  // SSM_STATUS_STR(p_ssms_env->ssm.device_status));
-  sesame *ssm = &p_ssms_env->ssm;
-  if (ssm->device_status >= SSM_LOGGIN) {
-    if (tag_length == 0) {
-      tag = tag_esp32;
-      tag_length = sizeof(tag_esp32);
-    }
-    ssm->b_buf[0] = SSM_ITEM_CODE_LOCK;
-    ssm->b_buf[1] = tag_length;
-    ssm->c_offset = tag_length + 2;
-    memcpy(ssm->b_buf + 2, tag, tag_length);
-    talk_to_ssm(ssm, SSM_SEG_PARSING_TYPE_CIPHERTEXT);
-  }
+void send_time_cmd_to_ssm(sesame *ssm, uint32_t unix_time) {
+  ESP_LOGI(TAG, "[esp32->ssm][time: %" PRIu32 "]", unix_time);
+  ssm_time_req_t req = {.unix_time = unix_time}; // ESP32はlittle endian
+  ssm_send(ssm, SSM_ITEM_CODE_TIME, &req, sizeof(req));
+}
+
+void send_mech_setting_cmd_to_ssm(sesame *ssm, const mech_setting_t *setting) {
+  ESP_LOGI(TAG, "[esp32->ssm][mech setting: lock %d, unlock %d]",
+           setting->lock_position, setting->unlock_position);
+  ssm_send(ssm, SSM_ITEM_CODE_MECH_SETTING, setting, sizeof(*setting));
 }
 
-void ssm_unlock(uint8_t *tag, uint8_t tag_length) {
-  // ESP_LOGI(TAG, "[ssm][ssm_lock][%s]",
-  // SSM_STATUS_STR(p_ssms_env->ssm.device_status));
-  sesame *ssm = &p_ssms_env->ssm;
-  if (ssm->device_status >= SSM_LOGGIN) {
-    if (tag_length == 0) {
-      tag = tag_esp32;
-      tag_length = sizeof(tag_esp32);
-    }
-    ssm->b_buf[0] = SSM_ITEM_CODE_UNLOCK;
-    ssm->b_buf[1] = tag_length;
-    ssm->c_offset = tag_length + 2;
-    memcpy(ssm->b_buf + 2, tag, tag_length);
-    talk_to_ssm(ssm, SSM_SEG_PARSING_TYPE_CIPHERTEXT);
+// lock/unlockはitem code以外同じ形式
+static void send_lock_cmd(sesame *ssm, uint8_t item_code, uint8_t *tag,
+                          uint8_t tag_length) {
+  if (ssm->device_status < SSM_LOGGIN)
+    return;
+
+  if (tag_length == 0) {
+    tag = tag_esp32;
+    tag_length = sizeof(tag_esp32);
   }
+  if (tag_length > SSM_HISTORY_TAG_MAX_LEN)
+    tag_length = SSM_HISTORY_TAG_MAX_LEN;
+
+  ssm_lock_req_t req = {.tag_len = tag_length};
+  memcpy(req.tag, tag, tag_length);
+  ssm_trace_stamp(SSM_TRACE_DISPATCHED);
+  ssm_send(ssm, item_code, &req, 1 + tag_length);
+}
+
+void ssm_lock(sesame *ssm, uint8_t *tag, uint8_t tag_length) {
+  send_lock_cmd(ssm, SSM_ITEM_CODE_LOCK, tag, tag_length);
+}
+
+void ssm_unlock(sesame *ssm, uint8_t *tag, uint8_t tag_length) {
+  send_lock_cmd(ssm, SSM_ITEM_CODE_UNLOCK, tag, tag_length);
 }
@@ -15,9 +15,13 @@ void send_login_cmd_to_ssm(sesame *ssm);
 
 void send_read_history_cmd_to_ssm(sesame *ssm);
 
-void ssm_lock(uint8_t *tag, uint8_t tag_length);
+void send_time_cmd_to_ssm(sesame *ssm, uint32_t unix_time);
 
-void ssm_unlock(uint8_t *tag, uint8_t tag_length);
+void send_mech_setting_cmd_to_ssm(sesame *ssm, const mech_setting_t *setting);
+
+void ssm_lock(sesame *ssm, uint8_t *tag, uint8_t tag_length);
+
+void ssm_unlock(sesame *ssm, uint8_t *tag, uint8_t tag_length);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,127 @@
+#include "ssm_codec.h"
+#include "esp_log.h"
+#include <string.h>
+
+#define TAG "ssm_codec"
+
+// 送信しないitem(受信専用)はparsing_typeを0にする
+#define SSM_ITEM(code, type, min, max)                                         \
+  [code] = {.name = #code, .parsing_type = (type), .payload_min = (min),       \
+            .payload_max = (max)}
+
+// 組み立てたコマンドがb_bufに収まることをコンパイル時に確認する
+#define SSM_B_BUF_SIZE sizeof(((sesame *)0)->b_buf)
+#define SSM_ASSERT_FITS(max, type)                                             \
+  _Static_assert(1 + (max) + ((type) == SSM_SEG_PARSING_TYPE_CIPHERTEXT        \
+                                  ? CCM_TAG_LENGTH                             \
+                                  : 0) <=                                      \
+                     SSM_B_BUF_SIZE,                                           \
+                 "command does not fit in sesame.b_buf")
+
+_Static_assert(sizeof(ssm_reg_req_t) == 64, "registration payload");
+_Static_assert(sizeof(ssm_login_req_t) == 4, "login payload");
+_Static_assert(sizeof(ssm_history_req_t) == 1, "history payload");
+_Static_assert(sizeof(ssm_lock_req_t) == 1 + SSM_HISTORY_TAG_MAX_LEN,
+               "lock payload");
+_Static_assert(sizeof(ssm_time_req_t) == 4, "time payload");
+_Static_assert(sizeof(mech_status_t) == 7, "mech status");
+_Static_assert(sizeof(mech_setting_t) == 4, "mech setting");
+SSM_ASSERT_FITS(sizeof(ssm_reg_req_t), SSM_SEG_PARSING_TYPE_PLAINTEXT);
+SSM_ASSERT_FITS(sizeof(ssm_lock_req_t), SSM_SEG_PARSING_TYPE_CIPHERTEXT);
+
+static const ssm_item_desc_t item_descs[SSM_ITEM_CODE_TABLE_SIZE] = {
+    SSM_ITEM(SSM_ITEM_CODE_NONE, 0, 0, 0),
+    SSM_ITEM(SSM_ITEM_CODE_REGISTRATION, SSM_SEG_PARSING_TYPE_PLAINTEXT,
+             sizeof(ssm_reg_req_t), sizeof(ssm_reg_req_t)),
+    SSM_ITEM(SSM_ITEM_CODE_LOGIN, SSM_SEG_PARSING_TYPE_PLAINTEXT,
+             sizeof(ssm_login_req_t), sizeof(ssm_login_req_t)),
+    SSM_ITEM(SSM_ITEM_CODE_USER, 0, 0, 0),
+    SSM_ITEM(SSM_ITEM_CODE_HISTORY, SSM_SEG_PARSING_TYPE_CIPHERTEXT,
+             sizeof(ssm_history_req_t), sizeof(ssm_history_req_t)),
+    SSM_ITEM(SSM_ITEM_CODE_VERSION_DETAIL, SSM_SEG_PARSING_TYPE_CIPHERTEXT, 0,
+             0),
+    SSM_ITEM(SSM_ITEM_CODE_DISCONNECT_REBOOT_NOW,
+             SSM_SEG_PARSING_TYPE_CIPHERTEXT, 0, 0),
+    SSM_ITEM(SSM_ITEM_CODE_ENABLE_DFU, 0, 0, 0),
+    SSM_ITEM(SSM_ITEM_CODE_TIME, SSM_SEG_PARSING_TYPE_CIPHERTEXT,
+             sizeof(ssm_time_req_t), sizeof(ssm_time_req_t)),
+    SSM_ITEM(SSM_ITEM_CODE_INITIAL, 0, 0, 0),
+    SSM_ITEM(SSM_ITEM_CODE_MAGNET, 0, 0, 0),
+    SSM_ITEM(SSM_ITEM_CODE_MECH_SETTING, SSM_SEG_PARSING_TYPE_CIPHERTEXT,
+             sizeof(mech_setting_t), sizeof(mech_setting_t)),
+    SSM_ITEM(SSM_ITEM_CODE_MECH_STATUS, 0, 0, 0),
+    SSM_ITEM(SSM_ITEM_CODE_LOCK, SSM_SEG_PARSING_TYPE_CIPHERTEXT, 1,
+             sizeof(ssm_lock_req_t)),
+    SSM_ITEM(SSM_ITEM_CODE_UNLOCK, SSM_SEG_PARSING_TYPE_CIPHERTEXT, 1,
+             sizeof(ssm_lock_req_t)),
+    SSM_ITEM(SSM2_ITEM_OPS_TIMER_SETTING, 0, 0, 0),
+};
+
+const ssm_item_desc_t *ssm_item_desc(uint8_t item_code) {
+  if (item_code >= SSM_ITEM_CODE_TABLE_SIZE || !item_descs[item_code].name)
+    return NULL;
+  return &item_descs[item_code];
+}
+
+const char *ssm_item_code_name(uint8_t item_code) {
+  const ssm_item_desc_t *desc = ssm_item_desc(item_code);
+  return desc ? desc->name : "UNKNOWN_ITEM_CODE";
+}
+
+size_t ssm_encode(uint8_t item_code, const void *payload, size_t payload_len,
+                  uint8_t *out, size_t out_size) {
+  const ssm_item_desc_t *desc = ssm_item_desc(item_code);
+  if (!desc || desc->parsing_type == 0 || !out)
+    return 0;
+  if (payload_len < desc->payload_min || payload_len > desc->payload_max ||
+      (payload_len > 0 && !payload))
+    return 0;
+
+  size_t need = 1 + payload_len;
+  if (desc->parsing_type == SSM_SEG_PARSING_TYPE_CIPHERTEXT)
+    need += CCM_TAG_LENGTH; // talk_to_ssmが後ろにタグを付ける
+  if (need > out_size)
+    return 0;
+
+  out[0] = item_code;
+  if (payload_len > 0)
+    memcpy(out + 1, payload, payload_len);
+  return 1 + payload_len;
+}
+
+bool ssm_decode_history(const uint8_t *buf, size_t len,
+                        ssm_history_record_t *out) {
+  if (!buf || !out || len < SSM_HISTORY_RESP_MIN_LEN)
+    return false;
+
+  memset(out, 0, sizeof(*out));
+  memcpy(&out->record_id, buf, 4);
+  out->type = buf[4];
+  memcpy(&out->timestamp, buf + 5, 4);
+  memcpy(&out->mech_status, buf + 9, sizeof(out->mech_status));
+  if (len > SSM_HISTORY_RESP_MIN_LEN) {
+    size_t tag_len = buf[SSM_HISTORY_RESP_MIN_LEN];
+    size_t avail = len - SSM_HISTORY_RESP_MIN_LEN - 1;
+    if (tag_len > avail)
+      tag_len = avail;
+    if (tag_len > SSM_HISTORY_TAG_MAX_LEN)
+      tag_len = SSM_HISTORY_TAG_MAX_LEN;
+    out->tag_len = tag_len;
+    memcpy(out->tag, buf + SSM_HISTORY_RESP_MIN_LEN + 1, tag_len);
+  }
+  return true;
+}
+
+bool ssm_send(sesame *ssm, uint8_t item_code, const void *payload,
+              size_t payload_len) {
+  // b_bufは受信の組み立て中かもしれないので、送信は呼び出し元の領域で組み立てる
+  uint8_t buf[sizeof(ssm->b_buf)];
+  size_t len = ssm_encode(item_code, payload, payload_len, buf, sizeof(buf));
+  if (len == 0) {
+    ESP_LOGE(TAG, "[ssm_send][invalid %s payload: %u bytes]",
+             ssm_item_code_name(item_code), (unsigned)payload_len);
+    return false;
+  }
+  talk_to_ssm(ssm, ssm_item_desc(item_code)->parsing_type, buf, len);
+  return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "candy.h"
+#include "ssm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * sesameへ送るコマンドの組み立てと、受信したitem codeの振り分けに使う表。
+ * item codeごとに1つの記述子を持ち、b_bufへの詰め方を1か所にまとめる。
+ */
+
+#define SSM_ITEM_CODE_TABLE_SIZE (SSM2_ITEM_OPS_TIMER_SETTING + 1)
+#define SSM_HISTORY_TAG_MAX_LEN 30 // 履歴に残るタグ(lock/unlockのペイロード)の最大長
+
+#pragma pack(1)
+
+typedef struct {
+  uint8_t public_key[64];
+} ssm_reg_req_t;
+
+typedef struct {
+  uint8_t token[4]; // AES_CMAC(device_secret, random_code)の先頭4bytes
+} ssm_login_req_t;
+
+typedef struct {
+  uint8_t count; // 1回で読み出す件数
+} ssm_history_req_t;
+
+typedef struct {
+  uint8_t tag_len;
+  uint8_t tag[SSM_HISTORY_TAG_MAX_LEN];
+} ssm_lock_req_t; // 送信長は1 + tag_len
+
+typedef struct {
+  uint32_t unix_time; // little endian
+} ssm_time_req_t;
+
+// 履歴の応答(結果コードを除く): record_id(4) type(1) timestamp(4)
+// mech_status(7) tag_len(1) tag(tag_len)
+#define SSM_HISTORY_RESP_MIN_LEN 16
+
+typedef struct {
+  int32_t record_id;
+  uint8_t type;
+  uint32_t timestamp; // sesameの時計(unix time)
+  mech_status_t mech_status;
+  uint8_t tag_len;
+  uint8_t tag[SSM_HISTORY_TAG_MAX_LEN];
+} ssm_history_record_t; // フラッシュのログにこのまま書き込む
+
+#pragma pack()
+
+typedef struct {
+  const char *name;
+  uint8_t parsing_type;  // SSM_SEG_PARSING_TYPE_*(0は送信しないitem)
+  uint8_t payload_min;   // 送信時のペイロード長(item codeを除く)
+  uint8_t payload_max;
+} ssm_item_desc_t;
+
+/**
+ * @brief item codeの記述子を取得する
+ * @param item_code ssm_item_code_e
+ * @return 未定義のitem codeの場合はNULL
+ */
+const ssm_item_desc_t *ssm_item_desc(uint8_t item_code);
+
+/**
+ * @brief item codeの名前を取得する(ログ用)
+ * @param item_code ssm_item_code_e
+ * @return 未定義のitem codeの場合は"UNKNOWN_ITEM_CODE"
+ */
+const char *ssm_item_code_name(uint8_t item_code);
+
+/**
+ * @brief item codeとペイロードをoutへ書き込む
+ * @param item_code ssm_item_code_e
+ * @param payload ペイロード(payload_lenが0の場合はNULL可)
+ * @param payload_len ペイロード長(記述子の範囲外の場合はエラー)
+ * @param out 書き込み先(暗号化する場合はCCMのタグ分の余裕が必要)
+ * @param out_size outのサイズ
+ * @return 書き込んだ長さ(エラーの場合は0)
+ */
+size_t ssm_encode(uint8_t item_code, const void *payload, size_t payload_len,
+                  uint8_t *out, size_t out_size);
+
+/**
+ * @brief 履歴の応答を固定長のレコードへ変換する
+ * @param buf 結果コードを除いた応答
+ * @param len bufの長さ
+ * @param out 変換結果(タグが長い場合は切り詰める)
+ * @return lenが短い場合はfalse
+ */
+bool ssm_decode_history(const uint8_t *buf, size_t len,
+                        ssm_history_record_t *out);
+
+/**
+ * @brief コマンドを組み立てて送信する(複数のタスクから呼んでよい)
+ * @param ssm 送信先
+ * @param item_code ssm_item_code_e
+ * @param payload ペイロード
+ * @param payload_len ペイロード長
+ * @return 組み立てられない場合はfalse
+ */
+bool ssm_send(sesame *ssm, uint8_t item_code, const void *payload,
+              size_t payload_len);
@@ -0,0 +1,306 @@
+#include "ssm_history.h"
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_spiffs.h"
+#include "esp_timer.h"
+#include "firebase_sesame/firebase_ssm_cmd.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include "ssm_codec.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SSM_HISTORY_BASE_PATH "/spiffs"
+#define SSM_HISTORY_LOG_PATH SSM_HISTORY_BASE_PATH "/history.bin"
+#define SSM_HISTORY_PARTITION "storage"
+#define SSM_HISTORY_NVS_NAMESPACE "ssm_history"
+#define SSM_HISTORY_NVS_KEY "sent" // アップロード済みのレコード数
+
+#define SSM_HISTORY_QUEUE_LEN 16
+#define SSM_HISTORY_BURST_GAP_MS 500     // これだけ空いたら読み出しの終わり
+#define SSM_HISTORY_READ_TIMEOUT_MS 5000 // 応答が来ない読み出しを打ち切る
+#define SSM_HISTORY_UPLOAD_BATCH 16      // 1回のPATCHで送るレコード数
+#define SSM_HISTORY_UPLOAD_RETRY_MS 60000
+#define SSM_HISTORY_COMPACT_BYTES 16384 // 全て送信済みでこれ以上なら空にする
+#define SSM_HISTORY_LOG_MAX_BYTES (CONFIG_SSM_HISTORY_LOG_MAX_KB * 1024)
+
+#define TAG "ssm_history"
+
+static QueueHandle_t record_queue = NULL;
+// 読み出しを開始した時刻(ms)。0は読み出し中でない
+static atomic_uint_least32_t read_started_ms;
+
+static uint32_t now_ms(void) {
+  uint32_t ms = (uint32_t)(esp_timer_get_time() / 1000);
+  return ms ? ms : 1;
+}
+
+bool ssm_history_begin_read(void) {
+  if (!record_queue || uxQueueSpacesAvailable(record_queue) == 0)
+    return false;
+
+  uint32_t now = now_ms();
+  uint32_t started = atomic_load(&read_started_ms);
+  // 応答が来ないまま止まった読み出しはタイムアウトで開始し直す
+  if (started != 0 && now - started < SSM_HISTORY_READ_TIMEOUT_MS)
+    return false;
+  return atomic_compare_exchange_strong(&read_started_ms, &started, now);
+}
+
+bool ssm_history_on_response(const uint8_t *buf, size_t len) {
+  ssm_history_record_t record;
+  if (!record_queue || !ssm_decode_history(buf, len, &record)) {
+    atomic_store(&read_started_ms, 0); // 全て読み出した
+    return false;
+  }
+
+  if (xQueueSend(record_queue, &record, 0) != pdTRUE) {
+    metrics_counter_inc(METRIC_HISTORY_DROPPED);
+    atomic_store(&read_started_ms, 0);
+    return false;
+  }
+  // 書き込みが追いつくまで読み出しを止める(次の通知で再開する)
+  if (uxQueueSpacesAvailable(record_queue) == 0) {
+    atomic_store(&read_started_ms, 0);
+    return false;
+  }
+  atomic_store(&read_started_ms, now_ms());
+  return true;
+}
+
+static uint32_t load_sent_count(void) {
+  nvs_handle_t handle;
+  uint32_t sent = 0;
+  if (nvs_open(SSM_HISTORY_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+    nvs_get_u32(handle, SSM_HISTORY_NVS_KEY, &sent);
+    nvs_close(handle);
+  }
+  return sent;
+}
+
+static esp_err_t save_sent_count(uint32_t sent) {
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(SSM_HISTORY_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK)
+    return err;
+
+  err = nvs_set_u32(handle, SSM_HISTORY_NVS_KEY, sent);
+  if (err == ESP_OK)
+    err = nvs_commit(handle);
+
+  nvs_close(handle);
+  return err;
+}
+
+// ログに保存されているレコード数(書き込み途中で切れた末尾は数えない)
+static uint32_t log_record_count(void) {
+  struct stat st;
+  if (stat(SSM_HISTORY_LOG_PATH, &st) != 0)
+    return 0;
+  return (uint32_t)(st.st_size / sizeof(ssm_history_record_t));
+}
+
+static esp_err_t mount_storage(void) {
+  esp_vfs_spiffs_conf_t conf = {
+      .base_path = SSM_HISTORY_BASE_PATH,
+      .partition_label = SSM_HISTORY_PARTITION,
+      .max_files = 2,
+      .format_if_mount_failed = true,
+  };
+  esp_err_t err = esp_vfs_spiffs_register(&conf);
+  if (err != ESP_OK)
+    return err;
+
+  // 電源断で末尾のレコードが途中までしか書かれていない場合は切り詰める
+  struct stat st;
+  if (stat(SSM_HISTORY_LOG_PATH, &st) == 0 &&
+      st.st_size % sizeof(ssm_history_record_t) != 0) {
+    ESP_LOGW(TAG, "truncate partial record at %ld", (long)st.st_size);
+    truncate(SSM_HISTORY_LOG_PATH,
+             st.st_size - st.st_size % sizeof(ssm_history_record_t));
+  }
+  return ESP_OK;
+}
+
+// キューに溜まったレコードをまとめてログへ追記する
+static size_t append_records(const ssm_history_record_t *first) {
+  struct stat st;
+  size_t size = stat(SSM_HISTORY_LOG_PATH, &st) == 0 ? st.st_size : 0;
+  FILE *fp = fopen(SSM_HISTORY_LOG_PATH, "ab");
+  if (!fp) {
+    ESP_LOGE(TAG, "failed to open %s", SSM_HISTORY_LOG_PATH);
+    return 0;
+  }
+
+  size_t written = 0;
+  ssm_history_record_t record = *first;
+  do {
+    if (size + sizeof(record) > SSM_HISTORY_LOG_MAX_BYTES) {
+      metrics_counter_inc(METRIC_HISTORY_DROPPED); // アップロードが追いつかない
+      continue;
+    }
+    if (fwrite(&record, sizeof(record), 1, fp) != 1) {
+      metrics_counter_inc(METRIC_HISTORY_DROPPED);
+      continue;
+    }
+    size += sizeof(record);
+    written++;
+  } while (xQueueReceive(record_queue, &record, 0) == pdTRUE);
+
+  fclose(fp);
+  metrics_counter_add(METRIC_HISTORY_RECORDS, written);
+  return written;
+}
+
+static cJSON *record_to_json(const ssm_history_record_t *record) {
+  cJSON *json = cJSON_CreateObject();
+  if (!json)
+    return NULL;
+
+  // タグは利用者名等の文字列だが、表示できない文字は置き換える
+  char tag[SSM_HISTORY_TAG_MAX_LEN + 1];
+  for (int i = 0; i < record->tag_len; i++) {
+    uint8_t c = record->tag[i];
+    tag[i] = c >= 0x20 && c < 0x7f && c != '"' && c != '\\' ? c : '?';
+  }
+  tag[record->tag_len] = '\0';
+
+  cJSON_AddNumberToObject(json, "type", record->type);
+  cJSON_AddNumberToObject(json, "ts", record->timestamp);
+  cJSON_AddNumberToObject(json, "position", record->mech_status.position);
+  cJSON_AddBoolToObject(json, "locked", record->mech_status.is_lock_range);
+  cJSON_AddStringToObject(json, "tag", tag);
+  return json;
+}
+
+// 未送信のレコードをSSM_HISTORY_UPLOAD_BATCHずつPATCHする
+static esp_err_t upload_pending(firebase_auth_info_t *auth_info,
+                                uint32_t *sent) {
+  uint32_t total = log_record_count();
+  if (*sent > total) {
+    // 記録と一致しない場合は先頭から送り直す(record_idがキーなので重複しない)
+    ESP_LOGW(TAG, "sent count %" PRIu32 " exceeds log (%" PRIu32 "), resend",
+             *sent, total);
+    *sent = 0;
+  }
+  if (*sent == total)
+    return ESP_OK;
+
+  FILE *fp = fopen(SSM_HISTORY_LOG_PATH, "rb");
+  if (!fp)
+    return ESP_FAIL;
+
+  esp_err_t err = ESP_OK;
+  ssm_history_record_t records[SSM_HISTORY_UPLOAD_BATCH];
+  while (*sent < total) {
+    if (fseek(fp, (long)*sent * sizeof(ssm_history_record_t), SEEK_SET) != 0) {
+      err = ESP_FAIL;
+      break;
+    }
+    size_t n = fread(records, sizeof(records[0]), SSM_HISTORY_UPLOAD_BATCH, fp);
+    if (n == 0) {
+      err = ESP_FAIL;
+      break;
+    }
+
+    cJSON *root = cJSON_CreateObject();
+    for (size_t i = 0; root && i < n; i++) {
+      char key[12];
+      snprintf(key, sizeof(key), "%" PRId32, records[i].record_id);
+      cJSON_AddItemToObject(root, key, record_to_json(&records[i]));
+    }
+    char *json = root ? cJSON_PrintUnformatted(root) : NULL;
+    cJSON_Delete(root);
+    if (!json) {
+      err = ESP_ERR_NO_MEM;
+      break;
+    }
+    err = firebase_ssm_patch_history(auth_info, json);
+    free(json);
+    if (err != ESP_OK)
+      break;
+
+    *sent += n;
+    metrics_counter_add(METRIC_HISTORY_UPLOADED, n);
+    save_sent_count(*sent);
+  }
+  fclose(fp);
+
+  // 全て送信済みでログが大きくなっていれば空にする
+  // 先に0を保存してから消すので、間で電源が切れても送り直すだけで済む
+  // (逆の順序では、再起動までに追記された分が送信済み扱いになる)
+  if (err == ESP_OK && *sent == total &&
+      total * sizeof(ssm_history_record_t) >= SSM_HISTORY_COMPACT_BYTES &&
+      save_sent_count(0) == ESP_OK) {
+    *sent = 0;
+    if (remove(SSM_HISTORY_LOG_PATH) != 0)
+      ESP_LOGW(TAG, "failed to remove %s", SSM_HISTORY_LOG_PATH);
+  }
+  return err;
+}
+
+static void task_ssm_history(void *pvParameters) {
+  firebase_auth_info_t *auth_info = (firebase_auth_info_t *)pvParameters;
+  uint32_t sent = load_sent_count();
+  bool upload_pending_records = log_record_count() > sent;
+
+  while (1) {
+    ssm_history_record_t record;
+    TickType_t wait = upload_pending_records
+                          ? pdMS_TO_TICKS(SSM_HISTORY_UPLOAD_RETRY_MS)
+                          : portMAX_DELAY;
+    if (xQueueReceive(record_queue, &record, wait) == pdTRUE) {
+      // 読み出しが続いている間はまとめて追記し、終わってからアップロードする
+      int64_t start = esp_timer_get_time();
+      size_t burst = 0;
+      do {
+        burst += append_records(&record);
+      } while (xQueueReceive(record_queue, &record,
+                             pdMS_TO_TICKS(SSM_HISTORY_BURST_GAP_MS)) == pdTRUE);
+
+      int64_t elapsed_ms =
+          (esp_timer_get_time() - start) / 1000 - SSM_HISTORY_BURST_GAP_MS;
+      if (elapsed_ms < 1)
+        elapsed_ms = 1;
+      uint32_t rate = (uint32_t)(burst * 1000 / elapsed_ms);
+      metrics_gauge_set(METRIC_GAUGE_HISTORY_RATE, rate);
+      ESP_LOGI(TAG, "stored %u entries in %lld ms (%" PRIu32 " entries/s)",
+               (unsigned)burst, (long long)elapsed_ms, rate);
+    }
+
+    if (!auth_info)
+      continue;
+    esp_err_t err = upload_pending(auth_info, &sent);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "history upload failed: %s", esp_err_to_name(err));
+    }
+    upload_pending_records = log_record_count() > sent;
+  }
+}
+
+void ssm_history_start(void *auth_info) {
+  esp_err_t err = mount_storage();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "esp_vfs_spiffs_register failed: %s", esp_err_to_name(err));
+    return; // record_queueがNULLのままなので履歴は読み出さない
+  }
+
+  record_queue =
+      xQueueCreate(SSM_HISTORY_QUEUE_LEN, sizeof(ssm_history_record_t));
+  if (!record_queue) {
+    ESP_LOGE(TAG, "failed to create record queue");
+    return;
+  }
+
+  TaskHandle_t task = NULL;
+  xTaskCreate(task_ssm_history, "sesame history task", 6144, auth_info, 2,
+              &task);
+  metrics_register_task(task);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "firebase_internal.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * sesameの履歴をBLEで続けて読み出し、固定長のレコードとして
+ * SPIFFS(storageパーティション)のログへ追記する。
+ * ログはFirebaseへまとめてアップロードし、送信済みの位置をNVSに保存する。
+ */
+
+/**
+ * @brief SPIFFSをマウントし、ログの書き込みとアップロードのタスクを開始する
+ * @param auth_info アップロードに使うFirebase認証情報
+ */
+void ssm_history_start(void *auth_info);
+
+/**
+ * @brief 履歴の読み出しを開始してよいか確認し、読み出し中にする
+ * @return 既に読み出し中、またはキューに空きがない場合はfalse
+ */
+bool ssm_history_begin_read(void);
+
+/**
+ * @brief 履歴の応答を処理する(BLEのコールバックから呼ぶ)
+ * @param buf 結果コードを除いた応答
+ * @param len bufの長さ(0は履歴がもう無いことを表す)
+ * @return 続けて次の履歴を読み出す場合はtrue
+ */
+bool ssm_history_on_response(const uint8_t *buf, size_t len);
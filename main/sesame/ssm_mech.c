@@ -0,0 +1,211 @@
+#include "ssm_mech.h"
+#include "app_events.h"
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "firebase_sesame/firebase_ssm_cmd.h"
+#include "freertos/FreeRTOS.h"
+#include "ssm_cmd.h"
+#include "ssm_sched.h"
+
+#define SSM_MECH_CALIBRATION_MS 60000 // 校正で位置を記録する時間
+#define SSM_MECH_MIN_SPAN 30 // 施錠と開錠の位置がこれ以上離れていれば提案する
+
+#define TAG "ssm_mech"
+
+typedef struct {
+  bool active;
+  uint32_t samples; // 止まった位置の記録数
+  int16_t min_position;
+  int16_t max_position;
+} ssm_mech_calibration_t;
+
+// BLEのコールバックと各タスクから触るのでspinlockで保護する
+static portMUX_TYPE mech_mux = portMUX_INITIALIZER_UNLOCKED;
+static mech_setting_t current;
+static bool current_valid = false;
+static mech_setting_t pending;
+static bool pending_valid = false;
+static ssm_mech_calibration_t calibration;
+static esp_timer_handle_t calibration_timer = NULL;
+
+void ssm_mech_on_setting(const mech_setting_t *setting) {
+  bool changed;
+  portENTER_CRITICAL(&mech_mux);
+  changed = !current_valid ||
+            current.lock_position != setting->lock_position ||
+            current.unlock_position != setting->unlock_position;
+  current = *setting;
+  current_valid = true;
+  portEXIT_CRITICAL(&mech_mux);
+
+  if (changed)
+    app_events_post(APP_EVENT_SSM_MECH_CHANGED, NULL, 0);
+}
+
+void ssm_mech_on_status(const mech_status_t *status) {
+  if (!status->is_stop)
+    return; // 回転中の位置は使わない
+
+  portENTER_CRITICAL(&mech_mux);
+  if (calibration.active) {
+    if (calibration.samples == 0 ||
+        status->position < calibration.min_position)
+      calibration.min_position = status->position;
+    if (calibration.samples == 0 ||
+        status->position > calibration.max_position)
+      calibration.max_position = status->position;
+    calibration.samples++;
+  }
+  portEXIT_CRITICAL(&mech_mux);
+}
+
+static void calibration_timer_cb(void *arg) {
+  portENTER_CRITICAL(&mech_mux);
+  calibration.active = false;
+  portEXIT_CRITICAL(&mech_mux);
+  app_events_post(APP_EVENT_SSM_MECH_CHANGED, NULL, 0); // 結果を報告する
+}
+
+static void start_calibration(void) {
+  if (!calibration_timer) {
+    const esp_timer_create_args_t timer_args = {
+        .callback = calibration_timer_cb,
+        .name = "mech_calibration",
+    };
+    if (esp_timer_create(&timer_args, &calibration_timer) != ESP_OK)
+      return;
+  }
+
+  portENTER_CRITICAL(&mech_mux);
+  calibration = (ssm_mech_calibration_t){.active = true};
+  portEXIT_CRITICAL(&mech_mux);
+  esp_timer_stop(calibration_timer);
+  esp_timer_start_once(calibration_timer,
+                       (uint64_t)SSM_MECH_CALIBRATION_MS * 1000);
+  ESP_LOGI(TAG, "calibration started: turn the thumb turn to both ends");
+}
+
+// 記録した両端の位置から角度を提案する
+static bool suggest(const ssm_mech_calibration_t *cal,
+                    const mech_setting_t *cur, bool cur_valid,
+                    mech_setting_t *out) {
+  if (cal->samples < 2 || cal->max_position - cal->min_position < SSM_MECH_MIN_SPAN)
+    return false;
+
+  // 向きは現在の設定に合わせる(不明な場合は小さい方を施錠とする)
+  if (cur_valid && cur->lock_position > cur->unlock_position) {
+    out->lock_position = cal->max_position;
+    out->unlock_position = cal->min_position;
+  } else {
+    out->lock_position = cal->min_position;
+    out->unlock_position = cal->max_position;
+  }
+  return true;
+}
+
+static cJSON *report_to_json(void) {
+  mech_setting_t cur;
+  bool cur_valid;
+  ssm_mech_calibration_t cal;
+  portENTER_CRITICAL(&mech_mux);
+  cur = current;
+  cur_valid = current_valid;
+  cal = calibration;
+  portEXIT_CRITICAL(&mech_mux);
+
+  cJSON *root = cJSON_CreateObject();
+  if (!root)
+    return NULL;
+
+  if (cur_valid) {
+    cJSON_AddNumberToObject(root, "lock", cur.lock_position);
+    cJSON_AddNumberToObject(root, "unlock", cur.unlock_position);
+  }
+  cJSON *json = cJSON_AddObjectToObject(root, "calibration");
+  if (json) {
+    cJSON_AddBoolToObject(json, "active", cal.active);
+    cJSON_AddNumberToObject(json, "samples", cal.samples);
+    mech_setting_t suggestion;
+    if (suggest(&cal, &cur, cur_valid, &suggestion)) {
+      cJSON_AddNumberToObject(json, "lock", suggestion.lock_position);
+      cJSON_AddNumberToObject(json, "unlock", suggestion.unlock_position);
+    }
+  }
+  return root;
+}
+
+bool ssm_mech_sync(const firebase_auth_info_t *auth) {
+  firebase_ssm_mech_config_t config;
+  esp_err_t err = firebase_ssm_get_mech_config(auth, &config);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "firebase_ssm_get_mech_config failed: %s",
+             esp_err_to_name(err));
+  } else {
+    if (config.calibrate) {
+      start_calibration();
+      // 次の確認で開始し直さないようにフラグを戻す
+      firebase_ssm_clear_mech_calibrate(auth);
+    }
+    if (config.has_setting) {
+      portENTER_CRITICAL(&mech_mux);
+      // sesameから現在の角度が届くまでは書き込まない
+      if (current_valid &&
+          (current.lock_position != config.setting.lock_position ||
+           current.unlock_position != config.setting.unlock_position)) {
+        pending = config.setting;
+        pending_valid = true;
+      }
+      portEXIT_CRITICAL(&mech_mux);
+    }
+  }
+
+  cJSON *root = report_to_json();
+  char *json = root ? cJSON_PrintUnformatted(root) : NULL;
+  cJSON_Delete(root);
+  if (json) {
+    err = firebase_ssm_put_mech_setting(auth, json);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "firebase_ssm_put_mech_setting failed: %s",
+               esp_err_to_name(err));
+    }
+    free(json);
+  }
+
+  portENTER_CRITICAL(&mech_mux);
+  bool has_pending = pending_valid;
+  portEXIT_CRITICAL(&mech_mux);
+  return has_pending;
+}
+
+// 順番が来た時点の書き込み待ちを送る(スケジューラのタスクから呼ばれる)
+static void write_pending(sesame *ssm) {
+  mech_setting_t setting;
+  portENTER_CRITICAL(&mech_mux);
+  bool has_pending = pending_valid;
+  setting = pending;
+  pending_valid = false; // 反映されたかはsesameからの通知で確認する
+  portEXIT_CRITICAL(&mech_mux);
+  if (has_pending)
+    send_mech_setting_cmd_to_ssm(ssm, &setting);
+}
+
+bool ssm_mech_push_pending(void) {
+  sesame *ssm = &p_ssms_env->ssm;
+  portENTER_CRITICAL(&mech_mux);
+  bool has_pending = pending_valid;
+  portEXIT_CRITICAL(&mech_mux);
+  if (!has_pending)
+    return false;
+  if (ssm->device_status < SSM_LOGGIN)
+    return true;
+
+  // 施錠/開錠の送信や応答待ちの間は、その後に回す
+  esp_err_t err = ssm_sched_submit_write(ssm, write_pending,
+                                         SSM_SCHED_PRIO_BACKGROUND, 0, NULL);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "ssm_sched_submit_write failed: %s", esp_err_to_name(err));
+    return true;
+  }
+  return false;
+}
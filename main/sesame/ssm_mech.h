@@ -0,0 +1,40 @@
+#pragma once
+
+#include "firebase_internal.h"
+#include "ssm.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * sesameの施錠/開錠の角度(SSM_ITEM_CODE_MECH_SETTING)の読み書きと校正。
+ * Firebaseのsesami5pro/config/mech_settingに書かれた角度をsesameへ書き込み、
+ * 現在の角度と校正の結果をsesami5pro/mech_settingへ報告する。
+ * 校正はMECH_STATUSで止まった位置を記録するだけで、コマンドの処理は止めない。
+ */
+
+/**
+ * @brief sesameから通知された角度を記録する(BLEのコールバックから呼ぶ)
+ * @param setting 現在の角度
+ */
+void ssm_mech_on_setting(const mech_setting_t *setting);
+
+/**
+ * @brief 校正中であればMECH_STATUSの位置を記録する(BLEのコールバックから呼ぶ)
+ * @param status 受信したMECH_STATUS
+ */
+void ssm_mech_on_status(const mech_status_t *status);
+
+/**
+ * @brief Firebaseの設定を確認し、角度の書き込みや校正の開始を行い、結果を報告する
+ * HTTPSを使うので状態監視タスクから呼ぶ
+ * @param auth Firebase認証情報
+ * @return sesameへ書き込む角度がある場合はtrue(ssm_mech_push_pendingを呼ぶ)
+ */
+bool ssm_mech_sync(const firebase_auth_info_t *auth);
+
+/**
+ * @brief 書き込み待ちの角度の送信をssm_schedへ背景の優先度で追加する
+ * (ログイン済みの場合のみ。送る角度は順番が来た時点のもの)
+ * @return 書き込み待ちが残っている場合はtrue
+ */
+bool ssm_mech_push_pending(void);
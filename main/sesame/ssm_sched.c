@@ -0,0 +1,429 @@
+#include "ssm_sched.h"
+#include "candy.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "ssm_cmd.h"
+
+// ホストのテストでは短くする
+#ifndef SSM_SCHED_CONFIRM_TIMEOUT_MS
+#define SSM_SCHED_CONFIRM_TIMEOUT_MS 10000 // 送信後にMECH_STATUSを待つ最大時間
+#endif
+#ifndef SSM_SCHED_MAX_DEVICES
+#define SSM_SCHED_MAX_DEVICES SSM_MAX_NUM
+#endif
+#define SSM_SCHED_ID_SLOT_BITS 8
+
+#define TAG "ssm_sched"
+
+typedef enum {
+  SLOT_FREE = 0,
+  SLOT_QUEUED,    // キューで送信待ち
+  SLOT_IN_FLIGHT, // 送信済みでMECH_STATUSを待っている
+  SLOT_DONE,      // 完了してssm_sched_waitで回収されるのを待っている
+} slot_state_t;
+
+typedef struct {
+  slot_state_t state;
+  bool detached; // 結果を待つ呼び出し元がいない
+  uint8_t gen;   // スロットを再利用した回数(古いIDを見分ける)
+  uint8_t dev;   // devicesの添字
+  ssm_sched_cmd_t cmd;
+  ssm_sched_write_fn write; // SSM_SCHED_CMD_WRITEの場合のみ
+  ssm_sched_prio_t prio;
+  ssm_sched_result_t result;
+  uint32_t seq; // 同じ優先度での到着順
+  int64_t submitted_us;
+  int64_t deadline_us; // 0は期限なし
+  int64_t dispatched_us;
+  SemaphoreHandle_t done;
+} sched_slot_t;
+
+// 送信するコマンド(クリティカルセクションの外で送るため写しておく)
+typedef struct {
+  uint8_t index;
+  uint8_t gen;
+  sesame *ssm;
+  ssm_sched_cmd_t cmd;
+  ssm_sched_write_fn write;
+  ssm_sched_prio_t prio;
+} sched_pick_t;
+
+static sched_slot_t slots[SSM_SCHED_MAX_REQUESTS];
+static sesame *devices[SSM_SCHED_MAX_DEVICES];
+static uint8_t num_devices = 0;
+static uint8_t rr_next = 0; // 次の周回で最初に送るsesame
+static uint32_t next_seq = 0;
+static portMUX_TYPE sched_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t sched_task = NULL;
+
+static device_status_t target_status(ssm_sched_cmd_t cmd) {
+  return cmd == SSM_SCHED_CMD_LOCK ? SSM_LOCKED : SSM_UNLOCKED;
+}
+
+static uint32_t slot_id(const sched_slot_t *slot) {
+  return ((uint32_t)slot->gen << SSM_SCHED_ID_SLOT_BITS) | (slot - slots);
+}
+
+// IDが指すスロット(解放済みや再利用済みの場合はNULL)
+static sched_slot_t *slot_from_id_locked(uint32_t id) {
+  uint32_t index = id & ((1u << SSM_SCHED_ID_SLOT_BITS) - 1);
+  if (index >= SSM_SCHED_MAX_REQUESTS)
+    return NULL;
+  sched_slot_t *slot = &slots[index];
+  if (slot->state == SLOT_FREE || slot->detached ||
+      slot->gen != (uint8_t)(id >> SSM_SCHED_ID_SLOT_BITS))
+    return NULL;
+  return slot;
+}
+
+static int device_index_locked(sesame *ssm) {
+  for (int i = 0; i < num_devices; i++) {
+    if (devices[i] == ssm)
+      return i;
+  }
+  if (num_devices >= SSM_SCHED_MAX_DEVICES)
+    return -1;
+  devices[num_devices] = ssm;
+  return num_devices++;
+}
+
+// 結果を確定する。待っている呼び出し元がいれば与えるセマフォを返す
+static SemaphoreHandle_t finish_locked(sched_slot_t *slot,
+                                       ssm_sched_result_t result) {
+  switch (result) {
+  case SSM_SCHED_SUCCESS:
+    metrics_counter_inc(METRIC_SCHED_COMPLETED);
+    break;
+  case SSM_SCHED_EXPIRED:
+    metrics_counter_inc(METRIC_SCHED_EXPIRED);
+    break;
+  case SSM_SCHED_CANCELLED:
+    metrics_counter_inc(METRIC_SCHED_CANCELLED);
+    break;
+  default:
+    metrics_counter_inc(METRIC_SCHED_FAILED);
+    break;
+  }
+
+  slot->result = result;
+  if (slot->detached) {
+    slot->state = SLOT_FREE;
+    return NULL;
+  }
+  slot->state = SLOT_DONE;
+  return slot->done;
+}
+
+static void give_all(SemaphoreHandle_t *sems, int num) {
+  for (int i = 0; i < num; i++)
+    xSemaphoreGive(sems[i]);
+}
+
+// 期限を過ぎた送信待ちと、応答のない送信済みを打ち切る
+static int expire_locked(int64_t now, SemaphoreHandle_t *to_give) {
+  int num = 0;
+  for (int i = 0; i < SSM_SCHED_MAX_REQUESTS; i++) {
+    sched_slot_t *slot = &slots[i];
+    SemaphoreHandle_t sem = NULL;
+    if (slot->state == SLOT_QUEUED && slot->deadline_us &&
+        now >= slot->deadline_us) {
+      sem = finish_locked(slot, SSM_SCHED_EXPIRED);
+    } else if (slot->state == SLOT_IN_FLIGHT &&
+               now - slot->dispatched_us >=
+                   SSM_SCHED_CONFIRM_TIMEOUT_MS * 1000LL) {
+      sem = finish_locked(slot, SSM_SCHED_FAILED);
+    } else {
+      continue;
+    }
+    if (sem)
+      to_give[num++] = sem;
+  }
+  return num;
+}
+
+// sesameのキューから次に送るものを選ぶ(送信済みのものがあればNULL)
+static sched_slot_t *pick_locked(uint8_t dev) {
+  sched_slot_t *best = NULL;
+  for (int i = 0; i < SSM_SCHED_MAX_REQUESTS; i++) {
+    sched_slot_t *slot = &slots[i];
+    if (slot->dev != dev)
+      continue;
+    if (slot->state == SLOT_IN_FLIGHT)
+      return NULL;
+    if (slot->state != SLOT_QUEUED)
+      continue;
+    if (!best || slot->prio < best->prio ||
+        (slot->prio == best->prio && (int32_t)(slot->seq - best->seq) < 0))
+      best = slot;
+  }
+  return best;
+}
+
+// 次に期限を確認する時刻(なければINT64_MAX)
+static int64_t next_wakeup_locked(void) {
+  int64_t next = INT64_MAX;
+  for (int i = 0; i < SSM_SCHED_MAX_REQUESTS; i++) {
+    const sched_slot_t *slot = &slots[i];
+    int64_t at = INT64_MAX;
+    if (slot->state == SLOT_QUEUED && slot->deadline_us) {
+      at = slot->deadline_us;
+    } else if (slot->state == SLOT_IN_FLIGHT) {
+      at = slot->dispatched_us + SSM_SCHED_CONFIRM_TIMEOUT_MS * 1000LL;
+    }
+    if (at < next)
+      next = at;
+  }
+  return next;
+}
+
+static void complete(const sched_pick_t *pick, ssm_sched_result_t result) {
+  SemaphoreHandle_t sem = NULL;
+  taskENTER_CRITICAL(&sched_mux);
+  sched_slot_t *slot = &slots[pick->index];
+  if (slot->state == SLOT_IN_FLIGHT && slot->gen == pick->gen)
+    sem = finish_locked(slot, result);
+  taskEXIT_CRITICAL(&sched_mux);
+  if (sem)
+    xSemaphoreGive(sem);
+}
+
+static void dispatch(const sched_pick_t *pick) {
+  sesame *ssm = pick->ssm;
+  if (ssm->device_status < SSM_LOGGIN) {
+    ESP_LOGW(TAG, "ssm is not logged in: %s",
+             SSM_STATUS_STR(ssm->device_status));
+    complete(pick, SSM_SCHED_NOT_LOGGED_IN);
+    return;
+  }
+  // 書き込みでは状態が変わらないので、送った時点で完了にする
+  if (pick->cmd == SSM_SCHED_CMD_WRITE) {
+    pick->write(ssm);
+    complete(pick, SSM_SCHED_SUCCESS);
+    return;
+  }
+  // 既に目的の状態であればMECH_STATUSの変化は通知されない
+  if (ssm->device_status == target_status(pick->cmd)) {
+    complete(pick, SSM_SCHED_SUCCESS);
+    return;
+  }
+
+  if (pick->cmd == SSM_SCHED_CMD_LOCK) {
+    ssm_lock(ssm, NULL, 0);
+  } else {
+    ssm_unlock(ssm, NULL, 0);
+  }
+}
+
+// 周回ごとに各sesameから1つずつ選んで送る。
+// 応答はBLEのコールバック(ssm_sched_on_status)で受けるので、
+// あるsesameの応答を待つ間も他のsesameへは送信できる
+static void task_ssm_sched(void *pvParameters) {
+  TickType_t wait = portMAX_DELAY;
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, wait);
+    int64_t now = esp_timer_get_time();
+    SemaphoreHandle_t to_give[SSM_SCHED_MAX_REQUESTS];
+    sched_pick_t picks[SSM_SCHED_MAX_DEVICES];
+    int num_picks = 0;
+
+    taskENTER_CRITICAL(&sched_mux);
+    int num_give = expire_locked(now, to_give);
+    for (int k = 0; k < num_devices; k++) {
+      uint8_t dev = (rr_next + k) % num_devices;
+      sched_slot_t *slot = pick_locked(dev);
+      if (!slot)
+        continue;
+      slot->state = SLOT_IN_FLIGHT;
+      slot->dispatched_us = now;
+      metrics_hist_observe(METRIC_HIST_SCHED_QUEUE_WAIT,
+                           now - slot->submitted_us);
+      picks[num_picks++] = (sched_pick_t){
+          .index = slot - slots,
+          .gen = slot->gen,
+          .ssm = devices[dev],
+          .cmd = slot->cmd,
+          .write = slot->write,
+          .prio = slot->prio,
+      };
+    }
+    if (num_devices)
+      rr_next = (rr_next + 1) % num_devices;
+    int64_t next = next_wakeup_locked();
+    taskEXIT_CRITICAL(&sched_mux);
+    give_all(to_give, num_give);
+
+    // 周回の中では緊急のものを先に送る(同じ優先度はラウンドロビンの順)
+    for (int i = 1; i < num_picks; i++) {
+      sched_pick_t pick = picks[i];
+      int j = i;
+      for (; j > 0 && picks[j - 1].prio > pick.prio; j--)
+        picks[j] = picks[j - 1];
+      picks[j] = pick;
+    }
+    for (int i = 0; i < num_picks; i++)
+      dispatch(&picks[i]);
+
+    if (next == INT64_MAX) {
+      wait = portMAX_DELAY;
+    } else {
+      now = esp_timer_get_time();
+      wait = next <= now ? 0 : pdMS_TO_TICKS((next - now + 999) / 1000) + 1;
+    }
+  }
+}
+
+esp_err_t ssm_sched_init(void) {
+  if (sched_task)
+    return ESP_OK;
+
+  for (int i = 0; i < SSM_SCHED_MAX_REQUESTS; i++) {
+    slots[i].done = xSemaphoreCreateBinary();
+    if (!slots[i].done)
+      return ESP_ERR_NO_MEM;
+  }
+  if (xTaskCreate(task_ssm_sched, "sesame sched task", 4096, NULL, 6,
+                  &sched_task) != pdPASS) {
+    sched_task = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  metrics_register_task(sched_task);
+  return ESP_OK;
+}
+
+static esp_err_t submit(sesame *ssm, ssm_sched_cmd_t cmd,
+                        ssm_sched_write_fn write, ssm_sched_prio_t prio,
+                        uint32_t deadline_ms, uint32_t *out_id) {
+  if (!ssm || prio >= SSM_SCHED_PRIO_NUM)
+    return ESP_ERR_INVALID_ARG;
+  if (!sched_task)
+    return ESP_ERR_INVALID_STATE;
+
+  int64_t now = esp_timer_get_time();
+  sched_slot_t *slot = NULL;
+  taskENTER_CRITICAL(&sched_mux);
+  int dev = device_index_locked(ssm);
+  for (int i = 0; dev >= 0 && i < SSM_SCHED_MAX_REQUESTS; i++) {
+    if (slots[i].state == SLOT_FREE) {
+      slot = &slots[i];
+      break;
+    }
+  }
+  if (slot) {
+    slot->state = SLOT_QUEUED;
+    slot->detached = out_id == NULL;
+    slot->gen = (uint8_t)(slot->gen + 1);
+    if (!slot->gen)
+      slot->gen = 1; // IDが0にならないようにする
+    slot->dev = dev;
+    slot->cmd = cmd;
+    slot->write = write;
+    slot->prio = prio;
+    slot->result = SSM_SCHED_PENDING;
+    slot->seq = next_seq++;
+    slot->submitted_us = now;
+    slot->deadline_us = deadline_ms ? now + deadline_ms * 1000LL : 0;
+    if (out_id)
+      *out_id = slot_id(slot);
+  }
+  taskEXIT_CRITICAL(&sched_mux);
+
+  if (!slot) {
+    ESP_LOGW(TAG, "no free slot (%s)", dev < 0 ? "devices" : "requests");
+    return ESP_ERR_NO_MEM;
+  }
+  xTaskNotifyGive(sched_task);
+  return ESP_OK;
+}
+
+esp_err_t ssm_sched_submit(sesame *ssm, ssm_sched_cmd_t cmd,
+                           ssm_sched_prio_t prio, uint32_t deadline_ms,
+                           uint32_t *out_id) {
+  if (cmd > SSM_SCHED_CMD_UNLOCK)
+    return ESP_ERR_INVALID_ARG;
+  return submit(ssm, cmd, NULL, prio, deadline_ms, out_id);
+}
+
+esp_err_t ssm_sched_submit_write(sesame *ssm, ssm_sched_write_fn write,
+                                 ssm_sched_prio_t prio, uint32_t deadline_ms,
+                                 uint32_t *out_id) {
+  if (!write)
+    return ESP_ERR_INVALID_ARG;
+  return submit(ssm, SSM_SCHED_CMD_WRITE, write, prio, deadline_ms, out_id);
+}
+
+ssm_sched_result_t ssm_sched_wait(uint32_t id, TickType_t timeout) {
+  taskENTER_CRITICAL(&sched_mux);
+  sched_slot_t *slot = slot_from_id_locked(id);
+  taskEXIT_CRITICAL(&sched_mux);
+  if (!slot)
+    return SSM_SCHED_FAILED;
+  if (xSemaphoreTake(slot->done, timeout) != pdTRUE)
+    return SSM_SCHED_PENDING;
+
+  taskENTER_CRITICAL(&sched_mux);
+  ssm_sched_result_t result = slot->result;
+  slot->state = SLOT_FREE;
+  taskEXIT_CRITICAL(&sched_mux);
+  return result;
+}
+
+bool ssm_sched_cancel(uint32_t id) {
+  SemaphoreHandle_t sem = NULL;
+  bool cancelled = false;
+  taskENTER_CRITICAL(&sched_mux);
+  sched_slot_t *slot = slot_from_id_locked(id);
+  if (slot && slot->state == SLOT_QUEUED) {
+    sem = finish_locked(slot, SSM_SCHED_CANCELLED);
+    cancelled = true;
+  }
+  taskEXIT_CRITICAL(&sched_mux);
+  if (sem)
+    xSemaphoreGive(sem);
+  return cancelled;
+}
+
+bool ssm_sched_is_busy(void) {
+  bool busy = false;
+  taskENTER_CRITICAL(&sched_mux);
+  for (int i = 0; i < SSM_SCHED_MAX_REQUESTS && !busy; i++)
+    busy = slots[i].state == SLOT_QUEUED || slots[i].state == SLOT_IN_FLIGHT;
+  taskEXIT_CRITICAL(&sched_mux);
+  return busy;
+}
+
+void ssm_sched_on_status(sesame *ssm) {
+  SemaphoreHandle_t sem = NULL;
+  bool finished = false;
+  int64_t now = esp_timer_get_time();
+
+  taskENTER_CRITICAL(&sched_mux);
+  for (int i = 0; i < SSM_SCHED_MAX_REQUESTS; i++) {
+    sched_slot_t *slot = &slots[i];
+    if (slot->state != SLOT_IN_FLIGHT || slot->cmd == SSM_SCHED_CMD_WRITE ||
+        devices[slot->dev] != ssm)
+      continue;
+    if (ssm->device_status == target_status(slot->cmd)) {
+      metrics_hist_observe(METRIC_HIST_SCHED_CONFIRM,
+                           now - slot->dispatched_us);
+      sem = finish_locked(slot, SSM_SCHED_SUCCESS);
+    } else if (ssm->device_status < SSM_LOGGIN) {
+      // 切断された場合はタイムアウトを待たずに失敗にする
+      sem = finish_locked(slot, SSM_SCHED_FAILED);
+    } else {
+      break;
+    }
+    finished = true;
+    break; // 送信済みはsesameごとに1つだけ
+  }
+  taskEXIT_CRITICAL(&sched_mux);
+
+  if (sem)
+    xSemaphoreGive(sem);
+  // 次のコマンドを送る
+  if (finished && sched_task)
+    xTaskNotifyGive(sched_task);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "ssm.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * sesameごとの施錠/開錠コマンドのキューとスケジューラ。
+ * 各sesameで同時に送るコマンドは1つだけで、MECH_STATUSで目的の状態に
+ * なるまで次は送らない。異なるsesameへのコマンドは完了を待たずに
+ * ラウンドロビンで順に送るので、1つのsesameの応答待ちで他が止まらない。
+ * 同じsesameのキューは優先度順(同じ優先度は到着順)に処理する。
+ * 時刻や角度の書き込みもSSM_SCHED_PRIO_BACKGROUNDで同じキューに入れ、
+ * 施錠/開錠の送信や応答待ちに割り込まないようにする。
+ */
+
+#define SSM_SCHED_MAX_REQUESTS 16 // 全sesameで保持できる要求の数
+
+typedef enum {
+  SSM_SCHED_CMD_LOCK = 0,
+  SSM_SCHED_CMD_UNLOCK,
+  SSM_SCHED_CMD_WRITE, // ssm_sched_submit_writeの書き込み(送信で完了)
+} ssm_sched_cmd_t;
+
+// 送信する順番が来た時にsesameへ書き込む関数(スケジューラのタスクから呼ぶ)
+typedef void (*ssm_sched_write_fn)(sesame *ssm);
+
+typedef enum {
+  SSM_SCHED_PRIO_EMERGENCY = 0, // 緊急の開錠など。キューの先頭に入る
+  SSM_SCHED_PRIO_NORMAL,
+  SSM_SCHED_PRIO_BACKGROUND,
+  SSM_SCHED_PRIO_NUM,
+} ssm_sched_prio_t;
+
+typedef enum {
+  SSM_SCHED_PENDING = 0, // 待機中または実行中(ssm_sched_waitのタイムアウト)
+  SSM_SCHED_SUCCESS,     // 目的の状態になった
+  SSM_SCHED_FAILED,      // 送信したが時間内に目的の状態にならなかった
+  SSM_SCHED_NOT_LOGGED_IN, // 送信する時点でログインしていなかった
+  SSM_SCHED_EXPIRED,       // 期限までに送信できなかった
+  SSM_SCHED_CANCELLED,     // 送信前に取り消された
+} ssm_sched_result_t;
+
+/**
+ * @brief スケジューラのタスクを開始する
+ * @return ESP_OK 成功、ESP_ERR_NO_MEM タスク等を作成できない
+ */
+esp_err_t ssm_sched_init(void);
+
+/**
+ * @brief sesameへのコマンドをキューに追加する
+ * @param ssm 送信先のsesame
+ * @param cmd 施錠/開錠
+ * @param prio 優先度
+ * @param deadline_ms 送信するまでの期限(0は期限なし)
+ * @param out_id 要求のID(ssm_sched_wait/ssm_sched_cancelに使う)。
+ *               NULLの場合は結果を待たず、完了後に自動で解放する
+ * @return ESP_OK 成功、ESP_ERR_NO_MEM キューが満杯、
+ *         ESP_ERR_INVALID_STATE 未初期化
+ */
+esp_err_t ssm_sched_submit(sesame *ssm, ssm_sched_cmd_t cmd,
+                           ssm_sched_prio_t prio, uint32_t deadline_ms,
+                           uint32_t *out_id);
+
+/**
+ * @brief 状態を変えない書き込み(時刻、角度など)をキューに追加する
+ * 順番が来た時にログイン済みであればwriteを呼び、MECH_STATUSを待たずに
+ * 完了にする(ログインしていなければwriteは呼ばない)
+ * @param ssm 送信先のsesame
+ * @param write 書き込む関数
+ * @param prio 優先度(通常はSSM_SCHED_PRIO_BACKGROUND)
+ * @param deadline_ms 送信するまでの期限(0は期限なし)
+ * @param out_id ssm_sched_submitと同じ
+ * @return ssm_sched_submitと同じ
+ */
+esp_err_t ssm_sched_submit_write(sesame *ssm, ssm_sched_write_fn write,
+                                 ssm_sched_prio_t prio, uint32_t deadline_ms,
+                                 uint32_t *out_id);
+
+/**
+ * @brief 要求の完了を待ち、結果を返して解放する
+ * @param id ssm_sched_submitで得たID
+ * @param timeout 最大待ち時間
+ * @return 結果。タイムアウトした場合はSSM_SCHED_PENDING(要求は残る)
+ */
+ssm_sched_result_t ssm_sched_wait(uint32_t id, TickType_t timeout);
+
+/**
+ * @brief 送信前の要求を取り消す(結果はSSM_SCHED_CANCELLEDになる)
+ * @param id ssm_sched_submitで得たID
+ * @return 取り消せた場合はtrue。送信済みや完了済みの場合はfalse
+ */
+bool ssm_sched_cancel(uint32_t id);
+
+/**
+ * @brief 送信待ちまたは応答待ちの要求があるか
+ * (OTAのダウンロード等、急がない通信を控えるために使う)
+ * @return 要求がある場合はtrue
+ */
+bool ssm_sched_is_busy(void);
+
+/**
+ * @brief sesameの状態の変化を通知する(ssm_action_handleから呼ぶ)
+ * @param ssm 状態が変化したsesame
+ */
+void ssm_sched_on_status(sesame *ssm);
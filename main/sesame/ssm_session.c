@@ -0,0 +1,117 @@
+#include "ssm_session.h"
+#include "c_ccm.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+#include <string.h>
+
+#define SSM_SESSION_WINDOW 4 // 取りこぼしを許す通知の数
+#define SSM_SESSION_MAX_FAILS 2 // 続けて復号に失敗したら切断する
+
+#define TAG "ssm_session"
+
+static const uint8_t additional_data[] = {0x00};
+
+// 状態はBLEのhostタスクと送信するタスクから触る
+static portMUX_TYPE session_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// 同じrandom_code(token)のままカウンタを0に戻すと、使用済みの(鍵, nonce)を
+// 送受信の両方で使い直すことになるので、切断して新しいINITIALを受け取る
+static void on_auth_failure(sesame *ssm) {
+  metrics_counter_inc(METRIC_CCM_AUTH_FAILURES);
+  if (ssm->session.fail_us == 0)
+    ssm->session.fail_us = esp_timer_get_time();
+
+  bool reconnect = false;
+  portENTER_CRITICAL(&session_mux);
+  // 1回だけなら壊れた通知を読み捨てたとみなし、次の通知で追従を試みる
+  if (ssm->session.state == SSM_SESSION_OK &&
+      ++ssm->session.fails >= SSM_SESSION_MAX_FAILS) {
+    ssm->session.state = SSM_SESSION_RECONNECT;
+    reconnect = true;
+  }
+  portEXIT_CRITICAL(&session_mux);
+  if (!reconnect)
+    return;
+
+  ESP_LOGW(TAG, "[%d][auth failed %d times][disconnect]", ssm->conn_id,
+           ssm->session.fails);
+  metrics_counter_inc(METRIC_CCM_RECONNECTS);
+  // 応答を受け取るまでコマンドを送らせない
+  if (ssm->device_status >= SSM_LOGGIN) {
+    ssm->device_status = SSM_CONNECTED;
+    p_ssms_env->ssm_cb__(ssm); // callback: ssm_action_handle
+  }
+  ssm_disconnect(ssm); // 再接続のINITIALでssm_session_resetが呼ばれる
+}
+
+void ssm_session_reset(sesame *ssm) {
+  portENTER_CRITICAL(&session_mux);
+  ssm->session.state = SSM_SESSION_OK;
+  portEXIT_CRITICAL(&session_mux);
+  ssm->session.fails = 0;
+  // 他のタスクが送信中であれば、そのメッセージを送り終えてから戻す
+  if (ssm->tx_mutex)
+    xSemaphoreTake(ssm->tx_mutex, portMAX_DELAY);
+  ssm->cipher.encrypt.count = 0;
+  if (ssm->tx_mutex)
+    xSemaphoreGive(ssm->tx_mutex);
+  ssm->cipher.decrypt.count = 0;
+  // fail_usは残し、再接続を含めた復旧までの時間を測る
+}
+
+bool ssm_session_decrypt(sesame *ssm, uint8_t *buf, uint16_t len) {
+  // 失敗すると出力が消されるので、先のカウンタで試すために写しておく
+  uint8_t cipher[sizeof(ssm->b_buf)];
+  uint8_t tag[CCM_TAG_LENGTH];
+  if (len > sizeof(cipher))
+    return false;
+#if CONFIG_SSM_CCM_FAULT_INJECT_EVERY > 0
+  static uint32_t received = 0;
+  if (len > 0 && ++received % CONFIG_SSM_CCM_FAULT_INJECT_EVERY == 0) {
+    ESP_LOGW(TAG, "[%d][inject corrupted segment]", ssm->conn_id);
+    buf[0] ^= 0x01;
+  }
+#endif
+  memcpy(cipher, buf, len);
+  memcpy(tag, buf + len, CCM_TAG_LENGTH);
+
+  SSM_CCM_NONCE nonce = ssm->cipher.decrypt;
+  int skipped = 0;
+  for (; skipped <= SSM_SESSION_WINDOW; skipped++, nonce.count++) {
+    if (aes_ccm_auth_decrypt(ssm->cipher.token, (const unsigned char *)&nonce,
+                             13, additional_data, sizeof(additional_data),
+                             cipher, len, buf, tag, CCM_TAG_LENGTH) == 0)
+      break;
+  }
+  if (skipped > SSM_SESSION_WINDOW) {
+    on_auth_failure(ssm);
+    return false;
+  }
+
+  if (skipped > 0) {
+    ESP_LOGW(TAG, "[%d][resync][skipped %d]", ssm->conn_id, skipped);
+    metrics_counter_inc(METRIC_CCM_RESYNCS);
+  }
+  ssm->cipher.decrypt.count = nonce.count + 1;
+  ssm->session.fails = 0;
+  if (ssm->session.fail_us) {
+    metrics_hist_observe(METRIC_HIST_CCM_RECOVER,
+                         esp_timer_get_time() - ssm->session.fail_us);
+    ssm->session.fail_us = 0;
+  }
+  return true;
+}
+
+void ssm_session_on_login(sesame *ssm) {
+  // 切断から再接続してログインできた時点で復旧とする
+  if (ssm->session.fail_us) {
+    int64_t elapsed = esp_timer_get_time() - ssm->session.fail_us;
+    ESP_LOGI(TAG, "[%d][recovered in %lld ms]", ssm->conn_id,
+             (long long)(elapsed / 1000));
+    metrics_hist_observe(METRIC_HIST_CCM_RECOVER, elapsed);
+    ssm->session.fail_us = 0;
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "ssm.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * AES-CCMのセッション(nonceのカウンタ)の管理。
+ * 受信したメッセージのタグを確認し、通知の取りこぼしでsesameのカウンタが
+ * 先に進んでいる場合は数個先までのカウンタで復号し直して追従する。
+ * 古いカウンタには戻らないので、再送されたメッセージは受け付けない。
+ * 失敗が続いた場合は切断し、新しいrandom_code(INITIAL)でやり直す
+ * (同じtokenでカウンタを0に戻すとnonceを使い直すことになるため)。
+ */
+
+typedef enum {
+  SSM_SESSION_OK = 0,
+  SSM_SESSION_RECONNECT, // 切断して再接続を待っている
+} ssm_session_state_t;
+
+/**
+ * @brief 新しいrandom_code(INITIAL)を受け取った時にセッションを初期化する
+ * @param ssm 対象のsesame
+ */
+void ssm_session_reset(sesame *ssm);
+
+/**
+ * @brief 受信したメッセージを復号する(BLEのコールバックから呼ぶ)
+ * 復号できない場合はカウンタを進めず、失敗が続けば切断する
+ * @param ssm 対象のsesame
+ * @param buf 暗号文とタグ。復号結果で上書きする
+ * @param len タグを除いた長さ
+ * @return タグが一致した場合はtrue
+ */
+bool ssm_session_decrypt(sesame *ssm, uint8_t *buf, uint16_t len);
+
+/**
+ * @brief ログインの応答を受け取った時に呼ぶ。切断からの復旧中であれば完了とする
+ * @param ssm 対象のsesame
+ */
+void ssm_session_on_login(sesame *ssm);
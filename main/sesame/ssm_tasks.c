@@ -1,65 +1,474 @@
 #include "esp_log.h"
+#include "esp_timer.h"
 
+#include "app_events.h"
+#include "boot.h"
 #include "candy.h"
+#include "firebase/firebase_auth.h"
 #include "firebase_sesame/firebase_ssm_cmd.h"
 #include "sesame/ssm.h"
 #include "sesame/ssm_cmd.h"
+#include "sesame/ssm_history.h"
+#include "sesame/ssm_mech.h"
+#include "sesame/ssm_sched.h"
+#include "sesame/ssm_tasks.h"
+#include "firebase_sesame/ssm_cmd_dedup.h"
+#include "firebase_sesame/ssm_outbox.h"
+#include "freertos/event_groups.h"
+#include "sdkconfig.h"
+#include "metrics.h"
+#include "ssm_trace.h"
+#include "time_sync.h"
+#include <sys/time.h>
+
+#define SSM_CMD_DEADLINE_MS 5000 // キューの古いコマンドを送らずに打ち切るまでの時間
+#define SSM_CMD_POLL_INTERVAL_MS 1000 // ストリームが使えない間のポーリング間隔
+#define SSM_CMD_FETCH_BACKOFF_MAX_MS 60000 // 取得に失敗し続けた場合の最大間隔
+#define SSM_CMD_LATENCY_MAX_MS 60000 // これより古いコマンドは遅延に含めない
+#define SSM_CMD_SAFETY_POLL_MS 60000  // ストリームの取りこぼしに備えた確認間隔
+#define SSM_STATUS_RECONCILE_MS 300000 // firebaseの状態とのずれを確認する間隔
+#define SSM_STREAM_BACKOFF_MIN_MS 1000
+#define SSM_STREAM_BACKOFF_MAX_MS 60000
+
+#define SSM_NETWORK_BIT_UP BIT0
+
+// タスク通知のビット
+#define SSM_NOTIFY_CMD BIT0       // コマンドキューを確認する
+#define SSM_NOTIFY_TOKEN BIT1     // id_tokenを更新する
+#define SSM_NOTIFY_STATUS BIT2    // sesameの状態をfirebaseへ反映する
+#define SSM_NOTIFY_RECONCILE BIT3 // firebaseの状態とのずれを確認する
+#define SSM_NOTIFY_TIME BIT4      // sesameの時計を合わせる
+#define SSM_NOTIFY_HISTORY BIT5   // sesameの履歴を読み出す
+#define SSM_NOTIFY_MECH BIT6      // 角度の設定を確認/書き込む
 
 static char *TAG = "ssm_task";
 
-// 現在のsesameの状態とfirebaseの状態に差がないかを確認するタスク
+static EventGroupHandle_t network_events = NULL;
+
+static TaskHandle_t cmd_task = NULL;
+static TaskHandle_t status_task = NULL;
+static esp_timer_handle_t token_refresh_timer = NULL;
+static volatile bool cmd_stream_connected = false;
+
+static bool network_is_up(void) {
+  return xEventGroupGetBits(network_events) & SSM_NETWORK_BIT_UP;
+}
+
+static void notify_task(TaskHandle_t task, uint32_t bits) {
+  if (task)
+    xTaskNotify(task, bits, eSetBits);
+}
+
+// 状態の変化をfirebaseへ反映し、定期的にずれがないかを確認するタスク
 static void task_ssm_status_monitoring(void *pvParameters) {
   firebase_ssm_status_t firebase_ssm_status;
   firebase_auth_info_t *auth_info = (firebase_auth_info_t *)pvParameters;
 
   while (1) {
-    firebase_ssm_get_current_status(auth_info, &firebase_ssm_status);
-
-    if (p_ssms_env->ssm.device_status == SSM_LOCKED &&
-        firebase_ssm_status == SSM_STATUS_UNLOCKED) {
-      firebase_ssm_update_current_status(auth_info, SSM_STATUS_LOCKED);
-    } else if (p_ssms_env->ssm.device_status == SSM_UNLOCKED &&
-               firebase_ssm_status == SSM_STATUS_LOCKED) {
-      firebase_ssm_update_current_status(auth_info, SSM_UNLOCKED);
+    uint32_t bits = 0;
+    if (xTaskNotifyWait(0, UINT32_MAX, &bits,
+                        pdMS_TO_TICKS(SSM_STATUS_RECONCILE_MS)) == pdFALSE) {
+      bits = SSM_NOTIFY_RECONCILE; // タイムアウト
+    }
+    metrics_counter_inc(METRIC_WAKEUPS_STATUS_TASK);
+    if (!network_is_up())
+      continue; // 再接続時にSSM_NOTIFY_RECONCILEで確認し直す
+
+    uint8_t device_status = p_ssms_env->ssm.device_status;
+    if (bits & SSM_NOTIFY_STATUS) {
+      if (device_status == SSM_LOCKED) {
+        firebase_ssm_update_current_status(auth_info, SSM_STATUS_LOCKED);
+      } else if (device_status == SSM_UNLOCKED) {
+        firebase_ssm_update_current_status(auth_info, SSM_STATUS_UNLOCKED);
+      }
+    }
+    if (bits & (SSM_NOTIFY_MECH | SSM_NOTIFY_RECONCILE)) {
+      // 書き込みはコマンドの処理と同じタスクで、キューの処理の後に行う
+      if (ssm_mech_sync(auth_info))
+        notify_task(cmd_task, SSM_NOTIFY_MECH);
+    }
+    if (!(bits & SSM_NOTIFY_STATUS) && (bits & SSM_NOTIFY_RECONCILE)) {
+      firebase_ssm_get_current_status(auth_info, &firebase_ssm_status);
+
+      if (device_status == SSM_LOCKED &&
+          firebase_ssm_status == SSM_STATUS_UNLOCKED) {
+        firebase_ssm_update_current_status(auth_info, SSM_STATUS_LOCKED);
+      } else if (device_status == SSM_UNLOCKED &&
+                 firebase_ssm_status == SSM_STATUS_LOCKED) {
+        firebase_ssm_update_current_status(auth_info, SSM_STATUS_UNLOCKED);
+      }
+    }
+  }
+}
+
+// 送信と確認はスケジューラが行い、ここでは完了を待つだけ
+bool ssm_execute_command(firebase_ssm_cmd_type_t cmd_type) {
+  ssm_sched_cmd_t cmd;
+  ssm_sched_prio_t prio = SSM_SCHED_PRIO_NORMAL;
+  if (cmd_type == SSM_CMD_LOCK) {
+    cmd = SSM_SCHED_CMD_LOCK;
+  } else if (cmd_type == SSM_CMD_UNLOCK) {
+    cmd = SSM_SCHED_CMD_UNLOCK;
+  } else if (cmd_type == SSM_CMD_EMERGENCY_UNLOCK) {
+    cmd = SSM_SCHED_CMD_UNLOCK;
+    prio = SSM_SCHED_PRIO_EMERGENCY;
+  } else {
+    return false;
+  }
+
+  uint32_t id;
+  esp_err_t err = ssm_sched_submit(&p_ssms_env->ssm, cmd, prio,
+                                   SSM_CMD_DEADLINE_MS, &id);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "ssm_sched_submit failed: %s", esp_err_to_name(err));
+    return false;
+  }
+  // 期限と確認のタイムアウトがあるので、必ず結果が返る
+  return ssm_sched_wait(id, portMAX_DELAY) == SSM_SCHED_SUCCESS;
+}
+
+void ssm_observe_cmd_latency(metric_hist_id_t id, int64_t issued_ms) {
+  if (!time_sync_is_valid())
+    return;
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  int64_t elapsed_ms =
+      (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000 - issued_ms;
+  if (elapsed_ms >= 0 && elapsed_ms < SSM_CMD_LATENCY_MAX_MS)
+    metrics_hist_observe(id, elapsed_ms * 1000);
+}
+
+// キューの1コマンドを最大1回だけ実行し、結果をfirebaseへ報告する
+static void ssm_process_command(firebase_auth_info_t *auth_info,
+                                firebase_ssm_cmd_t *cmd) {
+  ssm_cmd_dedup_result_t result;
+  if (ssm_cmd_dedup_lookup(cmd->id, &result)) {
+    // 実行済み: 前回のPATCHが失敗しているので結果の報告だけをやり直す
+    // PENDINGのままのものは実行中に再起動したので失敗扱いにする
+    ESP_LOGW(TAG, "command %s already executed, report again", cmd->id);
+  } else {
+    // 実行前に記録しておくことで、この後何があっても再実行されない
+    if (ssm_cmd_dedup_record(cmd->id, SSM_CMD_DEDUP_RESULT_PENDING) !=
+        ESP_OK) {
+      return; // 記録できないものは実行しない(次回の取得で再試行)
     }
-    vTaskDelay(pdMS_TO_TICKS(10000)); // 10秒待機
+    bool ok = ssm_execute_command(cmd->cmd_type);
+    int64_t issued_ms; // push IDの先頭はクライアントで作成した時刻
+    if (firebase_ssm_push_id_time_ms(cmd->id, &issued_ms))
+      ssm_observe_cmd_latency(METRIC_HIST_CMD_FIREBASE, issued_ms);
+    result = ok ? SSM_CMD_DEDUP_RESULT_SUCCESS : SSM_CMD_DEDUP_RESULT_FAILURE;
+    ssm_cmd_dedup_record(cmd->id, result);
+    ESP_LOGI(TAG, "command %s (%d) %s", cmd->id, cmd->cmd_type,
+             ok ? "succeeded" : "failed");
+  }
+
+  cmd->is_finished = true;
+  cmd->is_success = result == SSM_CMD_DEDUP_RESULT_SUCCESS;
+  esp_err_t status = firebase_ssm_update_status(auth_info, cmd);
+  if (status != ESP_OK) {
+    ESP_LOGE(TAG, "firebase_ssm_update_status failed: %s",
+             esp_err_to_name(status));
   }
+  ssm_trace_end();
 }
 
-// 現在のコマンドを1秒間隔で取得するタスク
+// 取得やサインインに失敗した後、次に試すまでの間隔
+static uint32_t next_backoff_ms(uint32_t backoff_ms) {
+  if (backoff_ms == 0)
+    return SSM_CMD_POLL_INTERVAL_MS * 2;
+  return backoff_ms * 2 > SSM_CMD_FETCH_BACKOFF_MAX_MS
+             ? SSM_CMD_FETCH_BACKOFF_MAX_MS
+             : backoff_ms * 2;
+}
+
+// コマンドの到着(ストリーム)やトークン更新の通知を待ち、
+// コマンドキューを取得して古い順に処理するタスク
 static void task_sesame_get_command(void *pvParameters) {
   esp_err_t status;
   firebase_auth_info_t *auth_info = (firebase_auth_info_t *)pvParameters;
+  static firebase_ssm_cmd_t cmds[FIREBASE_SSM_CMD_QUEUE_MAX];
+  bool time_push_pending = false;
+  bool history_read_pending = false;
+  bool mech_write_pending = false;
+  bool token_refresh_pending = false; // 成功するまで更新をやり直す
+  uint32_t fetch_backoff_ms = 0; // 取得に失敗している間の待ち時間
 
   while (1) {
-    firebase_ssm_cmd_t cmd = {0};
-    status = firebase_ssm_get_commands(auth_info, &cmd);
-    if (status != ESP_OK) {
-      ESP_LOGE(TAG, "firebase_ssm_command_get_current failed: %s",
-               esp_err_to_name(status));
+    uint32_t bits = 0;
+    TickType_t wait = pdMS_TO_TICKS(
+        fetch_backoff_ms       ? fetch_backoff_ms
+        : cmd_stream_connected ? SSM_CMD_SAFETY_POLL_MS
+                               : SSM_CMD_POLL_INTERVAL_MS);
+    xTaskNotifyWait(0, UINT32_MAX, &bits, wait);
+    metrics_counter_inc(METRIC_WAKEUPS_CMD_TASK);
+    if (bits & SSM_NOTIFY_TIME)
+      time_push_pending = true;
+    if (bits & SSM_NOTIFY_HISTORY)
+      history_read_pending = true;
+    if (bits & SSM_NOTIFY_MECH)
+      mech_write_pending = true;
+    if (bits & SSM_NOTIFY_TOKEN)
+      token_refresh_pending = true;
+    if (!network_is_up())
       continue;
+
+    // 起動時にサインインできなかった場合は、取得と同じ間隔でやり直す
+    bool signed_in = auth_info->id_token[0] != '\0';
+    if (token_refresh_pending || !signed_in) {
+      status = firebase_refresh_auth(auth_info);
+      if (status != ESP_OK) {
+        ESP_LOGE(TAG, "firebase_refresh_auth failed: %s",
+                 esp_err_to_name(status));
+      } else {
+        token_refresh_pending = false;
+        if (!signed_in)
+          boot_mark(BOOT_PHASE_FIREBASE_AUTH);
+      }
     }
-    if (cmd.is_finished == 0 && cmd.cmd_type != SSM_CMD_NONE) {
-      // ここで実際のsesameを操作
-      if (cmd.cmd_type == SSM_CMD_LOCK) {
-        ssm_lock(NULL, 0);
-      } else if (cmd.cmd_type == SSM_CMD_UNLOCK) {
-        ssm_unlock(NULL, 0);
+
+    size_t count = 0;
+    status = auth_info->id_token[0] != '\0'
+                 ? firebase_ssm_get_commands(auth_info, cmds,
+                                             FIREBASE_SSM_CMD_QUEUE_MAX,
+                                             &count)
+                 : ESP_ERR_INVALID_STATE;
+    if (status == ESP_ERR_INVALID_STATE)
+      token_refresh_pending = true; // id_tokenが失効して拒否された
+    if (status != ESP_OK) {
+      // Firebaseに届かない間は間隔を空け、LANからの操作(local_ctrl)に任せる
+      fetch_backoff_ms = next_backoff_ms(fetch_backoff_ms);
+      ESP_LOGE(TAG, "firebase_ssm_get_commands failed: %s (retry in %lu ms)",
+               esp_err_to_name(status), (unsigned long)fetch_backoff_ms);
+    } else {
+      fetch_backoff_ms = 0;
+      // 通信できない間にLANから実行した結果を、キューの処理より先に古い順で送る
+      ssm_outbox_flush(auth_info);
+    }
+    // 緊急の開錠は先に届いたコマンドより先に処理する
+    for (int pass = 0; pass < 2; pass++) {
+      for (size_t i = 0; i < count; i++) {
+        if ((cmds[i].cmd_type == SSM_CMD_EMERGENCY_UNLOCK) != (pass == 0))
+          continue;
+        ssm_trace_begin();
+        ssm_process_command(auth_info, &cmds[i]);
       }
+    }
 
-      // 成功後にはfirebaseをupdateする。
-      cmd.is_finished = true;
-      cmd.is_success = true;
-      firebase_ssm_update_status(auth_info, &cmd);
+    // 時刻と角度の書き込みはキューのコマンドを処理し終えてから、
+    // ssm_schedへ背景の優先度で追加する
+    // (ログイン前やSNTPの取得前は次のSSM_NOTIFY_TIMEまで持ち越す)
+    if (time_push_pending && time_sync_push())
+      time_push_pending = false;
+    if (mech_write_pending)
+      mech_write_pending = ssm_mech_push_pending();
+
+    // 履歴は最初の1件だけを要求し、続きはBLEのコールバックで読み出す
+    if (history_read_pending &&
+        p_ssms_env->ssm.device_status >= SSM_LOGGIN) {
+      history_read_pending = false;
+      if (ssm_history_begin_read())
+        send_read_history_cmd_to_ssm(&p_ssms_env->ssm);
     }
+  }
+}
+
+#if CONFIG_SSM_CMD_STREAM
+// ストリームで待ち受けるパスと、変更があった時に通知するイベント
+typedef struct {
+  const char *name;
+  esp_err_t (*open)(const firebase_auth_info_t *auth, firebase_stream_cb_t cb,
+                    void *arg);
+  app_event_id_t event;
+  volatile bool *connected; // 受信できている間true(NULL可)
+  firebase_auth_info_t *auth_info;
+  TaskHandle_t task;
+} ssm_stream_t;
+
+static ssm_stream_t cmd_stream = {
+    .name = "command",
+    .open = firebase_ssm_stream_commands,
+    .event = APP_EVENT_CMD_ARRIVED,
+    .connected = &cmd_stream_connected,
+};
+// 校正の開始や角度の変更を定期確認(5分)を待たずに反映する
+static ssm_stream_t mech_stream = {
+    .name = "mech config",
+    .open = firebase_ssm_stream_mech_config,
+    .event = APP_EVENT_SSM_MECH_CHANGED,
+};
+
+static void stream_cb(const char *event, const char *data, void *arg) {
+  ssm_stream_t *stream = (ssm_stream_t *)arg;
+  // 接続直後に最初のputが届いた時点で受信できているとみなす
+  if (stream->connected)
+    *stream->connected = true;
+  // put/patchのどちらでも全体を取得し直す
+  app_events_post(stream->event, NULL, 0);
+}
+
+// パスの変更をストリームで待ち受けるタスク
+static void task_stream(void *pvParameters) {
+  ssm_stream_t *stream = (ssm_stream_t *)pvParameters;
+  uint32_t backoff_ms = SSM_STREAM_BACKOFF_MIN_MS;
+
+  while (1) {
+    xEventGroupWaitBits(network_events, SSM_NETWORK_BIT_UP, pdFALSE, pdTRUE,
+                        portMAX_DELAY);
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = stream->open(stream->auth_info, stream_cb, stream);
+    if (stream->connected)
+      *stream->connected = false;
+    metrics_counter_inc(METRIC_CMD_STREAM_RECONNECTS);
+    ESP_LOGW(TAG, "%s stream closed: %s", stream->name, esp_err_to_name(err));
+
+    // 長く続いた接続の後はすぐに繋ぎ直す
+    if (esp_timer_get_time() - start > SSM_STREAM_BACKOFF_MAX_MS * 1000LL)
+      backoff_ms = SSM_STREAM_BACKOFF_MIN_MS;
+    // id_tokenが更新された場合は待たずに新しいトークンで繋ぎ直す
+    if (xTaskNotifyWait(0, UINT32_MAX, NULL, pdMS_TO_TICKS(backoff_ms)) ==
+        pdTRUE) {
+      backoff_ms = SSM_STREAM_BACKOFF_MIN_MS;
+      continue;
+    }
+    backoff_ms = backoff_ms * 2 > SSM_STREAM_BACKOFF_MAX_MS
+                     ? SSM_STREAM_BACKOFF_MAX_MS
+                     : backoff_ms * 2;
+  }
+}
+#endif
+
+static void publish_diagnostics(firebase_auth_info_t *auth_info,
+                                const char *name, cJSON *root) {
+  char *json = root ? cJSON_PrintUnformatted(root) : NULL;
+  cJSON_Delete(root);
+  if (!json) {
+    ESP_LOGE(TAG, "failed to build %s json", name);
+    return;
+  }
+  esp_err_t status = firebase_ssm_put_diagnostics(auth_info, name, json);
+  if (status != ESP_OK) {
+    ESP_LOGE(TAG, "firebase_ssm_put_diagnostics(%s) failed: %s", name,
+             esp_err_to_name(status));
+  }
+  free(json);
+}
+
+// 診断情報を定期的にfirebaseへ書き込むタスク
+static void task_diagnostics_publish(void *pvParameters) {
+  firebase_auth_info_t *auth_info = (firebase_auth_info_t *)pvParameters;
+
+  // 起動時間は一度だけ書き込む(ログインできない場合もタイムアウト後に書く)
+  boot_wait(BOOT_BITS_ALL,
+            pdMS_TO_TICKS(CONFIG_SSM_DIAG_PUBLISH_INTERVAL_SEC * 1000));
+  publish_diagnostics(auth_info, "boot", boot_to_json());
+
+  while (1) {
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_SSM_DIAG_PUBLISH_INTERVAL_SEC * 1000));
 
-    vTaskDelay(pdMS_TO_TICKS(1000)); // 1秒待機
+    publish_diagnostics(auth_info, "latency", ssm_trace_to_json());
+    publish_diagnostics(auth_info, "metrics", metrics_to_json());
   }
 }
 
+// app_eventsのループで呼ばれるので、各タスクへ通知するだけにする
+static void app_event_handler(void *arg, esp_event_base_t base, int32_t id,
+                              void *event_data) {
+  switch (id) {
+  case APP_EVENT_SSM_STATUS_CHANGED: {
+    uint8_t device_status = *(uint8_t *)event_data;
+    notify_task(status_task, SSM_NOTIFY_STATUS);
+    if (device_status == SSM_LOGGIN) { // ログイン前に届いたコマンドと時刻合わせ
+      notify_task(cmd_task,
+                  SSM_NOTIFY_CMD | SSM_NOTIFY_TIME | SSM_NOTIFY_HISTORY);
+    } else if (device_status == SSM_LOCKED || device_status == SSM_UNLOCKED) {
+      notify_task(cmd_task, SSM_NOTIFY_HISTORY); // 操作で履歴が増えた
+    }
+    break;
+  }
+  case APP_EVENT_CMD_ARRIVED:
+    notify_task(cmd_task, SSM_NOTIFY_CMD);
+    break;
+  case APP_EVENT_NETWORK_UP:
+    xEventGroupSetBits(network_events, SSM_NETWORK_BIT_UP);
+    notify_task(cmd_task, SSM_NOTIFY_CMD);
+    notify_task(status_task, SSM_NOTIFY_RECONCILE);
+    break;
+  case APP_EVENT_NETWORK_DOWN:
+    xEventGroupClearBits(network_events, SSM_NETWORK_BIT_UP);
+    break;
+  case APP_EVENT_TOKEN_REFRESH_DUE:
+    notify_task(cmd_task, SSM_NOTIFY_TOKEN);
+    break;
+#if CONFIG_SSM_CMD_STREAM
+  case APP_EVENT_TOKEN_REFRESHED:
+    // 失効したトークンで接続に失敗し続けているストリームを繋ぎ直す
+    notify_task(cmd_stream.task, SSM_NOTIFY_TOKEN);
+    notify_task(mech_stream.task, SSM_NOTIFY_TOKEN);
+    break;
+#endif
+  case APP_EVENT_TIME_SYNC_DUE:
+    notify_task(cmd_task, SSM_NOTIFY_TIME);
+    break;
+  case APP_EVENT_SSM_MECH_CHANGED:
+    notify_task(status_task, SSM_NOTIFY_MECH);
+    break;
+  case APP_EVENT_LOCAL_CMD_DONE:
+    notify_task(cmd_task, SSM_NOTIFY_CMD); // 結果を送る
+    break;
+  default:
+    break;
+  }
+}
+
+static void token_refresh_timer_cb(void *arg) {
+  app_events_post(APP_EVENT_TOKEN_REFRESH_DUE, NULL, 0);
+}
+
 void start_sesame_tasks(void *auth_info) {
+  network_events = xEventGroupCreate();
+  // start_sesame_tasksはIP取得後に呼ばれる
+  xEventGroupSetBits(network_events, SSM_NETWORK_BIT_UP);
+  esp_err_t err = ssm_cmd_dedup_init();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "ssm_cmd_dedup_init failed: %s", esp_err_to_name(err));
+  }
+  ssm_history_start(auth_info);
+
+  TaskHandle_t task = NULL;
   xTaskCreate(task_sesame_get_command, "sesame command get task", 8192,
-              auth_info, 5, NULL);
+              auth_info, 5, &cmd_task);
+  metrics_register_task(cmd_task);
   xTaskCreate(task_ssm_status_monitoring, "sesame status monitoring task", 8192,
-              auth_info, 10, NULL);
+              auth_info, 10, &status_task);
+  metrics_register_task(status_task);
+#if CONFIG_SSM_CMD_STREAM
+  cmd_stream.auth_info = auth_info;
+  xTaskCreate(task_stream, "sesame command stream task", 8192, &cmd_stream, 5,
+              &cmd_stream.task);
+  metrics_register_task(cmd_stream.task);
+  mech_stream.auth_info = auth_info;
+  xTaskCreate(task_stream, "sesame mech stream task", 6144, &mech_stream, 3,
+              &mech_stream.task);
+  metrics_register_task(mech_stream.task);
+#endif
+
+  err = app_events_register(ESP_EVENT_ANY_ID, app_event_handler, NULL);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "app_events_register failed: %s", esp_err_to_name(err));
+  }
+
+  // id_tokenは1時間で失効するので、その前に更新する
+  const esp_timer_create_args_t timer_args = {
+      .callback = token_refresh_timer_cb,
+      .name = "token_refresh",
+  };
+  if (esp_timer_create(&timer_args, &token_refresh_timer) == ESP_OK) {
+    esp_timer_start_periodic(
+        token_refresh_timer,
+        (uint64_t)CONFIG_FIREBASE_TOKEN_REFRESH_MIN * 60 * 1000000);
+  }
+  xTaskCreate(task_diagnostics_publish, "diagnostics publish task", 4096,
+              auth_info, 1, &task);
+  metrics_register_task(task);
 }
@@ -1,6 +1,25 @@
 #pragma once
 
 #include "firebase_internal.h"
+#include "firebase_sesame/firebase_ssm_cmd.h"
 #include "freertos/task.h"
+#include "metrics.h"
 
 void start_sesame_tasks(void *auth_info);
+
+/**
+ * @brief sesameを操作し、MECH_STATUSで目的の状態になるまで待つ
+ * (コマンドキューとローカルの受付(local_ctrl)の両方から使う)
+ * @param cmd_type コマンドの種類
+ * @return 目的の状態になった場合はtrue
+ */
+bool ssm_execute_command(firebase_ssm_cmd_type_t cmd_type);
+
+/**
+ * @brief コマンドの作成から確認までの時間を記録する
+ * 経路によらず同じ起点で比べるため、作成時刻はクライアントの時計による。
+ * 時刻が不明な場合や、通信できない間に溜まっていたものは記録しない
+ * @param id METRIC_HIST_CMD_FIREBASEまたはMETRIC_HIST_CMD_LOCAL
+ * @param issued_ms クライアントがコマンドを作成した時刻(unix time, ms)
+ */
+void ssm_observe_cmd_latency(metric_hist_id_t id, int64_t issued_ms);
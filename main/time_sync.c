@@ -0,0 +1,99 @@
+#include "time_sync.h"
+#include "app_events.h"
+#include "esp_log.h"
+#include "esp_netif_sntp.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+#include "sesame/ssm.h"
+#include "sesame/ssm_cmd.h"
+#include "sesame/ssm_sched.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define TAG "time_sync"
+
+static atomic_bool synced;
+static bool sntp_started = false; // app_eventsのループでのみ触る
+static esp_timer_handle_t resync_timer = NULL;
+
+static void sntp_sync_cb(struct timeval *tv) {
+  bool first = !atomic_exchange(&synced, true);
+  ESP_LOGI(TAG, "sntp synced: %lld", (long long)tv->tv_sec);
+  // 最初の取得時はログイン済みのsesameへすぐに書き込む
+  if (first)
+    app_events_post(APP_EVENT_TIME_SYNC_DUE, NULL, 0);
+}
+
+static void start_sntp(void) {
+  esp_sntp_config_t config =
+      ESP_NETIF_SNTP_DEFAULT_CONFIG(CONFIG_SSM_TIME_SYNC_SNTP_SERVER);
+  config.sync_cb = sntp_sync_cb;
+  esp_err_t err = esp_netif_sntp_init(&config);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "esp_netif_sntp_init failed: %s", esp_err_to_name(err));
+    return;
+  }
+  sntp_started = true;
+}
+
+static void network_up_handler(void *arg, esp_event_base_t base, int32_t id,
+                               void *event_data) {
+  // SNTPは以降lwIPが自動で再同期する
+  if (!sntp_started)
+    start_sntp();
+}
+
+static void resync_timer_cb(void *arg) {
+  app_events_post(APP_EVENT_TIME_SYNC_DUE, NULL, 0);
+}
+
+void time_sync_init(void) {
+  esp_err_t err =
+      app_events_register(APP_EVENT_NETWORK_UP, network_up_handler, NULL);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "app_events_register failed: %s", esp_err_to_name(err));
+  }
+
+  const esp_timer_create_args_t timer_args = {
+      .callback = resync_timer_cb,
+      .name = "time_resync",
+  };
+  if (esp_timer_create(&timer_args, &resync_timer) == ESP_OK) {
+    esp_timer_start_periodic(
+        resync_timer, (uint64_t)CONFIG_SSM_TIME_SYNC_INTERVAL_MIN * 60 * 1000000);
+  }
+}
+
+bool time_sync_is_valid(void) { return atomic_load(&synced); }
+
+void time_sync_observe_lock_time(uint32_t lock_time) {
+  if (!time_sync_is_valid())
+    return;
+
+  int32_t drift = (int32_t)(lock_time - (uint32_t)time(NULL));
+  metrics_gauge_set(METRIC_GAUGE_SSM_CLOCK_DRIFT_S, drift);
+  ESP_LOGI(TAG, "ssm clock drift: %" PRId32 " s", drift);
+}
+
+// 送る直前の時刻を書き込む(スケジューラのタスクから呼ばれる)
+static void write_time(sesame *ssm) {
+  send_time_cmd_to_ssm(ssm, (uint32_t)time(NULL));
+  metrics_counter_inc(METRIC_SSM_TIME_PUSHES);
+}
+
+bool time_sync_push(void) {
+  sesame *ssm = &p_ssms_env->ssm;
+  if (!time_sync_is_valid() || ssm->device_status < SSM_LOGGIN)
+    return false;
+
+  // 施錠/開錠の送信や応答待ちの間は、その後に回す
+  esp_err_t err = ssm_sched_submit_write(ssm, write_time,
+                                         SSM_SCHED_PRIO_BACKGROUND, 0, NULL);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "ssm_sched_submit_write failed: %s", esp_err_to_name(err));
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * SNTPで取得した時刻をsesameの時計へ書き込む(SSM_ITEM_CODE_TIME)。
+ * ログインのたびとCONFIG_SSM_TIME_SYNC_INTERVAL_MINごとに
+ * APP_EVENT_TIME_SYNC_DUEを送り、コマンド取得タスクが空いた時に書き込む。
+ */
+
+/**
+ * @brief SNTPの開始(最初のAPP_EVENT_NETWORK_UP)と再同期のタイマーを登録する
+ * app_events_initの後に呼ぶ
+ */
+void time_sync_init(void);
+
+/**
+ * @brief SNTPで時刻を一度でも取得できたか
+ * @return 取得前はfalse(sesameへ書き込まない)
+ */
+bool time_sync_is_valid(void);
+
+/**
+ * @brief ログインの応答に含まれるsesameの時刻とのずれを記録する
+ * @param lock_time sesameの時刻(unix time)
+ */
+void time_sync_observe_lock_time(uint32_t lock_time);
+
+/**
+ * @brief 現在時刻の書き込みをssm_schedへ背景の優先度で追加する
+ * (ログイン済みの場合のみ。キューの施錠/開錠を送り終えてから書き込む)
+ * @return 追加した場合はtrue
+ */
+bool time_sync_push(void);
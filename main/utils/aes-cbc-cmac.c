@@ -91,10 +91,53 @@ int AES_CMAC_CHECK(const unsigned char *key, const unsigned char *input, int len
 }
 
  void AES_128_ENC(unsigned const char *key, unsigned const char* msg, unsigned char *cipher){
+#if AES_128_BACKEND_CT
+	aes_ct_encrypt(key, msg, cipher);
+#else
+	AES_128_CTX ctx;
+	AES_128_INIT(&ctx, key);
+	AES_128_ENC_BLOCKS(&ctx, msg, cipher, 1);
+	AES_128_FREE(&ctx);
+#endif
+}
+
+void AES_128_INIT(AES_128_CTX *ctx, unsigned const char *key){
+#if AES_128_BACKEND_CT
+	aes_ct_init(&ctx->ct, key);
+#elif AES_128_BACKEND_HW
+	esp_aes_init(&ctx->hw);
+	esp_aes_setkey(&ctx->hw, key, 128);
+#else
+	memcpy(ctx->key, key, BLOCK_SIZE);
+#endif
+}
+
+/* 連続したブロックを同じ鍵で暗号化する(ECB) */
+void AES_128_ENC_BLOCKS(AES_128_CTX *ctx, unsigned const char *msg, unsigned char *cipher, size_t num){
+#if AES_128_BACKEND_CT
+	aes_ct_encrypt_blocks(&ctx->ct, msg, cipher, num); /* 2ブロックずつ並列に処理する */
+#elif AES_128_BACKEND_HW
+	for (; num > 0; num--, msg += BLOCK_SIZE, cipher += BLOCK_SIZE)
+		esp_aes_crypt_ecb(&ctx->hw, ESP_AES_ENCRYPT, msg, cipher);
+#else
 	unsigned char key_copy[BLOCK_SIZE];
-	memcpy(cipher, msg, BLOCK_SIZE);
-	memcpy(key_copy, key, BLOCK_SIZE);
-	aes_enc_dec(cipher, key_copy, 0);
+	for (; num > 0; num--, msg += BLOCK_SIZE, cipher += BLOCK_SIZE) {
+		memmove(cipher, msg, BLOCK_SIZE);
+		memcpy(key_copy, ctx->key, BLOCK_SIZE); /* aes_enc_decは鍵を書き換える */
+		aes_enc_dec(cipher, key_copy, 0);
+	}
+#endif
+}
+
+void AES_128_FREE(AES_128_CTX *ctx){
+#if !AES_128_BACKEND_CT && AES_128_BACKEND_HW
+	esp_aes_free(&ctx->hw);
+#else
+	volatile unsigned char *p = (volatile unsigned char *)ctx;
+	size_t n = sizeof(*ctx);
+	while (n--)
+		*p++ = 0;
+#endif
 }
 
 void AES_128_DEC(unsigned const char *key, unsigned const char* msg, unsigned char *cipher){
@@ -144,12 +187,12 @@ static void leftshift_onebit(const unsigned char *input, unsigned char *output)
 	return;
 }
 
-static void generate_subkey(const unsigned char *key, unsigned char *K1, unsigned
+static void generate_subkey(AES_128_CTX *ctx, unsigned char *K1, unsigned
 char *K2) {
 	unsigned char L[BLOCK_SIZE];
 	unsigned char tmp[BLOCK_SIZE];
 
-	AES_128_ENC(key, const_Zero, L);
+	AES_128_ENC_BLOCKS(ctx, const_Zero, L, 1);
 
 	if ((L[0] & 0x80) == 0) { /* If MSB(L) = 0, then K1 = L << 1 */
 		leftshift_onebit(L, K1);
@@ -188,7 +231,9 @@ void AES_CMAC(const unsigned char *key, const unsigned char *input, int length,
 	unsigned char X[BLOCK_SIZE], Y[BLOCK_SIZE], M_last[BLOCK_SIZE], padded[BLOCK_SIZE];
 	unsigned char K1[BLOCK_SIZE], K2[BLOCK_SIZE];
 	int n, i, flag;
-	generate_subkey(key, K1, K2);
+	AES_128_CTX ctx;
+	AES_128_INIT(&ctx, key);
+	generate_subkey(&ctx, K1, K2);
 
 	n = (length + LAST_INDEX) / BLOCK_SIZE; /* n is number of rounds */
 
@@ -213,11 +258,12 @@ void AES_CMAC(const unsigned char *key, const unsigned char *input, int length,
 	memset(X, 0, BLOCK_SIZE);
 	for (i = 0; i < n - 1; i++) {
 		xor_128(X, &input[BLOCK_SIZE * i], Y); /* Y := Mi (+) X  */
-		AES_128_ENC(key, Y, X); /* X := AES-128(KEY, Y); */
+		AES_128_ENC_BLOCKS(&ctx, Y, X, 1); /* X := AES-128(KEY, Y); */
 	}
 
 	xor_128(X, M_last, Y);
-	AES_128_ENC(key, Y, X);
+	AES_128_ENC_BLOCKS(&ctx, Y, X, 1);
+	AES_128_FREE(&ctx);
 
 	memcpy(mac, X, BLOCK_SIZE);
 }
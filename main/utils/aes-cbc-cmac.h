@@ -28,6 +28,16 @@
 #ifndef AES_CBC_CMAC_H__
 #define AES_CBC_CMAC_H__
 
+#include <stddef.h>
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+#if defined(AES_128_BACKEND_CT) || defined(CONFIG_SSM_AES_BACKEND_CT)
+#include "aes_ct.h"
+#elif defined(AES_128_BACKEND_HW) || defined(CONFIG_SSM_AES_BACKEND_HW)
+#include "aes/esp_aes.h"
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -35,6 +45,25 @@ extern "C" {
 #define BLOCK_SIZE 16
 #define LAST_INDEX (BLOCK_SIZE - 1)
 
+/* AES-128の実装の選択: ホストでは-DAES_128_BACKEND_CT=1等で選ぶ */
+#if !defined(AES_128_BACKEND_CT) && defined(CONFIG_SSM_AES_BACKEND_CT)
+#define AES_128_BACKEND_CT 1
+#endif
+#if !defined(AES_128_BACKEND_HW) && defined(CONFIG_SSM_AES_BACKEND_HW)
+#define AES_128_BACKEND_HW 1
+#endif
+
+/* 鍵を展開済みのAES-128(CCM/CMACで同じ鍵を続けて使う場合) */
+typedef struct {
+#if AES_128_BACKEND_CT
+	aes_ct_ctx_t ct;
+#elif AES_128_BACKEND_HW
+	esp_aes_context hw;
+#else
+	unsigned char key[BLOCK_SIZE];
+#endif
+} AES_128_CTX;
+
 
 
 void AES_CMAC(const unsigned char *key, const unsigned char *input, int length,
@@ -46,6 +75,9 @@ int AES_CMAC_CHECK(const unsigned char *key, const unsigned char *input,
 void xor_128(const unsigned char *a, const unsigned char *b, unsigned char *out);
 void AES_128_DEC(unsigned const char *key, unsigned const char* msg, unsigned char *cipher);
 void AES_128_ENC(unsigned const char *key, unsigned const char* msg, unsigned char *cipher);
+void AES_128_INIT(AES_128_CTX *ctx, unsigned const char *key);
+void AES_128_ENC_BLOCKS(AES_128_CTX *ctx, unsigned const char *msg, unsigned char *cipher, size_t num);
+void AES_128_FREE(AES_128_CTX *ctx);
 #ifdef DEBUG_CMAC
 void print_hex(const char *str, const unsigned char *buf, int len);
 void print128(const unsigned char *bytes);
@@ -0,0 +1,334 @@
+#include "aes_ct.h"
+#include <string.h>
+
+/*
+ * 32bitのビットスライス実装。q[0..7]の各語のビットiに、2ブロック分の
+ * 32バイトのうちの1バイトのビット(q[7]が最上位)を並べる。
+ * S-boxはBoyar-Peraltaの回路(AND 32個/XOR 83個)で計算する。
+ */
+
+static inline uint32_t dec32le(const unsigned char *src) {
+  return (uint32_t)src[0] | ((uint32_t)src[1] << 8) |
+         ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static inline void enc32le(unsigned char *dst, uint32_t x) {
+  dst[0] = (unsigned char)x;
+  dst[1] = (unsigned char)(x >> 8);
+  dst[2] = (unsigned char)(x >> 16);
+  dst[3] = (unsigned char)(x >> 24);
+}
+
+static void bitslice_sbox(uint32_t *q) {
+  uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+  uint32_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+  uint32_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+  uint32_t y20, y21;
+  uint32_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+  uint32_t z10, z11, z12, z13, z14, z15, z16, z17;
+  uint32_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+  uint32_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+  uint32_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+  uint32_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+  uint32_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+  uint32_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+  uint32_t t60, t61, t62, t63, t64, t65, t66, t67;
+  uint32_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+  x0 = q[7];
+  x1 = q[6];
+  x2 = q[5];
+  x3 = q[4];
+  x4 = q[3];
+  x5 = q[2];
+  x6 = q[1];
+  x7 = q[0];
+
+  // 入力側の線形変換
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  // GF(2^8)の逆元(非線形部)
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  // 出力側の線形変換(アフィン変換を含む)
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  q[7] = s0;
+  q[6] = s1;
+  q[5] = s2;
+  q[4] = s3;
+  q[3] = s4;
+  q[2] = s5;
+  q[1] = s6;
+  q[0] = s7;
+}
+
+#define SWAPN(cl, ch, s, x, y)                                                 \
+  do {                                                                         \
+    uint32_t a = (x), b = (y);                                                 \
+    (x) = (a & (uint32_t)(cl)) | ((b & (uint32_t)(cl)) << (s));                \
+    (y) = ((a & (uint32_t)(ch)) >> (s)) | (b & (uint32_t)(ch));                \
+  } while (0)
+#define SWAP2(x, y) SWAPN(0x55555555, 0xAAAAAAAA, 1, x, y)
+#define SWAP4(x, y) SWAPN(0x33333333, 0xCCCCCCCC, 2, x, y)
+#define SWAP8(x, y) SWAPN(0x0F0F0F0F, 0xF0F0F0F0, 4, x, y)
+
+// バイト単位の表現とビットスライス表現を相互に変換する(自身が逆変換)
+static void ortho(uint32_t *q) {
+  SWAP2(q[0], q[1]);
+  SWAP2(q[2], q[3]);
+  SWAP2(q[4], q[5]);
+  SWAP2(q[6], q[7]);
+
+  SWAP4(q[0], q[2]);
+  SWAP4(q[1], q[3]);
+  SWAP4(q[4], q[6]);
+  SWAP4(q[5], q[7]);
+
+  SWAP8(q[0], q[4]);
+  SWAP8(q[1], q[5]);
+  SWAP8(q[2], q[6]);
+  SWAP8(q[3], q[7]);
+}
+
+static inline void add_round_key(uint32_t *q, const uint32_t *sk) {
+  for (int i = 0; i < 8; i++)
+    q[i] ^= sk[i];
+}
+
+static inline void shift_rows(uint32_t *q) {
+  for (int i = 0; i < 8; i++) {
+    uint32_t x = q[i];
+    q[i] = (x & 0x000000FF) | ((x & 0x0000FC00) >> 2) |
+           ((x & 0x00000300) << 6) | ((x & 0x00F00000) >> 4) |
+           ((x & 0x000F0000) << 4) | ((x & 0xC0000000) >> 6) |
+           ((x & 0x3F000000) << 2);
+  }
+}
+
+static inline uint32_t rotr16(uint32_t x) { return (x << 16) | (x >> 16); }
+
+static inline void mix_columns(uint32_t *q) {
+  uint32_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+  uint32_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+  uint32_t r0 = (q0 >> 8) | (q0 << 24);
+  uint32_t r1 = (q1 >> 8) | (q1 << 24);
+  uint32_t r2 = (q2 >> 8) | (q2 << 24);
+  uint32_t r3 = (q3 >> 8) | (q3 << 24);
+  uint32_t r4 = (q4 >> 8) | (q4 << 24);
+  uint32_t r5 = (q5 >> 8) | (q5 << 24);
+  uint32_t r6 = (q6 >> 8) | (q6 << 24);
+  uint32_t r7 = (q7 >> 8) | (q7 << 24);
+
+  q[0] = q7 ^ r7 ^ r0 ^ rotr16(q0 ^ r0);
+  q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ rotr16(q1 ^ r1);
+  q[2] = q1 ^ r1 ^ r2 ^ rotr16(q2 ^ r2);
+  q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ rotr16(q3 ^ r3);
+  q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ rotr16(q4 ^ r4);
+  q[5] = q4 ^ r4 ^ r5 ^ rotr16(q5 ^ r5);
+  q[6] = q5 ^ r5 ^ r6 ^ rotr16(q6 ^ r6);
+  q[7] = q6 ^ r6 ^ r7 ^ rotr16(q7 ^ r7);
+}
+
+static uint32_t sub_word(uint32_t x) {
+  uint32_t q[8] = {x};
+  ortho(q);
+  bitslice_sbox(q);
+  ortho(q);
+  return q[0];
+}
+
+void aes_ct_init(aes_ct_ctx_t *ctx, const unsigned char *key) {
+  static const unsigned char rcon[AES_CT_ROUNDS] = {
+      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
+  uint32_t w[(AES_CT_ROUNDS + 1) * 4];
+
+  for (int i = 0; i < 4; i++)
+    w[i] = dec32le(key + 4 * i);
+  uint32_t tmp = w[3];
+  for (int i = 4; i < (AES_CT_ROUNDS + 1) * 4; i++) {
+    if ((i & 3) == 0) {
+      tmp = (tmp << 24) | (tmp >> 8);
+      tmp = sub_word(tmp) ^ rcon[(i >> 2) - 1];
+    }
+    tmp ^= w[i - 4];
+    w[i] = tmp;
+  }
+
+  // ラウンド鍵も2ブロック分を並べたビットスライス形式にしておく
+  for (int r = 0; r <= AES_CT_ROUNDS; r++) {
+    uint32_t q[8];
+    q[0] = q[1] = w[4 * r];
+    q[2] = q[3] = w[4 * r + 1];
+    q[4] = q[5] = w[4 * r + 2];
+    q[6] = q[7] = w[4 * r + 3];
+    ortho(q);
+    uint32_t *sk = &ctx->sk[8 * r];
+    for (int k = 0; k < 4; k++) {
+      uint32_t c = (q[2 * k] & 0x55555555) | (q[2 * k + 1] & 0xAAAAAAAA);
+      uint32_t x = c & 0x55555555;
+      uint32_t y = c & 0xAAAAAAAA;
+      sk[2 * k] = x | (x << 1);
+      sk[2 * k + 1] = y | (y >> 1);
+    }
+  }
+  memset(w, 0, sizeof(w));
+}
+
+// 2ブロック(32 bytes)を暗号化する
+static void encrypt2(const aes_ct_ctx_t *ctx, uint32_t *q) {
+  add_round_key(q, ctx->sk);
+  for (int r = 1; r < AES_CT_ROUNDS; r++) {
+    bitslice_sbox(q);
+    shift_rows(q);
+    mix_columns(q);
+    add_round_key(q, &ctx->sk[8 * r]);
+  }
+  bitslice_sbox(q);
+  shift_rows(q);
+  add_round_key(q, &ctx->sk[8 * AES_CT_ROUNDS]);
+}
+
+void aes_ct_encrypt_blocks(const aes_ct_ctx_t *ctx, const unsigned char *in,
+                           unsigned char *out, size_t num) {
+  while (num > 0) {
+    size_t n = num >= 2 ? 2 : 1;
+    uint32_t q[8] = {0};
+    for (size_t b = 0; b < n; b++) {
+      for (int i = 0; i < 4; i++)
+        q[2 * i + b] = dec32le(in + AES_CT_BLOCK_SIZE * b + 4 * i);
+    }
+    ortho(q);
+    encrypt2(ctx, q);
+    ortho(q);
+    for (size_t b = 0; b < n; b++) {
+      for (int i = 0; i < 4; i++)
+        enc32le(out + AES_CT_BLOCK_SIZE * b + 4 * i, q[2 * i + b]);
+    }
+    in += AES_CT_BLOCK_SIZE * n;
+    out += AES_CT_BLOCK_SIZE * n;
+    num -= n;
+  }
+}
+
+void aes_ct_encrypt(const unsigned char *key, const unsigned char *in,
+                    unsigned char *out) {
+  aes_ct_ctx_t ctx;
+  aes_ct_init(&ctx, key);
+  aes_ct_encrypt_blocks(&ctx, in, out, 1);
+  memset(&ctx, 0, sizeof(ctx));
+}
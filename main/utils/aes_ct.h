@@ -0,0 +1,56 @@
+#ifndef AES_CT_H__
+#define AES_CT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * ビットスライスによる定数時間のAES-128(暗号化のみ)。
+ * 32bitの語を8本使い、2ブロックを同時に処理する。S-boxの表引きや
+ * データに依存する分岐がないので、キャッシュやタイミングから鍵が漏れない。
+ * TI_aes_128.cの代わりにAES_128_ENCから使う(Kconfigで選択)。
+ */
+
+#define AES_CT_ROUNDS 10
+#define AES_CT_BLOCK_SIZE 16
+
+// 展開済みの鍵(ビットスライス形式、352 bytes)
+typedef struct {
+  uint32_t sk[(AES_CT_ROUNDS + 1) * 8];
+} aes_ct_ctx_t;
+
+/**
+ * @brief 鍵を展開する
+ * @param ctx 展開した鍵の格納先
+ * @param key 16 bytesの鍵
+ */
+void aes_ct_init(aes_ct_ctx_t *ctx, const unsigned char *key);
+
+/**
+ * @brief 展開済みの鍵で複数ブロックを暗号化する(ECB)
+ * @param ctx aes_ct_initで展開した鍵
+ * @param in 平文(16 * num bytes)
+ * @param out 暗号文の格納先(inと同じでもよい)
+ * @param num ブロック数
+ */
+void aes_ct_encrypt_blocks(const aes_ct_ctx_t *ctx, const unsigned char *in,
+                           unsigned char *out, size_t num);
+
+/**
+ * @brief 鍵の展開と1ブロックの暗号化をまとめて行う
+ * @param key 16 bytesの鍵
+ * @param in 平文16 bytes
+ * @param out 暗号文の格納先(inと同じでもよい)
+ */
+void aes_ct_encrypt(const unsigned char *key, const unsigned char *in,
+                    unsigned char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AES_CT_H__ */
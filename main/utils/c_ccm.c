@@ -7,12 +7,11 @@
 #define CCM_ENCRYPT 0
 #define CCM_DECRYPT 1
 
-static int aes_ecb_encrypt(const uint8_t * pKey, uint8_t * input, uint8_t * output)
-{
-    AES_128_ENC(pKey, input, output);
-
-    return 0;
-}
+/* Number of CTR keystream blocks generated per call
+ * (overridden with 1 by the host benchmark for comparison) */
+#ifndef CCM_CTR_BATCH
+#define CCM_CTR_BATCH 4
+#endif
 
 /* Implementation that should never be optimized out by the compiler */
 static void mbedtls_zeroize(void * v, size_t n)
@@ -35,35 +34,48 @@ static void mbedtls_zeroize(void * v, size_t n)
     for (i = 0; i < 16; i++)                                                                                                                                                                                                                                  \
         y[i] ^= b[i];                                                                                                                                                                                                                                         \
                                                                                                                                                                                                                                                               \
-    if ((ret = aes_ecb_encrypt(key, y, y)) != 0)                                                                                                                                                                                                              \
-        return (ret);
+    AES_128_ENC_BLOCKS(&aes, y, y, 1);
 
 /*
- * Encrypt or decrypt a partial block with CTR
- * Warning: using b for temporary storage! src and dst must not be b!
- * This avoids allocating one more 16 bytes buffer while allowing src == dst.
+ * Generate the CTR keystream for counter values first .. first + num - 1
+ * in one call, so that the block cipher can process several counter
+ * blocks side by side (two per pass for the bitsliced AES).
  */
-#define CTR_CRYPT_1(dst, src, len)                                                                                                                                                                                                                            \
-    if ((ret = aes_ecb_encrypt(key, ctr, b)) != 0)                                                                                                                                                                                                            \
-        return (ret);                                                                                                                                                                                                                                         \
-                                                                                                                                                                                                                                                              \
-    for (i = 0; i < len; i++)                                                                                                                                                                                                                                 \
-        dst[i] = src[i] ^ b[i];
+static void ctr_keystream(AES_128_CTX * aes, const unsigned char * ctr, unsigned char q, size_t first, size_t num, unsigned char * out)
+{
+    unsigned char blocks[CCM_CTR_BATCH * 16];
+    unsigned char i;
+    size_t n;
+
+    for (n = 0; n < num; n++)
+    {
+        unsigned char * c = blocks + 16 * n;
+        size_t value     = first + n;
+
+        memcpy(c, ctr, 16);
+        for (i = 0; i < q; i++, value >>= 8)
+            c[15 - i] = (unsigned char) (value & 0xFF);
+    }
+    AES_128_ENC_BLOCKS(aes, blocks, out, num);
+}
 
 /*
  * Authenticated encryption or decryption
  */
 static int ccm_auth_crypt(int mode, const unsigned char * key, const unsigned char * iv, size_t iv_len, const unsigned char * add, size_t add_len, const unsigned char * input, size_t length, unsigned char * output, unsigned char * tag, size_t tag_len)
 {
-    int ret;
     unsigned char i;
     unsigned char q;
     size_t len_left;
+    size_t blocks, n, ks_first, ks_num;
     unsigned char b[16];
     unsigned char y[16];
     unsigned char ctr[16];
+    unsigned char s0[16];
+    unsigned char ks[CCM_CTR_BATCH * 16];
     const unsigned char * src;
     unsigned char * dst;
+    AES_128_CTX aes;
 
     /*
      * Check length requirements: SP800-38C A.1
@@ -107,6 +119,9 @@ static int ccm_auth_crypt(int mode, const unsigned char * key, const unsigned ch
     if (len_left > 0)
         return (MBEDTLS_ERR_CCM_BAD_INPUT);
 
+    /* Expand the key once for all blocks of this message */
+    AES_128_INIT(&aes, key);
+
     /* Start CBC-MAC with first block */
     memset(y, 0, 16);
     UPDATE_CBC_MAC_1;
@@ -158,7 +173,16 @@ static int ccm_auth_crypt(int mode, const unsigned char * key, const unsigned ch
     ctr[0] = q - 1;
     memcpy(ctr + 1, iv, iv_len);
     memset(ctr + 1 + iv_len, 0, q);
-    ctr[15] = 1;
+
+    /*
+     * The keystream is generated CCM_CTR_BATCH blocks at a time.
+     * The first batch starts at counter 0, whose block S_0 masks the tag.
+     */
+    blocks   = (length + 15) / 16;
+    ks_first = 0;
+    ks_num   = blocks + 1 < CCM_CTR_BATCH ? blocks + 1 : CCM_CTR_BATCH;
+    ctr_keystream(&aes, ctr, q, ks_first, ks_num, ks);
+    memcpy(s0, ks, 16);
 
     /*
      * Authenticate and {en,de}crypt the message.
@@ -170,9 +194,10 @@ static int ccm_auth_crypt(int mode, const unsigned char * key, const unsigned ch
     src      = input;
     dst      = output;
 
-    while (len_left > 0)
+    for (n = 1; len_left > 0; n++)
     {
         size_t use_len = len_left > 16 ? 16 : len_left;
+        const unsigned char * k;
 
         if (mode == CCM_ENCRYPT)
         {
@@ -181,7 +206,19 @@ static int ccm_auth_crypt(int mode, const unsigned char * key, const unsigned ch
             UPDATE_CBC_MAC_1;
         }
 
-        CTR_CRYPT_1(dst, src, use_len);
+        /*
+         * Counter values cannot overflow the q length bytes
+         * thanks to the length check above.
+         */
+        if (n >= ks_first + ks_num)
+        {
+            ks_first = n;
+            ks_num   = blocks - n + 1 < CCM_CTR_BATCH ? blocks - n + 1 : CCM_CTR_BATCH;
+            ctr_keystream(&aes, ctr, q, ks_first, ks_num, ks);
+        }
+        k = ks + 16 * (n - ks_first);
+        for (i = 0; i < use_len; i++)
+            dst[i] = src[i] ^ k[i];
 
         if (mode == CCM_DECRYPT)
         {
@@ -193,25 +230,20 @@ static int ccm_auth_crypt(int mode, const unsigned char * key, const unsigned ch
         dst += use_len;
         src += use_len;
         len_left -= use_len;
-
-        /*
-         * Increment counter.
-         * No need to check for overflow thanks to the length check above.
-         */
-        for (i = 0; i < q; i++)
-            if (++ctr[15 - i] != 0)
-                break;
     }
 
     /*
-     * Authentication: reset counter and crypt/mask internal tag
+     * Authentication: crypt/mask internal tag with S_0
      */
-    for (i = 0; i < q; i++)
-        ctr[15 - i] = 0;
-
-    CTR_CRYPT_1(y, y, 16);
+    for (i = 0; i < 16; i++)
+        y[i] ^= s0[i];
     memcpy(tag, y, tag_len);
 
+    AES_128_FREE(&aes);
+    mbedtls_zeroize(ks, sizeof(ks));
+    mbedtls_zeroize(s0, sizeof(s0));
+    mbedtls_zeroize(y, sizeof(y));
+
     return (0);
 }
 
@@ -1,25 +1,208 @@
 // this is a file that contains the wifi functions
 #include <stdio.h>
+#include <string.h>
 #include "esp_wifi.h"
 #include "esp_log.h"
 #include "esp_event.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "app_events.h"
+#include "boot.h"
+#include "metrics.h"
 
 #define WIFI_CONNECTED_BIT BIT0
 
+#define WIFI_NVS_NAMESPACE "wifi"
+#define WIFI_NVS_KEY "fast"
+#define WIFI_BACKOFF_BASE_MS 500
+#define WIFI_BACKOFF_MAX_MS 30000
+#define WIFI_FAST_MAX_FAILURES 3 // この回数連続で失敗したらヒントを捨ててスキャンする
+
+// 前回接続できたAPとIPの情報(NVSにそのまま保存する)
+typedef struct {
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip;
+  uint32_t netmask;
+  uint32_t gw;
+} wifi_fast_cache_t;
+
+// 接続経路(IP取得までの時間をそれぞれ計測する)
+typedef enum {
+  WIFI_PATH_COLD = 0, // キャッシュなし(全チャンネルスキャン+DHCP)
+  WIFI_PATH_FAST,     // 起動時にキャッシュしたBSSID/チャンネルで接続
+  WIFI_PATH_WARM,     // 起動後の切断からの再接続
+} wifi_path_t;
+
 static EventGroupHandle_t wifi_event_group;
 static const char *TAG = "wifi";
 
+static esp_netif_t *sta_netif = NULL;
+static esp_timer_handle_t reconnect_timer = NULL;
+static wifi_fast_cache_t fast_cache;       // NVSに保存済みの内容
+static uint8_t connected_bssid[6];         // 現在接続しているAP
+static uint8_t connected_channel = 0;
+static bool fast_cache_valid = false;
+static bool hints_applied = false;
+static uint32_t failures = 0;
+static wifi_path_t connect_path = WIFI_PATH_COLD;
+static int64_t connect_start_us = 0;
+
+static const metric_hist_id_t path_hists[] = {
+    [WIFI_PATH_COLD] = METRIC_HIST_WIFI_CONNECT_COLD,
+    [WIFI_PATH_FAST] = METRIC_HIST_WIFI_CONNECT_FAST,
+    [WIFI_PATH_WARM] = METRIC_HIST_WIFI_CONNECT_WARM,
+};
+
+static bool load_fast_cache(void) {
+  nvs_handle_t handle;
+  if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    return false;
+
+  size_t len = sizeof(fast_cache);
+  esp_err_t err = nvs_get_blob(handle, WIFI_NVS_KEY, &fast_cache, &len);
+  nvs_close(handle);
+  return err == ESP_OK && len == sizeof(fast_cache) && fast_cache.channel != 0;
+}
+
+static void save_fast_cache(const wifi_fast_cache_t *cache) {
+  // 変化がなければフラッシュに書き込まない
+  if (fast_cache_valid && memcmp(cache, &fast_cache, sizeof(fast_cache)) == 0)
+    return;
+
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if (err == ESP_OK) {
+    err = nvs_set_blob(handle, WIFI_NVS_KEY, cache, sizeof(*cache));
+    if (err == ESP_OK)
+      err = nvs_commit(handle);
+    nvs_close(handle);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "failed to save fast connect cache: %s", esp_err_to_name(err));
+    return;
+  }
+  fast_cache = *cache;
+  fast_cache_valid = true;
+}
+
+// DHCPを使わずにIPを設定する(CONFIG_WIFI_IP_STATIC/CONFIG_WIFI_IP_REUSE_LEASE)
+static void apply_static_ip(void) {
+  esp_netif_ip_info_t ip_info = {0};
+#if CONFIG_WIFI_IP_STATIC
+  esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_IP_ADDR, &ip_info.ip);
+  esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_IP_NETMASK, &ip_info.netmask);
+  esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_IP_GW, &ip_info.gw);
+#elif CONFIG_WIFI_IP_REUSE_LEASE
+  if (!fast_cache_valid || fast_cache.ip == 0)
+    return; // 前回のリースがないので初回はDHCP
+  ip_info.ip.addr = fast_cache.ip;
+  ip_info.netmask.addr = fast_cache.netmask;
+  ip_info.gw.addr = fast_cache.gw;
+#else
+  return;
+#endif
+
+  if (esp_netif_dhcpc_stop(sta_netif) != ESP_OK ||
+      esp_netif_set_ip_info(sta_netif, &ip_info) != ESP_OK) {
+    ESP_LOGW(TAG, "failed to set static ip, fall back to DHCP");
+    esp_netif_dhcpc_start(sta_netif);
+    return;
+  }
+
+  // DNSはゲートウェイに問い合わせる
+  esp_netif_dns_info_t dns = {0};
+  dns.ip.u_addr.ip4 = ip_info.gw;
+  dns.ip.type = ESP_IPADDR_TYPE_V4;
+  esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+}
+
+// BSSID/チャンネルのヒントを外して全チャンネルスキャン+DHCPに戻す
+static void drop_fast_hints(void) {
+  wifi_config_t wifi_config;
+  if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK)
+    return;
+
+  wifi_config.sta.bssid_set = false;
+  wifi_config.sta.channel = 0;
+  wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+  esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+#if CONFIG_WIFI_IP_REUSE_LEASE
+  esp_netif_dhcpc_start(sta_netif);
+#endif
+  hints_applied = false;
+  ESP_LOGW(TAG, "fast connect failed %d times, fall back to full scan",
+           WIFI_FAST_MAX_FAILURES);
+}
+
+static void reconnect_timer_cb(void *arg) {
+  esp_wifi_connect();
+}
+
+static void start_connect(wifi_path_t path) {
+  connect_path = path;
+  connect_start_us = esp_timer_get_time();
+  esp_wifi_connect();
+}
+
+// 連続失敗回数に応じて待ってから再接続する
+static void schedule_reconnect(void) {
+  failures++;
+  if (hints_applied && failures >= WIFI_FAST_MAX_FAILURES) {
+    drop_fast_hints();
+  }
+
+  uint32_t shift = failures - 1 < 6 ? failures - 1 : 6;
+  uint32_t delay_ms = WIFI_BACKOFF_BASE_MS << shift;
+  if (delay_ms > WIFI_BACKOFF_MAX_MS)
+    delay_ms = WIFI_BACKOFF_MAX_MS;
+
+  if (!reconnect_timer || esp_timer_is_active(reconnect_timer))
+    return;
+  esp_timer_start_once(reconnect_timer, (uint64_t)delay_ms * 1000);
+}
+
 // wifiイベントハンドラ
 void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-    esp_wifi_connect();
+    start_connect(hints_applied ? WIFI_PATH_FAST : WIFI_PATH_COLD);
   } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+    bool was_connected = xEventGroupGetBits(wifi_event_group) & WIFI_CONNECTED_BIT;
     xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
-    esp_wifi_connect();
+    if (was_connected) {
+      // 接続中の切断は計測をやり直す
+      metrics_counter_inc(METRIC_WIFI_DISCONNECTS);
+      app_events_post(APP_EVENT_NETWORK_DOWN, NULL, 0);
+      connect_path = WIFI_PATH_WARM;
+      connect_start_us = esp_timer_get_time();
+    }
+    schedule_reconnect();
+  } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+    wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+    memcpy(connected_bssid, event->bssid, sizeof(connected_bssid));
+    connected_channel = event->channel;
   } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-    ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    int64_t elapsed_us = esp_timer_get_time() - connect_start_us;
+    ESP_LOGI(TAG, "Got IP: " IPSTR " (%s path, %d ms)", IP2STR(&event->ip_info.ip),
+             connect_path == WIFI_PATH_FAST   ? "fast"
+             : connect_path == WIFI_PATH_WARM ? "warm"
+                                              : "cold",
+             (int)(elapsed_us / 1000));
+    metrics_hist_observe(path_hists[connect_path], elapsed_us);
+    failures = 0;
+
+    wifi_fast_cache_t cache = {0};
+    memcpy(cache.bssid, connected_bssid, sizeof(cache.bssid));
+    cache.channel = connected_channel;
+    cache.ip = event->ip_info.ip.addr;
+    cache.netmask = event->ip_info.netmask.addr;
+    cache.gw = event->ip_info.gw.addr;
+    save_fast_cache(&cache);
+
     xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+    boot_mark(BOOT_PHASE_WIFI_UP);
+    app_events_post(APP_EVENT_NETWORK_UP, NULL, 0);
   }
 }
 
@@ -33,11 +216,18 @@ void wifi_init(void) {
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
     // デフォルトのWiFi stationインターフェースを作成
-    esp_netif_create_default_wifi_sta();
+    sta_netif = esp_netif_create_default_wifi_sta();
 
     // WiFiイベントグループの作成
     wifi_event_group = xEventGroupCreate();
 
+    // 再接続用タイマーの作成
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_timer_cb,
+        .name = "wifi_reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &reconnect_timer));
+
     // WiFiの初期化
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -49,14 +239,30 @@ void wifi_init(void) {
         .sta = {
             .ssid = CONFIG_WIFI_SSID,
             .password = CONFIG_WIFI_PASSWORD,
+            .scan_method = WIFI_ALL_CHANNEL_SCAN,
         },
     };
 
+    fast_cache_valid = load_fast_cache();
+#if CONFIG_WIFI_FAST_CONNECT
+    // 前回接続できたAPへスキャンせずに直接接続する
+    if (fast_cache_valid) {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, fast_cache.bssid, sizeof(fast_cache.bssid));
+        wifi_config.sta.channel = fast_cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        hints_applied = true;
+    }
+#endif
+    apply_static_ip();
+#if CONFIG_SSM_POWER_SAVE
+    // modem sleep中はこのDTIM間隔ごとにビーコンを受信する
+    wifi_config.sta.listen_interval = CONFIG_SSM_POWER_WIFI_LISTEN_INTERVAL;
+#endif
+
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
 
-    // WiFi接続を待機
-    xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
-    ESP_LOGI(TAG, "WiFi connected");
-}
\ No newline at end of file
+    // 接続完了はboot_mark(BOOT_PHASE_WIFI_UP)で通知するのでここでは待たない
+}
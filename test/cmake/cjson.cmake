@@ -0,0 +1,15 @@
+# cJSONのソース(ESP-IDFのcomponents/json/cJSON、またはCJSON_SOURCE_DIR)から
+# ホスト用のライブラリを作る
+if(NOT TARGET cjson)
+  if(DEFINED ENV{IDF_PATH})
+    set(cjson_default "$ENV{IDF_PATH}/components/json/cJSON")
+  endif()
+  set(CJSON_SOURCE_DIR "${cjson_default}" CACHE PATH
+      "Directory containing cJSON.c and cJSON.h")
+  if(NOT EXISTS "${CJSON_SOURCE_DIR}/cJSON.c")
+    message(FATAL_ERROR
+            "cJSON.c not found: set IDF_PATH or -DCJSON_SOURCE_DIR=<dir>")
+  endif()
+  add_library(cjson STATIC ${CJSON_SOURCE_DIR}/cJSON.c)
+  target_include_directories(cjson PUBLIC ${CJSON_SOURCE_DIR})
+endif()
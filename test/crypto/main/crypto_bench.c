@@ -0,0 +1,286 @@
+#include "crypto_bench.h"
+#include "aes-cbc-cmac.h"
+#include "c_ccm.h"
+#include "uECC.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#endif
+
+#define CRYPTO_BENCH_MIN_US 100000 // 1項目あたりの最小計測時間
+#define CRYPTO_BENCH_MAX_LEN 80    // SESAMEのメッセージの最大長(b_buf)
+
+#define TAG "crypto_bench"
+
+#ifdef ESP_PLATFORM
+#define BENCH_LOGE(...) ESP_LOGE(TAG, __VA_ARGS__)
+
+static int64_t now_us(void) { return esp_timer_get_time(); }
+
+static uint32_t cycles(void) { return esp_cpu_get_cycle_count(); }
+
+static int bench_rng(uint8_t *dest, unsigned size) {
+  esp_fill_random(dest, size);
+  return 1;
+}
+#else
+#define BENCH_LOGE(fmt, ...) fprintf(stderr, TAG ": " fmt "\n", ##__VA_ARGS__)
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static uint32_t cycles(void) { return (uint32_t)__builtin_ia32_rdtsc(); }
+#else
+static uint32_t cycles(void) { return 0; } // サイクル数は取れない
+#endif
+
+static int bench_rng(uint8_t *dest, unsigned size) {
+  while (size--)
+    *dest++ = (uint8_t)rand();
+  return 1;
+}
+#endif
+
+// FIPS-197 Appendix C.1
+static const uint8_t aes_key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+                                    0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+                                    0x0c, 0x0d, 0x0e, 0x0f};
+static const uint8_t aes_pt[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+                                   0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+                                   0xcc, 0xdd, 0xee, 0xff};
+static const uint8_t aes_ct[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b,
+                                   0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80,
+                                   0x70, 0xb4, 0xc5, 0x5a};
+
+// RFC 4493 Example 2
+static const uint8_t cmac_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae,
+                                     0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88,
+                                     0x09, 0xcf, 0x4f, 0x3c};
+static const uint8_t cmac_msg[16] = {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40,
+                                     0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11,
+                                     0x73, 0x93, 0x17, 0x2a};
+static const uint8_t cmac_mac[16] = {0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d,
+                                     0x41, 0x44, 0xf7, 0x9b, 0xdd, 0x9d,
+                                     0xd0, 0x4a, 0x28, 0x7c};
+
+// RFC 3610 Packet Vector #1
+static const uint8_t ccm_key[16] = {0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5,
+                                    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb,
+                                    0xcc, 0xcd, 0xce, 0xcf};
+static const uint8_t ccm_nonce[13] = {0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00,
+                                      0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5};
+static const uint8_t ccm_aad[8] = {0x00, 0x01, 0x02, 0x03,
+                                   0x04, 0x05, 0x06, 0x07};
+static const uint8_t ccm_pt[23] = {0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d,
+                                   0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13,
+                                   0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+                                   0x1a, 0x1b, 0x1c, 0x1d, 0x1e};
+static const uint8_t ccm_ct[23 + 8] = {
+    0x58, 0x8c, 0x97, 0x9a, 0x61, 0xc6, 0x63, 0xd2, 0xf0, 0x66, 0xd0,
+    0xc2, 0xc0, 0xf9, 0x89, 0x80, 0x6d, 0x5f, 0x6b, 0x61, 0xda, 0xc3,
+    0x84, 0x17, 0xe8, 0xd1, 0x2c, 0xfd, 0xf9, 0x26, 0xe0};
+
+static bool selftest_aes(void) {
+  uint8_t out[16];
+  AES_128_ENC(aes_key, aes_pt, out);
+  return memcmp(out, aes_ct, sizeof(out)) == 0;
+}
+
+static bool selftest_cmac(void) {
+  uint8_t mac[16];
+  AES_CMAC(cmac_key, cmac_msg, sizeof(cmac_msg), mac);
+  return memcmp(mac, cmac_mac, sizeof(mac)) == 0;
+}
+
+static bool selftest_ccm(void) {
+  uint8_t out[sizeof(ccm_ct)];
+  uint8_t back[sizeof(ccm_pt)];
+  aes_ccm_encrypt_and_tag(ccm_key, ccm_nonce, sizeof(ccm_nonce), ccm_aad,
+                          sizeof(ccm_aad), ccm_pt, sizeof(ccm_pt), out,
+                          out + sizeof(ccm_pt), 8);
+  if (memcmp(out, ccm_ct, sizeof(ccm_ct)) != 0)
+    return false;
+  if (aes_ccm_auth_decrypt(ccm_key, ccm_nonce, sizeof(ccm_nonce), ccm_aad,
+                           sizeof(ccm_aad), out, sizeof(ccm_pt), back,
+                           out + sizeof(ccm_pt), 8) != 0)
+    return false;
+  // タグを壊したものは拒否されること
+  out[sizeof(ccm_pt)] ^= 1;
+  return memcmp(back, ccm_pt, sizeof(ccm_pt)) == 0 &&
+         aes_ccm_auth_decrypt(ccm_key, ccm_nonce, sizeof(ccm_nonce), ccm_aad,
+                              sizeof(ccm_aad), out, sizeof(ccm_pt), back,
+                              out + sizeof(ccm_pt), 8) != 0;
+}
+
+// 2組の鍵で共有した秘密が一致すること
+// (_litの鍵はSESAMEに送る並びなので、uECC_valid_public_keyでは検査できない)
+static bool selftest_ecdh(void) {
+  uint8_t pub_a[64], priv_a[32], pub_b[64], priv_b[32];
+  uint8_t secret_a[32], secret_b[32];
+  uECC_Curve curve = uECC_secp256r1();
+  uECC_set_rng(bench_rng);
+  return uECC_make_key_lit(pub_a, priv_a, curve) &&
+         uECC_make_key_lit(pub_b, priv_b, curve) &&
+         uECC_shared_secret_lit(pub_b, priv_a, secret_a, curve) &&
+         uECC_shared_secret_lit(pub_a, priv_b, secret_b, curve) &&
+         memcmp(secret_a, secret_b, sizeof(secret_a)) == 0;
+}
+
+bool crypto_bench_selftest(void) {
+  bool ok = true;
+  if (!selftest_aes()) {
+    BENCH_LOGE("AES-128 KAT failed");
+    ok = false;
+  }
+  if (!selftest_cmac()) {
+    BENCH_LOGE("AES-CMAC KAT failed");
+    ok = false;
+  }
+  if (!selftest_ccm()) {
+    BENCH_LOGE("AES-CCM KAT failed");
+    ok = false;
+  }
+  if (!selftest_ecdh()) {
+    BENCH_LOGE("ECDH consistency check failed");
+    ok = false;
+  }
+  return ok;
+}
+
+// ベンチマーク対象(lenは処理するバイト数)
+static uint8_t bench_buf[CRYPTO_BENCH_MAX_LEN + 16];
+static uint8_t bench_tag[4];
+static uint8_t bench_mac[16];
+static uint8_t bench_pub[64], bench_priv[32], bench_secret[32];
+
+static void run_aes_oneshot(size_t len) {
+  AES_128_ENC(aes_key, bench_buf, bench_buf);
+}
+
+static void run_aes_blocks(size_t len) {
+  AES_128_CTX ctx;
+  AES_128_INIT(&ctx, aes_key);
+  AES_128_ENC_BLOCKS(&ctx, bench_buf, bench_buf, len / 16);
+  AES_128_FREE(&ctx);
+}
+
+static void run_cmac(size_t len) {
+  AES_CMAC(cmac_key, bench_buf, (int)len, bench_mac);
+}
+
+static void run_ccm_encrypt(size_t len) {
+  aes_ccm_encrypt_and_tag(ccm_key, ccm_nonce, sizeof(ccm_nonce), ccm_aad, 1,
+                          bench_buf, len, bench_buf, bench_tag,
+                          sizeof(bench_tag));
+}
+
+static void run_ccm_decrypt(size_t len) {
+  // タグは一致しないが、処理量は成功した場合と同じ
+  aes_ccm_auth_decrypt(ccm_key, ccm_nonce, sizeof(ccm_nonce), ccm_aad, 1,
+                       bench_buf, len, bench_buf, bench_tag,
+                       sizeof(bench_tag));
+}
+
+static void run_ecc_keygen(size_t len) {
+  uECC_make_key_lit(bench_pub, bench_priv, uECC_secp256r1());
+}
+
+static void run_ecdh(size_t len) {
+  uECC_shared_secret_lit(bench_pub, bench_priv, bench_secret,
+                         uECC_secp256r1());
+}
+
+typedef struct {
+  const char *name;
+  void (*run)(size_t len);
+  size_t len; // 0はバイト数に依存しない処理
+} bench_item_t;
+
+static const bench_item_t bench_items[] = {
+    {"aes_oneshot", run_aes_oneshot, 16},
+    {"aes_ctx", run_aes_blocks, 16},
+    {"aes_ctx", run_aes_blocks, 64},
+    {"cmac", run_cmac, 4}, // ログインのtoken(random_code 4 bytes)
+    {"cmac", run_cmac, 64},
+    {"ccm_encrypt", run_ccm_encrypt, 16},
+    {"ccm_encrypt", run_ccm_encrypt, CRYPTO_BENCH_MAX_LEN},
+    {"ccm_decrypt", run_ccm_decrypt, 16},
+    {"ccm_decrypt", run_ccm_decrypt, CRYPTO_BENCH_MAX_LEN},
+    {"ecc_keygen", run_ecc_keygen, 0},
+    {"ecdh", run_ecdh, 0},
+};
+
+static cJSON *bench_one(const bench_item_t *item) {
+  item->run(item->len); // 初回のキャッシュ等の影響を除く
+
+  uint32_t iterations = 0;
+  uint64_t total_cycles = 0;
+  int64_t start = now_us();
+  int64_t elapsed;
+  do {
+    uint32_t c0 = cycles();
+    item->run(item->len);
+    total_cycles += (uint32_t)(cycles() - c0); // 1回ごとなら32bitで溢れない
+    iterations++;
+    elapsed = now_us() - start;
+  } while (elapsed < CRYPTO_BENCH_MIN_US);
+
+  cJSON *json = cJSON_CreateObject();
+  if (!json)
+    return NULL;
+  cJSON_AddStringToObject(json, "name", item->name);
+  cJSON_AddNumberToObject(json, "bytes", item->len);
+  cJSON_AddNumberToObject(json, "ops_per_sec",
+                          (double)iterations * 1000000.0 / (double)elapsed);
+  double cycles_per_op = (double)total_cycles / iterations;
+  cJSON_AddNumberToObject(json, "cycles_per_op", cycles_per_op);
+  if (item->len > 0)
+    cJSON_AddNumberToObject(json, "cycles_per_byte", cycles_per_op / item->len);
+  return json;
+}
+
+static const char *backend_name(void) {
+#if AES_128_BACKEND_CT
+  return "ct";
+#elif AES_128_BACKEND_HW
+  return "hw";
+#else
+  return "ti";
+#endif
+}
+
+cJSON *crypto_bench_run(void) {
+  cJSON *root = cJSON_CreateObject();
+  if (!root)
+    return NULL;
+
+  cJSON_AddStringToObject(root, "aes_backend", backend_name());
+  cJSON_AddBoolToObject(root, "selftest", crypto_bench_selftest());
+
+  // 鍵交換の計測用の鍵
+  uECC_set_rng(bench_rng);
+  uECC_make_key_lit(bench_pub, bench_priv, uECC_secp256r1());
+  memset(bench_buf, 0x5a, sizeof(bench_buf));
+
+  cJSON *results = cJSON_AddArrayToObject(root, "results");
+  for (size_t i = 0;
+       results && i < sizeof(bench_items) / sizeof(bench_items[0]); i++) {
+    cJSON *json = bench_one(&bench_items[i]);
+    if (json)
+      cJSON_AddItemToArray(results, json);
+  }
+  return root;
+}
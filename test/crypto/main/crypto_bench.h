@@ -0,0 +1,23 @@
+#pragma once
+
+#include "cJSON.h"
+#include <stdbool.h>
+
+/*
+ * main/utils/の暗号(AES, CMAC, CCM, ECDH)の既知解テストとベンチマーク。
+ * SESAMEのメッセージの大きさで ops/sec と cycles/byte を測り、JSONで返す。
+ * ホストとデバイス(ESP-IDFのアプリ)の両方でビルドする(test/crypto/CMakeLists.txt)。
+ */
+
+/**
+ * @brief 既知解テストを行う
+ * @return 全て一致した場合はtrue
+ */
+bool crypto_bench_selftest(void);
+
+/**
+ * @brief 既知解テストとベンチマークを行い、結果をJSONで返す
+ * 数百msかかるので優先度の低いタスクから呼ぶ
+ * @return 結果(呼び出し側でcJSON_Deleteする)。メモリ不足の場合はNULL
+ */
+cJSON *crypto_bench_run(void);
@@ -0,0 +1,27 @@
+#include "crypto_bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// 結果のJSONを出力し、既知解テストに失敗した場合は1を返す
+static int run(void) {
+  cJSON *root = crypto_bench_run();
+  char *json = root ? cJSON_Print(root) : NULL;
+  if (!json) {
+    cJSON_Delete(root);
+    return 1;
+  }
+  printf("%s\n", json);
+  bool ok = cJSON_IsTrue(cJSON_GetObjectItem(root, "selftest"));
+  free(json);
+  cJSON_Delete(root);
+  return ok ? 0 : 1;
+}
+
+#ifdef ESP_PLATFORM
+void app_main(void) {
+  // 結果はシリアルのログで確認する
+  printf("crypto_bench %s\n", run() == 0 ? "passed" : "FAILED");
+}
+#else
+int main(void) { return run(); }
+#endif
@@ -0,0 +1,93 @@
+// AES-CCM(c_ccm.c)の暗号化/復号のスループットを16B, 80B(b_buf), 4KBで測る
+// AESの実装(AES_128_BACKEND_*)とCTRのまとめ数(CCM_CTR_BATCH)ごとにビルドする
+
+#include "aes-cbc-cmac.h"
+#include "bench_util.h"
+#include "c_ccm.h"
+#include "test_util.h"
+#include <string.h>
+
+#define BENCH_MAX_LEN 4096
+#define TAG_LEN 4 // SESAMEのメッセージと同じ
+
+#if AES_128_BACKEND_CT
+#define BACKEND "ct"
+#else
+#define BACKEND "ti"
+#endif
+
+// RFC 3610 Packet Vector #1
+static const uint8_t key[16] = {0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5,
+                                0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb,
+                                0xcc, 0xcd, 0xce, 0xcf};
+static const uint8_t nonce[13] = {0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00,
+                                  0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5};
+static const uint8_t aad[8] = {0x00, 0x01, 0x02, 0x03,
+                               0x04, 0x05, 0x06, 0x07};
+static const uint8_t pt[23] = {0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+                               0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+                               0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e};
+static const uint8_t ct[23 + 8] = {
+    0x58, 0x8c, 0x97, 0x9a, 0x61, 0xc6, 0x63, 0xd2, 0xf0, 0x66, 0xd0,
+    0xc2, 0xc0, 0xf9, 0x89, 0x80, 0x6d, 0x5f, 0x6b, 0x61, 0xda, 0xc3,
+    0x84, 0x17, 0xe8, 0xd1, 0x2c, 0xfd, 0xf9, 0x26, 0xe0};
+
+static uint8_t plain[BENCH_MAX_LEN], cipher[BENCH_MAX_LEN],
+    decrypted[BENCH_MAX_LEN];
+static uint8_t tag[TAG_LEN];
+
+static void test_vector(void) {
+  uint8_t out[sizeof(ct)];
+  aes_ccm_encrypt_and_tag(key, nonce, sizeof(nonce), aad, sizeof(aad), pt,
+                          sizeof(pt), out, out + sizeof(pt), 8);
+  CHECK(memcmp(out, ct, sizeof(ct)) == 0);
+}
+
+// 4KBまでの長さ(バッチの端数を含む)で暗号化と復号が対応すること
+static void test_round_trip(void) {
+  static const size_t lens[] = {1, 15, 16, 17, 48, 63, 64, 65, 80, 4095, 4096};
+  for (size_t i = 0; i < sizeof(plain); i++)
+    plain[i] = (uint8_t)(i * 7 + 3);
+  for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+    size_t len = lens[i];
+    aes_ccm_encrypt_and_tag(key, nonce, sizeof(nonce), aad, 1, plain, len,
+                            cipher, tag, TAG_LEN);
+    CHECK_EQ(0, aes_ccm_auth_decrypt(key, nonce, sizeof(nonce), aad, 1,
+                                     cipher, len, decrypted, tag, TAG_LEN));
+    CHECK(memcmp(plain, decrypted, len) == 0);
+    cipher[len - 1] ^= 1;
+    CHECK(aes_ccm_auth_decrypt(key, nonce, sizeof(nonce), aad, 1, cipher, len,
+                               decrypted, tag, TAG_LEN) != 0);
+  }
+}
+
+static void run_encrypt(size_t len) {
+  aes_ccm_encrypt_and_tag(key, nonce, sizeof(nonce), aad, 1, plain, len,
+                          cipher, tag, TAG_LEN);
+}
+
+static void run_decrypt(size_t len) {
+  // タグは一致しないが、処理量は成功した場合と同じ
+  aes_ccm_auth_decrypt(key, nonce, sizeof(nonce), aad, 1, cipher, len,
+                       decrypted, tag, TAG_LEN);
+}
+
+int main(void) {
+  RUN_TEST(test_vector);
+  RUN_TEST(test_round_trip);
+  if (test_failures)
+    return TEST_RESULT();
+
+  static const size_t sizes[] = {16, 80, BENCH_MAX_LEN};
+  char name[40];
+  printf("%-28s %6s %14s %12s\n", "ccm", "bytes", "cycles/byte", "MB/s");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    snprintf(name, sizeof(name), "%s batch %d encrypt", BACKEND,
+             CCM_CTR_BATCH);
+    bench_print(name, run_encrypt, sizes[i]);
+    snprintf(name, sizeof(name), "%s batch %d decrypt", BACKEND,
+             CCM_CTR_BATCH);
+    bench_print(name, run_decrypt, sizes[i]);
+  }
+  return 0;
+}
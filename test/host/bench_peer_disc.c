@@ -0,0 +1,296 @@
+// nimble_central_utils/peer.cの探索結果の保存に使うRAMと、探索にかかる時間
+//
+// RAM: 連結リストとプール(peer_init(1, 64, 64, 64))だった時の構造体と、
+// 今の平らな配列の構造体を、ESP32(ポインタが4bytes)の並びで比べる
+// 時間: fake_gattでATTの往復の回数を数え、接続間隔(30ms/50ms)を掛けて見積もる
+// 全ての探索(以前のpeer_disc_allと同じ手続きの順)と、0xFD81だけの探索を比べる
+
+#include "bench_util.h"
+#include "esp_central.h"
+#include "fake_gatt.h"
+#include "test_util.h"
+#include <string.h>
+
+#define CONN_HANDLE 1
+
+// NimBLEの既定の接続パラメーター(BLE_GAP_INITIAL_CONN_ITVL_MIN/MAX)
+#define CONN_ITVL_MIN_MS 30.0
+#define CONN_ITVL_MAX_MS 50.0
+
+static const ble_uuid_t *ssm_svc_uuid = BLE_UUID16_DECLARE(0xFD81);
+static const ble_uuid_t *ssm_chr_uuid =
+    BLE_UUID128_DECLARE(0x3e, 0x99, 0x76, 0xc6, 0xb4, 0xdb, 0xd3, 0xb6, 0x56,
+                        0x98, 0xae, 0xa5, 0x02, 0x00, 0x86, 0x16);
+static const ble_uuid_t *ssm_ntf_uuid =
+    BLE_UUID128_DECLARE(0x3e, 0x99, 0x76, 0xc6, 0xb4, 0xdb, 0xd3, 0xb6, 0x56,
+                        0x98, 0xae, 0xa5, 0x03, 0x00, 0x86, 0x16);
+
+/* ESP32(ILP32)でのRAM */
+
+typedef uint32_t ptr32_t; // ESP32のポインタ
+
+// 以前のesp_central.h(SLIST)
+struct old_peer_dsc {
+  ptr32_t next;
+  struct ble_gatt_dsc dsc;
+};
+struct old_peer_chr {
+  ptr32_t next;
+  struct ble_gatt_chr chr;
+  ptr32_t dscs;
+};
+struct old_peer_svc {
+  ptr32_t next;
+  struct ble_gatt_svc svc;
+  ptr32_t chrs;
+};
+struct old_peer {
+  ptr32_t next;
+  uint16_t conn_handle;
+  uint8_t peer_addr[PEER_ADDR_VAL_SIZE];
+  ptr32_t svcs;
+  uint16_t disc_prev_chr_val;
+  ptr32_t cur_svc;
+  ptr32_t disc_cb;
+  ptr32_t disc_cb_arg;
+};
+
+// 今のesp_central.hのstruct peer(並びを変えた場合はここも合わせる)
+struct new_peer {
+  uint16_t conn_handle;
+  ptr32_t ctx;
+  uint8_t peer_addr[PEER_ADDR_VAL_SIZE];
+  uint8_t num_svcs;
+  uint8_t num_chrs;
+  uint8_t num_dscs;
+  struct peer_svc svcs[PEER_MAX_SVCS];
+  struct peer_chr chrs[PEER_MAX_CHRS];
+  struct peer_dsc dscs[PEER_MAX_DSCS];
+  uint16_t disc_prev_chr_val;
+  ptr32_t cur_svc;
+  ptr32_t disc_cb;
+  ptr32_t disc_cb_arg;
+};
+
+// ポインタを含まないNimBLEの構造体はESP32でも同じ大きさ
+_Static_assert(sizeof(struct ble_gatt_svc) == 24, "ble_gatt_svc");
+_Static_assert(sizeof(struct ble_gatt_chr) == 28, "ble_gatt_chr");
+_Static_assert(sizeof(struct ble_gatt_dsc) == 24, "ble_gatt_dsc");
+
+#define OLD_MAX_ATTRS 64 // 以前のpeer_init(SSM_MAX_NUM, 64, 64, 64)
+
+static void report_ram(void) {
+  size_t old_bytes = OS_MEMPOOL_BYTES(1, sizeof(struct old_peer)) +
+                     OS_MEMPOOL_BYTES(OLD_MAX_ATTRS, sizeof(struct old_peer_svc)) +
+                     OS_MEMPOOL_BYTES(OLD_MAX_ATTRS, sizeof(struct old_peer_chr)) +
+                     OS_MEMPOOL_BYTES(OLD_MAX_ATTRS, sizeof(struct old_peer_dsc));
+  size_t old_pools = 4 * sizeof(struct os_mempool); // 64bitでの大きさ
+  size_t new_bytes = OS_MEMPOOL_BYTES(1, sizeof(struct new_peer)) +
+                     PEER_CONN_TABLE_SIZE * sizeof(ptr32_t);
+  size_t new_pools = 1 * sizeof(struct os_mempool);
+
+  printf("RAM per gateway (ESP32 layout, 1 peer)\n");
+  printf("  linked lists, pools 1/%d/%d/%d : %6zu bytes, 4 pools\n",
+         OLD_MAX_ATTRS, OLD_MAX_ATTRS, OLD_MAX_ATTRS, old_bytes);
+  printf("    peer %zu, svc %zu, chr %zu, dsc %zu bytes each\n",
+         sizeof(struct old_peer), sizeof(struct old_peer_svc),
+         sizeof(struct old_peer_chr), sizeof(struct old_peer_dsc));
+  printf("  flat arrays %d/%d/%d, table %-4d : %6zu bytes, 1 pool\n",
+         PEER_MAX_SVCS, PEER_MAX_CHRS, PEER_MAX_DSCS, PEER_CONN_TABLE_SIZE,
+         new_bytes);
+  printf("  saved                          : %6zu bytes\n",
+         old_bytes - new_bytes);
+  printf("  (host struct peer: %zu bytes, pool header %zu -> %zu bytes)\n",
+         sizeof(struct peer), old_pools, new_pools);
+  CHECK(new_bytes < old_bytes);
+}
+
+/* 以前のpeer_disc_allと同じ順の全探索(サービス→Characteristic→Descriptor) */
+
+static struct {
+  struct ble_gatt_svc svcs[8];
+  int num_svcs;
+  struct ble_gatt_chr chrs[16];
+  uint16_t chr_end[16];
+  int num_chrs;
+  int num_dscs;
+  int cur;
+  int done;
+} full;
+
+static int full_dsc_disced(uint16_t conn_handle,
+                           const struct ble_gatt_error *error,
+                           uint16_t chr_val_handle,
+                           const struct ble_gatt_dsc *dsc, void *arg);
+
+static void full_next_dscs(void) {
+  // 値の後ろに属性が無いCharacteristicは探索しない
+  for (; full.cur < full.num_chrs; full.cur++) {
+    if (full.chr_end[full.cur] > full.chrs[full.cur].val_handle) {
+      ble_gattc_disc_all_dscs(CONN_HANDLE, full.chrs[full.cur].val_handle,
+                              full.chr_end[full.cur], full_dsc_disced, NULL);
+      full.cur++;
+      return;
+    }
+  }
+  full.done = 1;
+}
+
+static int full_dsc_disced(uint16_t conn_handle,
+                           const struct ble_gatt_error *error,
+                           uint16_t chr_val_handle,
+                           const struct ble_gatt_dsc *dsc, void *arg) {
+  if (error->status == 0)
+    full.num_dscs++;
+  else
+    full_next_dscs();
+  return 0;
+}
+
+static int full_chr_disced(uint16_t conn_handle,
+                           const struct ble_gatt_error *error,
+                           const struct ble_gatt_chr *chr, void *arg);
+
+static void full_next_chrs(void) {
+  if (full.cur < full.num_svcs) {
+    const struct ble_gatt_svc *svc = &full.svcs[full.cur++];
+    ble_gattc_disc_all_chrs(CONN_HANDLE, svc->start_handle, svc->end_handle,
+                            full_chr_disced, NULL);
+    return;
+  }
+  // Characteristicの範囲は次のCharacteristicかサービスの終わりまで
+  for (int i = 0; i < full.num_chrs; i++) {
+    full.chr_end[i] = 0xffff;
+    for (int s = 0; s < full.num_svcs; s++) {
+      if (full.chrs[i].def_handle >= full.svcs[s].start_handle &&
+          full.chrs[i].def_handle <= full.svcs[s].end_handle)
+        full.chr_end[i] = full.svcs[s].end_handle;
+    }
+    if (i + 1 < full.num_chrs &&
+        full.chrs[i + 1].def_handle - 1 < full.chr_end[i])
+      full.chr_end[i] = full.chrs[i + 1].def_handle - 1;
+  }
+  full.cur = 0;
+  full_next_dscs();
+}
+
+static int full_chr_disced(uint16_t conn_handle,
+                           const struct ble_gatt_error *error,
+                           const struct ble_gatt_chr *chr, void *arg) {
+  if (error->status == 0)
+    full.chrs[full.num_chrs++] = *chr;
+  else
+    full_next_chrs();
+  return 0;
+}
+
+static int full_svc_disced(uint16_t conn_handle,
+                           const struct ble_gatt_error *error,
+                           const struct ble_gatt_svc *svc, void *arg) {
+  if (error->status == 0) {
+    full.svcs[full.num_svcs++] = *svc;
+  } else {
+    full.cur = 0;
+    full_next_chrs();
+  }
+  return 0;
+}
+
+/* peer.cによる0xFD81だけの探索 */
+
+static int disc_status;
+static int disc_calls;
+
+static void disc_complete(const struct peer *peer, int status, void *arg) {
+  disc_status = status;
+  disc_calls++;
+}
+
+static int targeted_discovery(void) {
+  disc_calls = 0;
+  disc_status = -1;
+  CHECK_EQ(0, peer_add(CONN_HANDLE));
+  CHECK_EQ(0, peer_disc_svc_by_uuid(CONN_HANDLE, ssm_svc_uuid, disc_complete,
+                                    NULL));
+  fake_gatt_run();
+  return disc_status;
+}
+
+static void check_targeted_result(void) {
+  const struct peer *peer = peer_find(CONN_HANDLE);
+  CHECK(peer != NULL);
+  if (!peer)
+    return;
+  CHECK_EQ(1, peer->num_svcs);
+  CHECK_EQ(2, peer->num_chrs);
+  CHECK_EQ(1, peer->num_dscs);
+  const struct peer_chr *chr =
+      peer_chr_find_uuid(peer, ssm_svc_uuid, ssm_chr_uuid);
+  CHECK(chr != NULL && chr->chr.val_handle == 14);
+  const struct peer_dsc *dsc =
+      peer_dsc_find_uuid(peer, ssm_svc_uuid, ssm_ntf_uuid,
+                         BLE_UUID16_DECLARE(BLE_GATT_DSC_CLT_CFG_UUID16));
+  CHECK(dsc != NULL && dsc->dsc.handle == 17);
+}
+
+static void print_discovery(const char *name, uint32_t round_trips,
+                            uint32_t procedures) {
+  printf("  %-24s %3u ATT round trips %2u procedures  %6.0f-%.0f ms\n", name,
+         round_trips, procedures, round_trips * CONN_ITVL_MIN_MS,
+         round_trips * CONN_ITVL_MAX_MS);
+}
+
+static void bench_targeted(size_t n) {
+  targeted_discovery();
+  peer_delete(CONN_HANDLE);
+}
+
+static void report_discovery(void) {
+  size_t num;
+  const fake_gatt_attr_t *db = fake_gatt_sesame_db(&num);
+
+  printf("\ndiscovery of a SESAME (ATT_MTU %d, 1 round trip per "
+         "connection interval)\n",
+         FAKE_GATT_ATT_MTU_DEFAULT);
+  fake_gatt_set_db(db, num, FAKE_GATT_ATT_MTU_DEFAULT);
+  memset(&full, 0, sizeof(full));
+  CHECK_EQ(0, ble_gattc_disc_all_svcs(CONN_HANDLE, full_svc_disced, NULL));
+  fake_gatt_run();
+  CHECK(full.done);
+  CHECK_EQ(4, full.num_svcs);
+  CHECK_EQ(7, full.num_chrs);
+  CHECK_EQ(3, full.num_dscs);
+  uint32_t full_trips = fake_gatt_round_trips();
+  print_discovery("all services", full_trips, fake_gatt_procedures());
+
+  fake_gatt_set_db(db, num, FAKE_GATT_ATT_MTU_DEFAULT);
+  CHECK_EQ(0, targeted_discovery());
+  CHECK_EQ(1, disc_calls);
+  check_targeted_result();
+  uint32_t targeted_trips = fake_gatt_round_trips();
+  print_discovery("0xFD81 only", targeted_trips, fake_gatt_procedures());
+  CHECK(targeted_trips < full_trips);
+  peer_delete(CONN_HANDLE);
+
+  // 今のプロファイルでは全探索のサービスが入りきらず、失敗として報告する
+  fake_gatt_set_db(db, num, FAKE_GATT_ATT_MTU_DEFAULT);
+  CHECK_EQ(0, peer_add(CONN_HANDLE));
+  disc_calls = 0;
+  CHECK_EQ(0, peer_disc_all(CONN_HANDLE, disc_complete, NULL));
+  fake_gatt_run();
+  CHECK_EQ(1, disc_calls);
+  CHECK_EQ(BLE_HS_ENOMEM, disc_status);
+  peer_delete(CONN_HANDLE);
+
+  fake_gatt_set_db(db, num, FAKE_GATT_ATT_MTU_DEFAULT);
+  bench_result_t r = bench_measure(bench_targeted, 1);
+  printf("  host CPU per targeted discovery (peer.c + fake GATT): %.2f us\n",
+         r.ns_per_op / 1000.0);
+}
+
+int main(void) {
+  CHECK_EQ(0, peer_init(1));
+  report_ram();
+  report_discovery();
+  return TEST_RESULT();
+}
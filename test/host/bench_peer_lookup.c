@@ -0,0 +1,125 @@
+// nimble_central_utils/peer.cのpeer_find(接続ハンドルの表)の所要時間を、
+// 以前のSLISTを先頭からたどる方法と、1/4/8台の接続で比べる
+// 接続ハンドルが連続する場合と、表の同じ位置に集まる場合(16おき)を測る
+
+#include "bench_util.h"
+#include "esp_central.h"
+#include "test_util.h"
+#include <string.h>
+
+#define LOOKUPS 1024 // 1回の計測で引く回数
+#define MAX_CONNS 8  // peer_initの上限(PEER_CONN_TABLE_SIZE / 2)
+
+_Static_assert(MAX_CONNS <= PEER_CONN_TABLE_SIZE / 2, "table too small");
+
+// 以前のstruct peerと同じく、先頭にnextを置いたSLISTの要素
+struct list_peer {
+  struct list_peer *next;
+  uint16_t conn_handle;
+  uint8_t body[26];
+};
+
+static struct list_peer list_pool[MAX_CONNS];
+static struct list_peer *list_head;
+static uint16_t handles[MAX_CONNS];
+static uint16_t order[LOOKUPS]; // 引く順(書き込みが来る接続の順)
+static int num_conns;
+static volatile uintptr_t sink;
+
+static struct list_peer *list_find(uint16_t conn_handle) {
+  for (struct list_peer *p = list_head; p != NULL; p = p->next) {
+    if (p->conn_handle == conn_handle)
+      return p;
+  }
+  return NULL;
+}
+
+static void run_list(size_t n) {
+  uintptr_t acc = 0;
+  for (size_t i = 0; i < n; i++)
+    acc += (uintptr_t)list_find(order[i]);
+  sink = acc;
+}
+
+static void run_table(size_t n) {
+  uintptr_t acc = 0;
+  for (size_t i = 0; i < n; i++)
+    acc += (uintptr_t)peer_find(order[i]);
+  sink = acc;
+}
+
+static void run_ctx(size_t n) {
+  uintptr_t acc = 0;
+  for (size_t i = 0; i < n; i++)
+    acc += (uintptr_t)peer_ctx(order[i]);
+  sink = acc;
+}
+
+static uint32_t rng_state = 12345;
+
+static uint32_t next_rand(void) {
+  rng_state = rng_state * 1103515245u + 12345u;
+  return rng_state >> 16;
+}
+
+// stride: 接続ハンドルの間隔(16では全てが表の同じ位置に入る)
+static void setup(int conns, uint16_t stride) {
+  CHECK_EQ(0, peer_init(MAX_CONNS));
+  list_head = NULL;
+  num_conns = conns;
+  for (int i = 0; i < conns; i++) {
+    handles[i] = (uint16_t)(1 + i * stride);
+    CHECK_EQ(0, peer_add(handles[i]));
+    CHECK_EQ(0, peer_set_ctx(handles[i], &list_pool[i]));
+    // 以前のpeer_addはSLIST_INSERT_HEADで先頭に足していた
+    list_pool[i].conn_handle = handles[i];
+    list_pool[i].next = list_head;
+    list_head = &list_pool[i];
+  }
+  for (int i = 0; i < LOOKUPS; i++)
+    order[i] = handles[next_rand() % conns];
+}
+
+static void check_lookups(void) {
+  for (int i = 0; i < num_conns; i++) {
+    struct peer *peer = peer_find(handles[i]);
+    CHECK(peer != NULL && peer->conn_handle == handles[i]);
+    CHECK(peer_ctx(handles[i]) == &list_pool[i]);
+    CHECK(list_find(handles[i]) == &list_pool[i]);
+  }
+  CHECK(peer_find(0xffff) == NULL);
+}
+
+static void report(const char *name, int conns, uint16_t stride) {
+  setup(conns, stride);
+  check_lookups();
+  bench_result_t list = bench_measure(run_list, LOOKUPS);
+  bench_result_t table = bench_measure(run_table, LOOKUPS);
+  bench_result_t ctx = bench_measure(run_ctx, LOOKUPS);
+  printf("%-11s %5d %12.2f %12.2f %12.2f %10.1f\n", name, conns,
+         list.ns_per_op / LOOKUPS, table.ns_per_op / LOOKUPS,
+         ctx.ns_per_op / LOOKUPS, table.cycles_per_op / LOOKUPS);
+}
+
+int main(void) {
+  printf("%-11s %5s %12s %12s %12s %10s\n", "handles", "conns",
+         "slist ns", "table ns", "peer_ctx ns", "table cyc");
+  const int conns[] = {1, 4, 8};
+  for (size_t i = 0; i < sizeof(conns) / sizeof(conns[0]); i++)
+    report("sequential", conns[i], 1);
+  for (size_t i = 0; i < sizeof(conns) / sizeof(conns[0]); i++)
+    report("colliding", conns[i], PEER_CONN_TABLE_SIZE);
+
+  // 削除した後も、同じ位置に入っていた残りの接続を引ける
+  setup(MAX_CONNS, PEER_CONN_TABLE_SIZE);
+  CHECK_EQ(0, peer_delete(handles[0]));
+  CHECK_EQ(0, peer_delete(handles[3]));
+  CHECK(peer_find(handles[0]) == NULL);
+  CHECK(peer_find(handles[3]) == NULL);
+  for (int i = 0; i < MAX_CONNS; i++) {
+    if (i != 0 && i != 3)
+      CHECK(peer_ctx(handles[i]) == &list_pool[i]);
+  }
+  CHECK_EQ(BLE_HS_EINVAL, peer_init(PEER_CONN_TABLE_SIZE / 2 + 1));
+  return TEST_RESULT();
+}
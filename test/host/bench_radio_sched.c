@@ -0,0 +1,172 @@
+// HTTPSの通信が続く中でのlockコマンドの所要時間を、radio_sched.cで
+// HTTPSを待たせる場合(CONFIG_SSM_RADIO_SCHED=1)と待たせない場合で比べる
+// WiFiとBLEが1つの無線を共有する様子を、順番に使う無線(radio_acquire)で模す
+//   BLE:   1セグメントの書き込み/通知ごとに BLE_SEGMENT_AIR_US
+//   HTTPS: 1リクエストごとに HTTP_BURSTS回 HTTP_BURST_AIR_US ずつ
+// HTTPSのスレッドはfirebase_database.cと同じく、リクエストの前に
+// radio_sched_wait_idleを呼ぶ
+
+#include "bench_util.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "power.h"
+#include "radio_sched.h"
+#include "sesame_sim.h"
+#include "ssm_cmd.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BLE_SEGMENT_AIR_US 1000
+#define HTTP_BURST_AIR_US 3000 // TLSのレコード1つ分の送受信
+#define HTTP_BURSTS 8
+#define HTTP_THREADS 2      // ポーリングと診断の送信
+#define HTTP_MAX_GAP_US 20000 // リクエストの間隔(0から一様)
+#define COMMANDS 200
+#define COMMAND_TIMEOUT_US 1000000
+#define RADIO_SCHED_MAX_DEFER_MS 3000 // firebase_database.cと同じ
+
+static const uint8_t secret[16] = {0x5a, 0x01, 0x02, 0x03, 0x04, 0x05,
+                                   0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+                                   0x0c, 0x0d, 0x0e, 0x0f};
+
+// 来た順に使わせる無線(コエグジスタンスの調停を単純化したもの)
+static pthread_mutex_t radio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t radio_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t radio_next_ticket;
+static uint32_t radio_serving;
+
+static void sleep_us(int64_t us) {
+  struct timespec ts = {.tv_sec = us / 1000000,
+                        .tv_nsec = (long)(us % 1000000) * 1000};
+  nanosleep(&ts, NULL);
+}
+
+static void radio_use(int64_t air_us) {
+  pthread_mutex_lock(&radio_lock);
+  uint32_t ticket = radio_next_ticket++;
+  while (ticket != radio_serving)
+    pthread_cond_wait(&radio_cond, &radio_lock);
+  pthread_mutex_unlock(&radio_lock);
+
+  sleep_us(air_us);
+
+  pthread_mutex_lock(&radio_lock);
+  radio_serving++;
+  pthread_cond_broadcast(&radio_cond);
+  pthread_mutex_unlock(&radio_lock);
+}
+
+static void ble_air(void) { radio_use(BLE_SEGMENT_AIR_US); }
+
+static volatile int running;
+static uint32_t http_requests;
+
+static void *http_load(void *arg) {
+  unsigned int seed = (unsigned int)(uintptr_t)arg;
+  while (running) {
+    radio_sched_wait_idle(pdMS_TO_TICKS(RADIO_SCHED_MAX_DEFER_MS));
+    for (int i = 0; i < HTTP_BURSTS; i++)
+      radio_use(HTTP_BURST_AIR_US);
+    __atomic_fetch_add(&http_requests, 1, __ATOMIC_RELAXED);
+    sleep_us(rand_r(&seed) % HTTP_MAX_GAP_US);
+  }
+  return NULL;
+}
+
+// NimBLEのhostタスクの代わりに通知を渡し続ける
+static void *host_task(void *arg) {
+  while (running) {
+    if (sesame_sim_pump() == 0)
+      sleep_us(50);
+  }
+  return NULL;
+}
+
+// radio_sched.cのPMロックは使わない
+void power_lock_acquire(power_lock_t lock) {}
+void power_lock_release(power_lock_t lock) {}
+
+static uint32_t mech_status_events(void) {
+  return __atomic_load_n(&sim_gw.mech_status_events, __ATOMIC_ACQUIRE);
+}
+
+static double counter(const char *name) {
+  cJSON *root = metrics_to_json();
+  double value = cJSON_GetNumberValue(
+      cJSON_GetObjectItem(cJSON_GetObjectItem(root, "counters"), name));
+  cJSON_Delete(root);
+  return value;
+}
+
+static int compare_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// HTTPSのスレッドをhttp_threads本動かしながらlock/unlockをCOMMANDS回送る
+static void measure(sesame_sim_t *sim, int http_threads) {
+  sesame *gw = sim->gw;
+  http_requests = 0;
+  running = 1;
+  pthread_t host, http[HTTP_THREADS];
+  pthread_create(&host, NULL, host_task, NULL);
+  for (int i = 0; i < http_threads; i++)
+    pthread_create(&http[i], NULL, http_load, (void *)(uintptr_t)(i + 1));
+
+  static int64_t latency_us[COMMANDS];
+  unsigned int seed = 7;
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < COMMANDS; i++) {
+    sleep_us(5000 + rand_r(&seed) % 10000); // HTTPSのどの時点で届くかを散らす
+    uint32_t events = mech_status_events();
+    int64_t t0 = esp_timer_get_time();
+    if (i % 2)
+      ssm_lock(gw, NULL, 0);
+    else
+      ssm_unlock(gw, NULL, 0);
+    // 応答とMECH_STATUSの通知まで
+    while (mech_status_events() == events &&
+           esp_timer_get_time() - t0 < COMMAND_TIMEOUT_US)
+      sleep_us(50);
+    latency_us[i] = esp_timer_get_time() - t0;
+    CHECK(mech_status_events() != events);
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  running = 0;
+  for (int i = 0; i < http_threads; i++)
+    pthread_join(http[i], NULL);
+  pthread_join(host, NULL);
+
+  qsort(latency_us, COMMANDS, sizeof(latency_us[0]), compare_i64);
+  printf("radio_sched %s, %d https: lock p50 %5.1f ms, p99 %5.1f ms, "
+         "max %5.1f ms | https %4.1f req/s, %3.0f deferred\n",
+         CONFIG_SSM_RADIO_SCHED ? "on " : "off", http_threads,
+         latency_us[COMMANDS / 2] / 1000.0,
+         latency_us[COMMANDS * 99 / 100] / 1000.0,
+         latency_us[COMMANDS - 1] / 1000.0, http_requests * 1e6 / elapsed,
+         counter("radio_deferrals"));
+}
+
+int main(void) {
+  sesame_sim_setup();
+  radio_sched_init();
+  static sesame_sim_t sim;
+  sesame_sim_init(&sim, &p_ssms_env->ssm);
+  sesame_sim_provision(&sim, secret);
+  sesame_sim_connect(&sim);
+  sesame_sim_pump();
+  CHECK_EQ(SSM_LOCKED, sim.gw->device_status);
+
+  sesame_sim_air = ble_air;
+  measure(&sim, 0); // 負荷なしの基準
+  measure(&sim, HTTP_THREADS);
+  CHECK_EQ(0, sim.auth_failures);
+  if (CONFIG_SSM_RADIO_SCHED)
+    CHECK(counter("radio_deferrals") > 0);
+  else
+    CHECK_EQ(0, counter("radio_deferrals"));
+  return TEST_RESULT();
+}
@@ -0,0 +1,144 @@
+// ssm_sched.cを通した施錠/開錠の、全てのsesameを合わせたコマンド数/秒を
+// 1, 2, 4台の偽のSESAME(sesame_sim.c)で測る
+// SESAMEのモーターが回る時間を、MECH_STATUSを受けてからssm_sched_on_statusを
+// 呼ぶまでの遅れ(MOTOR_US)で模す。1台の応答待ちで他が止まらなければ、
+// 台数に比例してコマンド数/秒が増える
+
+#include "bench_util.h"
+#include "esp_timer.h"
+#include "sesame_sim.h"
+#include "ssm_sched.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define BLE_SEGMENT_AIR_US 200
+#define MOTOR_US 20000
+#define COMMANDS_PER_SESAME 100
+#define COMMAND_TIMEOUT_MS 2000
+
+static const uint8_t secret[16] = {0x5a, 0x01, 0x02, 0x03, 0x04, 0x05,
+                                   0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+                                   0x0c, 0x0d, 0x0e, 0x0f};
+
+static sesame_sim_t sims[SIM_MAX_SESAMES];
+static sesame *gws[SIM_MAX_SESAMES];
+static esp_timer_handle_t motors[SIM_MAX_SESAMES];
+
+static void sleep_us(int64_t us) {
+  struct timespec ts = {.tv_sec = us / 1000000,
+                        .tv_nsec = (long)(us % 1000000) * 1000};
+  nanosleep(&ts, NULL);
+}
+
+static void ble_air(void) { sleep_us(BLE_SEGMENT_AIR_US); }
+
+static void motor_done(void *arg) {
+  ssm_sched_on_status(gws[(intptr_t)arg]);
+}
+
+// 施錠/開錠の位置に着いたことは、モーターが止まってから伝える
+static void on_status(sesame *ssm) {
+  for (int i = 0; i < SIM_MAX_SESAMES; i++) {
+    if (gws[i] != ssm)
+      continue;
+    if (ssm->device_status == SSM_LOCKED || ssm->device_status == SSM_UNLOCKED)
+      esp_timer_start_once(motors[i], MOTOR_US);
+    else
+      ssm_sched_on_status(ssm);
+  }
+}
+
+static volatile int running;
+
+// NimBLEのhostタスクの代わりに通知を渡し続ける
+static void *host_task(void *arg) {
+  while (running) {
+    if (sesame_sim_pump() == 0)
+      sleep_us(50);
+  }
+  return NULL;
+}
+
+// 4台とも接続しておき、測る台数だけにコマンドを送る
+// (ssm_schedは一度見たsesameを覚えているので、作り直さない)
+static void setup(void) {
+  sesame_sim_setup();
+  for (int i = 0; i < SIM_MAX_SESAMES; i++) {
+    sesame *gw = i == 0 ? &p_ssms_env->ssm : sesame_sim_new_gateway_sesame(i);
+    sesame_sim_init(&sims[i], gw);
+    sesame_sim_provision(&sims[i], secret);
+    sesame_sim_connect(&sims[i]);
+    sesame_sim_pump();
+    CHECK_EQ(SSM_LOCKED, gw->device_status);
+    gws[i] = gw;
+    esp_timer_create_args_t args = {.callback = motor_done,
+                                    .arg = (void *)(intptr_t)i,
+                                    .name = "sim motor"};
+    CHECK_EQ(ESP_OK, esp_timer_create(&args, &motors[i]));
+  }
+  sesame_sim_on_status = on_status;
+  sesame_sim_air = ble_air;
+}
+
+static double measure(int num) {
+  running = 1;
+  pthread_t host;
+  pthread_create(&host, NULL, host_task, NULL);
+
+  // 保持できる数まで要求を積み、古いものから結果を待つ
+  uint32_t window[SSM_SCHED_MAX_REQUESTS];
+  int head = 0, len = 0, failures = 0;
+  ssm_sched_cmd_t next_cmd[SIM_MAX_SESAMES];
+  for (int i = 0; i < num; i++)
+    next_cmd[i] = SSM_SCHED_CMD_UNLOCK;
+  int total = num * COMMANDS_PER_SESAME;
+  int64_t start = bench_now_ns();
+  for (int submitted = 0, done = 0; done < total;) {
+    if (submitted < total && len < SSM_SCHED_MAX_REQUESTS) {
+      int dev = submitted % num;
+      uint32_t id;
+      CHECK_EQ(ESP_OK, ssm_sched_submit(gws[dev], next_cmd[dev],
+                                        SSM_SCHED_PRIO_NORMAL, 0, &id));
+      // 交互に送り、全てのコマンドで実際にモーターが回るようにする
+      next_cmd[dev] = next_cmd[dev] == SSM_SCHED_CMD_LOCK
+                          ? SSM_SCHED_CMD_UNLOCK
+                          : SSM_SCHED_CMD_LOCK;
+      window[(head + len++) % SSM_SCHED_MAX_REQUESTS] = id;
+      submitted++;
+      continue;
+    }
+    ssm_sched_result_t result = ssm_sched_wait(
+        window[head], pdMS_TO_TICKS(COMMAND_TIMEOUT_MS));
+    if (result != SSM_SCHED_SUCCESS)
+      failures++;
+    head = (head + 1) % SSM_SCHED_MAX_REQUESTS;
+    len--;
+    done++;
+  }
+  int64_t elapsed = bench_now_ns() - start;
+  running = 0;
+  pthread_join(host, NULL);
+
+  double rate = total * 1e9 / elapsed;
+  printf("  %d sesame(s): %6.1f commands/s (%d commands, %d failed)\n", num,
+         rate, total, failures);
+  CHECK_EQ(0, failures);
+  for (int i = 0; i < num; i++)
+    CHECK_EQ(0, sims[i].auth_failures);
+  return rate;
+}
+
+int main(void) {
+  setup();
+  CHECK_EQ(ESP_OK, ssm_sched_init());
+  printf("lock/unlock through ssm_sched (motor %d ms per command)\n",
+         MOTOR_US / 1000);
+  double one = measure(1);
+  measure(2);
+  double four = measure(4);
+  // モーターの待ちが重ならなければ4台で2倍を下回ることはない
+  CHECK(four > one * 2);
+  return TEST_RESULT();
+}
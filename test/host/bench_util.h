@@ -0,0 +1,55 @@
+#pragma once
+
+// ホストのベンチマークで使う計測(x86ではTSCのサイクル数も測る)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_MIN_NS 200000000LL // 1項目あたりの最小計測時間
+
+static inline int64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline uint64_t bench_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return 0; // サイクル数は取れない
+#endif
+}
+
+typedef struct {
+  double ns_per_op;
+  double cycles_per_op;
+} bench_result_t;
+
+// runをBENCH_MIN_NS以上繰り返し、1回あたりの時間とサイクル数を求める
+static inline bench_result_t bench_measure(void (*run)(size_t), size_t len) {
+  run(len); // 初回のキャッシュ等の影響を除く
+  uint64_t iterations = 0;
+  uint64_t c0 = bench_cycles();
+  int64_t start = bench_now_ns();
+  int64_t elapsed;
+  do {
+    run(len);
+    iterations++;
+    elapsed = bench_now_ns() - start;
+  } while (elapsed < BENCH_MIN_NS);
+  bench_result_t result = {
+      .ns_per_op = (double)elapsed / iterations,
+      .cycles_per_op = (double)(bench_cycles() - c0) / iterations,
+  };
+  return result;
+}
+
+static inline void bench_print(const char *name, void (*run)(size_t),
+                               size_t len) {
+  bench_result_t r = bench_measure(run, len);
+  printf("%-28s %6zu %14.1f %12.1f\n", name, len, r.cycles_per_op / len,
+         len * 1000.0 / r.ns_per_op);
+}
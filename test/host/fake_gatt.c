@@ -0,0 +1,338 @@
+#include "fake_gatt.h"
+#include <string.h>
+
+#define PROC_QUEUE_LEN 16
+#define UUID16(v) {.u16 = {.u = {.type = BLE_UUID_TYPE_16}, .value = (v)}}
+#define UUID128(...)                                                           \
+  {.u128 = {.u = {.type = BLE_UUID_TYPE_128}, .value = {__VA_ARGS__}}}
+#define SSM_UUID(n)                                                            \
+  UUID128(0x3e, 0x99, 0x76, 0xc6, 0xb4, 0xdb, 0xd3, 0xb6, 0x56, 0x98, 0xae,   \
+          0xa5, (n), 0x00, 0x86, 0x16)
+#define DFU_UUID                                                               \
+  UUID128(0x50, 0xea, 0xda, 0x30, 0x88, 0x83, 0xb8, 0x9f, 0x60, 0x4f, 0x15,   \
+          0xf3, 0x03, 0x00, 0xc9, 0x8e)
+
+// 実機の表は公開されていないので、サービスの構成はbluetooth.mdと
+// 一般的なNordicのDFUに合わせている
+static const fake_gatt_attr_t sesame_db[] = {
+    {1, FAKE_GATT_SVC, UUID16(0x1800)}, // GAP
+    {2, FAKE_GATT_CHR, UUID16(0x2a00), 0x02},
+    {3, FAKE_GATT_VAL, UUID16(0x2a00)},
+    {4, FAKE_GATT_CHR, UUID16(0x2a01), 0x02},
+    {5, FAKE_GATT_VAL, UUID16(0x2a01)},
+    {6, FAKE_GATT_CHR, UUID16(0x2a04), 0x02},
+    {7, FAKE_GATT_VAL, UUID16(0x2a04)},
+    {8, FAKE_GATT_SVC, UUID16(0x1801)}, // GATT
+    {9, FAKE_GATT_CHR, UUID16(0x2a05), 0x20},
+    {10, FAKE_GATT_VAL, UUID16(0x2a05)},
+    {11, FAKE_GATT_DSC, UUID16(BLE_GATT_DSC_CLT_CFG_UUID16)},
+    {12, FAKE_GATT_SVC, UUID16(0xfd81)}, // SESAME
+    {13, FAKE_GATT_CHR, SSM_UUID(0x02), 0x0c},
+    {14, FAKE_GATT_VAL, SSM_UUID(0x02)},
+    {15, FAKE_GATT_CHR, SSM_UUID(0x03), 0x10},
+    {16, FAKE_GATT_VAL, SSM_UUID(0x03)},
+    {17, FAKE_GATT_DSC, UUID16(BLE_GATT_DSC_CLT_CFG_UUID16)},
+    {18, FAKE_GATT_SVC, UUID16(0xfe59)}, // Secure DFU
+    {19, FAKE_GATT_CHR, DFU_UUID, 0x28},
+    {20, FAKE_GATT_VAL, DFU_UUID},
+    {21, FAKE_GATT_DSC, UUID16(BLE_GATT_DSC_CLT_CFG_UUID16)},
+};
+
+typedef enum {
+  PROC_DISC_ALL_SVCS,
+  PROC_DISC_SVC_UUID,
+  PROC_DISC_ALL_CHRS,
+  PROC_DISC_ALL_DSCS,
+} proc_kind_t;
+
+typedef struct {
+  proc_kind_t kind;
+  uint16_t conn_handle;
+  uint16_t start_handle;
+  uint16_t end_handle;
+  ble_uuid_any_t uuid;
+  void *cb;
+  void *cb_arg;
+} proc_t;
+
+static const fake_gatt_attr_t *db;
+static size_t db_num;
+static uint16_t att_mtu = FAKE_GATT_ATT_MTU_DEFAULT;
+static proc_t queue[PROC_QUEUE_LEN];
+static int queue_head;
+static int queue_len;
+static uint32_t round_trips;
+static uint32_t procedures;
+
+const fake_gatt_attr_t *fake_gatt_sesame_db(size_t *num) {
+  *num = sizeof(sesame_db) / sizeof(sesame_db[0]);
+  return sesame_db;
+}
+
+void fake_gatt_set_db(const fake_gatt_attr_t *attrs, size_t num,
+                      uint16_t mtu) {
+  db = attrs;
+  db_num = num;
+  att_mtu = mtu;
+  queue_head = 0;
+  queue_len = 0;
+  round_trips = 0;
+  procedures = 0;
+}
+
+uint32_t fake_gatt_round_trips(void) { return round_trips; }
+
+uint32_t fake_gatt_procedures(void) { return procedures; }
+
+static size_t uuid_len(const ble_uuid_any_t *uuid) {
+  return uuid->u.type == BLE_UUID_TYPE_16 ? 2 : 16;
+}
+
+// サービスの範囲の最後は次のサービスの直前か、表の最後
+static uint16_t svc_end_handle(size_t idx) {
+  for (size_t i = idx + 1; i < db_num; i++) {
+    if (db[i].kind == FAKE_GATT_SVC)
+      return db[i].handle - 1;
+  }
+  return db[db_num - 1].handle;
+}
+
+static int enqueue(const proc_t *proc) {
+  if (queue_len == PROC_QUEUE_LEN)
+    return BLE_HS_ENOMEM;
+  queue[(queue_head + queue_len) % PROC_QUEUE_LEN] = *proc;
+  queue_len++;
+  return 0;
+}
+
+static const struct ble_gatt_error done = {.status = BLE_HS_EDONE};
+static const struct ble_gatt_error ok = {.status = 0};
+
+// Read By Group Type Request。同じ長さのUUIDのサービスを
+// (ATT_MTU - 2) / (4 + UUIDの長さ)件まで返す
+static void run_disc_all_svcs(const proc_t *p) {
+  ble_gatt_disc_svc_fn *cb = p->cb;
+  uint16_t cur = 1;
+  for (;;) {
+    round_trips++;
+    size_t first = db_num;
+    for (size_t i = 0; i < db_num; i++) {
+      if (db[i].kind == FAKE_GATT_SVC && db[i].handle >= cur) {
+        first = i;
+        break;
+      }
+    }
+    if (first == db_num) { // Attribute Not Found
+      cb(p->conn_handle, &done, NULL, p->cb_arg);
+      return;
+    }
+    size_t len = uuid_len(&db[first].uuid);
+    size_t max = (att_mtu - 2) / (4 + len);
+    size_t n = 0;
+    uint16_t last_end = 0;
+    for (size_t i = first; i < db_num && n < max; i++) {
+      if (db[i].kind != FAKE_GATT_SVC)
+        continue;
+      if (uuid_len(&db[i].uuid) != len)
+        break;
+      struct ble_gatt_svc svc = {.start_handle = db[i].handle,
+                                 .end_handle = svc_end_handle(i),
+                                 .uuid = db[i].uuid};
+      if (cb(p->conn_handle, &ok, &svc, p->cb_arg) != 0)
+        return;
+      last_end = svc.end_handle;
+      n++;
+    }
+    if (last_end == 0xffff) {
+      cb(p->conn_handle, &done, NULL, p->cb_arg);
+      return;
+    }
+    cur = last_end + 1;
+  }
+}
+
+// Find By Type Value Request。(ATT_MTU - 1) / 4件まで返す
+static void run_disc_svc_by_uuid(const proc_t *p) {
+  ble_gatt_disc_svc_fn *cb = p->cb;
+  size_t max = (att_mtu - 1) / 4;
+  uint16_t cur = 1;
+  for (;;) {
+    round_trips++;
+    size_t n = 0;
+    uint16_t last_end = 0;
+    for (size_t i = 0; i < db_num && n < max; i++) {
+      if (db[i].kind != FAKE_GATT_SVC || db[i].handle < cur ||
+          ble_uuid_cmp(&db[i].uuid.u, &p->uuid.u) != 0)
+        continue;
+      struct ble_gatt_svc svc = {.start_handle = db[i].handle,
+                                 .end_handle = svc_end_handle(i),
+                                 .uuid = db[i].uuid};
+      if (cb(p->conn_handle, &ok, &svc, p->cb_arg) != 0)
+        return;
+      last_end = svc.end_handle;
+      n++;
+    }
+    if (n == 0 || last_end == 0xffff) {
+      cb(p->conn_handle, &done, NULL, p->cb_arg);
+      return;
+    }
+    cur = last_end + 1;
+  }
+}
+
+// Read By Type Request(0x2803)。(ATT_MTU - 2) / (5 + UUIDの長さ)件まで返す
+static void run_disc_all_chrs(const proc_t *p) {
+  ble_gatt_chr_fn *cb = p->cb;
+  uint16_t cur = p->start_handle;
+  for (;;) {
+    round_trips++;
+    size_t first = db_num;
+    for (size_t i = 0; i < db_num; i++) {
+      if (db[i].kind == FAKE_GATT_CHR && db[i].handle >= cur &&
+          db[i].handle <= p->end_handle) {
+        first = i;
+        break;
+      }
+    }
+    if (first == db_num) {
+      cb(p->conn_handle, &done, NULL, p->cb_arg);
+      return;
+    }
+    size_t len = uuid_len(&db[first].uuid);
+    size_t max = (att_mtu - 2) / (5 + len);
+    size_t n = 0;
+    uint16_t last = 0;
+    for (size_t i = first; i < db_num && n < max; i++) {
+      if (db[i].handle > p->end_handle)
+        break;
+      if (db[i].kind != FAKE_GATT_CHR)
+        continue;
+      if (uuid_len(&db[i].uuid) != len)
+        break;
+      struct ble_gatt_chr chr = {.def_handle = db[i].handle,
+                                 .val_handle = db[i].handle + 1,
+                                 .properties = db[i].properties,
+                                 .uuid = db[i].uuid};
+      if (cb(p->conn_handle, &ok, &chr, p->cb_arg) != 0)
+        return;
+      last = chr.val_handle;
+      n++;
+    }
+    if (last >= p->end_handle) {
+      cb(p->conn_handle, &done, NULL, p->cb_arg);
+      return;
+    }
+    cur = last + 1;
+  }
+}
+
+// Find Information Request。16bitのUUIDは(ATT_MTU - 2) / 4件、
+// 128bitのUUIDは(ATT_MTU - 2) / 18件まで返す
+static void run_disc_all_dscs(const proc_t *p) {
+  ble_gatt_dsc_fn *cb = p->cb;
+  uint16_t cur = p->start_handle + 1;
+  for (;;) {
+    round_trips++;
+    size_t first = db_num;
+    for (size_t i = 0; i < db_num; i++) {
+      if (db[i].handle >= cur && db[i].handle <= p->end_handle) {
+        first = i;
+        break;
+      }
+    }
+    if (first == db_num) {
+      cb(p->conn_handle, &done, p->start_handle, NULL, p->cb_arg);
+      return;
+    }
+    size_t len = uuid_len(&db[first].uuid);
+    size_t max = (att_mtu - 2) / (2 + len);
+    size_t n = 0;
+    uint16_t last = 0;
+    for (size_t i = first;
+         i < db_num && n < max && db[i].handle <= p->end_handle; i++) {
+      if (uuid_len(&db[i].uuid) != len)
+        break;
+      struct ble_gatt_dsc dsc = {.handle = db[i].handle, .uuid = db[i].uuid};
+      if (cb(p->conn_handle, &ok, p->start_handle, &dsc, p->cb_arg) != 0)
+        return;
+      last = dsc.handle;
+      n++;
+    }
+    if (last >= p->end_handle) {
+      cb(p->conn_handle, &done, p->start_handle, NULL, p->cb_arg);
+      return;
+    }
+    cur = last + 1;
+  }
+}
+
+int fake_gatt_run(void) {
+  int n = 0;
+  while (queue_len > 0) {
+    proc_t proc = queue[queue_head];
+    queue_head = (queue_head + 1) % PROC_QUEUE_LEN;
+    queue_len--;
+    procedures++;
+    n++;
+    switch (proc.kind) {
+    case PROC_DISC_ALL_SVCS:
+      run_disc_all_svcs(&proc);
+      break;
+    case PROC_DISC_SVC_UUID:
+      run_disc_svc_by_uuid(&proc);
+      break;
+    case PROC_DISC_ALL_CHRS:
+      run_disc_all_chrs(&proc);
+      break;
+    case PROC_DISC_ALL_DSCS:
+      run_disc_all_dscs(&proc);
+      break;
+    }
+  }
+  return n;
+}
+
+int ble_gattc_disc_all_svcs(uint16_t conn_handle, ble_gatt_disc_svc_fn *cb,
+                            void *cb_arg) {
+  proc_t proc = {.kind = PROC_DISC_ALL_SVCS,
+                 .conn_handle = conn_handle,
+                 .cb = cb,
+                 .cb_arg = cb_arg};
+  return enqueue(&proc);
+}
+
+int ble_gattc_disc_svc_by_uuid(uint16_t conn_handle, const ble_uuid_t *uuid,
+                               ble_gatt_disc_svc_fn *cb, void *cb_arg) {
+  proc_t proc = {.kind = PROC_DISC_SVC_UUID,
+                 .conn_handle = conn_handle,
+                 .cb = cb,
+                 .cb_arg = cb_arg};
+  memcpy(&proc.uuid, uuid,
+         uuid->type == BLE_UUID_TYPE_16 ? sizeof(ble_uuid16_t)
+                                        : sizeof(ble_uuid128_t));
+  return enqueue(&proc);
+}
+
+int ble_gattc_disc_all_chrs(uint16_t conn_handle, uint16_t start_handle,
+                            uint16_t end_handle, ble_gatt_chr_fn *cb,
+                            void *cb_arg) {
+  proc_t proc = {.kind = PROC_DISC_ALL_CHRS,
+                 .conn_handle = conn_handle,
+                 .start_handle = start_handle,
+                 .end_handle = end_handle,
+                 .cb = cb,
+                 .cb_arg = cb_arg};
+  return enqueue(&proc);
+}
+
+int ble_gattc_disc_all_dscs(uint16_t conn_handle, uint16_t start_handle,
+                            uint16_t end_handle, ble_gatt_dsc_fn *cb,
+                            void *cb_arg) {
+  proc_t proc = {.kind = PROC_DISC_ALL_DSCS,
+                 .conn_handle = conn_handle,
+                 .start_handle = start_handle,
+                 .end_handle = end_handle,
+                 .cb = cb,
+                 .cb_arg = cb_arg};
+  return enqueue(&proc);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// NimBLEのGATTクライアントの探索手続き(ble_gattc_disc_*)の偽物
+// 属性の表からATTのPDU単位で応答を作り、往復の回数を数える
+// 手続きはキューに積み、fake_gatt_run()でNimBLEのホストタスクと同じく順に実行する
+
+#include "host/ble_hs.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FAKE_GATT_ATT_MTU_DEFAULT 23 // MTUの交換をしない場合
+
+typedef enum {
+  FAKE_GATT_SVC, // 0x2800 Primary Service
+  FAKE_GATT_CHR, // 0x2803 Characteristic(値のハンドルは次のハンドル)
+  FAKE_GATT_VAL, // Characteristicの値
+  FAKE_GATT_DSC, // Descriptor
+} fake_gatt_kind_t;
+
+typedef struct {
+  uint16_t handle;
+  fake_gatt_kind_t kind;
+  ble_uuid_any_t uuid; // サービス、Characteristic、DescriptorのUUID
+  uint8_t properties;
+} fake_gatt_attr_t;
+
+/**
+ * @brief 応答に使う属性の表とATT_MTUを設定し、往復の回数を0に戻す
+ * @param attrs ハンドル順の属性(呼び出し側で保持する)
+ */
+void fake_gatt_set_db(const fake_gatt_attr_t *attrs, size_t num, uint16_t mtu);
+
+/**
+ * @brief SESAME 5 Proを模した属性の表(GAP, GATT, 0xFD81, DFU)
+ */
+const fake_gatt_attr_t *fake_gatt_sesame_db(size_t *num);
+
+/**
+ * @brief キューの手続きを、コールバックが積んだものも含めて全て実行する
+ * @return 実行した手続きの数
+ */
+int fake_gatt_run(void);
+
+// 探索で交わしたATTのリクエストとレスポンスの往復の回数
+uint32_t fake_gatt_round_trips(void);
+
+// fake_gatt_run()で実行した手続き(ble_gattc_disc_*の呼び出し)の数
+uint32_t fake_gatt_procedures(void);
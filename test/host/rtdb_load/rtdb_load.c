@@ -0,0 +1,647 @@
+// firebase/とfirebase_sesame/firebase_ssm_cmd.cをrtdb_standin.pyに繋いで動かす
+// ESP-IDFのlinuxターゲットの代わりに、esp_http_clientをlibcurlで実装した
+// shim(shim/esp_http_client_shim.c)でビルドする
+//
+//   rtdb_load --standin <rtdb_standin.py> [--python <python3>]  起動して使う
+//   rtdb_load --port <port>                                    起動済みのものを使う
+//   [--requests N] [--threads T] [--latency-ms L]
+//
+// サインイン、GET/PUT/PATCH、コマンドのバースト、トークンの失効と更新、
+// エラーの注入、ストリームを確かめた後、APIごとにN回のリクエストを
+// T本のスレッドから送り、p50/p99, 1秒あたりのリクエスト数と
+// 1リクエストあたりのヒープの確保を表示する
+// (遅延を注入しない場合と、L msの遅延を注入した場合)
+//
+// ヒープの確保は-Wl,--wrap=mallocなどで数える(libcurl内部の確保は含まない)
+
+#include "app_events.h"
+#include "cJSON.h"
+#include "dlog.h"
+#include "esp_timer.h"
+#include "firebase_auth.h"
+#include "firebase_config.h"
+#include "firebase_database.h"
+#include "firebase_ssm_cmd.h"
+#include "metrics.h"
+#include "power.h"
+#include "radio_sched.h"
+#include "test_util.h"
+#include <curl/curl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define URL_LEN 96
+#define DEFAULT_REQUESTS 400
+#define DEFAULT_THREADS 4
+#define DEFAULT_LATENCY_MS 10
+#define STANDIN_START_TIMEOUT_MS 10000
+#define STREAM_EVENT_TIMEOUT_US 5000000
+// 1リクエストあたりに残ってよいヒープ(これを超えるとリークとみなす)
+#define RETAINED_BYTES_PER_REQUEST_MAX 16
+#define BURST_COMMANDS 60 // 2/3が未完了
+#define QUEUE_PATH "sesami5pro/commands/queue"
+
+char rtdb_load_db_url[URL_LEN];
+char rtdb_load_auth_url[URL_LEN];
+char rtdb_load_refresh_url[URL_LEN];
+static char control_url[URL_LEN];
+static char stats_url[URL_LEN];
+
+// firebase_common.cが参照する(http://のURLでは使われない)
+const char root_cert_pem_start[] = "";
+const char root_cert_pem_end[] = "";
+
+// ---- ヒープの確保を数える ----
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static uint64_t heap_allocs;
+static uint64_t heap_bytes;
+static int64_t heap_live;
+static int64_t heap_peak;
+
+static void heap_grow(int64_t delta) {
+  int64_t live = __atomic_add_fetch(&heap_live, delta, __ATOMIC_RELAXED);
+  int64_t peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+  while (live > peak &&
+         !__atomic_compare_exchange_n(&heap_peak, &peak, live, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static void *heap_counted(void *ptr, size_t size) {
+  if (ptr) {
+    __atomic_add_fetch(&heap_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&heap_bytes, size, __ATOMIC_RELAXED);
+    heap_grow((int64_t)malloc_usable_size(ptr));
+  }
+  return ptr;
+}
+
+void *__wrap_malloc(size_t size) {
+  return heap_counted(__real_malloc(size), size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  return heap_counted(__real_calloc(n, size), n * size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  int64_t before = ptr ? (int64_t)malloc_usable_size(ptr) : 0;
+  void *p = __real_realloc(ptr, size);
+  if (p) {
+    __atomic_add_fetch(&heap_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&heap_bytes, size, __ATOMIC_RELAXED);
+    heap_grow((int64_t)malloc_usable_size(p) - before);
+  }
+  return p;
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr)
+    heap_grow(-(int64_t)malloc_usable_size(ptr));
+  __real_free(ptr);
+}
+
+char *__wrap_strdup(const char *s) {
+  size_t len = strlen(s) + 1;
+  char *p = __wrap_malloc(len);
+  if (p)
+    memcpy(p, s, len);
+  return p;
+}
+
+// ---- firebase/が使う、このホストでは不要な部分 ----
+
+static uint32_t token_refreshed_events;
+
+esp_err_t app_events_post(app_event_id_t id, const void *data, size_t size) {
+  if (id == APP_EVENT_TOKEN_REFRESHED)
+    __atomic_add_fetch(&token_refreshed_events, 1, __ATOMIC_RELAXED);
+  return ESP_OK;
+}
+
+void power_lock_acquire(power_lock_t lock) {}
+void power_lock_release(power_lock_t lock) {}
+bool radio_sched_wait_idle(TickType_t max_wait) { return true; }
+void dlog_write(dlog_fmt_t fmt, uint32_t arg0, uint32_t arg1, uint32_t arg2) {}
+
+// ---- スタンドイン ----
+
+static pid_t standin_pid;
+
+static void stop_standin(void) {
+  if (standin_pid > 0) {
+    kill(standin_pid, SIGTERM);
+    waitpid(standin_pid, NULL, 0);
+    standin_pid = 0;
+  }
+}
+
+// --port 0で起動し、--port-fileに書かれたポートを返す(失敗した場合は0)
+static int start_standin(const char *python, const char *script) {
+  char port_file[] = "/tmp/rtdb_load_portXXXXXX";
+  int fd = mkstemp(port_file);
+  if (fd < 0)
+    return 0;
+  close(fd);
+  unlink(port_file);
+
+  standin_pid = fork();
+  if (standin_pid == 0) {
+    execlp(python, python, script, "--port", "0", "--port-file", port_file,
+           "--api-key", FIREBASE_API_KEY, "--email", FIREBASE_EMAIL,
+           "--password", FIREBASE_PASSWORD, "--require-auth", "--keepalive",
+           "1", "--index", QUEUE_PATH ":is_finished", (char *)NULL);
+    _exit(127);
+  }
+  if (standin_pid < 0)
+    return 0;
+  atexit(stop_standin);
+
+  int port = 0;
+  for (int waited = 0; waited < STANDIN_START_TIMEOUT_MS && port == 0;
+       waited += 20) {
+    FILE *f = fopen(port_file, "r");
+    if (f) {
+      if (fscanf(f, "%d", &port) != 1)
+        port = 0;
+      fclose(f);
+    }
+    if (port == 0)
+      usleep(20000);
+  }
+  unlink(port_file);
+  return port;
+}
+
+typedef struct {
+  char *buf;
+  size_t len;
+} curl_body_t;
+
+static size_t curl_body_write(char *data, size_t size, size_t n, void *arg) {
+  curl_body_t *body = arg;
+  char *p = realloc(body->buf, body->len + size * n + 1);
+  if (!p)
+    return 0;
+  memcpy(p + body->len, data, size * n);
+  body->buf = p;
+  body->len += size * n;
+  body->buf[body->len] = '\0';
+  return size * n;
+}
+
+// スタンドインの/__controlと/__statsはfirebase/を通さずに直接呼ぶ
+static cJSON *standin_request(const char *url, const char *post_json) {
+  curl_body_t body = {0};
+  CURL *curl = curl_easy_init();
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_body_write);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+  if (post_json)
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_json);
+  CURLcode res = curl_easy_perform(curl);
+  curl_easy_cleanup(curl);
+  cJSON *root = res == CURLE_OK && body.buf ? cJSON_Parse(body.buf) : NULL;
+  free(body.buf);
+  return root;
+}
+
+static void standin_control(const char *json) {
+  cJSON *root = standin_request(control_url, json);
+  CHECK(root != NULL);
+  cJSON_Delete(root);
+}
+
+static double standin_stat(const char *name) {
+  cJSON *root = standin_request(stats_url, NULL);
+  double value = cJSON_GetNumberValue(cJSON_GetObjectItem(root, name));
+  cJSON_Delete(root);
+  return value != value ? 0 : value; // 未記録はNaN
+}
+
+static double counter(const char *name) {
+  cJSON *root = metrics_to_json();
+  double value = cJSON_GetNumberValue(
+      cJSON_GetObjectItem(cJSON_GetObjectItem(root, "counters"), name));
+  cJSON_Delete(root);
+  return value;
+}
+
+// ---- 機能の確認 ----
+
+static firebase_auth_info_t *auth;
+
+static void test_sign_in(void) {
+  auth = firebase_setup_auth(FIREBASE_EMAIL, FIREBASE_PASSWORD,
+                             FIREBASE_API_KEY, FIREBASE_DB_URL_BASE, 1);
+  CHECK(auth != NULL);
+  if (!auth)
+    exit(1);
+  CHECK(auth->id_token[0] != '\0');
+  CHECK(auth->refresh_token[0] != '\0');
+  CHECK_EQ(1, standin_stat("sign_ins"));
+}
+
+static void test_status_round_trip(void) {
+  firebase_ssm_status_t status = SSM_STATUS_UNKNOWN;
+  CHECK_EQ(ESP_OK, firebase_ssm_update_current_status(auth, SSM_STATUS_LOCKED));
+  CHECK_EQ(ESP_OK, firebase_ssm_get_current_status(auth, &status));
+  CHECK_EQ(SSM_STATUS_LOCKED, status);
+  CHECK_EQ(ESP_OK,
+           firebase_ssm_update_current_status(auth, SSM_STATUS_UNLOCKED));
+  CHECK_EQ(ESP_OK, firebase_ssm_get_current_status(auth, &status));
+  CHECK_EQ(SSM_STATUS_UNLOCKED, status);
+}
+
+static void seed_queue(int unfinished, int finished) {
+  // sesami5pro/commands/queueとsesami5pro/statusを作り直す
+  cJSON *root = cJSON_CreateObject();
+  cJSON *ssm = cJSON_AddObjectToObject(root, "sesami5pro");
+  cJSON_AddStringToObject(ssm, "status", "locked");
+  cJSON *commands = cJSON_AddObjectToObject(ssm, "commands");
+  cJSON *q = cJSON_AddObjectToObject(commands, "queue");
+  for (int i = 0; i < unfinished + finished; i++) {
+    char id[FIREBASE_SSM_CMD_ID_LEN];
+    // 逆順に作り、push IDの昇順に並べ直されることを確かめる
+    snprintf(id, sizeof(id), "-Load%04d", unfinished + finished - i);
+    cJSON *cmd = cJSON_AddObjectToObject(q, id);
+    cJSON_AddStringToObject(cmd, "name", i % 2 ? "unlock" : "lock");
+    cJSON_AddStringToObject(cmd, "user_name", "rtdb_load");
+    cJSON_AddBoolToObject(cmd, "is_finished", i >= unfinished);
+  }
+  cJSON *body = cJSON_CreateObject();
+  cJSON_AddItemToObject(body, "data", root);
+  char *json = cJSON_PrintUnformatted(body);
+  standin_control(json);
+  free(json);
+  cJSON_Delete(body);
+}
+
+static void test_commands(void) {
+  seed_queue(3, 2);
+  firebase_ssm_cmd_t cmds[FIREBASE_SSM_CMD_QUEUE_MAX];
+  size_t count = 0;
+  CHECK_EQ(ESP_OK, firebase_ssm_get_commands(auth, cmds,
+                                             FIREBASE_SSM_CMD_QUEUE_MAX,
+                                             &count));
+  CHECK_EQ(3, count);
+  CHECK(strcmp(cmds[0].id, "-Load0003") == 0);
+  CHECK(strcmp(cmds[2].id, "-Load0005") == 0);
+  CHECK_EQ(SSM_CMD_LOCK, cmds[0].cmd_type);
+
+  cmds[0].is_finished = true;
+  cmds[0].is_success = true;
+  CHECK_EQ(ESP_OK, firebase_ssm_update_status(auth, &cmds[0]));
+  CHECK_EQ(ESP_OK, firebase_ssm_get_commands(auth, cmds,
+                                             FIREBASE_SSM_CMD_QUEUE_MAX,
+                                             &count));
+  CHECK_EQ(2, count);
+  CHECK(strcmp(cmds[0].id, "-Load0004") == 0);
+}
+
+static void test_token_expiry(void) {
+  double before_4xx = counter("http_4xx");
+  uint32_t before_events = token_refreshed_events;
+  standin_control("{\"expire_tokens\": true}");
+
+  firebase_ssm_status_t status;
+  CHECK(firebase_ssm_get_current_status(auth, &status) != ESP_OK);
+  CHECK_EQ(before_4xx + 1, counter("http_4xx"));
+  // ssm_tasks.cはこれを見てid_tokenの更新をやり直す
+  firebase_ssm_cmd_t cmds[FIREBASE_SSM_CMD_QUEUE_MAX];
+  size_t count;
+  CHECK_EQ(ESP_ERR_INVALID_STATE,
+           firebase_ssm_get_commands(auth, cmds, FIREBASE_SSM_CMD_QUEUE_MAX,
+                                     &count));
+
+  CHECK_EQ(ESP_OK, firebase_refresh_auth(auth));
+  CHECK_EQ(before_events + 1, token_refreshed_events);
+  CHECK_EQ(1, standin_stat("refreshes"));
+  CHECK_EQ(ESP_OK, firebase_ssm_get_current_status(auth, &status));
+}
+
+static void test_injected_errors(void) {
+  double before_5xx = counter("http_5xx");
+  double before_transport = counter("http_transport_errors");
+
+  // 5xxはesp_http_client_performとしては成功で、ステータスで区別する
+  standin_control("{\"error_rate\": 1, \"error_status\": 503}");
+  firebase_ssm_update_current_status(auth, SSM_STATUS_LOCKED);
+  CHECK_EQ(before_5xx + 1, counter("http_5xx"));
+
+  standin_control("{\"error_status\": 0}");
+  CHECK(firebase_ssm_update_current_status(auth, SSM_STATUS_LOCKED) !=
+        ESP_OK);
+  CHECK_EQ(before_transport + 1, counter("http_transport_errors"));
+
+  standin_control("{\"error_rate\": 0, \"error_status\": 503}");
+  CHECK_EQ(ESP_OK, firebase_ssm_update_current_status(auth, SSM_STATUS_LOCKED));
+}
+
+// ssm_tasks.cのコマンドの処理と同じく、取得して結果を書き込むことを
+// キューが空になるまで繰り返す
+static void test_command_burst(void) {
+  // 古いコマンドの間に完了済みのものを混ぜ、新しい順に作る
+  cJSON *root = cJSON_CreateObject();
+  cJSON *ssm = cJSON_AddObjectToObject(root, "sesami5pro");
+  cJSON_AddStringToObject(ssm, "status", "locked");
+  cJSON *commands = cJSON_AddObjectToObject(ssm, "commands");
+  cJSON *q = cJSON_AddObjectToObject(commands, "queue");
+  int unfinished = 0;
+  for (int i = BURST_COMMANDS - 1; i >= 0; i--) {
+    char id[FIREBASE_SSM_CMD_ID_LEN];
+    snprintf(id, sizeof(id), "-Burst%04d", i);
+    cJSON *cmd = cJSON_AddObjectToObject(q, id);
+    cJSON_AddStringToObject(cmd, "name", i % 2 ? "unlock" : "lock");
+    cJSON_AddBoolToObject(cmd, "is_finished", i % 3 == 0);
+    unfinished += i % 3 != 0;
+  }
+  cJSON *body = cJSON_CreateObject();
+  cJSON_AddItemToObject(body, "data", root);
+  char *json = cJSON_PrintUnformatted(body);
+  standin_control(json);
+  free(json);
+  cJSON_Delete(body);
+
+  double queries = standin_stat("queries");
+  int executed = 0, fetches = 0, out_of_order = 0;
+  char last_id[FIREBASE_SSM_CMD_ID_LEN] = "";
+  int64_t start = esp_timer_get_time();
+  for (;;) {
+    firebase_ssm_cmd_t cmds[FIREBASE_SSM_CMD_QUEUE_MAX];
+    size_t count = 0;
+    esp_err_t err = firebase_ssm_get_commands(
+        auth, cmds, FIREBASE_SSM_CMD_QUEUE_MAX, &count);
+    CHECK_EQ(ESP_OK, err);
+    fetches++;
+    if (err != ESP_OK || count == 0)
+      break;
+    for (size_t i = 0; i < count; i++) {
+      out_of_order += strcmp(last_id, cmds[i].id) >= 0;
+      strcpy(last_id, cmds[i].id);
+      cmds[i].is_finished = true;
+      cmds[i].is_success = true;
+      CHECK_EQ(ESP_OK, firebase_ssm_update_status(auth, &cmds[i]));
+      executed++;
+    }
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+
+  // 1回の取得でFIREBASE_SSM_CMD_QUEUE_MAX件ずつ、古い順に1回だけ処理する
+  CHECK_EQ(unfinished, executed);
+  CHECK_EQ(0, out_of_order);
+  int expected_fetches = (unfinished + FIREBASE_SSM_CMD_QUEUE_MAX - 1) /
+                             FIREBASE_SSM_CMD_QUEUE_MAX +
+                         1;
+  CHECK_EQ(expected_fetches, fetches);
+  CHECK_EQ(queries + fetches, standin_stat("queries"));
+  printf("burst: %d of %d commands in %.1f ms (%.0f cmds/s, %d fetches)\n",
+         executed, BURST_COMMANDS, elapsed / 1000.0,
+         executed * 1e6 / elapsed, fetches);
+}
+
+typedef struct {
+  pthread_mutex_t lock;
+  char events[8][16];
+  int count;
+  esp_err_t result;
+  bool done;
+} stream_log_t;
+
+static void stream_cb(const char *event, const char *data, void *arg) {
+  stream_log_t *log = arg;
+  pthread_mutex_lock(&log->lock);
+  if (log->count < 8)
+    snprintf(log->events[log->count++], sizeof(log->events[0]), "%s", event);
+  pthread_mutex_unlock(&log->lock);
+}
+
+static void *stream_task(void *arg) {
+  stream_log_t *log = arg;
+  esp_err_t err = firebase_ssm_stream_commands(auth, stream_cb, log);
+  pthread_mutex_lock(&log->lock);
+  log->result = err;
+  log->done = true;
+  pthread_mutex_unlock(&log->lock);
+  return NULL;
+}
+
+// n個目のイベントが届くまで待ち、その名前を返す
+static const char *wait_stream_event(stream_log_t *log, int n) {
+  int64_t start = esp_timer_get_time();
+  const char *event = NULL;
+  while (!event && esp_timer_get_time() - start < STREAM_EVENT_TIMEOUT_US) {
+    pthread_mutex_lock(&log->lock);
+    if (log->count > n)
+      event = log->events[n];
+    pthread_mutex_unlock(&log->lock);
+    if (!event)
+      usleep(1000);
+  }
+  return event ? event : "";
+}
+
+static void test_stream(void) {
+  seed_queue(1, 0);
+  static stream_log_t log = {.lock = PTHREAD_MUTEX_INITIALIZER};
+  pthread_t task;
+  pthread_create(&task, NULL, stream_task, &log);
+  CHECK(strcmp(wait_stream_event(&log, 0), "put") == 0);
+
+  firebase_ssm_cmd_t cmd = {.id = "-Load0001", .is_finished = true};
+  CHECK_EQ(ESP_OK, firebase_ssm_update_status(auth, &cmd));
+  // クエリのストリームなので、範囲から外れたコマンドはputで届く
+  CHECK(strcmp(wait_stream_event(&log, 1), "put") == 0);
+
+  // トークンが失効するとauth_revokedで切断される
+  standin_control("{\"expire_tokens\": true}");
+  pthread_join(task, NULL);
+  CHECK(log.done);
+  CHECK_EQ(ESP_OK, log.result);
+  CHECK_EQ(0, standin_stat("active_streams"));
+  CHECK_EQ(ESP_OK, firebase_refresh_auth(auth));
+}
+
+// ---- 負荷 ----
+
+typedef esp_err_t (*load_fn_t)(int i);
+
+static esp_err_t load_get_status(int i) {
+  firebase_ssm_status_t status;
+  return firebase_ssm_get_current_status(auth, &status);
+}
+
+static esp_err_t load_put_status(int i) {
+  return firebase_ssm_update_current_status(
+      auth, i % 2 ? SSM_STATUS_UNLOCKED : SSM_STATUS_LOCKED);
+}
+
+static esp_err_t load_patch_result(int i) {
+  firebase_ssm_cmd_t cmd = {.is_finished = false, .is_success = i % 2};
+  snprintf(cmd.id, sizeof(cmd.id), "-Load%04d",
+           1 + i % FIREBASE_SSM_CMD_QUEUE_MAX);
+  return firebase_ssm_update_status(auth, &cmd);
+}
+
+static esp_err_t load_get_commands(int i) {
+  firebase_ssm_cmd_t cmds[FIREBASE_SSM_CMD_QUEUE_MAX];
+  size_t count = 0;
+  esp_err_t err = firebase_ssm_get_commands(auth, cmds,
+                                            FIREBASE_SSM_CMD_QUEUE_MAX, &count);
+  return err == ESP_OK && count != FIREBASE_SSM_CMD_QUEUE_MAX
+             ? ESP_ERR_INVALID_RESPONSE
+             : err;
+}
+
+static const struct {
+  const char *name;
+  load_fn_t fn;
+} scenarios[] = {
+    {"get status", load_get_status},
+    {"put status", load_put_status},
+    {"patch result", load_patch_result},
+    {"get commands", load_get_commands},
+};
+
+typedef struct {
+  load_fn_t fn;
+  int requests;
+  int next;
+  int errors;
+  int64_t *latency_us;
+} load_run_t;
+
+static void *load_task(void *arg) {
+  load_run_t *run = arg;
+  for (;;) {
+    int i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED);
+    if (i >= run->requests)
+      break;
+    int64_t t0 = esp_timer_get_time();
+    if (run->fn(i) != ESP_OK)
+      __atomic_add_fetch(&run->errors, 1, __ATOMIC_RELAXED);
+    run->latency_us[i] = esp_timer_get_time() - t0;
+  }
+  return NULL;
+}
+
+static int compare_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void measure(const char *name, load_fn_t fn, int requests, int threads,
+                    int latency_ms) {
+  load_run_t run = {.fn = fn, .requests = requests};
+  run.latency_us = calloc(requests, sizeof(int64_t));
+  pthread_t tasks[threads];
+
+  uint64_t allocs = heap_allocs, bytes = heap_bytes;
+  int64_t base = __atomic_load_n(&heap_live, __ATOMIC_RELAXED);
+  __atomic_store_n(&heap_peak, base, __ATOMIC_RELAXED);
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < threads; i++)
+    pthread_create(&tasks[i], NULL, load_task, &run);
+  for (int i = 0; i < threads; i++)
+    pthread_join(tasks[i], NULL);
+  int64_t elapsed = esp_timer_get_time() - start;
+  uint64_t run_allocs = heap_allocs - allocs;
+  uint64_t run_bytes = heap_bytes - bytes;
+  int64_t peak = heap_peak - base;
+  int64_t retained = heap_live - base; // 解放されずに残った分
+
+  qsort(run.latency_us, requests, sizeof(int64_t), compare_i64);
+  printf("%-13s %4d ms %5d %3d %4d %8.1f %8.2f %8.2f %7.1f %8.1f %8.1f "
+         "%7.1f\n",
+         name, latency_ms, requests, threads, run.errors,
+         requests * 1e6 / elapsed, run.latency_us[requests / 2] / 1000.0,
+         run.latency_us[requests * 99 / 100] / 1000.0,
+         (double)run_allocs / requests, (double)run_bytes / requests / 1024,
+         peak / 1024.0, (double)retained / requests);
+  CHECK_EQ(0, run.errors);
+  CHECK(retained < requests * RETAINED_BYTES_PER_REQUEST_MAX);
+  free(run.latency_us);
+}
+
+static void run_load(int requests, int threads, int latency_ms) {
+  char knobs[64];
+  snprintf(knobs, sizeof(knobs), "{\"latency_ms\": %d}", latency_ms);
+  standin_control(knobs);
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    measure(scenarios[i].name, scenarios[i].fn, requests, threads,
+            latency_ms);
+}
+
+int main(int argc, char **argv) {
+  const char *python = "python3";
+  const char *script = NULL;
+  int port = 0;
+  int requests = DEFAULT_REQUESTS;
+  int threads = DEFAULT_THREADS;
+  int latency_ms = DEFAULT_LATENCY_MS;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--standin"))
+      script = argv[i + 1];
+    else if (!strcmp(argv[i], "--python"))
+      python = argv[i + 1];
+    else if (!strcmp(argv[i], "--port"))
+      port = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--requests"))
+      requests = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--threads"))
+      threads = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--latency-ms"))
+      latency_ms = atoi(argv[i + 1]);
+  }
+  if (script)
+    port = start_standin(python, script);
+  if (port <= 0 || requests <= 0 || threads <= 0) {
+    fprintf(stderr, "usage: %s --standin <rtdb_standin.py> | --port <port>\n",
+            argv[0]);
+    return 2;
+  }
+
+  snprintf(rtdb_load_db_url, URL_LEN, "http://127.0.0.1:%d/", port);
+  snprintf(rtdb_load_auth_url, URL_LEN,
+           "http://127.0.0.1:%d/v1/accounts:signInWithPassword?key=", port);
+  snprintf(rtdb_load_refresh_url, URL_LEN,
+           "http://127.0.0.1:%d/v1/token?key=", port);
+  snprintf(control_url, URL_LEN, "http://127.0.0.1:%d/__control", port);
+  snprintf(stats_url, URL_LEN, "http://127.0.0.1:%d/__stats", port);
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  firebase_https_mutex = xSemaphoreCreateMutex();
+
+  RUN_TEST(test_sign_in);
+  RUN_TEST(test_status_round_trip);
+  RUN_TEST(test_commands);
+  RUN_TEST(test_command_burst);
+  RUN_TEST(test_token_expiry);
+  RUN_TEST(test_injected_errors);
+  RUN_TEST(test_stream);
+
+  seed_queue(FIREBASE_SSM_CMD_QUEUE_MAX, FIREBASE_SSM_CMD_QUEUE_MAX);
+  printf("\n%-13s %7s %5s %3s %4s %8s %8s %8s %7s %8s %8s %7s\n", "api",
+         "latency", "req", "thr", "err", "req/s", "p50 ms", "p99 ms", "allocs",
+         "KB/req", "peak KB", "B left");
+  run_load(requests, threads, 0);
+  // firebase_https_mutexで1本ずつになるため、遅延がそのまま積み重なる
+  int slow_requests = requests / 8 > threads ? requests / 8 : threads;
+  run_load(slow_requests, threads, latency_ms);
+  standin_control("{\"latency_ms\": 0}");
+
+  free(auth);
+  curl_global_cleanup();
+  return TEST_RESULT();
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// rtdb_load用の設定(shim/include/sdkconfig.hの代わりに読み込ませる)
+// 接続先のURLはrtdb_standin.pyが待ち受けたポートからrtdb_load.cが組み立てる
+
+extern char rtdb_load_db_url[];
+extern char rtdb_load_auth_url[];
+extern char rtdb_load_refresh_url[];
+
+#define CONFIG_FIREBASE_EMAIL "gateway@example.com"
+#define CONFIG_FIREBASE_PASSWORD "rtdb-load-password"
+#define CONFIG_FIREBASE_API_KEY "rtdb-load-key"
+#define CONFIG_FIREBASE_DB_URL_BASE rtdb_load_db_url
+#define CONFIG_FIREBASE_AUTH_URL_BASE rtdb_load_auth_url
+#define CONFIG_FIREBASE_REFRESH_URL_BASE rtdb_load_refresh_url
@@ -0,0 +1,600 @@
+#!/usr/bin/env python3
+# Firebase Realtime Database(REST)とIdentity Toolkit/Secure Tokenの
+# ローカルのスタンドイン。firebase/のクライアントをオフラインで動かすために使う
+#
+#   python3 rtdb_standin.py --port 9000 --index sesami5pro/commands/queue:is_finished
+#
+# Kconfigの接続先を次のようにすると、ファームウェアのクライアントもそのまま繋がる
+#   FIREBASE_DB_URL_BASE      http://<host>:9000/
+#   FIREBASE_AUTH_URL_BASE    http://<host>:9000/v1/accounts:signInWithPassword?key=
+#   FIREBASE_REFRESH_URL_BASE http://<host>:9000/v1/token?key=
+#
+# RTDB:
+#   GET/PUT/PATCH/POST/DELETE <path>.json
+#   クエリ(orderBy, equalTo, startAt, endAt, limitToFirst, limitToLast)
+#     子の値で並べる場合は--indexで.indexOnを定義しておく(無い場合は400)
+#   ETag(X-Firebase-ETag: true, if-match), print=silent
+#   Accept: text/event-stream でのストリーミング(put/patch, keep-alive,
+#   トークン失効時のauth_revoked)
+# 認証:
+#   ?auth=<idToken>。--token-ttlで失効し、失効後は401
+# 故障の注入:
+#   --latency-ms/--jitter-ms, --error-rate/--error-status(0は応答せずに切断)
+# 制御(テスト用):
+#   POST /__control {"latency_ms", "jitter_ms", "error_rate", "error_status",
+#                    "token_ttl", "expire_tokens", "reset", "data"}
+#   GET  /__stats
+
+import argparse
+import collections
+import hashlib
+import json
+import os
+import random
+import secrets
+import sys
+import threading
+import time
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+PUSH_CHARS = "-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz"
+CHANGE_LOG_LEN = 1024
+
+
+def split_path(path):
+    if path.endswith(".json"):
+        path = path[: -len(".json")]
+    return [urllib.parse.unquote(p) for p in path.split("/") if p]
+
+
+def is_prefix(a, b):
+    return len(a) <= len(b) and b[: len(a)] == a
+
+
+def etag_of(value):
+    body = json.dumps(value, sort_keys=True, separators=(",", ":"))
+    return hashlib.md5(body.encode()).hexdigest()
+
+
+def prune(value):
+    # RTDBは空のオブジェクトとnullを保存しない
+    if isinstance(value, dict):
+        out = {}
+        for k, v in value.items():
+            v = prune(v)
+            if v is not None:
+                out[k] = v
+        return out or None
+    return value
+
+
+class QueryError(Exception):
+    pass
+
+
+def sort_key_for(value, key):
+    # RTDBの並び順: 無し(null) < false < true < 数値 < 文字列 < オブジェクト
+    if value is None:
+        rank, v = 0, 0
+    elif value is False:
+        rank, v = 1, 0
+    elif value is True:
+        rank, v = 2, 0
+    elif isinstance(value, (int, float)):
+        rank, v = 3, value
+    elif isinstance(value, str):
+        rank, v = 4, value
+    else:
+        rank, v = 5, 0
+    return (rank, v, key)
+
+
+class State:
+    def __init__(self, args):
+        self.cond = threading.Condition()
+        self.root = None
+        self.seq = 0
+        self.changes = collections.deque(maxlen=CHANGE_LOG_LEN)
+        self.last_push_ms = 0
+        self.last_push_rand = [0] * 12
+        self.api_key = args.api_key
+        self.email = args.email
+        self.password = args.password
+        self.require_auth = args.require_auth
+        self.indexes = set()
+        for spec in args.index or []:
+            path, _, child = spec.rpartition(":")
+            self.indexes.add((tuple(split_path(path)), child))
+        self.knobs = {
+            "latency_ms": args.latency_ms,
+            "jitter_ms": args.jitter_ms,
+            "error_rate": args.error_rate,
+            "error_status": args.error_status,
+            "token_ttl": args.token_ttl,
+        }
+        self.tokens = {}  # idToken -> 失効する時刻
+        self.refresh_tokens = set()
+        self.stats = collections.Counter()
+        self.active_streams = 0
+
+    # データ
+
+    def get(self, parts):
+        node = self.root
+        for p in parts:
+            if not isinstance(node, dict) or p not in node:
+                return None
+            node = node[p]
+        return node
+
+    def _set(self, parts, value):
+        if not parts:
+            self.root = prune(value)
+            return
+        if not isinstance(self.root, dict):
+            self.root = {}
+        node = self.root
+        for p in parts[:-1]:
+            if not isinstance(node.get(p), dict):
+                node[p] = {}
+            node = node[p]
+        value = prune(value)
+        if value is None:
+            node.pop(parts[-1], None)
+        else:
+            node[parts[-1]] = value
+        self.root = prune(self.root)
+
+    def write(self, parts, value, kind="put"):
+        # condを持って呼ぶ
+        if kind == "patch":
+            for k, v in value.items():
+                self._set(parts + split_path(k), v)
+        else:
+            self._set(parts, value)
+        self.seq += 1
+        self.changes.append((self.seq, parts, kind, value))
+        self.cond.notify_all()
+
+    def push_id(self):
+        now = int(time.time() * 1000)
+        if now == self.last_push_ms:
+            for i in range(11, -1, -1):
+                if self.last_push_rand[i] != 63:
+                    self.last_push_rand[i] += 1
+                    break
+                self.last_push_rand[i] = 0
+        else:
+            self.last_push_ms = now
+            self.last_push_rand = [random.randrange(64) for _ in range(12)]
+        head = ""
+        for _ in range(8):
+            head = PUSH_CHARS[now % 64] + head
+            now //= 64
+        return head + "".join(PUSH_CHARS[i] for i in self.last_push_rand)
+
+    # クエリ
+
+    def query(self, parts, params):
+        value = self.get(parts)
+        order_by = params.get("orderBy")
+        filters = [k for k in ("equalTo", "startAt", "endAt", "limitToFirst",
+                               "limitToLast") if k in params]
+        if order_by is None:
+            if filters:
+                raise QueryError("orderBy must be defined when other query "
+                                 "parameters are defined")
+            return value
+        try:
+            order_by = json.loads(order_by)
+            bounds = {k: json.loads(params[k]) for k in filters}
+        except ValueError:
+            raise QueryError("Constraint index field must be a JSON primitive")
+        if (order_by not in ("$key", "$value", "$priority")
+                and (tuple(parts), order_by) not in self.indexes):
+            path = "/" + "/".join(parts)
+            raise QueryError(
+                'Index not defined, add ".indexOn": "%s", for path "%s", '
+                "to the rules" % (order_by, path))
+        if not isinstance(value, dict):
+            return value
+
+        def field(key, child):
+            if order_by == "$key":
+                return key
+            if order_by == "$value":
+                return child
+            return child.get(order_by) if isinstance(child, dict) else None
+
+        items = sorted(value.items(),
+                       key=lambda kv: sort_key_for(field(*kv), kv[0]))
+        out = []
+        for key, child in items:
+            v = field(key, child)
+            k = sort_key_for(v, "")
+            if "equalTo" in bounds and k != sort_key_for(bounds["equalTo"], ""):
+                continue
+            if "startAt" in bounds and k < sort_key_for(bounds["startAt"], ""):
+                continue
+            if "endAt" in bounds and k > sort_key_for(bounds["endAt"], ""):
+                continue
+            out.append((key, child))
+        if "limitToFirst" in bounds:
+            out = out[: int(bounds["limitToFirst"])]
+        if "limitToLast" in bounds:
+            out = out[-int(bounds["limitToLast"]):] if bounds["limitToLast"] else []
+        return dict(out) or None
+
+    # 認証
+
+    def new_tokens(self):
+        id_token = "id-" + secrets.token_hex(16)
+        refresh_token = "rt-" + secrets.token_hex(16)
+        self.tokens[id_token] = time.time() + self.knobs["token_ttl"]
+        self.refresh_tokens.add(refresh_token)
+        return id_token, refresh_token
+
+    def check_token(self, token):
+        # 問題なければNone、そうでなければエラーのメッセージ
+        if token is None:
+            return "Permission denied" if self.require_auth else None
+        expires = self.tokens.get(token)
+        if expires is None:
+            return "Could not parse auth token."
+        if time.time() >= expires:
+            return "Auth token is expired"
+        return None
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "rtdb-standin/1.0"
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            sys.stderr.write("standin: " + fmt % args + "\n")
+
+    @property
+    def state(self):
+        return self.server.state
+
+    def _send(self, status, body, headers=None):
+        data = json.dumps(body).encode()  # RTDBと同じく値が無い場合は"null"
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json; charset=utf-8")
+        self.send_header("Content-Length", str(len(data)))
+        for k, v in (headers or {}).items():
+            self.send_header(k, v)
+        self.end_headers()
+        self.wfile.write(data)
+
+    def _read_body(self):
+        length = int(self.headers.get("Content-Length") or 0)
+        return self.rfile.read(length) if length else b""
+
+    def _inject(self):
+        # 遅延とエラーの注入。応答した(または切断した)場合はTrue
+        knobs = self.state.knobs
+        delay = knobs["latency_ms"] + random.uniform(0, knobs["jitter_ms"])
+        if delay > 0:
+            time.sleep(delay / 1000.0)
+        if knobs["error_rate"] > 0 and random.random() < knobs["error_rate"]:
+            with self.state.cond:
+                self.state.stats["errors_injected"] += 1
+            self._read_body()
+            if knobs["error_status"] == 0:
+                self.close_connection = True
+                self.connection.shutdown(2)
+                return True
+            self._send(knobs["error_status"], {"error": "injected error"})
+            return True
+        return False
+
+    def _split(self):
+        url = urllib.parse.urlsplit(self.path)
+        params = dict(urllib.parse.parse_qsl(url.query, keep_blank_values=True))
+        return url.path, params
+
+    def _handle(self, method):
+        path, params = self._split()
+        with self.state.cond:
+            self.state.stats[method] += 1
+        if path == "/__control" and method == "POST":
+            return self._control()
+        if path == "/__stats" and method == "GET":
+            with self.state.cond:
+                stats = dict(self.state.stats)
+                stats["active_streams"] = self.state.active_streams
+            return self._send(200, stats)
+        if self._inject():
+            return
+        if path.startswith("/v1/") and method == "POST":
+            return self._identity(path, params)
+        return self._database(method, path, params)
+
+    def do_GET(self):
+        self._handle("GET")
+
+    def do_PUT(self):
+        self._handle("PUT")
+
+    def do_PATCH(self):
+        self._handle("PATCH")
+
+    def do_POST(self):
+        self._handle("POST")
+
+    def do_DELETE(self):
+        self._handle("DELETE")
+
+    def _control(self):
+        body = json.loads(self._read_body() or b"{}")
+        st = self.state
+        with st.cond:
+            for k in st.knobs:
+                if k in body:
+                    st.knobs[k] = body[k]
+            if body.get("expire_tokens"):
+                for token in st.tokens:
+                    st.tokens[token] = 0
+                st.cond.notify_all()
+            if body.get("reset"):
+                st.stats.clear()
+                st.write([], None)
+            if "data" in body:
+                st.write([], body["data"])
+        self._send(200, st.knobs)
+
+    # Identity Toolkit / Secure Token
+
+    def _identity(self, path, params):
+        st = self.state
+        raw = self._read_body()
+        if st.api_key and params.get("key") != st.api_key:
+            return self._send(400, {"error": {
+                "code": 400, "message": "API key not valid. Please pass a "
+                "valid API key."}})
+        if path == "/v1/accounts:signInWithPassword":
+            try:
+                req = json.loads(raw)
+            except ValueError:
+                return self._send(400, {"error": {"code": 400,
+                                                  "message": "INVALID_JSON"}})
+            if st.email and req.get("email") != st.email:
+                return self._send(400, {"error": {"code": 400,
+                                                  "message": "EMAIL_NOT_FOUND"}})
+            if st.password and req.get("password") != st.password:
+                return self._send(400, {"error": {"code": 400,
+                                                  "message": "INVALID_PASSWORD"}})
+            with st.cond:
+                st.stats["sign_ins"] += 1
+                id_token, refresh_token = st.new_tokens()
+                ttl = st.knobs["token_ttl"]
+            return self._send(200, {
+                "kind": "identitytoolkit#VerifyPasswordResponse",
+                "localId": "standin-user", "email": req.get("email"),
+                "idToken": id_token, "refreshToken": refresh_token,
+                "expiresIn": str(int(ttl)), "registered": True})
+        if path == "/v1/token":
+            form = dict(urllib.parse.parse_qsl(raw.decode()))
+            with st.cond:
+                if (form.get("grant_type") != "refresh_token"
+                        or form.get("refresh_token") not in st.refresh_tokens):
+                    return self._send(400, {"error": {
+                        "code": 400, "message": "INVALID_REFRESH_TOKEN"}})
+                st.stats["refreshes"] += 1
+                st.refresh_tokens.discard(form["refresh_token"])
+                id_token, refresh_token = st.new_tokens()
+                ttl = st.knobs["token_ttl"]
+            return self._send(200, {
+                "id_token": id_token, "refresh_token": refresh_token,
+                "expires_in": str(int(ttl)), "token_type": "Bearer",
+                "user_id": "standin-user"})
+        return self._send(404, {"error": {"code": 404, "message": "NOT_FOUND"}})
+
+    # Realtime Database
+
+    def _database(self, method, path, params):
+        st = self.state
+        if not path.endswith(".json"):
+            return self._send(404, {"error": "Not Found"})
+        parts = split_path(path)
+        raw = self._read_body() if method in ("PUT", "PATCH", "POST") else b""
+        token = params.get("auth")
+        with st.cond:
+            denied = st.check_token(token)
+        if denied:
+            return self._send(401, {"error": denied})
+
+        if method == "GET" and "text/event-stream" in (
+                self.headers.get("Accept") or ""):
+            return self._stream(parts, params, token)
+
+        body = None
+        if raw:
+            try:
+                body = json.loads(raw)
+            except ValueError:
+                return self._send(400, {"error": "Invalid data; couldn't "
+                                                 "parse JSON object."})
+        silent = params.get("print") == "silent"
+        with st.cond:
+            current = st.get(parts)
+            headers = {}
+            if self.headers.get("X-Firebase-ETag", "").lower() == "true":
+                headers["ETag"] = etag_of(current)
+            if_match = self.headers.get("if-match")
+            if if_match is not None and if_match != etag_of(current):
+                headers["ETag"] = etag_of(current)
+                return self._send(412, current, headers)
+
+            if method == "GET":
+                if "orderBy" in params:
+                    st.stats["queries"] += 1
+                try:
+                    value = st.query(parts, params)
+                except QueryError as e:
+                    return self._send(400, {"error": str(e)})
+            elif method == "PUT":
+                st.write(parts, body)
+                value = st.get(parts)
+            elif method == "PATCH":
+                if not isinstance(body, dict):
+                    return self._send(400, {"error": "Invalid data; couldn't "
+                                                     "parse JSON object."})
+                st.write(parts, body, "patch")
+                value = body
+            elif method == "POST":
+                name = st.push_id()
+                st.write(parts + [name], body)
+                value = {"name": name}
+            else:  # DELETE
+                st.write(parts, None)
+                value = None
+            if "ETag" in headers and method != "GET":
+                headers["ETag"] = etag_of(st.get(parts))
+        if silent:
+            self.send_response(204)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+        self._send(200, value, headers)
+
+    def _event(self, name, data):
+        msg = "event: %s\ndata: %s\n\n" % (name, json.dumps(data))
+        self.wfile.write(msg.encode())
+        self.wfile.flush()
+
+    def _stream(self, parts, params, token):
+        st = self.state
+        with st.cond:
+            try:
+                snapshot = st.query(parts, params)
+            except QueryError as e:
+                return self._send(400, {"error": str(e)})
+            seq = st.seq
+            st.active_streams += 1
+        is_query = "orderBy" in params
+        self.close_connection = True
+        self.send_response(200)
+        self.send_header("Content-Type", "text/event-stream")
+        self.send_header("Cache-Control", "no-cache")
+        self.send_header("Connection", "close")
+        self.end_headers()
+        try:
+            self._event("put", {"path": "/", "data": snapshot})
+            keepalive = self.server.keepalive
+            last_sent = time.monotonic()
+            while True:
+                events = []
+                with st.cond:
+                    while st.seq == seq and st.check_token(token) is None:
+                        wait = keepalive - (time.monotonic() - last_sent)
+                        if wait <= 0:
+                            break
+                        if token in st.tokens:  # 失効した時点で起きる
+                            wait = min(wait, st.tokens[token] - time.time())
+                        st.cond.wait(max(wait, 0.001))
+                    if st.check_token(token) is not None:
+                        events.append(("auth_revoked",
+                                       "credential is no longer valid"))
+                    elif st.seq != seq:
+                        events.extend(self._changes_for(parts, params, seq,
+                                                        is_query))
+                        seq = st.seq
+                if not events:
+                    self._event("keep-alive", None)
+                for name, data in events:
+                    self._event(name, data)
+                last_sent = time.monotonic()
+                if events and events[-1][0] == "auth_revoked":
+                    return
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+        finally:
+            with st.cond:
+                st.active_streams -= 1
+
+    def _changes_for(self, parts, params, seq, is_query):
+        # condを持って呼ぶ。seqより後の変更のうち、partsに関係するもの
+        st = self.state
+        changes = [c for c in st.changes if c[0] > seq]
+        if not changes or changes[0][0] != seq + 1 or is_query:
+            # 取りこぼした、またはクエリの結果が変わりうる場合は全体を送り直す
+            if any(is_prefix(parts, c[1]) or is_prefix(c[1], parts)
+                   for c in changes) or not changes:
+                return [("put", {"path": "/", "data": st.query(parts, params)})]
+            return []
+        events = []
+        for _, path, kind, value in changes:
+            if is_prefix(parts, path):
+                rel = "/" + "/".join(path[len(parts):])
+                events.append((kind, {"path": rel, "data": value}))
+            elif is_prefix(path, parts):
+                events.append(("put", {"path": "/", "data": st.get(parts)}))
+        return events
+
+
+class Server(ThreadingHTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+
+def make_server(args):
+    server = Server((args.host, args.port), Handler)
+    server.state = State(args)
+    server.keepalive = args.keepalive
+    server.verbose = args.verbose
+    if args.data:
+        with open(args.data) as f:
+            server.state.root = prune(json.load(f))
+    return server
+
+
+def parse_args(argv=None):
+    p = argparse.ArgumentParser(
+        description="Firebase RTDB/Identity Toolkitのスタンドイン")
+    p.add_argument("--host", default="127.0.0.1")
+    p.add_argument("--port", type=int, default=9000, help="0は空いているポート")
+    p.add_argument("--port-file", help="待ち受けたポートを書き込むファイル")
+    p.add_argument("--data", help="初期データ(JSON)")
+    p.add_argument("--index", action="append", metavar="PATH:CHILD",
+                   help=".indexOnを定義する(複数可)")
+    p.add_argument("--api-key", default="", help="指定した場合はkeyを検査する")
+    p.add_argument("--email", default="")
+    p.add_argument("--password", default="")
+    p.add_argument("--require-auth", action="store_true",
+                   help="authの無いRTDBへのリクエストを拒否する")
+    p.add_argument("--token-ttl", type=float, default=3600,
+                   help="idTokenの有効期間(秒)")
+    p.add_argument("--keepalive", type=float, default=30,
+                   help="ストリームのkeep-aliveの間隔(秒)")
+    p.add_argument("--latency-ms", type=float, default=0)
+    p.add_argument("--jitter-ms", type=float, default=0)
+    p.add_argument("--error-rate", type=float, default=0)
+    p.add_argument("--error-status", type=int, default=503,
+                   help="注入するエラーのステータス(0は応答せずに切断)")
+    p.add_argument("--verbose", action="store_true")
+    return p.parse_args(argv)
+
+
+def main():
+    args = parse_args()
+    server = make_server(args)
+    port = server.server_address[1]
+    if args.port_file:
+        tmp = args.port_file + ".tmp"
+        with open(tmp, "w") as f:
+            f.write("%d\n" % port)
+        os.replace(tmp, args.port_file)
+    print("rtdb-standin listening on http://%s:%d/" % (args.host, port),
+          flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,488 @@
+#include "sesame_sim.h"
+#include "aes-cbc-cmac.h"
+#include "app_events.h"
+#include "c_ccm.h"
+#include "dlog.h"
+#include "esp_random.h"
+#include "radio_sched.h"
+#include "ssm_history.h"
+#include "ssm_mech.h"
+#include "time_sync.h"
+#include "uECC.h"
+#include <string.h>
+
+#define SIM_RESULT_SUCCESS 0
+#define SIM_RESULT_NOT_FOUND 5
+
+sim_gateway_t sim_gw;
+void (*sesame_sim_air)(void);
+void (*sesame_sim_on_status)(sesame *ssm);
+
+static sesame_sim_t *sims[SIM_MAX_SESAMES];
+static int num_sims;
+static pthread_mutex_t gw_lock = PTHREAD_MUTEX_INITIALIZER;
+static const uint8_t additional_data[] = {0x00};
+
+static int sim_rng(uint8_t *dest, unsigned size) {
+  esp_fill_random(dest, size);
+  return 1;
+}
+
+static sesame_sim_t *find_sim(const sesame *gw) {
+  for (int i = 0; i < num_sims; i++) {
+    if (sims[i]->gw == gw)
+      return sims[i];
+  }
+  return NULL;
+}
+
+/* 通知(SESAME→ゲートウェイ)。lockを持って呼ぶ */
+
+static void queue_segment(sesame_sim_t *sim, const uint8_t *value,
+                          uint8_t len) {
+  if (sim->notify_len == SIM_NOTIFY_QUEUE_LEN) {
+    sim->notify_overflows++; // 実機でも溢れた通知は届かない
+    return;
+  }
+  sim_segment_t *seg =
+      &sim->notify[(sim->notify_head + sim->notify_len) % SIM_NOTIFY_QUEUE_LEN];
+  memcpy(seg->value, value, len);
+  seg->len = len;
+  sim->notify_len++;
+}
+
+// talk_to_ssmと同じ形式で分割する
+static void notify(sesame_sim_t *sim, uint8_t parsing_type,
+                   const uint8_t *frame, uint16_t frame_len) {
+  uint8_t buf[sizeof(sim->rx_buf)];
+  memcpy(buf, frame, frame_len);
+  uint16_t len = frame_len;
+  bool drop = false;
+  if (parsing_type == SSM_SEG_PARSING_TYPE_CIPHERTEXT) {
+    aes_ccm_encrypt_and_tag(sim->token, (const unsigned char *)&sim->encrypt,
+                            13, additional_data, sizeof(additional_data), buf,
+                            len, buf, buf + len, CCM_TAG_LENGTH);
+    sim->encrypt.count++;
+    len += CCM_TAG_LENGTH;
+    if (sim->drop_notifies > 0) {
+      sim->drop_notifies--;
+      drop = true;
+    } else if (sim->corrupt_notifies > 0) {
+      sim->corrupt_notifies--;
+      buf[0] ^= 0x01;
+    }
+  }
+  if (drop)
+    return;
+
+  uint16_t remain = len;
+  const uint8_t *data = buf;
+  while (remain) {
+    uint8_t seg[20];
+    uint8_t seg_len;
+    if (remain <= 19) {
+      seg[0] = parsing_type << 1u;
+      seg_len = 1 + remain;
+    } else {
+      seg[0] = 0;
+      seg_len = 20;
+    }
+    if (remain == len)
+      seg[0] |= 1u;
+    memcpy(&seg[1], data, seg_len - 1);
+    queue_segment(sim, seg, seg_len);
+    remain -= seg_len - 1;
+    data += seg_len - 1;
+  }
+}
+
+static void respond(sesame_sim_t *sim, uint8_t parsing_type, uint8_t item,
+                    uint8_t result, const void *payload, uint16_t len) {
+  uint8_t frame[3 + 80];
+  frame[0] = SSM_OP_CODE_RESPONSE;
+  frame[1] = item;
+  frame[2] = result;
+  if (len > 0)
+    memcpy(frame + 3, payload, len);
+  notify(sim, parsing_type, frame, 3 + len);
+}
+
+static void publish(sesame_sim_t *sim, uint8_t parsing_type, uint8_t item,
+                    const void *payload, uint16_t len) {
+  uint8_t frame[2 + 80];
+  frame[0] = SSM_OP_CODE_PUBLISH;
+  frame[1] = item;
+  memcpy(frame + 2, payload, len);
+  notify(sim, parsing_type, frame, 2 + len);
+}
+
+static void publish_mech_status_locked(sesame_sim_t *sim) {
+  publish(sim, SSM_SEG_PARSING_TYPE_CIPHERTEXT, SSM_ITEM_CODE_MECH_STATUS,
+          &sim->mech_status, sizeof(sim->mech_status));
+}
+
+static void add_history_locked(sesame_sim_t *sim, uint8_t type,
+                               const uint8_t *tag, uint8_t tag_len) {
+  if (sim->history_len == SIM_HISTORY_MAX)
+    return;
+  ssm_history_record_t *rec = &sim->history[sim->history_len++];
+  memset(rec, 0, sizeof(*rec));
+  rec->record_id = sim->next_record_id++;
+  rec->type = type;
+  rec->timestamp = sim->clock;
+  rec->mech_status = sim->mech_status;
+  rec->tag_len = tag_len > SSM_HISTORY_TAG_MAX_LEN ? SSM_HISTORY_TAG_MAX_LEN
+                                                   : tag_len;
+  memcpy(rec->tag, tag, rec->tag_len);
+}
+
+/* ゲートウェイからのコマンド。lockを持って呼ぶ */
+
+static void handle_registration(sesame_sim_t *sim, const uint8_t *payload) {
+  uint8_t secret[32];
+  uECC_shared_secret_lit(payload, sim->private_key, secret, uECC_secp256r1());
+  memcpy(sim->device_secret, secret, sizeof(sim->device_secret));
+  AES_CMAC(sim->device_secret, sim->random_code, 4, sim->token);
+  sim->registered = true;
+  sim->logged_in = true;
+
+  // 応答: 機器の状態(13bytes)とSESAMEの公開鍵
+  uint8_t resp[13 + 64] = {0};
+  memcpy(resp, &sim->mech_status, sizeof(sim->mech_status));
+  memcpy(resp + sizeof(sim->mech_status), &sim->mech_setting,
+         sizeof(sim->mech_setting));
+  memcpy(resp + 13, sim->public_key, sizeof(sim->public_key));
+  respond(sim, SSM_SEG_PARSING_TYPE_PLAINTEXT, SSM_ITEM_CODE_REGISTRATION,
+          SIM_RESULT_SUCCESS, resp, sizeof(resp));
+  publish_mech_status_locked(sim);
+}
+
+static void handle_login(sesame_sim_t *sim, const uint8_t *payload) {
+  uint8_t expected[16];
+  AES_CMAC(sim->device_secret, sim->random_code, 4, expected);
+  if (!sim->registered || memcmp(expected, payload, 4) != 0) {
+    sim->auth_failures++; // 応答せず、ゲートウェイのタイムアウトに任せる
+    return;
+  }
+  memcpy(sim->token, expected, sizeof(sim->token));
+  sim->logged_in = true;
+  respond(sim, SSM_SEG_PARSING_TYPE_CIPHERTEXT, SSM_ITEM_CODE_LOGIN,
+          SIM_RESULT_SUCCESS, &sim->clock, sizeof(sim->clock));
+  publish_mech_status_locked(sim);
+}
+
+static void handle_history(sesame_sim_t *sim) {
+  if (sim->history_len == 0) {
+    respond(sim, SSM_SEG_PARSING_TYPE_CIPHERTEXT, SSM_ITEM_CODE_HISTORY,
+            SIM_RESULT_NOT_FOUND, NULL, 0);
+    return;
+  }
+  // 古いものから1件ずつ返し、返したものは消す
+  const ssm_history_record_t *rec = &sim->history[0];
+  uint8_t resp[SSM_HISTORY_RESP_MIN_LEN + 1 + SSM_HISTORY_TAG_MAX_LEN];
+  memcpy(resp, &rec->record_id, 4);
+  resp[4] = rec->type;
+  memcpy(resp + 5, &rec->timestamp, 4);
+  memcpy(resp + 9, &rec->mech_status, sizeof(rec->mech_status));
+  resp[SSM_HISTORY_RESP_MIN_LEN] = rec->tag_len;
+  memcpy(resp + SSM_HISTORY_RESP_MIN_LEN + 1, rec->tag, rec->tag_len);
+  respond(sim, SSM_SEG_PARSING_TYPE_CIPHERTEXT, SSM_ITEM_CODE_HISTORY,
+          SIM_RESULT_SUCCESS, resp, SSM_HISTORY_RESP_MIN_LEN + 1 + rec->tag_len);
+  memmove(&sim->history[0], &sim->history[1],
+          (sim->history_len - 1) * sizeof(sim->history[0]));
+  sim->history_len--;
+}
+
+static void handle_lock(sesame_sim_t *sim, uint8_t item, const uint8_t *payload,
+                        uint16_t len) {
+  bool lock = item == SSM_ITEM_CODE_LOCK;
+  sim->mech_status.is_lock_range = lock;
+  sim->mech_status.is_unlock_range = !lock;
+  sim->mech_status.position =
+      lock ? sim->mech_setting.lock_position : sim->mech_setting.unlock_position;
+  sim->mech_status.target = sim->mech_status.position;
+  uint8_t tag_len = payload[0] < len - 1 ? payload[0] : len - 1;
+  add_history_locked(sim, lock ? 1 : 2, payload + 1, tag_len);
+  respond(sim, SSM_SEG_PARSING_TYPE_CIPHERTEXT, item, SIM_RESULT_SUCCESS, NULL,
+          0);
+  publish_mech_status_locked(sim);
+}
+
+static void handle_message(sesame_sim_t *sim, uint8_t parsing_type) {
+  uint8_t *buf = sim->rx_buf;
+  uint16_t len = sim->rx_len;
+  if (parsing_type == SSM_SEG_PARSING_TYPE_CIPHERTEXT) {
+    if (!sim->logged_in || len < 1 + CCM_TAG_LENGTH) {
+      sim->auth_failures++;
+      return;
+    }
+    len -= CCM_TAG_LENGTH;
+    uint8_t cipher[sizeof(sim->rx_buf)];
+    memcpy(cipher, buf, len);
+    if (aes_ccm_auth_decrypt(sim->token, (const unsigned char *)&sim->decrypt,
+                             13, additional_data, sizeof(additional_data),
+                             cipher, len, buf, buf + len,
+                             CCM_TAG_LENGTH) != 0) {
+      sim->auth_failures++; // SESAMEはカウンタを進めない
+      return;
+    }
+    sim->decrypt.count++;
+  }
+  if (len < 1)
+    return;
+
+  uint8_t item = buf[0];
+  const uint8_t *payload = buf + 1;
+  uint16_t payload_len = len - 1;
+  sim->commands++;
+  if (item < SSM_ITEM_CODE_TABLE_SIZE)
+    sim->item_counts[item]++;
+
+  switch (item) {
+  case SSM_ITEM_CODE_REGISTRATION:
+    if (payload_len == 64)
+      handle_registration(sim, payload);
+    break;
+  case SSM_ITEM_CODE_LOGIN:
+    if (payload_len == 4)
+      handle_login(sim, payload);
+    break;
+  case SSM_ITEM_CODE_HISTORY:
+    handle_history(sim);
+    break;
+  case SSM_ITEM_CODE_LOCK:
+  case SSM_ITEM_CODE_UNLOCK:
+    if (payload_len >= 1)
+      handle_lock(sim, item, payload, payload_len);
+    break;
+  case SSM_ITEM_CODE_TIME:
+    if (payload_len == 4)
+      memcpy(&sim->clock, payload, 4);
+    respond(sim, SSM_SEG_PARSING_TYPE_CIPHERTEXT, item, SIM_RESULT_SUCCESS,
+            NULL, 0);
+    break;
+  case SSM_ITEM_CODE_MECH_SETTING:
+    if (payload_len == sizeof(sim->mech_setting))
+      memcpy(&sim->mech_setting, payload, sizeof(sim->mech_setting));
+    respond(sim, SSM_SEG_PARSING_TYPE_CIPHERTEXT, item, SIM_RESULT_SUCCESS,
+            NULL, 0);
+    publish(sim, SSM_SEG_PARSING_TYPE_CIPHERTEXT, SSM_ITEM_CODE_MECH_SETTING,
+            &sim->mech_setting, sizeof(sim->mech_setting));
+    break;
+  default:
+    respond(sim, SSM_SEG_PARSING_TYPE_CIPHERTEXT, item, SIM_RESULT_SUCCESS,
+            NULL, 0);
+    break;
+  }
+}
+
+/* 偽のGATT層(ssm_set_transport) */
+
+static int sim_write(sesame *gw, const uint8_t *value, uint16_t length) {
+  sesame_sim_t *sim = find_sim(gw);
+  if (!sim || length < 1 || length > 20)
+    return -1;
+  if (sesame_sim_air)
+    sesame_sim_air();
+
+  pthread_mutex_lock(&sim->lock);
+  int rc = 0;
+  if (!sim->connected) {
+    rc = -1;
+  } else if (sim->fail_write_segment > 0 && --sim->fail_write_segment == 0) {
+    rc = -1; // 書き込みが届かなかった
+  } else {
+    sim->write_segments++;
+    if (value[0] & 1u) {
+      if (sim->rx_len > 0)
+        sim->partial_dropped++;
+      sim->rx_len = 0;
+    }
+    if (sim->rx_len + length - 1 > sizeof(sim->rx_buf)) {
+      sim->rx_len = 0;
+    } else {
+      memcpy(sim->rx_buf + sim->rx_len, value + 1, length - 1);
+      sim->rx_len += length - 1;
+      uint8_t parsing_type = value[0] >> 1u;
+      if (parsing_type != SSM_SEG_PARSING_TYPE_APPEND_ONLY) {
+        handle_message(sim, parsing_type);
+        sim->rx_len = 0;
+      }
+    }
+  }
+  pthread_mutex_unlock(&sim->lock);
+  return rc;
+}
+
+static int sim_disconnect(sesame *gw) {
+  sesame_sim_t *sim = find_sim(gw);
+  if (!sim)
+    return -1;
+  pthread_mutex_lock(&sim->lock);
+  sim->connected = false;
+  sim->logged_in = false;
+  sim->notify_len = 0;
+  sim->disconnects++;
+  pthread_mutex_unlock(&sim->lock);
+  return 0;
+}
+
+int sesame_sim_pump(void) {
+  int delivered = 0;
+  bool any;
+  do {
+    any = false;
+    for (int i = 0; i < num_sims; i++) {
+      sesame_sim_t *sim = sims[i];
+      sim_segment_t seg;
+      pthread_mutex_lock(&sim->lock);
+      bool has = sim->notify_len > 0;
+      if (has) {
+        seg = sim->notify[sim->notify_head];
+        sim->notify_head = (sim->notify_head + 1) % SIM_NOTIFY_QUEUE_LEN;
+        sim->notify_len--;
+        sim->notify_segments++;
+      }
+      pthread_mutex_unlock(&sim->lock);
+      if (!has)
+        continue;
+      if (sesame_sim_air)
+        sesame_sim_air();
+      // NimBLEのhostタスクと同じく、1つのスレッドから順に渡す
+      ssm_ble_receiver(sim->gw, seg.value, seg.len);
+      delivered++;
+      any = true;
+    }
+  } while (any);
+  return delivered;
+}
+
+/* SESAMEの操作 */
+
+static void status_cb(sesame *ssm) {
+  __atomic_fetch_add(&sim_gw.status_callbacks, 1, __ATOMIC_RELAXED);
+  if (sesame_sim_on_status)
+    sesame_sim_on_status(ssm);
+}
+
+void sesame_sim_setup(void) {
+  if (p_ssms_env)
+    ssm_mem_deinit();
+  ssm_init(status_cb);
+  p_ssms_env->ssm.conn_id = 0;
+  ssm_set_transport(sim_write, sim_disconnect);
+  num_sims = 0;
+  memset(&sim_gw, 0, sizeof(sim_gw));
+}
+
+sesame *sesame_sim_new_gateway_sesame(uint8_t conn_id) {
+  sesame *gw = calloc(1, sizeof(*gw));
+  gw->conn_id = conn_id;
+  gw->device_status = SSM_NOUSE;
+  gw->tx_mutex = xSemaphoreCreateMutex();
+  return gw;
+}
+
+void sesame_sim_init(sesame_sim_t *sim, sesame *gw) {
+  memset(sim, 0, sizeof(*sim));
+  pthread_mutex_init(&sim->lock, NULL);
+  sim->gw = gw;
+  uECC_set_rng(sim_rng);
+  uECC_make_key_lit(sim->public_key, sim->private_key, uECC_secp256r1());
+  sim->mech_setting.lock_position = -90;
+  sim->mech_setting.unlock_position = 90;
+  sim->mech_status.battery = 6000;
+  sim->mech_status.is_lock_range = 1;
+  sim->mech_status.position = sim->mech_setting.lock_position;
+  sim->clock = 1700000000;
+  sim->next_record_id = 1;
+  if (num_sims < SIM_MAX_SESAMES)
+    sims[num_sims++] = sim;
+}
+
+void sesame_sim_provision(sesame_sim_t *sim, const uint8_t secret[16]) {
+  pthread_mutex_lock(&sim->lock);
+  memcpy(sim->device_secret, secret, sizeof(sim->device_secret));
+  sim->registered = true;
+  pthread_mutex_unlock(&sim->lock);
+  memcpy(sim->gw->device_secret, secret, sizeof(sim->gw->device_secret));
+}
+
+void sesame_sim_connect(sesame_sim_t *sim) {
+  pthread_mutex_lock(&sim->lock);
+  esp_fill_random(sim->random_code, sizeof(sim->random_code));
+  memset(&sim->encrypt, 0, sizeof(sim->encrypt));
+  memcpy(sim->encrypt.random_code, sim->random_code, 4);
+  sim->decrypt = sim->encrypt;
+  sim->logged_in = false;
+  sim->connected = true;
+  sim->rx_len = 0;
+  sim->notify_len = 0;
+  publish(sim, SSM_SEG_PARSING_TYPE_PLAINTEXT, SSM_ITEM_CODE_INITIAL,
+          sim->random_code, sizeof(sim->random_code));
+  pthread_mutex_unlock(&sim->lock);
+  // blecentの接続イベントと同じくゲートウェイ側を接続済みにする
+  sim->gw->device_status = SSM_CONNECTED;
+}
+
+void sesame_sim_publish_mech_status(sesame_sim_t *sim) {
+  pthread_mutex_lock(&sim->lock);
+  if (sim->logged_in)
+    publish_mech_status_locked(sim);
+  pthread_mutex_unlock(&sim->lock);
+}
+
+void sesame_sim_add_history(sesame_sim_t *sim, uint8_t type, const char *tag) {
+  pthread_mutex_lock(&sim->lock);
+  add_history_locked(sim, type, (const uint8_t *)tag, strlen(tag));
+  pthread_mutex_unlock(&sim->lock);
+}
+
+/* ゲートウェイ側の周辺モジュールの代わり */
+
+esp_err_t app_events_post(app_event_id_t id, const void *data, size_t size) {
+  if (id == APP_EVENT_SSM_MECH_STATUS && size == sizeof(mech_status_t)) {
+    pthread_mutex_lock(&gw_lock);
+    sim_gw.mech_status_events++;
+    memcpy(&sim_gw.last_mech_status, data, size);
+    pthread_mutex_unlock(&gw_lock);
+  }
+  return ESP_OK;
+}
+
+#ifndef SESAME_SIM_RADIO_SCHED
+void radio_sched_ble_begin(void) {
+  __atomic_fetch_add(&sim_gw.radio_begin, 1, __ATOMIC_RELAXED);
+}
+
+void radio_sched_ble_end(void) {
+  __atomic_fetch_add(&sim_gw.radio_end, 1, __ATOMIC_RELAXED);
+}
+#endif
+
+bool ssm_history_on_response(const uint8_t *buf, size_t len) {
+  ssm_history_record_t record;
+  if (!ssm_decode_history(buf, len, &record))
+    return false; // 全て読み出した
+  pthread_mutex_lock(&gw_lock);
+  bool room = sim_gw.records_len < SIM_HISTORY_MAX * SIM_MAX_SESAMES;
+  if (room)
+    sim_gw.records[sim_gw.records_len++] = record;
+  pthread_mutex_unlock(&gw_lock);
+  return room;
+}
+
+void ssm_mech_on_status(const mech_status_t *status) {}
+
+void ssm_mech_on_setting(const mech_setting_t *setting) {
+  pthread_mutex_lock(&gw_lock);
+  sim_gw.mech_settings++;
+  sim_gw.last_mech_setting = *setting;
+  pthread_mutex_unlock(&gw_lock);
+}
+
+void time_sync_observe_lock_time(uint32_t lock_time) {
+  sim_gw.lock_time = lock_time;
+}
+
+void dlog_write(dlog_fmt_t fmt, uint32_t arg0, uint32_t arg1, uint32_t arg2) {}
@@ -0,0 +1,140 @@
+#pragma once
+
+// SESAME 5 Proの偽物(ホスト用)
+// ssm_set_transportに登録する偽のGATT層で、ゲートウェイ(sesame/)の書き込みを
+// SESAME側で組み立て、INITIAL, 登録(ECDH), ログイン(CMAC), AES-CCMの
+// セッション, MECH_STATUS, 履歴に応答する。通知はキューに積み、
+// sesame_sim_pump()でNimBLEのhostタスクと同じくssm_ble_receiverへ渡す
+//
+// sesame/が呼ぶ周辺のモジュール(app_events, radio_sched, ssm_history,
+// ssm_mech, time_sync, dlog)もここで置き換え、受け取った内容をsim_gwに記録する
+// SESAME_SIM_RADIO_SCHEDを定義した場合、radio_schedは置き換えずmain/のものを使う
+
+#include "ssm.h"
+#include "ssm_codec.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SIM_MAX_SESAMES 4
+#define SIM_NOTIFY_QUEUE_LEN 1024 // 通知のセグメント
+#define SIM_HISTORY_MAX 64
+
+typedef struct {
+  uint8_t value[20];
+  uint8_t len;
+} sim_segment_t;
+
+typedef struct {
+  sesame *gw; // 接続しているゲートウェイ側のsesame
+  pthread_mutex_t lock;
+
+  // 鍵とセッション
+  uint8_t private_key[32];
+  uint8_t public_key[64];
+  uint8_t device_secret[16];
+  bool registered;
+  uint8_t random_code[4];
+  uint8_t token[16];
+  SSM_CCM_NONCE encrypt; // SESAMEからの通知
+  SSM_CCM_NONCE decrypt; // ゲートウェイからの書き込み
+  bool logged_in;
+  bool connected;
+
+  // 受信の組み立て
+  uint8_t rx_buf[128];
+  uint16_t rx_len;
+
+  // 通知のキュー
+  sim_segment_t notify[SIM_NOTIFY_QUEUE_LEN];
+  int notify_head;
+  int notify_len;
+
+  // 機器の状態
+  mech_status_t mech_status;
+  mech_setting_t mech_setting;
+  uint32_t clock; // TIMEで合わせた時刻
+  ssm_history_record_t history[SIM_HISTORY_MAX];
+  int history_len;
+  int32_t next_record_id;
+
+  // 故障の注入
+  int fail_write_segment; // N番目(1始まり)の書き込みを失敗させる(0は無効)
+  int drop_notifies;      // 次のN個の暗号化した通知を送らない(取りこぼし)
+  int corrupt_notifies;   // 次のN個の暗号化した通知を壊す
+
+  // 統計
+  uint32_t write_segments;
+  uint32_t notify_segments;
+  uint32_t commands;        // 復号できたコマンド
+  uint32_t auth_failures;   // 復号できなかったコマンド
+  uint32_t partial_dropped; // 組み立て途中で捨てたメッセージ
+  uint32_t notify_overflows; // キューが溢れて送れなかったセグメント
+  uint32_t disconnects;
+  uint32_t item_counts[SSM_ITEM_CODE_TABLE_SIZE];
+} sesame_sim_t;
+
+// ゲートウェイ側のモジュールの代わりに記録する内容
+typedef struct {
+  uint32_t mech_status_events; // APP_EVENT_SSM_MECH_STATUS
+  mech_status_t last_mech_status;
+  uint32_t mech_settings;
+  mech_setting_t last_mech_setting;
+  uint32_t lock_time; // ログインの応答の時刻
+  uint32_t radio_begin;
+  uint32_t radio_end;
+  ssm_history_record_t records[SIM_HISTORY_MAX * SIM_MAX_SESAMES];
+  int records_len;
+  uint32_t status_callbacks; // ssm_cb__
+} sim_gateway_t;
+
+extern sim_gateway_t sim_gw;
+
+// BLEの1セグメントを送受信するごとに呼ぶ(無線の使用時間を模す場合に設定する)
+extern void (*sesame_sim_air)(void);
+
+// ゲートウェイ側のsesameの状態が変わるごとに呼ぶ(ssm_action_handleの代わり)
+extern void (*sesame_sim_on_status)(sesame *ssm);
+
+/**
+ * @brief ssm_initの代わりにゲートウェイ側を初期化し、偽のGATT層を登録する
+ * 1台目のsesameはp_ssms_env->ssm
+ */
+void sesame_sim_setup(void);
+
+/**
+ * @brief 2台目以降のゲートウェイ側のsesameを作る(p_ssms_envの外)
+ */
+sesame *sesame_sim_new_gateway_sesame(uint8_t conn_id);
+
+/**
+ * @brief 未登録のSESAMEとして初期化する(鍵ペアを作る)
+ */
+void sesame_sim_init(sesame_sim_t *sim, sesame *gw);
+
+/**
+ * @brief 登録済みの状態にする(ゲートウェイ側のdevice_secretも同じ値にする)
+ */
+void sesame_sim_provision(sesame_sim_t *sim, const uint8_t secret[16]);
+
+/**
+ * @brief 接続する。新しいrandom_codeでINITIALを通知する
+ */
+void sesame_sim_connect(sesame_sim_t *sim);
+
+/**
+ * @brief 状態を変えずにMECH_STATUSを通知する(ログイン後のみ)
+ */
+void sesame_sim_publish_mech_status(sesame_sim_t *sim);
+
+/**
+ * @brief 履歴を1件追加する
+ */
+void sesame_sim_add_history(sesame_sim_t *sim, uint8_t type, const char *tag);
+
+/**
+ * @brief 全てのSESAMEの通知を、1セグメントずつ順番に混ぜてゲートウェイへ渡す
+ * キューが空になるまで続ける(受信側から送ったコマンドの応答も含む)
+ * @return 渡したセグメントの数
+ */
+int sesame_sim_pump(void);
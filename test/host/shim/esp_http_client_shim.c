@@ -0,0 +1,403 @@
+// esp_http_clientをlibcurlで実装したもの
+// ESP-IDFと同じく、init〜cleanupごとに新しい接続を作る(接続を使い回さない)
+// perform: 受信したデータをHTTP_EVENT_ON_DATAで渡し、ON_FINISHで終える
+// open/fetch_headers/read: curl_multiでヘッダーまで進め、本体はreadで少しずつ渡す
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define TAG "esp_http_client"
+
+struct esp_http_client {
+  CURL *curl;
+  CURLM *multi; // open〜closeの間
+  char *url;
+  const char *cert_pem;
+  esp_http_client_method_t method;
+  int timeout_ms;
+  bool auto_redirect;
+  http_event_handle_cb event_handler;
+  void *user_data;
+  struct curl_slist *headers;
+  const char *post_data; // ESP-IDFと同じくコピーしない
+  int post_len;
+  // ESP-IDFが確保する送受信のバッファ(ヒープの計測のため同じ大きさを確保する)
+  char *rx_buffer;
+  char *tx_buffer;
+
+  int status_code;
+  char *location; // リダイレクト先
+  bool headers_done;
+  bool done;
+  CURLcode result;
+  // open/readで受信して、まだreadで渡していないデータ
+  char *pending;
+  size_t pending_len;
+  size_t pending_off;
+  size_t pending_cap;
+};
+
+static pthread_once_t curl_once = PTHREAD_ONCE_INIT;
+
+static void curl_init_once(void) { curl_global_init(CURL_GLOBAL_DEFAULT); }
+
+static void dispatch(esp_http_client_handle_t client,
+                     esp_http_client_event_id_t id, void *data, int len,
+                     char *key, char *value) {
+  if (!client->event_handler)
+    return;
+  esp_http_client_event_t evt = {
+      .event_id = id,
+      .client = client,
+      .data = data,
+      .data_len = len,
+      .user_data = client->user_data,
+      .header_key = key,
+      .header_value = value,
+  };
+  client->event_handler(&evt);
+}
+
+static size_t header_cb(char *buf, size_t size, size_t nitems, void *arg) {
+  esp_http_client_handle_t client = arg;
+  size_t len = size * nitems;
+  if (len >= 5 && strncmp(buf, "HTTP/", 5) == 0) {
+    // リダイレクトを追う場合は応答ごとにやり直す
+    const char *sp = memchr(buf, ' ', len);
+    client->status_code = sp ? atoi(sp + 1) : 0;
+    client->headers_done = false;
+    return len;
+  }
+  if (len <= 2) { // ヘッダーの終わりの空行
+    client->headers_done = true;
+    return len;
+  }
+  char line[512];
+  size_t n = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+  memcpy(line, buf, n);
+  line[n] = '\0';
+  line[strcspn(line, "\r\n")] = '\0';
+  char *colon = strchr(line, ':');
+  if (!colon)
+    return len;
+  *colon = '\0';
+  char *value = colon + 1;
+  while (*value == ' ')
+    value++;
+  if (strcasecmp(line, "Location") == 0) {
+    free(client->location);
+    client->location = strdup(value);
+  }
+  dispatch(client, HTTP_EVENT_ON_HEADER, NULL, 0, line, value);
+  return len;
+}
+
+static size_t write_cb(char *buf, size_t size, size_t nmemb, void *arg) {
+  esp_http_client_handle_t client = arg;
+  size_t len = size * nmemb;
+  if (client->multi) {
+    // readで渡すまで溜める
+    if (client->pending_len + len > client->pending_cap) {
+      size_t cap = client->pending_cap ? client->pending_cap : 1024;
+      while (cap < client->pending_len + len)
+        cap *= 2;
+      char *p = realloc(client->pending, cap);
+      if (!p)
+        return 0;
+      client->pending = p;
+      client->pending_cap = cap;
+    }
+    memcpy(client->pending + client->pending_len, buf, len);
+    client->pending_len += len;
+    return len;
+  }
+  dispatch(client, HTTP_EVENT_ON_DATA, buf, (int)len, NULL, NULL);
+  return len;
+}
+
+esp_http_client_handle_t
+esp_http_client_init(const esp_http_client_config_t *config) {
+  pthread_once(&curl_once, curl_init_once);
+  if (!config || !config->url)
+    return NULL;
+  esp_http_client_handle_t client = calloc(1, sizeof(*client));
+  if (!client)
+    return NULL;
+  client->curl = curl_easy_init();
+  client->url = strdup(config->url);
+  // 100-continueを待たない(esp_http_clientは送らない)
+  client->headers = curl_slist_append(NULL, "Expect:");
+  client->rx_buffer = malloc(config->buffer_size > 0 ? config->buffer_size
+                                                     : DEFAULT_HTTP_BUF_SIZE);
+  client->tx_buffer = malloc(config->buffer_size_tx > 0
+                                 ? config->buffer_size_tx
+                                 : DEFAULT_HTTP_BUF_SIZE);
+  if (!client->curl || !client->url || !client->headers ||
+      !client->rx_buffer || !client->tx_buffer) {
+    esp_http_client_cleanup(client);
+    return NULL;
+  }
+  client->cert_pem = config->cert_pem;
+  client->method = config->method;
+  client->timeout_ms = config->timeout_ms > 0 ? config->timeout_ms : 5000;
+  client->auto_redirect = !config->disable_auto_redirect;
+  client->event_handler = config->event_handler;
+  client->user_data = config->user_data;
+  return client;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client,
+                                     const char *key, const char *value) {
+  // 同じ名前のヘッダーは置き換える
+  size_t key_len = strlen(key);
+  struct curl_slist *list = NULL;
+  for (struct curl_slist *h = client->headers; h; h = h->next) {
+    if (strncasecmp(h->data, key, key_len) != 0 || h->data[key_len] != ':')
+      list = curl_slist_append(list, h->data);
+  }
+  size_t len = key_len + strlen(value) + 3;
+  char *line = malloc(len);
+  if (!line)
+    return ESP_ERR_NO_MEM;
+  snprintf(line, len, "%s: %s", key, value);
+  list = curl_slist_append(list, line);
+  free(line);
+  curl_slist_free_all(client->headers);
+  client->headers = list;
+  return list ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client,
+                                     esp_http_client_method_t method) {
+  client->method = method;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client,
+                                         const char *data, int len) {
+  client->post_data = data;
+  client->post_len = len;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client) {
+  if (!client->location)
+    return ESP_ERR_INVALID_ARG;
+  // 相対パスの場合はcurlが解決したURLを使う
+  char *redirect = NULL;
+  curl_easy_getinfo(client->curl, CURLINFO_REDIRECT_URL, &redirect);
+  char *url = strdup(redirect ? redirect : client->location);
+  if (!url)
+    return ESP_ERR_NO_MEM;
+  free(client->url);
+  client->url = url;
+  return ESP_OK;
+}
+
+static const char *method_name(esp_http_client_method_t method) {
+  static const char *names[] = {
+      [HTTP_METHOD_GET] = "GET",       [HTTP_METHOD_POST] = "POST",
+      [HTTP_METHOD_PUT] = "PUT",       [HTTP_METHOD_PATCH] = "PATCH",
+      [HTTP_METHOD_DELETE] = "DELETE", [HTTP_METHOD_HEAD] = "HEAD",
+  };
+  return method < HTTP_METHOD_MAX ? names[method] : "GET";
+}
+
+static void prepare(esp_http_client_handle_t client, bool streaming) {
+  CURL *curl = client->curl;
+  curl_easy_reset(curl);
+  curl_easy_setopt(curl, CURLOPT_URL, client->url);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long)client->timeout_ms);
+  if (!streaming)
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)client->timeout_ms);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION,
+                   client->auto_redirect && !streaming ? 1L : 0L);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, client);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, client);
+  if (client->cert_pem) {
+    struct curl_blob blob = {.data = (void *)client->cert_pem,
+                             .len = strlen(client->cert_pem),
+                             .flags = CURL_BLOB_COPY};
+    curl_easy_setopt(curl, CURLOPT_CAINFO_BLOB, &blob);
+  }
+
+  if (client->method == HTTP_METHOD_HEAD) {
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+  } else if (client->method != HTTP_METHOD_GET) {
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method_name(client->method));
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS,
+                     client->post_data ? client->post_data : "");
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+                     client->post_data ? (long)client->post_len : 0L);
+  }
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, client->headers);
+
+  client->status_code = 0;
+  client->headers_done = false;
+  client->done = false;
+  client->result = CURLE_OK;
+  free(client->location);
+  client->location = NULL;
+}
+
+static esp_err_t transport_error(CURLcode rc) {
+  switch (rc) {
+  case CURLE_OK:
+    return ESP_OK;
+  case CURLE_COULDNT_CONNECT:
+  case CURLE_COULDNT_RESOLVE_HOST:
+    return ESP_ERR_HTTP_CONNECT;
+  case CURLE_OPERATION_TIMEDOUT:
+    return ESP_ERR_HTTP_EAGAIN;
+  case CURLE_GOT_NOTHING:
+  case CURLE_RECV_ERROR:
+  case CURLE_PARTIAL_FILE:
+    return ESP_ERR_HTTP_CONNECTION_CLOSED;
+  default:
+    return ESP_FAIL;
+  }
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client) {
+  prepare(client, false);
+  dispatch(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+  CURLcode rc = curl_easy_perform(client->curl);
+  client->done = true;
+  client->result = rc;
+  if (rc != CURLE_OK) {
+    ESP_LOGE(TAG, "%s: %s", client->url, curl_easy_strerror(rc));
+    dispatch(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+    dispatch(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+    return transport_error(rc);
+  }
+  long code = 0;
+  curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &code);
+  client->status_code = (int)code;
+  dispatch(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+  dispatch(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+  return ESP_OK;
+}
+
+// 転送を進める。timeout_msの間に何も進まなければfalse
+static bool multi_step(esp_http_client_handle_t client, int timeout_ms) {
+  int running = 0;
+  curl_multi_perform(client->multi, &running);
+  if (running > 0) {
+    int numfds = 0;
+    curl_multi_poll(client->multi, NULL, 0, timeout_ms, &numfds);
+    curl_multi_perform(client->multi, &running);
+    if (numfds == 0 && running > 0)
+      return false;
+  }
+  CURLMsg *msg;
+  int left;
+  while ((msg = curl_multi_info_read(client->multi, &left))) {
+    if (msg->msg == CURLMSG_DONE) {
+      client->done = true;
+      client->result = msg->data.result;
+    }
+  }
+  return true;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client,
+                               int write_len) {
+  if (write_len > 0)
+    return ESP_ERR_NOT_SUPPORTED; // esp_http_client_writeは使っていない
+  esp_http_client_close(client);
+  prepare(client, true);
+  client->multi = curl_multi_init();
+  if (!client->multi)
+    return ESP_ERR_NO_MEM;
+  curl_multi_add_handle(client->multi, client->curl);
+
+  int64_t waited = 0;
+  while (!client->headers_done && !client->done) {
+    if (!multi_step(client, 100))
+      waited += 100;
+    if (waited >= client->timeout_ms)
+      return ESP_ERR_HTTP_CONNECT;
+  }
+  if (client->done && client->result != CURLE_OK) {
+    ESP_LOGE(TAG, "%s: %s", client->url, curl_easy_strerror(client->result));
+    return transport_error(client->result);
+  }
+  dispatch(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+  return ESP_OK;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+  if (!client->headers_done && !client->done)
+    return -1;
+  curl_off_t len = -1;
+  curl_easy_getinfo(client->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &len);
+  return len;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer,
+                         int len) {
+  if (!client->multi)
+    return -1;
+  int64_t waited = 0;
+  while (client->pending_off == client->pending_len) {
+    client->pending_off = client->pending_len = 0;
+    if (client->done)
+      return client->result == CURLE_OK ? 0 : -1;
+    if (!multi_step(client, 100))
+      waited += 100;
+    if (waited >= client->timeout_ms)
+      return -ESP_ERR_HTTP_EAGAIN; // 受信のタイムアウト
+  }
+  size_t n = client->pending_len - client->pending_off;
+  if (n > (size_t)len)
+    n = len;
+  memcpy(buffer, client->pending + client->pending_off, n);
+  client->pending_off += n;
+  dispatch(client, HTTP_EVENT_ON_DATA, buffer, (int)n, NULL, NULL);
+  return (int)n;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) {
+  return client->status_code;
+}
+
+bool esp_http_client_is_complete_data_received(
+    esp_http_client_handle_t client) {
+  return client->done && client->result == CURLE_OK &&
+         client->pending_off == client->pending_len;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+  if (client->multi) {
+    curl_multi_remove_handle(client->multi, client->curl);
+    curl_multi_cleanup(client->multi);
+    client->multi = NULL;
+    dispatch(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+  }
+  client->pending_len = client->pending_off = 0;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+  if (!client)
+    return ESP_FAIL;
+  esp_http_client_close(client);
+  if (client->curl)
+    curl_easy_cleanup(client->curl);
+  curl_slist_free_all(client->headers);
+  free(client->pending);
+  free(client->location);
+  free(client->url);
+  free(client->rx_buffer);
+  free(client->tx_buffer);
+  free(client);
+  return ESP_OK;
+}
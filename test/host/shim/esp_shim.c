@@ -0,0 +1,214 @@
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HOST_HEAP_SIZE (320 * 1024)
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_NOT_SUPPORTED:
+    return "ESP_ERR_NOT_SUPPORTED";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  case ESP_ERR_INVALID_RESPONSE:
+    return "ESP_ERR_INVALID_RESPONSE";
+  case ESP_ERR_INVALID_CRC:
+    return "ESP_ERR_INVALID_CRC";
+  case ESP_ERR_INVALID_VERSION:
+    return "ESP_ERR_INVALID_VERSION";
+  case ESP_ERR_NVS_NOT_FOUND:
+    return "ESP_ERR_NVS_NOT_FOUND";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+int64_t esp_timer_get_time(void) {
+  static struct timespec start;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (start.tv_sec == 0 && start.tv_nsec == 0)
+    start = now;
+  return (int64_t)(now.tv_sec - start.tv_sec) * 1000000 +
+         (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+struct host_timer {
+  esp_timer_create_args_t args;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int64_t deadline_us; // 0は停止中
+};
+
+static void *timer_thread(void *arg) {
+  esp_timer_handle_t timer = arg;
+  pthread_mutex_lock(&timer->lock);
+  for (;;) {
+    if (timer->deadline_us == 0) {
+      pthread_cond_wait(&timer->cond, &timer->lock);
+      continue;
+    }
+    int64_t remaining = timer->deadline_us - esp_timer_get_time();
+    if (remaining > 0) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      int64_t ns = ts.tv_nsec + remaining * 1000;
+      ts.tv_sec += ns / 1000000000;
+      ts.tv_nsec = ns % 1000000000;
+      pthread_cond_timedwait(&timer->cond, &timer->lock, &ts);
+      continue;
+    }
+    timer->deadline_us = 0;
+    pthread_mutex_unlock(&timer->lock);
+    timer->args.callback(timer->args.arg);
+    pthread_mutex_lock(&timer->lock);
+  }
+  return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args,
+                           esp_timer_handle_t *out_handle) {
+  esp_timer_handle_t timer = calloc(1, sizeof(*timer));
+  if (!timer)
+    return ESP_ERR_NO_MEM;
+  timer->args = *args;
+  pthread_mutex_init(&timer->lock, NULL);
+  pthread_cond_init(&timer->cond, NULL);
+  if (pthread_create(&timer->thread, NULL, timer_thread, timer) != 0) {
+    free(timer);
+    return ESP_FAIL;
+  }
+  pthread_detach(timer->thread);
+  *out_handle = timer;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  pthread_mutex_lock(&timer->lock);
+  esp_err_t err = ESP_ERR_INVALID_STATE; // ESP-IDFと同じく動作中は失敗する
+  if (timer->deadline_us == 0) {
+    timer->deadline_us = esp_timer_get_time() + (int64_t)timeout_us + 1;
+    pthread_cond_signal(&timer->cond);
+    err = ESP_OK;
+  }
+  pthread_mutex_unlock(&timer->lock);
+  return err;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  pthread_mutex_lock(&timer->lock);
+  esp_err_t err = timer->deadline_us != 0 ? ESP_OK : ESP_ERR_INVALID_STATE;
+  timer->deadline_us = 0;
+  pthread_cond_signal(&timer->cond);
+  pthread_mutex_unlock(&timer->lock);
+  return err;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+  pthread_mutex_lock(&timer->lock);
+  bool active = timer->deadline_us != 0;
+  pthread_mutex_unlock(&timer->lock);
+  return active;
+}
+
+uint32_t esp_get_free_heap_size(void) { return HOST_HEAP_SIZE; }
+
+uint32_t esp_get_minimum_free_heap_size(void) { return HOST_HEAP_SIZE; }
+
+void esp_restart(void) { exit(0); }
+
+void esp_fill_random(void *buf, size_t len) {
+  uint8_t *p = buf;
+  while (len > 0) {
+    size_t n = len < 256 ? len : 256; // getentropyは1回256bytesまで
+    if (getentropy(p, n) != 0)
+      abort();
+    p += n;
+    len -= n;
+  }
+}
+
+uint32_t esp_random(void) {
+  uint32_t value;
+  esp_fill_random(&value, sizeof(value));
+  return value;
+}
+
+static int log_level = -1;
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) {
+  if (log_level < 0) {
+    const char *env = getenv("HOST_LOG_LEVEL");
+    log_level = env ? atoi(env) : ESP_LOG_WARN;
+  }
+  if ((int)level > log_level)
+    return;
+  va_list ap;
+  va_start(ap, format);
+  vfprintf(stderr, format, ap);
+  va_end(ap);
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+  log_level = level; // tagごとには分けない
+}
+
+uint32_t esp_log_timestamp(void) {
+  return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void host_log_buffer_hex(const char *tag, const void *buffer, uint16_t len,
+                         esp_log_level_t level) {
+  char line[16 * 3 + 1];
+  const uint8_t *p = buffer;
+  for (uint16_t i = 0; i < len; i += 16) {
+    int n = 0;
+    for (uint16_t j = i; j < len && j < i + 16; j++)
+      n += snprintf(line + n, sizeof(line) - n, "%02x ", p[j]);
+    esp_log_write(level, tag, "%s: %s\n", tag, line);
+  }
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type) {
+  const uint8_t base[6] = {0x02, 0, 0, 0, 0, (uint8_t)(type + 1)};
+  memcpy(mac, base, sizeof(base));
+  return ESP_OK;
+}
+
+#if HOST_NEEDS_STRLCPY
+size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size > 0) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+#endif
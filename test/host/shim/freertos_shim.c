@@ -0,0 +1,241 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+static pthread_mutex_t critical_mutex;
+static pthread_once_t critical_once = PTHREAD_ONCE_INIT;
+
+static void critical_init(void) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&critical_mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+void host_critical_enter(void) {
+  pthread_once(&critical_once, critical_init);
+  pthread_mutex_lock(&critical_mutex);
+}
+
+void host_critical_exit(void) { pthread_mutex_unlock(&critical_mutex); }
+
+TickType_t xTaskGetTickCount(void) {
+  return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  struct timespec ts = {.tv_sec = ticks / 1000,
+                        .tv_nsec = (long)(ticks % 1000) * 1000000};
+  nanosleep(&ts, NULL);
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 0; }
+
+const char *pcTaskGetName(TaskHandle_t task) { return "host"; }
+
+// mutexもbinaryも、上限1のカウンタとして扱う(優先度継承はしない)
+struct host_semaphore {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int count;
+};
+
+static SemaphoreHandle_t semaphore_create(int count) {
+  SemaphoreHandle_t sem = calloc(1, sizeof(*sem));
+  if (!sem)
+    return NULL;
+  pthread_mutex_init(&sem->lock, NULL);
+  pthread_cond_init(&sem->cond, NULL);
+  sem->count = count;
+  return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return semaphore_create(1); }
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return semaphore_create(0); }
+
+static struct timespec deadline_after(TickType_t ticks) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += ticks / 1000;
+  deadline.tv_nsec += (long)(ticks % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  return deadline;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  struct timespec deadline = deadline_after(ticks);
+  pthread_mutex_lock(&sem->lock);
+  int err = 0;
+  while (sem->count == 0 && err != ETIMEDOUT) {
+    if (ticks == portMAX_DELAY)
+      pthread_cond_wait(&sem->cond, &sem->lock);
+    else
+      err = pthread_cond_timedwait(&sem->cond, &sem->lock, &deadline);
+  }
+  BaseType_t taken = sem->count > 0 ? pdTRUE : pdFALSE;
+  if (taken)
+    sem->count--;
+  pthread_mutex_unlock(&sem->lock);
+  return taken;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  pthread_mutex_lock(&sem->lock);
+  BaseType_t given = sem->count == 0 ? pdTRUE : pdFALSE;
+  sem->count = 1;
+  pthread_cond_signal(&sem->cond);
+  pthread_mutex_unlock(&sem->lock);
+  return given;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+  pthread_cond_destroy(&sem->cond);
+  pthread_mutex_destroy(&sem->lock);
+  free(sem);
+}
+
+struct host_task {
+  pthread_t thread;
+  TaskFunction_t fn;
+  void *arg;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t notify;
+};
+
+static __thread TaskHandle_t current_task;
+
+static void *task_main(void *arg) {
+  TaskHandle_t task = arg;
+  current_task = task;
+  task->fn(task->arg);
+  return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t prio, TaskHandle_t *out) {
+  TaskHandle_t task = calloc(1, sizeof(*task));
+  if (!task)
+    return pdFAIL;
+  task->fn = fn;
+  task->arg = arg;
+  pthread_mutex_init(&task->lock, NULL);
+  pthread_cond_init(&task->cond, NULL);
+  if (out)
+    *out = task;
+  if (pthread_create(&task->thread, NULL, task_main, task) != 0) {
+    free(task);
+    return pdFAIL;
+  }
+  pthread_detach(task->thread);
+  return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  pthread_mutex_lock(&task->lock);
+  task->notify++;
+  pthread_cond_signal(&task->cond);
+  pthread_mutex_unlock(&task->lock);
+  return pdPASS;
+}
+
+// xTaskCreateで作ったタスクの中からのみ呼べる
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+  TaskHandle_t task = current_task;
+  struct timespec deadline = deadline_after(ticks);
+  pthread_mutex_lock(&task->lock);
+  int err = 0;
+  while (task->notify == 0 && err != ETIMEDOUT) {
+    if (ticks == portMAX_DELAY)
+      pthread_cond_wait(&task->cond, &task->lock);
+    else
+      err = pthread_cond_timedwait(&task->cond, &task->lock, &deadline);
+  }
+  uint32_t value = task->notify;
+  if (value)
+    task->notify = clear_on_exit ? 0 : value - 1;
+  pthread_mutex_unlock(&task->lock);
+  return value;
+}
+
+struct host_event_group {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+  EventGroupHandle_t group = calloc(1, sizeof(*group));
+  if (!group)
+    return NULL;
+  pthread_mutex_init(&group->lock, NULL);
+  pthread_cond_init(&group->cond, NULL);
+  return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  pthread_mutex_lock(&group->lock);
+  group->bits |= bits;
+  EventBits_t value = group->bits;
+  pthread_cond_broadcast(&group->cond);
+  pthread_mutex_unlock(&group->lock);
+  return value;
+}
+
+// FreeRTOSと同じく、クリアする前の値を返す
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+  pthread_mutex_lock(&group->lock);
+  EventBits_t value = group->bits;
+  group->bits &= ~bits;
+  pthread_mutex_unlock(&group->lock);
+  return value;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+  pthread_mutex_lock(&group->lock);
+  EventBits_t value = group->bits;
+  pthread_mutex_unlock(&group->lock);
+  return value;
+}
+
+static bool bits_satisfied(EventBits_t value, EventBits_t bits,
+                           BaseType_t wait_for_all) {
+  return wait_for_all ? (value & bits) == bits : (value & bits) != 0;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks) {
+  struct timespec deadline = deadline_after(ticks);
+  pthread_mutex_lock(&group->lock);
+  int err = 0;
+  while (!bits_satisfied(group->bits, bits, wait_for_all) &&
+         err != ETIMEDOUT) {
+    if (ticks == portMAX_DELAY)
+      pthread_cond_wait(&group->cond, &group->lock);
+    else
+      err = pthread_cond_timedwait(&group->cond, &group->lock, &deadline);
+  }
+  EventBits_t value = group->bits;
+  if (clear_on_exit && bits_satisfied(value, bits, wait_for_all))
+    group->bits &= ~bits;
+  pthread_mutex_unlock(&group->lock);
+  return value;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+  pthread_cond_destroy(&group->cond);
+  pthread_mutex_destroy(&group->lock);
+  free(group);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// esp_eventの型とイベントループのAPI(テストがapp_events_*を置き換える場合は
+// 宣言だけを使う)
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef const char *esp_event_base_t;
+typedef void *esp_event_loop_handle_t;
+typedef void (*esp_event_handler_t)(void *event_handler_arg,
+                                    esp_event_base_t event_base,
+                                    int32_t event_id, void *event_data);
+
+typedef struct {
+  int32_t queue_size;
+  const char *task_name;
+  UBaseType_t task_priority;
+  uint32_t task_stack_size;
+  BaseType_t task_core_id;
+} esp_event_loop_args_t;
+
+#define ESP_EVENT_ANY_ID -1
+#define ESP_EVENT_DECLARE_BASE(id) extern esp_event_base_t const id
+#define ESP_EVENT_DEFINE_BASE(id) esp_event_base_t const id = #id
+
+esp_err_t esp_event_loop_create(const esp_event_loop_args_t *event_loop_args,
+                                esp_event_loop_handle_t *event_loop);
+esp_err_t esp_event_post_to(esp_event_loop_handle_t event_loop,
+                            esp_event_base_t event_base, int32_t event_id,
+                            const void *event_data, size_t event_data_size,
+                            TickType_t ticks_to_wait);
+esp_err_t esp_event_handler_register_with(esp_event_loop_handle_t event_loop,
+                                          esp_event_base_t event_base,
+                                          int32_t event_id,
+                                          esp_event_handler_t event_handler,
+                                          void *event_handler_arg);
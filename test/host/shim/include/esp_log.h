@@ -0,0 +1,44 @@
+#pragma once
+
+// ESP_LOGxをstderrへの出力に置き換えたもの
+// 既定ではWARN以上を表示し、HOST_LOG_LEVEL(0-5)で変えられる
+
+#include <stdint.h>
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) __attribute__((format(printf, 3, 4)));
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+uint32_t esp_log_timestamp(void);
+void host_log_buffer_hex(const char *tag, const void *buffer, uint16_t len,
+                         esp_log_level_t level);
+
+#define HOST_LOG(level, letter, tag, format, ...)                              \
+  esp_log_write(level, tag, letter " (%u) %s: " format "\n",                   \
+                (unsigned)esp_log_timestamp(), tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...)                                             \
+  HOST_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)                                             \
+  HOST_LOG(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)                                             \
+  HOST_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)                                             \
+  HOST_LOG(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...)                                             \
+  HOST_LOG(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+#define ESP_LOG_LEVEL_LOCAL(level, tag, format, ...)                           \
+  HOST_LOG(level, "L", tag, format, ##__VA_ARGS__)
+
+#define ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, len, level)                      \
+  host_log_buffer_hex(tag, buffer, len, level)
+#define ESP_LOG_BUFFER_HEX(tag, buffer, len)                                   \
+  host_log_buffer_hex(tag, buffer, len, ESP_LOG_INFO)
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+
+typedef enum {
+  ESP_MAC_WIFI_STA,
+  ESP_MAC_WIFI_SOFTAP,
+  ESP_MAC_BT,
+  ESP_MAC_ETH,
+} esp_mac_type_t;
+
+// ホストではローカル管理アドレス 02:00:00:00:00:<type+1> を返す
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ホストではgetentropyによる乱数を返す
+uint32_t esp_random(void);
+void esp_fill_random(void *buf, size_t len);
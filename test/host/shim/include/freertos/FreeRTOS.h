@@ -0,0 +1,35 @@
+#pragma once
+
+// FreeRTOSのAPIのうち、main/が使うものをpthreadで実装したもの
+// tickは1msとする
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define pdTICKS_TO_MS(ticks) ((uint32_t)(ticks))
+
+// クリティカルセクションは全体で1つの再帰mutexで代用する
+typedef struct {
+  int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+void host_critical_enter(void);
+void host_critical_exit(void);
+#define portENTER_CRITICAL(mux) ((void)(mux), host_critical_enter())
+#define portEXIT_CRITICAL(mux) ((void)(mux), host_critical_exit())
+#define taskENTER_CRITICAL(mux) ((void)(mux), host_critical_enter())
+#define taskEXIT_CRITICAL(mux) ((void)(mux), host_critical_exit())
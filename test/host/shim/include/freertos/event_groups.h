@@ -0,0 +1,25 @@
+#pragma once
+
+// イベントグループをpthreadで実装したもの
+
+#include "freertos/FreeRTOS.h"
+
+// ESP-IDFではesp_bit_defs.hが定義する
+#ifndef BIT0
+#define BIT0 0x00000001
+#define BIT1 0x00000002
+#define BIT2 0x00000004
+#define BIT3 0x00000008
+#endif
+
+typedef uint32_t EventBits_t;
+typedef struct host_event_group *EventGroupHandle_t;
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks);
+void vEventGroupDelete(EventGroupHandle_t group);
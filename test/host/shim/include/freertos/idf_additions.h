@@ -0,0 +1,5 @@
+#pragma once
+
+// ESP-IDFがFreeRTOSに追加したAPI(ホストでは使わない)
+
+#include "freertos/FreeRTOS.h"
@@ -0,0 +1,5 @@
+#pragma once
+
+// pdMS_TO_TICKS等はfreertos/FreeRTOS.hで定義している
+
+#include "freertos/FreeRTOS.h"
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+// タスクはpthreadで作る(優先度とスタックの大きさは無視する)
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t prio, TaskHandle_t *out);
+
+// 通知はタスクごとのカウンタとして扱う
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+
+// スタックの残量は測れないので0を返す
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+const char *pcTaskGetName(TaskHandle_t task);
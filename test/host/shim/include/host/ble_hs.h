@@ -0,0 +1,151 @@
+#pragma once
+
+// NimBLEのうち、nimble_central_utils/peer.cが使う型と関数
+// 構造体の並びはNimBLEと同じにする(RAMの計測に使うため)
+// GATTの手続きはtest/host/fake_gatt.cが実装する
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MYNEWT_VAL(name) MYNEWT_VAL_##name
+#define MYNEWT_VAL_ENC_ADV_DATA 0
+
+#define BLE_HS_EAGAIN 1
+#define BLE_HS_EALREADY 2
+#define BLE_HS_EINVAL 3
+#define BLE_HS_EMSGSIZE 4
+#define BLE_HS_ENOENT 5
+#define BLE_HS_ENOMEM 6
+#define BLE_HS_ENOTCONN 7
+#define BLE_HS_ENOTSUP 8
+#define BLE_HS_EAPP 9
+#define BLE_HS_EBADDATA 10
+#define BLE_HS_EOS 11
+#define BLE_HS_ECONTROLLER 12
+#define BLE_HS_ETIMEOUT 13
+#define BLE_HS_EDONE 14
+#define BLE_HS_EBUSY 15
+#define BLE_HS_EREJECT 16
+#define BLE_HS_EUNKNOWN 17
+
+/* UUID */
+enum {
+  BLE_UUID_TYPE_16 = 16,
+  BLE_UUID_TYPE_32 = 32,
+  BLE_UUID_TYPE_128 = 128,
+};
+
+typedef struct {
+  uint8_t type;
+} ble_uuid_t;
+
+typedef struct {
+  ble_uuid_t u;
+  uint16_t value;
+} ble_uuid16_t;
+
+typedef struct {
+  ble_uuid_t u;
+  uint32_t value;
+} ble_uuid32_t;
+
+typedef struct {
+  ble_uuid_t u;
+  uint8_t value[16];
+} ble_uuid128_t;
+
+typedef union {
+  ble_uuid_t u;
+  ble_uuid16_t u16;
+  ble_uuid32_t u32;
+  ble_uuid128_t u128;
+} ble_uuid_any_t;
+
+#define BLE_UUID16_INIT(uuid16)                                                \
+  {.u = {.type = BLE_UUID_TYPE_16}, .value = (uuid16)}
+#define BLE_UUID128_INIT(uuid128...)                                           \
+  {.u = {.type = BLE_UUID_TYPE_128}, .value = {uuid128}}
+#define BLE_UUID16_DECLARE(uuid16)                                             \
+  ((ble_uuid_t *)(&(ble_uuid16_t)BLE_UUID16_INIT(uuid16)))
+#define BLE_UUID128_DECLARE(uuid128...)                                        \
+  ((ble_uuid_t *)(&(ble_uuid128_t)BLE_UUID128_INIT(uuid128)))
+
+#define BLE_GATT_DSC_CLT_CFG_UUID16 0x2902
+
+int ble_uuid_cmp(const ble_uuid_t *uuid1, const ble_uuid_t *uuid2);
+
+/* GATT */
+struct ble_gatt_error {
+  uint16_t status;
+  uint16_t att_handle;
+};
+
+struct ble_gatt_svc {
+  uint16_t start_handle;
+  uint16_t end_handle;
+  ble_uuid_any_t uuid;
+};
+
+struct ble_gatt_chr {
+  uint16_t def_handle;
+  uint16_t val_handle;
+  uint8_t properties;
+  ble_uuid_any_t uuid;
+};
+
+struct ble_gatt_dsc {
+  uint16_t handle;
+  ble_uuid_any_t uuid;
+};
+
+typedef int ble_gatt_disc_svc_fn(uint16_t conn_handle,
+                                 const struct ble_gatt_error *error,
+                                 const struct ble_gatt_svc *service,
+                                 void *arg);
+typedef int ble_gatt_chr_fn(uint16_t conn_handle,
+                            const struct ble_gatt_error *error,
+                            const struct ble_gatt_chr *chr, void *arg);
+typedef int ble_gatt_dsc_fn(uint16_t conn_handle,
+                            const struct ble_gatt_error *error,
+                            uint16_t chr_val_handle,
+                            const struct ble_gatt_dsc *dsc, void *arg);
+
+int ble_gattc_disc_all_svcs(uint16_t conn_handle, ble_gatt_disc_svc_fn *cb,
+                            void *cb_arg);
+int ble_gattc_disc_svc_by_uuid(uint16_t conn_handle, const ble_uuid_t *uuid,
+                               ble_gatt_disc_svc_fn *cb, void *cb_arg);
+int ble_gattc_disc_all_chrs(uint16_t conn_handle, uint16_t start_handle,
+                            uint16_t end_handle, ble_gatt_chr_fn *cb,
+                            void *cb_arg);
+int ble_gattc_disc_all_dscs(uint16_t conn_handle, uint16_t start_handle,
+                            uint16_t end_handle, ble_gatt_dsc_fn *cb,
+                            void *cb_arg);
+
+/* mempool(ESP32と同じく4byte単位) */
+typedef uint32_t os_membuf_t;
+#define OS_ALIGNMENT 4
+#define OS_ALIGN(n, a) (((n) + ((a) - 1)) & ~((a) - 1))
+#define OS_MEMPOOL_SIZE(n, blksize)                                            \
+  ((n) * (OS_ALIGN(blksize, OS_ALIGNMENT) / sizeof(os_membuf_t)))
+#define OS_MEMPOOL_BYTES(n, blksize)                                           \
+  (sizeof(os_membuf_t) * OS_MEMPOOL_SIZE((n), (blksize)))
+
+struct os_mempool {
+  uint32_t mp_block_size;
+  uint16_t mp_num_blocks;
+  uint16_t mp_num_free;
+  void *mp_membuf;
+  void *mp_free; // 空きブロックの単方向リスト
+  const char *name;
+};
+
+int os_mempool_init(struct os_mempool *mp, uint16_t blocks,
+                    uint32_t block_size, void *membuf, const char *name);
+void *os_memblock_get(struct os_mempool *mp);
+int os_memblock_put(struct os_mempool *mp, void *block_addr);
+
+/* esp_central.hのmisc.cの宣言が参照する型 */
+struct os_mbuf;
+struct ble_gap_conn_desc;
+struct ble_hs_adv_fields;
@@ -0,0 +1,12 @@
+#pragma once
+
+// ESP-IDF(newlib)にあり、ホストのglibcに無い関数
+// host_shimを使うターゲットには-includeで読み込む
+
+#include <stddef.h>
+#include <limits.h> // glibcのfeatures.h(__GLIBC__)を読み込ませる
+
+#if defined(__GLIBC__) && !(__GLIBC__ > 2 || __GLIBC_MINOR__ >= 38)
+#define HOST_NEEDS_STRLCPY 1
+size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
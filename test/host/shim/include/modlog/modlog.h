@@ -0,0 +1,4 @@
+#pragma once
+
+// esp_central.hが最初に読むヘッダー(ホストではNimBLEの型だけを読む)
+#include "host/ble_hs.h"
@@ -0,0 +1,3 @@
+#pragma once
+
+// ホストでのビルド用の設定(main/Kconfig.projbuildの既定値に合わせる)
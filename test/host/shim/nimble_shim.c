@@ -0,0 +1,62 @@
+#include "host/ble_hs.h"
+#include <string.h>
+
+int ble_uuid_cmp(const ble_uuid_t *uuid1, const ble_uuid_t *uuid2) {
+  if (uuid1->type != uuid2->type)
+    return uuid1->type - uuid2->type;
+  switch (uuid1->type) {
+  case BLE_UUID_TYPE_16:
+    return (int)((const ble_uuid16_t *)uuid1)->value -
+           (int)((const ble_uuid16_t *)uuid2)->value;
+  case BLE_UUID_TYPE_32:
+    return ((const ble_uuid32_t *)uuid1)->value <
+                   ((const ble_uuid32_t *)uuid2)->value
+               ? -1
+               : ((const ble_uuid32_t *)uuid1)->value !=
+                     ((const ble_uuid32_t *)uuid2)->value;
+  case BLE_UUID_TYPE_128:
+    return memcmp(((const ble_uuid128_t *)uuid1)->value,
+                  ((const ble_uuid128_t *)uuid2)->value, 16);
+  default:
+    return -1;
+  }
+}
+
+int os_mempool_init(struct os_mempool *mp, uint16_t blocks,
+                    uint32_t block_size, void *membuf, const char *name) {
+  if (!mp || (blocks > 0 && !membuf))
+    return BLE_HS_EINVAL;
+  mp->mp_block_size = OS_ALIGN(block_size, OS_ALIGNMENT);
+  mp->mp_num_blocks = blocks;
+  mp->mp_num_free = blocks;
+  mp->mp_membuf = membuf;
+  mp->mp_free = NULL;
+  mp->name = name;
+  // 後ろのブロックから積み、先頭のブロックから払い出す
+  for (int i = blocks - 1; i >= 0; i--) {
+    void *block = (uint8_t *)membuf + (size_t)i * mp->mp_block_size;
+    memcpy(block, &mp->mp_free, sizeof(void *));
+    mp->mp_free = block;
+  }
+  return 0;
+}
+
+void *os_memblock_get(struct os_mempool *mp) {
+  void *block = mp->mp_free;
+  if (block) {
+    memcpy(&mp->mp_free, block, sizeof(void *));
+    mp->mp_num_free--;
+  }
+  return block;
+}
+
+int os_memblock_put(struct os_mempool *mp, void *block_addr) {
+  uint8_t *start = mp->mp_membuf;
+  uint8_t *p = block_addr;
+  if (p < start || p >= start + (size_t)mp->mp_num_blocks * mp->mp_block_size)
+    return BLE_HS_EINVAL;
+  memcpy(block_addr, &mp->mp_free, sizeof(void *));
+  mp->mp_free = block_addr;
+  mp->mp_num_free++;
+  return 0;
+}
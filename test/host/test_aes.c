@@ -0,0 +1,178 @@
+// AES-128の2つの実装(TI_aes_128.cとaes_ct.c)のFIPS-197/AESAVSの既知解テスト
+// --benchを付けるとホストでのcycles/byteを比べる
+
+#include "TI_aes_128.h"
+#include "aes_ct.h"
+#include "bench_util.h"
+#include "test_util.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  const char *name;
+  const char *key, *pt, *ct;
+} aes_kat_t;
+
+static const aes_kat_t kats[] = {
+    {"FIPS-197 Appendix B", "2b7e151628aed2a6abf7158809cf4f3c",
+     "3243f6a8885a308d313198a2e0370734", "3925841d02dc09fbdc118597196a0b32"},
+    {"FIPS-197 Appendix C.1", "000102030405060708090a0b0c0d0e0f",
+     "00112233445566778899aabbccddeeff", "69c4e0d86a7b0430d8cdb78070b4c55a"},
+    // AESAVS GFSbox(鍵は0)
+    {"GFSbox 1", "00000000000000000000000000000000",
+     "f34481ec3cc627bacd5dc3fb08f273e6", "0336763e966d92595a567cc9ce537f5e"},
+    {"GFSbox 2", "00000000000000000000000000000000",
+     "9798c4640bad75c7c3227db910174e72", "a9a1631bf4996954ebc093957b234589"},
+    {"GFSbox 3", "00000000000000000000000000000000",
+     "96ab5c2ff612d9dfaae8c31f30c42168", "ff4f8391a6a40ca5b25d23bedd44a597"},
+    {"GFSbox 4", "00000000000000000000000000000000",
+     "6a118a874519e64e9963798a503f1d35", "dc43be40be0e53712f7e2bf5ca707209"},
+    {"GFSbox 5", "00000000000000000000000000000000",
+     "cb9fceec81286ca3e989bd979b0cb284", "92beedab1895a94faa69b632e5cc47ce"},
+    {"GFSbox 6", "00000000000000000000000000000000",
+     "b26aeb1874e47ca8358ff22378f09144", "459264f4798f6a78bacb89c15ed3d601"},
+    {"GFSbox 7", "00000000000000000000000000000000",
+     "58c8e00b2631686d54eab84b91f0aca1", "08a4e2efec8a8e3312ca7460b9040bbf"},
+    // AESAVS KeySbox(平文は0)
+    {"KeySbox 1", "10a58869d74be5a374cf867cfb473859",
+     "00000000000000000000000000000000", "6d251e6944b051e04eaa6fb4dbf78465"},
+    {"KeySbox 2", "caea65cdbb75e9169ecd22ebe6e54675",
+     "00000000000000000000000000000000", "6e29201190152df4ee058139def610bb"},
+    {"KeySbox 3", "a2e2fa9baf7d20822ca9f0542f764a41",
+     "00000000000000000000000000000000", "c3b44b95d9d2f25670eee9a0de099fa3"},
+};
+
+static void unhex(const char *hex, uint8_t *out) {
+  for (int i = 0; i < 16; i++) {
+    unsigned int byte;
+    sscanf(hex + i * 2, "%2x", &byte);
+    out[i] = (uint8_t)byte;
+  }
+}
+
+static void ti_encrypt(const uint8_t *key, const uint8_t *in, uint8_t *out) {
+  uint8_t key_copy[16]; // aes_enc_decは鍵を書き換える
+  memcpy(key_copy, key, 16);
+  memmove(out, in, 16);
+  aes_enc_dec(out, key_copy, 0);
+}
+
+static void ti_decrypt(const uint8_t *key, const uint8_t *in, uint8_t *out) {
+  uint8_t key_copy[16];
+  memcpy(key_copy, key, 16);
+  memmove(out, in, 16);
+  aes_enc_dec(out, key_copy, 1);
+}
+
+static void test_kat(void) {
+  for (size_t i = 0; i < sizeof(kats) / sizeof(kats[0]); i++) {
+    uint8_t key[16], pt[16], ct[16], out[16];
+    unhex(kats[i].key, key);
+    unhex(kats[i].pt, pt);
+    unhex(kats[i].ct, ct);
+
+    ti_encrypt(key, pt, out);
+    if (memcmp(out, ct, 16) != 0) {
+      fprintf(stderr, "TI encrypt: %s\n", kats[i].name);
+      test_failures++;
+    }
+    ti_decrypt(key, ct, out);
+    if (memcmp(out, pt, 16) != 0) {
+      fprintf(stderr, "TI decrypt: %s\n", kats[i].name);
+      test_failures++;
+    }
+    aes_ct_encrypt(key, pt, out);
+    if (memcmp(out, ct, 16) != 0) {
+      fprintf(stderr, "CT encrypt: %s\n", kats[i].name);
+      test_failures++;
+    }
+    // 展開済みの鍵で、入力と出力が同じ場合
+    aes_ct_ctx_t ctx;
+    aes_ct_init(&ctx, key);
+    memcpy(out, pt, 16);
+    aes_ct_encrypt_blocks(&ctx, out, out, 1);
+    if (memcmp(out, ct, 16) != 0) {
+      fprintf(stderr, "CT blocks: %s\n", kats[i].name);
+      test_failures++;
+    }
+  }
+}
+
+// 2ブロックずつ処理するので、奇数個や端数の扱いを1ブロックずつの結果と比べる
+static void test_ct_blocks_match_single(void) {
+  uint8_t key[16], in[16 * 7], out[16 * 7], expected[16 * 7];
+  srand(1);
+  for (size_t i = 0; i < sizeof(key); i++)
+    key[i] = (uint8_t)rand();
+  for (size_t i = 0; i < sizeof(in); i++)
+    in[i] = (uint8_t)rand();
+  for (int b = 0; b < 7; b++)
+    ti_encrypt(key, in + b * 16, expected + b * 16);
+
+  aes_ct_ctx_t ctx;
+  aes_ct_init(&ctx, key);
+  for (size_t num = 1; num <= 7; num++) {
+    memset(out, 0, sizeof(out));
+    aes_ct_encrypt_blocks(&ctx, in, out, num);
+    CHECK(memcmp(out, expected, num * 16) == 0);
+  }
+}
+
+// ランダムな鍵と平文で2つの実装が一致すること
+static void test_random_agree(void) {
+  srand(2);
+  int mismatches = 0;
+  for (int i = 0; i < 10000; i++) {
+    uint8_t key[16], pt[16], a[16], b[16];
+    for (int j = 0; j < 16; j++) {
+      key[j] = (uint8_t)rand();
+      pt[j] = (uint8_t)rand();
+    }
+    ti_encrypt(key, pt, a);
+    aes_ct_encrypt(key, pt, b);
+    if (memcmp(a, b, 16) != 0)
+      mismatches++;
+  }
+  CHECK_EQ(0, mismatches);
+}
+
+// ベンチマーク
+static uint8_t bench_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                                0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+static uint8_t bench_buf[4096];
+static aes_ct_ctx_t bench_ctx;
+
+static void run_ti_oneshot(size_t len) {
+  for (size_t off = 0; off < len; off += 16)
+    ti_encrypt(bench_key, bench_buf + off, bench_buf + off);
+}
+
+static void run_ct_oneshot(size_t len) {
+  for (size_t off = 0; off < len; off += 16)
+    aes_ct_encrypt(bench_key, bench_buf + off, bench_buf + off);
+}
+
+static void run_ct_expanded(size_t len) {
+  aes_ct_encrypt_blocks(&bench_ctx, bench_buf, bench_buf, len / 16);
+}
+
+static int bench(void) {
+  static const size_t sizes[] = {16, 80, 4096};
+  aes_ct_init(&bench_ctx, bench_key);
+  printf("%-28s %6s %14s %12s\n", "aes", "bytes", "cycles/byte", "MB/s");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    bench_print("ti (key per block)", run_ti_oneshot, sizes[i]);
+    bench_print("ct (key per block)", run_ct_oneshot, sizes[i]);
+    bench_print("ct (expanded key)", run_ct_expanded, sizes[i]);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    return bench();
+  RUN_TEST(test_kat);
+  RUN_TEST(test_ct_blocks_match_single);
+  RUN_TEST(test_random_agree);
+  return TEST_RESULT();
+}
@@ -0,0 +1,300 @@
+// sesame/ssm_codec.cの記述子表とssm_cmd.cのコマンドを、item codeごとに
+// 期待するバイト列(golden)と比べる
+
+#include "ssm_cmd.h"
+#include "ssm_codec.h"
+#include "test_util.h"
+#include <string.h>
+
+struct ssm_env_tag *p_ssms_env = NULL; // ssm.cをリンクしないので代わりに置く
+
+// talk_to_ssmの代わりに、送ろうとしたコマンドを記録する
+static struct {
+  int calls;
+  uint8_t parsing_type;
+  uint8_t buf[80];
+  uint16_t len;
+} sent;
+
+void talk_to_ssm(sesame *ssm, uint8_t parsing_type, uint8_t *buf,
+                 uint16_t len) {
+  sent.calls++;
+  sent.parsing_type = parsing_type;
+  sent.len = len;
+  memcpy(sent.buf, buf, len);
+}
+
+static void reset_sent(void) { memset(&sent, 0, sizeof(sent)); }
+
+static int check_bytes(const char *name, const uint8_t *expected,
+                       size_t expected_len, const uint8_t *actual,
+                       size_t actual_len) {
+  if (expected_len == actual_len && memcmp(expected, actual, actual_len) == 0)
+    return 1;
+  fprintf(stderr, "%s: expected", name);
+  for (size_t i = 0; i < expected_len; i++)
+    fprintf(stderr, " %02x", expected[i]);
+  fprintf(stderr, "\n%s: got     ", name);
+  for (size_t i = 0; i < actual_len; i++)
+    fprintf(stderr, " %02x", actual[i]);
+  fprintf(stderr, "\n");
+  return 0;
+}
+
+#define CHECK_BYTES(expected, actual, actual_len)                              \
+  CHECK(check_bytes(#actual, expected, sizeof(expected), actual, actual_len))
+
+// 定義済みのitem code全ての記述子(candy.hのssm_item_code_eと同じ並び)
+static const struct {
+  uint8_t code;
+  const char *name;
+  uint8_t parsing_type;
+  uint8_t payload_min;
+  uint8_t payload_max;
+} golden_descs[] = {
+    {0, "SSM_ITEM_CODE_NONE", 0, 0, 0},
+    {1, "SSM_ITEM_CODE_REGISTRATION", SSM_SEG_PARSING_TYPE_PLAINTEXT, 64, 64},
+    {2, "SSM_ITEM_CODE_LOGIN", SSM_SEG_PARSING_TYPE_PLAINTEXT, 4, 4},
+    {3, "SSM_ITEM_CODE_USER", 0, 0, 0},
+    {4, "SSM_ITEM_CODE_HISTORY", SSM_SEG_PARSING_TYPE_CIPHERTEXT, 1, 1},
+    {5, "SSM_ITEM_CODE_VERSION_DETAIL", SSM_SEG_PARSING_TYPE_CIPHERTEXT, 0, 0},
+    {6, "SSM_ITEM_CODE_DISCONNECT_REBOOT_NOW", SSM_SEG_PARSING_TYPE_CIPHERTEXT,
+     0, 0},
+    {7, "SSM_ITEM_CODE_ENABLE_DFU", 0, 0, 0},
+    {8, "SSM_ITEM_CODE_TIME", SSM_SEG_PARSING_TYPE_CIPHERTEXT, 4, 4},
+    {14, "SSM_ITEM_CODE_INITIAL", 0, 0, 0},
+    {17, "SSM_ITEM_CODE_MAGNET", 0, 0, 0},
+    {80, "SSM_ITEM_CODE_MECH_SETTING", SSM_SEG_PARSING_TYPE_CIPHERTEXT, 4, 4},
+    {81, "SSM_ITEM_CODE_MECH_STATUS", 0, 0, 0},
+    {82, "SSM_ITEM_CODE_LOCK", SSM_SEG_PARSING_TYPE_CIPHERTEXT, 1, 31},
+    {83, "SSM_ITEM_CODE_UNLOCK", SSM_SEG_PARSING_TYPE_CIPHERTEXT, 1, 31},
+    {92, "SSM2_ITEM_OPS_TIMER_SETTING", 0, 0, 0},
+};
+
+#define GOLDEN_NUM (sizeof(golden_descs) / sizeof(golden_descs[0]))
+
+static int golden_index(unsigned code) {
+  for (size_t i = 0; i < GOLDEN_NUM; i++) {
+    if (golden_descs[i].code == code)
+      return (int)i;
+  }
+  return -1;
+}
+
+static void test_descriptor_table(void) {
+  for (unsigned code = 0; code < 256; code++) {
+    const ssm_item_desc_t *desc = ssm_item_desc(code);
+    int i = golden_index(code);
+    if (i < 0) {
+      // 表の途中の空き、表の範囲外のどちらも未定義
+      CHECK(desc == NULL);
+      CHECK(strcmp(ssm_item_code_name(code), "UNKNOWN_ITEM_CODE") == 0);
+      continue;
+    }
+    CHECK(desc != NULL);
+    if (!desc)
+      continue;
+    CHECK(strcmp(desc->name, golden_descs[i].name) == 0);
+    CHECK(strcmp(ssm_item_code_name(code), golden_descs[i].name) == 0);
+    CHECK_EQ(golden_descs[i].parsing_type, desc->parsing_type);
+    CHECK_EQ(golden_descs[i].payload_min, desc->payload_min);
+    CHECK_EQ(golden_descs[i].payload_max, desc->payload_max);
+  }
+}
+
+static void test_encode_every_item_code(void) {
+  uint8_t payload[80];
+  for (size_t i = 0; i < sizeof(payload); i++)
+    payload[i] = (uint8_t)(0xA0 + i);
+
+  for (size_t i = 0; i < GOLDEN_NUM; i++) {
+    uint8_t code = golden_descs[i].code;
+    uint8_t out[96];
+    if (golden_descs[i].parsing_type == 0) {
+      // 受信専用のitemは組み立てない
+      for (size_t len = 0; len <= 8; len++)
+        CHECK_EQ(0, ssm_encode(code, payload, len, out, sizeof(out)));
+      continue;
+    }
+
+    size_t tag = golden_descs[i].parsing_type == SSM_SEG_PARSING_TYPE_CIPHERTEXT
+                     ? CCM_TAG_LENGTH
+                     : 0;
+    for (size_t len = golden_descs[i].payload_min;
+         len <= golden_descs[i].payload_max; len++) {
+      memset(out, 0xEE, sizeof(out));
+      CHECK_EQ(1 + len, ssm_encode(code, payload, len, out, sizeof(out)));
+      CHECK_EQ(code, out[0]);
+      CHECK(memcmp(out + 1, payload, len) == 0);
+      CHECK_EQ(0xEE, out[1 + len]); // 後ろは書き換えない
+
+      // 暗号化するitemはタグの分まで含めて収まる必要がある
+      CHECK_EQ(1 + len, ssm_encode(code, payload, len, out, 1 + len + tag));
+      CHECK_EQ(0, ssm_encode(code, payload, len, out, len + tag));
+    }
+    if (golden_descs[i].payload_min > 0)
+      CHECK_EQ(0, ssm_encode(code, payload, golden_descs[i].payload_min - 1,
+                             out, sizeof(out)));
+    CHECK_EQ(0, ssm_encode(code, payload, golden_descs[i].payload_max + 1, out,
+                           sizeof(out)));
+    if (golden_descs[i].payload_min > 0)
+      CHECK_EQ(0, ssm_encode(code, NULL, golden_descs[i].payload_min, out,
+                             sizeof(out)));
+    CHECK_EQ(0, ssm_encode(code, payload, golden_descs[i].payload_min, NULL,
+                           sizeof(out)));
+  }
+
+  uint8_t out[8];
+  CHECK_EQ(0, ssm_encode(9, NULL, 0, out, sizeof(out)));
+  CHECK_EQ(0, ssm_encode(SSM_ITEM_CODE_TABLE_SIZE, NULL, 0, out, sizeof(out)));
+  CHECK_EQ(0, ssm_encode(0xFF, NULL, 0, out, sizeof(out)));
+}
+
+static void test_send_uses_item_parsing_type(void) {
+  sesame ssm = {0};
+  reset_sent();
+  CHECK(ssm_send(&ssm, SSM_ITEM_CODE_VERSION_DETAIL, NULL, 0));
+  static const uint8_t version[] = {0x05};
+  CHECK_EQ(SSM_SEG_PARSING_TYPE_CIPHERTEXT, sent.parsing_type);
+  CHECK_BYTES(version, sent.buf, sent.len);
+
+  static const uint8_t reboot[] = {0x06};
+  CHECK(ssm_send(&ssm, SSM_ITEM_CODE_DISCONNECT_REBOOT_NOW, NULL, 0));
+  CHECK_BYTES(reboot, sent.buf, sent.len);
+
+  // 組み立てられないものは送らない
+  reset_sent();
+  CHECK(!ssm_send(&ssm, SSM_ITEM_CODE_MECH_STATUS, NULL, 0));
+  CHECK(!ssm_send(&ssm, SSM_ITEM_CODE_LOGIN, "\x01", 1));
+  CHECK(!ssm_send(&ssm, 200, NULL, 0));
+  CHECK_EQ(0, sent.calls);
+}
+
+static void test_login_frame(void) {
+  // トークンはAES-CMAC(device_secret, random_code)
+  // openssl mac -cipher AES-128-CBC -macopt hexkey:2b7e... CMAC で求めた値
+  sesame ssm = {0};
+  static const uint8_t secret[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae,
+                                     0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88,
+                                     0x09, 0xcf, 0x4f, 0x3c};
+  static const uint8_t token[16] = {0x3e, 0x85, 0x43, 0x6f, 0x5b, 0xe7,
+                                    0xc2, 0x7d, 0x71, 0xbe, 0x6f, 0x13,
+                                    0x6f, 0x70, 0xdb, 0xab};
+  static const uint8_t login[] = {0x02, 0x3e, 0x85, 0x43, 0x6f};
+  memcpy(ssm.device_secret, secret, sizeof(secret));
+  memcpy(ssm.cipher.decrypt.random_code, "\x01\x02\x03\x04", 4);
+
+  reset_sent();
+  send_login_cmd_to_ssm(&ssm);
+  CHECK_EQ(1, sent.calls);
+  CHECK_EQ(SSM_SEG_PARSING_TYPE_PLAINTEXT, sent.parsing_type);
+  CHECK_BYTES(login, sent.buf, sent.len);
+  CHECK(memcmp(ssm.cipher.token, token, sizeof(token)) == 0);
+}
+
+static void test_registration_frame(void) {
+  sesame ssm = {0};
+  reset_sent();
+  send_reg_cmd_to_ssm(&ssm);
+  CHECK_EQ(1, sent.calls);
+  CHECK_EQ(SSM_SEG_PARSING_TYPE_PLAINTEXT, sent.parsing_type);
+  CHECK_EQ(1 + 64, sent.len);
+  CHECK_EQ(SSM_ITEM_CODE_REGISTRATION, sent.buf[0]);
+}
+
+static void test_cipher_frames(void) {
+  sesame ssm = {0};
+  static const uint8_t history[] = {0x04, 0x01};
+  reset_sent();
+  send_read_history_cmd_to_ssm(&ssm);
+  CHECK_EQ(SSM_SEG_PARSING_TYPE_CIPHERTEXT, sent.parsing_type);
+  CHECK_BYTES(history, sent.buf, sent.len);
+
+  static const uint8_t time[] = {0x08, 0xc3, 0xb2, 0xa1, 0x65};
+  send_time_cmd_to_ssm(&ssm, 0x65a1b2c3);
+  CHECK_EQ(SSM_SEG_PARSING_TYPE_CIPHERTEXT, sent.parsing_type);
+  CHECK_BYTES(time, sent.buf, sent.len);
+
+  static const uint8_t setting[] = {0x50, 0x9c, 0xff, 0xc8, 0x00};
+  mech_setting_t angles = {.lock_position = -100, .unlock_position = 200};
+  send_mech_setting_cmd_to_ssm(&ssm, &angles);
+  CHECK_EQ(SSM_SEG_PARSING_TYPE_CIPHERTEXT, sent.parsing_type);
+  CHECK_BYTES(setting, sent.buf, sent.len);
+}
+
+static void test_lock_unlock_frames(void) {
+  sesame ssm = {.device_status = SSM_CONNECTED};
+  reset_sent();
+  ssm_lock(&ssm, NULL, 0);
+  CHECK_EQ(0, sent.calls); // ログイン前は送らない
+
+  ssm.device_status = SSM_LOGGIN;
+  // タグを省略すると"SESAME ESP32"
+  static const uint8_t lock[] = {0x52, 0x0c, 'S', 'E', 'S', 'A', 'M',
+                                 'E',  ' ',  'E', 'S', 'P', '3', '2'};
+  ssm_lock(&ssm, NULL, 0);
+  CHECK_EQ(SSM_SEG_PARSING_TYPE_CIPHERTEXT, sent.parsing_type);
+  CHECK_BYTES(lock, sent.buf, sent.len);
+
+  static const uint8_t unlock[] = {0x53, 0x03, 'a', 'p', 'p'};
+  ssm.device_status = SSM_LOCKED;
+  ssm_unlock(&ssm, (uint8_t *)"app", 3);
+  CHECK_BYTES(unlock, sent.buf, sent.len);
+
+  // 長いタグは履歴に残る30bytesまで
+  uint8_t long_tag[40];
+  memset(long_tag, 'x', sizeof(long_tag));
+  ssm_unlock(&ssm, long_tag, sizeof(long_tag));
+  CHECK_EQ(2 + SSM_HISTORY_TAG_MAX_LEN, sent.len);
+  CHECK_EQ(SSM_ITEM_CODE_UNLOCK, sent.buf[0]);
+  CHECK_EQ(SSM_HISTORY_TAG_MAX_LEN, sent.buf[1]);
+}
+
+static void test_decode_history(void) {
+  // record_id=0x01020304 type=2 timestamp=0x65a1b2c3
+  // mech_status(battery=0x1770 target=-90 position=-88 flags=0x02) tag="app"
+  static const uint8_t resp[] = {0x04, 0x03, 0x02, 0x01, 0x02, 0xc3, 0xb2,
+                                 0xa1, 0x65, 0x70, 0x17, 0xa6, 0xff, 0xa8,
+                                 0xff, 0x02, 0x03, 'a',  'p',  'p'};
+  ssm_history_record_t rec;
+  CHECK(ssm_decode_history(resp, sizeof(resp), &rec));
+  CHECK_EQ(0x01020304, rec.record_id);
+  CHECK_EQ(2, rec.type);
+  CHECK_EQ(0x65a1b2c3, rec.timestamp);
+  CHECK_EQ(0x1770, rec.mech_status.battery);
+  CHECK_EQ(-90, rec.mech_status.target);
+  CHECK_EQ(-88, rec.mech_status.position);
+  CHECK_EQ(1, rec.mech_status.is_lock_range);
+  CHECK_EQ(0, rec.mech_status.is_unlock_range);
+  CHECK_EQ(3, rec.tag_len);
+  CHECK(memcmp(rec.tag, "app", 3) == 0);
+
+  // タグが無い応答、タグ長が実際より長い応答
+  CHECK(ssm_decode_history(resp, SSM_HISTORY_RESP_MIN_LEN, &rec));
+  CHECK_EQ(0, rec.tag_len);
+  CHECK(ssm_decode_history(resp, sizeof(resp) - 1, &rec));
+  CHECK_EQ(2, rec.tag_len);
+
+  // 30bytesを超えるタグは切り詰める
+  uint8_t long_resp[SSM_HISTORY_RESP_MIN_LEN + 1 + 40];
+  memcpy(long_resp, resp, SSM_HISTORY_RESP_MIN_LEN);
+  long_resp[SSM_HISTORY_RESP_MIN_LEN] = 40;
+  memset(long_resp + SSM_HISTORY_RESP_MIN_LEN + 1, 'y', 40);
+  CHECK(ssm_decode_history(long_resp, sizeof(long_resp), &rec));
+  CHECK_EQ(SSM_HISTORY_TAG_MAX_LEN, rec.tag_len);
+
+  CHECK(!ssm_decode_history(resp, SSM_HISTORY_RESP_MIN_LEN - 1, &rec));
+  CHECK(!ssm_decode_history(NULL, sizeof(resp), &rec));
+}
+
+int main(void) {
+  RUN_TEST(test_descriptor_table);
+  RUN_TEST(test_encode_every_item_code);
+  RUN_TEST(test_send_uses_item_parsing_type);
+  RUN_TEST(test_login_frame);
+  RUN_TEST(test_registration_frame);
+  RUN_TEST(test_cipher_frames);
+  RUN_TEST(test_lock_unlock_frames);
+  RUN_TEST(test_decode_history);
+  return TEST_RESULT();
+}
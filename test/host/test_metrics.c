@@ -0,0 +1,165 @@
+// diagnostics/metrics.cのヒストグラムのバケット・合計・パーセンタイルの計算
+
+#include "metrics.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <string.h>
+
+#define THREADS 4
+#define SAMPLES_PER_THREAD 100000
+
+static double json_number(const cJSON *json, const char *name) {
+  return cJSON_GetNumberValue(cJSON_GetObjectItem(json, name));
+}
+
+static void test_bucket_boundaries(void) {
+  // 上限ちょうどはそのバケットに入る
+  CHECK_EQ(0, metrics_hist_bucket_index(0));
+  CHECK_EQ(0, metrics_hist_bucket_index(1000));
+  CHECK_EQ(1, metrics_hist_bucket_index(1001));
+  CHECK_EQ(1, metrics_hist_bucket_index(2000));
+  CHECK_EQ(2, metrics_hist_bucket_index(2001));
+  CHECK_EQ(9, metrics_hist_bucket_index(1000000));
+  CHECK_EQ(12, metrics_hist_bucket_index(10000000));
+  // 10sを超えるものは最後のバケット
+  CHECK_EQ(METRICS_HIST_BUCKET_NUM - 1, metrics_hist_bucket_index(10000001));
+  CHECK_EQ(METRICS_HIST_BUCKET_NUM - 1,
+           metrics_hist_bucket_index(INT64_C(1) << 40));
+
+  cJSON *bounds = metrics_hist_bounds_to_json();
+  CHECK_EQ(METRICS_HIST_BUCKET_NUM - 1, cJSON_GetArraySize(bounds));
+  cJSON_Delete(bounds);
+}
+
+static void test_record_clamps(void) {
+  metrics_hist_t hist;
+  memset(&hist, 0, sizeof(hist));
+  metrics_hist_record(&hist, -5);
+  metrics_hist_record(&hist, INT64_C(1) << 40);
+  CHECK_EQ(2, hist.count);
+  CHECK_EQ(1, hist.buckets[0]);
+  CHECK_EQ(1, hist.buckets[METRICS_HIST_BUCKET_NUM - 1]);
+  CHECK_EQ(UINT32_MAX, hist.max_us);
+  CHECK_EQ(UINT32_MAX, hist.sum_us);
+}
+
+// 1ms未満の処理を多数記録しても合計が消えないこと
+static void test_sum_keeps_sub_ms(void) {
+  metrics_hist_t hist;
+  memset(&hist, 0, sizeof(hist));
+  for (int i = 0; i < 1000; i++)
+    metrics_hist_record(&hist, 400);
+  for (int i = 0; i < 1000; i++)
+    metrics_hist_record(&hist, 1499);
+
+  cJSON *json = metrics_hist_to_json(&hist);
+  CHECK_EQ(2000, json_number(json, "count"));
+  CHECK(json_number(json, "sum_ms") == 1899.0);
+  CHECK(json_number(json, "max_ms") == 1.499);
+  cJSON_Delete(json);
+}
+
+static void test_percentiles(void) {
+  metrics_hist_t hist;
+  memset(&hist, 0, sizeof(hist));
+  CHECK_EQ(0, metrics_hist_percentile_ms(&hist, 50));
+
+  // 90件が3ms、10件が700ms
+  for (int i = 0; i < 90; i++)
+    metrics_hist_record(&hist, 3000);
+  for (int i = 0; i < 10; i++)
+    metrics_hist_record(&hist, 700000);
+  CHECK_EQ(5, metrics_hist_percentile_ms(&hist, 50));
+  CHECK_EQ(5, metrics_hist_percentile_ms(&hist, 90)); // 90件目まで(2,5]
+  // 91件目以降は(500,1000]のバケットだが、最大値の700msを超えない
+  CHECK_EQ(700, metrics_hist_percentile_ms(&hist, 91));
+  CHECK_EQ(700, metrics_hist_percentile_ms(&hist, 99));
+  CHECK_EQ(700, metrics_hist_percentile_ms(&hist, 100));
+  CHECK_EQ(700, metrics_hist_percentile_ms(&hist, 150));
+  // 0%は最初の1件
+  CHECK_EQ(5, metrics_hist_percentile_ms(&hist, 0));
+
+  cJSON *json = metrics_hist_to_json(&hist);
+  CHECK_EQ(5, json_number(json, "p50_ms"));
+  CHECK_EQ(700, json_number(json, "p99_ms"));
+  cJSON_Delete(json);
+
+  // 最後のバケットは上限が無いので最大値(msへ切り上げ)
+  memset(&hist, 0, sizeof(hist));
+  metrics_hist_record(&hist, 20000001);
+  CHECK_EQ(20001, metrics_hist_percentile_ms(&hist, 50));
+}
+
+static metrics_hist_t shared_hist;
+
+static void *record_concurrently(void *arg) {
+  uint32_t us = (uint32_t)(uintptr_t)arg;
+  for (int i = 0; i < SAMPLES_PER_THREAD; i++)
+    metrics_hist_record(&shared_hist, us);
+  return NULL;
+}
+
+// ロックを取らずに複数のスレッドから記録しても件数と合計が合うこと
+static void test_concurrent_record(void) {
+  pthread_t threads[THREADS];
+  uint64_t expected_sum = 0;
+  for (int i = 0; i < THREADS; i++) {
+    uint32_t us = 250 + i * 1000;
+    expected_sum += (uint64_t)us * SAMPLES_PER_THREAD;
+    pthread_create(&threads[i], NULL, record_concurrently,
+                   (void *)(uintptr_t)us);
+  }
+  for (int i = 0; i < THREADS; i++)
+    pthread_join(threads[i], NULL);
+
+  CHECK_EQ(THREADS * SAMPLES_PER_THREAD, shared_hist.count);
+  CHECK_EQ(expected_sum, shared_hist.sum_us);
+  CHECK_EQ(250 + (THREADS - 1) * 1000, shared_hist.max_us);
+  uint32_t total = 0;
+  for (int i = 0; i < METRICS_HIST_BUCKET_NUM; i++)
+    total += shared_hist.buckets[i];
+  CHECK_EQ(THREADS * SAMPLES_PER_THREAD, total);
+}
+
+static void test_registry_snapshot(void) {
+  metrics_hist_observe(METRIC_HIST_HTTP_REQUEST, 1500);
+  metrics_counter_inc(METRIC_HTTP_2XX);
+  metrics_record_http(ESP_OK, 503);
+  metrics_record_http(ESP_FAIL, 0);
+
+  cJSON *root = metrics_to_json();
+  const cJSON *counters = cJSON_GetObjectItem(root, "counters");
+  CHECK_EQ(1, json_number(counters, "http_2xx"));
+  CHECK_EQ(1, json_number(counters, "http_5xx"));
+  CHECK_EQ(1, json_number(counters, "http_transport_errors"));
+  const cJSON *hists = cJSON_GetObjectItem(root, "hists");
+  const cJSON *http = cJSON_GetObjectItem(hists, "http_request");
+  CHECK_EQ(1, json_number(http, "count"));
+  CHECK(json_number(http, "sum_ms") == 1.5);
+  CHECK_EQ(2, json_number(http, "p50_ms"));
+  cJSON_Delete(root);
+}
+
+// 登録できる数を超えたタスクは捨てずに数える
+static void test_task_registry_overflow(void) {
+  for (uintptr_t i = 1; i <= METRICS_MAX_TASKS + 2; i++)
+    metrics_register_task((TaskHandle_t)i);
+
+  cJSON *root = metrics_to_json();
+  CHECK_EQ(METRICS_MAX_TASKS,
+           cJSON_GetArraySize(cJSON_GetObjectItem(root, "stack_hwm")));
+  CHECK_EQ(2, json_number(cJSON_GetObjectItem(root, "counters"),
+                          "tasks_unregistered"));
+  cJSON_Delete(root);
+}
+
+int main(void) {
+  RUN_TEST(test_bucket_boundaries);
+  RUN_TEST(test_record_clamps);
+  RUN_TEST(test_sum_keeps_sub_ms);
+  RUN_TEST(test_percentiles);
+  RUN_TEST(test_concurrent_record);
+  RUN_TEST(test_registry_snapshot);
+  RUN_TEST(test_task_registry_overflow);
+  return TEST_RESULT();
+}
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+# rtdb_standin.pyがRTDB/Identity Toolkitと同じように応答することを確かめる
+
+import http.client
+import json
+import os
+import sys
+import threading
+import time
+import unittest
+import urllib.parse
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import rtdb_standin  # noqa: E402
+
+QUEUE = "/sesami5pro/commands/queue"
+
+
+class StandinTest(unittest.TestCase):
+    def setUp(self):
+        args = rtdb_standin.parse_args([
+            "--port", "0", "--api-key", "key", "--password", "pw",
+            "--require-auth", "--keepalive", "0.2",
+            "--index", QUEUE[1:] + ":is_finished"])
+        self.server = rtdb_standin.make_server(args)
+        self.port = self.server.server_address[1]
+        threading.Thread(target=self.server.serve_forever, daemon=True).start()
+        self.token = self.sign_in()["idToken"]
+
+    def tearDown(self):
+        self.server.shutdown()
+        self.server.server_close()
+
+    def request(self, method, path, body=None, headers=None, params=None,
+                raw=None):
+        conn = http.client.HTTPConnection("127.0.0.1", self.port, timeout=5)
+        if params is not None:
+            path += "?" + urllib.parse.urlencode(params)
+        data = raw if raw is not None else (
+            None if body is None else json.dumps(body))
+        conn.request(method, path, data, headers or {})
+        resp = conn.getresponse()
+        text = resp.read()
+        conn.close()
+        return resp.status, json.loads(text) if text else None, resp
+
+    def db(self, method, path, body=None, headers=None, **params):
+        params.setdefault("auth", self.token)
+        return self.request(method, path + ".json", body, headers, params)
+
+    def sign_in(self):
+        status, body, _ = self.request(
+            "POST", "/v1/accounts:signInWithPassword?key=key",
+            {"email": "a@example.com", "password": "pw",
+             "returnSecureToken": True})
+        self.assertEqual(200, status)
+        return body
+
+    def control(self, **knobs):
+        return self.request("POST", "/__control", knobs)
+
+    def test_put_get_patch_delete(self):
+        self.assertEqual(200, self.db("PUT", "/a/b", {"x": 1, "y": 2})[0])
+        self.assertEqual({"x": 1, "y": 2}, self.db("GET", "/a/b")[1])
+        self.db("PATCH", "/a/b", {"y": 3, "z/w": 4})
+        self.assertEqual({"x": 1, "y": 3, "z": {"w": 4}},
+                         self.db("GET", "/a/b")[1])
+        self.assertEqual(204, self.db("DELETE", "/a/b", print="silent")[0])
+        self.assertIsNone(self.db("GET", "/a")[1])
+
+    def test_push_ids_are_ordered(self):
+        names = [self.db("POST", QUEUE, {"name": "lock"})[1]["name"]
+                 for _ in range(20)]
+        self.assertEqual(names, sorted(names))
+        self.assertEqual(20, len(set(names)))
+        now_ms = int(time.time() * 1000)
+        ms = 0
+        for c in names[0][:8]:
+            ms = ms * 64 + rtdb_standin.PUSH_CHARS.index(c)
+        self.assertLess(abs(now_ms - ms), 5000)
+
+    def test_query_unfinished(self):
+        self.db("PUT", QUEUE, {
+            "-c": {"name": "lock", "is_finished": False},
+            "-a": {"name": "unlock", "is_finished": True},
+            "-b": {"name": "unlock", "is_finished": False},
+            "-d": {"name": "lock", "is_finished": False}})
+        status, body, _ = self.db("GET", QUEUE, orderBy='"is_finished"',
+                                  equalTo="false", limitToFirst=2)
+        self.assertEqual(200, status)
+        self.assertEqual(["-b", "-c"], list(body))
+        self.assertEqual(1, self.request("GET", "/__stats")[1]["queries"])
+        # .indexOnの無い子では並べられない
+        status, body, _ = self.db("GET", QUEUE, orderBy='"name"',
+                                  equalTo='"lock"')
+        self.assertEqual(400, status)
+        self.assertIn("Index not defined", body["error"])
+        status, body, _ = self.db("GET", QUEUE, orderBy='"$key"',
+                                  limitToLast=1)
+        self.assertEqual(["-d"], list(body))
+        self.assertEqual(400, self.db("GET", QUEUE, limitToFirst=1)[0])
+
+    def test_etag(self):
+        self.db("PUT", "/status", "locked")
+        _, _, resp = self.db("GET", "/status", None, {"X-Firebase-ETag": "true"})
+        etag = resp.getheader("ETag")
+        self.assertTrue(etag)
+        status, body, _ = self.db("PUT", "/status", "unlocked",
+                                  {"if-match": etag})
+        self.assertEqual(200, status)
+        status, body, resp = self.db("PUT", "/status", "locked",
+                                     {"if-match": etag})
+        self.assertEqual(412, status)
+        self.assertEqual("unlocked", body)
+        self.assertNotEqual(etag, resp.getheader("ETag"))
+
+    def test_auth(self):
+        self.assertEqual(401, self.db("GET", "/a", auth="bogus")[0])
+        self.assertEqual(401, self.request("GET", "/a.json")[0])
+        status, _, _ = self.request(
+            "POST", "/v1/accounts:signInWithPassword?key=key",
+            {"email": "a@example.com", "password": "wrong"})
+        self.assertEqual(400, status)
+        self.assertEqual(400, self.request(
+            "POST", "/v1/accounts:signInWithPassword?key=bad", {})[0])
+
+    def test_token_expiry_and_refresh(self):
+        tokens = self.sign_in()
+        self.control(expire_tokens=True)
+        status, body, _ = self.db("GET", "/a", auth=tokens["idToken"])
+        self.assertEqual(401, status)
+        self.assertEqual("Auth token is expired", body["error"])
+        status, body, _ = self.request(
+            "POST", "/v1/token?key=key", raw=urllib.parse.urlencode({
+                "grant_type": "refresh_token",
+                "refresh_token": tokens["refreshToken"]}))
+        self.assertEqual(200, status)
+        self.assertEqual(200, self.db("GET", "/a", auth=body["id_token"])[0])
+        # 使ったrefresh_tokenは使えない
+        status, _, _ = self.request(
+            "POST", "/v1/token?key=key", raw=urllib.parse.urlencode({
+                "grant_type": "refresh_token",
+                "refresh_token": tokens["refreshToken"]}))
+        self.assertEqual(400, status)
+
+    def test_injected_errors_and_latency(self):
+        self.control(error_rate=1.0, error_status=503)
+        self.assertEqual(503, self.db("GET", "/a")[0])
+        self.control(error_rate=0, latency_ms=100)
+        start = time.monotonic()
+        self.assertEqual(200, self.db("GET", "/a")[0])
+        self.assertGreaterEqual(time.monotonic() - start, 0.1)
+
+    def test_stream(self):
+        self.db("PUT", QUEUE, {"-a": {"name": "lock", "is_finished": False}})
+        conn = http.client.HTTPConnection("127.0.0.1", self.port, timeout=5)
+        conn.request("GET", QUEUE + ".json?auth=" + self.token, None,
+                     {"Accept": "text/event-stream"})
+        resp = conn.getresponse()
+        self.assertEqual(200, resp.status)
+
+        def next_event():
+            event = data = None
+            while True:
+                line = resp.fp.readline().decode().rstrip("\n")
+                if line.startswith("event:"):
+                    event = line[6:].strip()
+                elif line.startswith("data:"):
+                    data = json.loads(line[5:].strip())
+                elif line == "" and event:
+                    return event, data
+
+        self.assertEqual(("put", {"path": "/", "data": {
+            "-a": {"name": "lock", "is_finished": False}}}), next_event())
+        self.db("PATCH", QUEUE + "/-a", {"is_finished": True})
+        self.assertEqual(("patch", {"path": "/-a",
+                                    "data": {"is_finished": True}}),
+                         next_event())
+        self.db("PUT", "/elsewhere", 1)  # 関係の無い変更は届かない
+        self.assertEqual(("keep-alive", None), next_event())
+        self.control(expire_tokens=True)
+        self.assertEqual("auth_revoked", next_event()[0])
+        conn.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
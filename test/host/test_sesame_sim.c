@@ -0,0 +1,412 @@
+// sesame/(ssm.c, ssm_cmd.c, ssm_codec.c, ssm_session.c)をsesame_sim.cの
+// 偽のSESAMEとGATT層に繋いで、接続からlock/unlock、履歴までを通す
+// --benchでコマンドの往復の速さと、複数台の通知が混ざる場合の履歴の読み出しを測る
+
+#include "bench_util.h"
+#include "metrics.h"
+#include "sesame_sim.h"
+#include "ssm_cmd.h"
+#include "ssm_session.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t secret_a[16] = {0x5a, 0x01, 0x02, 0x03, 0x04, 0x05,
+                                     0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+                                     0x0c, 0x0d, 0x0e, 0x0f};
+static const uint8_t secret_b[16] = {0xb5, 0x11, 0x12, 0x13, 0x14, 0x15,
+                                     0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b,
+                                     0x1c, 0x1d, 0x1e, 0x1f};
+
+static double counter(const char *name) {
+  cJSON *root = metrics_to_json();
+  double value = cJSON_GetNumberValue(
+      cJSON_GetObjectItem(cJSON_GetObjectItem(root, "counters"), name));
+  cJSON_Delete(root);
+  return value;
+}
+
+// 登録済みのSESAMEに接続してログインする
+static sesame *connect_provisioned(sesame_sim_t *sim, sesame *gw,
+                                   const uint8_t secret[16]) {
+  sesame_sim_init(sim, gw);
+  sesame_sim_provision(sim, secret);
+  sesame_sim_connect(sim);
+  sesame_sim_pump();
+  return gw;
+}
+
+static void test_registration(void) {
+  sesame_sim_setup();
+  sesame *gw = &p_ssms_env->ssm;
+  static sesame_sim_t sim;
+  sesame_sim_init(&sim, gw);
+  sesame_sim_connect(&sim);
+  sesame_sim_pump();
+
+  // INITIAL → 登録(ECDH) → 応答の公開鍵から同じdevice_secretを求める
+  CHECK_EQ(1, sim.item_counts[SSM_ITEM_CODE_REGISTRATION]);
+  CHECK(sim.registered);
+  CHECK(memcmp(gw->device_secret, sim.device_secret, 16) == 0);
+  CHECK(memcmp(gw->public_key, sim.public_key, 64) == 0);
+  CHECK(memcmp(gw->cipher.token, sim.token, 16) == 0);
+  // 登録後の最初のMECH_STATUSを復号できる
+  CHECK_EQ(1, sim_gw.mech_status_events);
+  CHECK_EQ(SSM_LOCKED, gw->device_status);
+  CHECK_EQ(0, sim.auth_failures);
+}
+
+static void test_login(void) {
+  sesame_sim_setup();
+  static sesame_sim_t sim;
+  sesame *gw = connect_provisioned(&sim, &p_ssms_env->ssm, secret_a);
+
+  // INITIAL → CMACのトークンでログイン → 時刻とMECH_STATUS
+  CHECK_EQ(0, sim.item_counts[SSM_ITEM_CODE_REGISTRATION]);
+  CHECK_EQ(1, sim.item_counts[SSM_ITEM_CODE_LOGIN]);
+  CHECK(sim.logged_in);
+  CHECK(memcmp(gw->cipher.token, sim.token, 16) == 0);
+  CHECK_EQ(sim.clock, sim_gw.lock_time);
+  CHECK_EQ(SSM_LOCKED, gw->device_status);
+  CHECK_EQ(1, sim_gw.mech_status_events);
+  CHECK(sim_gw.status_callbacks >= 2); // LOGGIN, LOCKED
+
+  // 別のdevice_secretではログインできない
+  static sesame_sim_t wrong;
+  sesame_sim_setup();
+  sesame_sim_init(&wrong, &p_ssms_env->ssm);
+  sesame_sim_provision(&wrong, secret_a);
+  memcpy(p_ssms_env->ssm.device_secret, secret_b, 16);
+  sesame_sim_connect(&wrong);
+  sesame_sim_pump();
+  CHECK(!wrong.logged_in);
+  CHECK_EQ(1, wrong.auth_failures);
+  CHECK_EQ(SSM_CONNECTED, p_ssms_env->ssm.device_status);
+}
+
+static void test_lock_unlock(void) {
+  sesame_sim_setup();
+  static sesame_sim_t sim;
+  sesame *gw = connect_provisioned(&sim, &p_ssms_env->ssm, secret_a);
+  uint32_t radio_end = sim_gw.radio_end;
+
+  ssm_unlock(gw, (uint8_t *)"app", 3);
+  sesame_sim_pump();
+  CHECK_EQ(SSM_UNLOCKED, gw->device_status);
+  CHECK_EQ(1, sim_gw.last_mech_status.is_unlock_range);
+  CHECK_EQ(90, sim_gw.last_mech_status.position);
+  CHECK_EQ(1, sim.history_len);
+  CHECK_EQ(3, sim.history[0].tag_len);
+  CHECK(memcmp(sim.history[0].tag, "app", 3) == 0);
+  // 応答とMECH_STATUSのどちらでもBLEのやり取りの終わりを知らせる
+  CHECK(sim_gw.radio_end > radio_end);
+
+  ssm_lock(gw, NULL, 0);
+  sesame_sim_pump();
+  CHECK_EQ(SSM_LOCKED, gw->device_status);
+  CHECK_EQ(12, sim.history[1].tag_len); // "SESAME ESP32"
+  CHECK_EQ(3, sim_gw.mech_status_events);
+  // 1つのメッセージごとにカウンタが1つ進み、ずれない
+  CHECK_EQ(sim.decrypt.count, gw->cipher.encrypt.count);
+  CHECK_EQ(sim.encrypt.count, gw->cipher.decrypt.count);
+  CHECK_EQ(0, sim.auth_failures);
+}
+
+static void test_time_and_mech_setting(void) {
+  sesame_sim_setup();
+  static sesame_sim_t sim;
+  sesame *gw = connect_provisioned(&sim, &p_ssms_env->ssm, secret_a);
+
+  send_time_cmd_to_ssm(gw, 1800000000);
+  mech_setting_t setting = {.lock_position = -120, .unlock_position = 60};
+  send_mech_setting_cmd_to_ssm(gw, &setting);
+  sesame_sim_pump();
+  CHECK_EQ(1800000000, sim.clock);
+  CHECK_EQ(-120, sim.mech_setting.lock_position);
+  // 新しい角度はpublishで届く
+  CHECK_EQ(1, sim_gw.mech_settings);
+  CHECK_EQ(-120, sim_gw.last_mech_setting.lock_position);
+  CHECK_EQ(60, sim_gw.last_mech_setting.unlock_position);
+
+  ssm_unlock(gw, NULL, 0);
+  sesame_sim_pump();
+  CHECK_EQ(60, sim_gw.last_mech_status.position);
+}
+
+static void test_history(void) {
+  sesame_sim_setup();
+  static sesame_sim_t sim;
+  sesame *gw = connect_provisioned(&sim, &p_ssms_env->ssm, secret_a);
+  char tag[32];
+  for (int i = 0; i < 10; i++) {
+    snprintf(tag, sizeof(tag), "history-record-%02d-0123456789", i);
+    sesame_sim_add_history(&sim, 1 + i % 2, tag);
+  }
+
+  // 応答ごとに次の1件を要求し、空になったら止める
+  send_read_history_cmd_to_ssm(gw);
+  sesame_sim_pump();
+  CHECK_EQ(10, sim_gw.records_len);
+  CHECK_EQ(0, sim.history_len);
+  CHECK_EQ(11, sim.item_counts[SSM_ITEM_CODE_HISTORY]);
+  for (int i = 0; i < sim_gw.records_len; i++) {
+    snprintf(tag, sizeof(tag), "history-record-%02d-0123456789", i);
+    CHECK_EQ(1 + i, sim_gw.records[i].record_id);
+    CHECK_EQ(1 + i % 2, sim_gw.records[i].type);
+    CHECK_EQ(strlen(tag), sim_gw.records[i].tag_len);
+    CHECK(memcmp(sim_gw.records[i].tag, tag, strlen(tag)) == 0);
+  }
+}
+
+static void test_resync_after_missed_notification(void) {
+  sesame_sim_setup();
+  static sesame_sim_t sim;
+  sesame *gw = connect_provisioned(&sim, &p_ssms_env->ssm, secret_a);
+  double resyncs = counter("ccm_resyncs");
+
+  // 応答の通知を取りこぼしても、次のMECH_STATUSは先のカウンタで復号できる
+  sim.drop_notifies = 1;
+  ssm_unlock(gw, NULL, 0);
+  sesame_sim_pump();
+  CHECK_EQ(SSM_UNLOCKED, gw->device_status);
+  CHECK_EQ(resyncs + 1, counter("ccm_resyncs"));
+  CHECK_EQ(sim.encrypt.count, gw->cipher.decrypt.count);
+  CHECK_EQ(0, sim.disconnects);
+}
+
+static void test_reconnect_after_auth_failures(void) {
+  sesame_sim_setup();
+  static sesame_sim_t sim;
+  sesame *gw = connect_provisioned(&sim, &p_ssms_env->ssm, secret_a);
+  double reconnects = counter("ccm_reconnects");
+  uint8_t old_random_code[4];
+  memcpy(old_random_code, sim.random_code, 4);
+
+  // 続けて復号できなければ、カウンタを戻さずに切断する
+  sim.corrupt_notifies = 2;
+  ssm_unlock(gw, NULL, 0);
+  sesame_sim_pump();
+  CHECK_EQ(1, sim.disconnects);
+  CHECK_EQ(SSM_CONNECTED, gw->device_status);
+  CHECK_EQ(reconnects + 1, counter("ccm_reconnects"));
+
+  // 再接続のINITIALで新しいrandom_code(token)のセッションを始める
+  sesame_sim_connect(&sim);
+  sesame_sim_pump();
+  CHECK(memcmp(old_random_code, sim.random_code, 4) != 0);
+  CHECK(memcmp(gw->cipher.token, sim.token, 16) == 0);
+  CHECK_EQ(SSM_UNLOCKED, gw->device_status);
+  CHECK_EQ(SSM_SESSION_OK, gw->session.state);
+  ssm_lock(gw, NULL, 0);
+  sesame_sim_pump();
+  CHECK_EQ(SSM_LOCKED, gw->device_status);
+}
+
+static void test_write_failure_rolls_back_counter(void) {
+  sesame_sim_setup();
+  static sesame_sim_t sim;
+  sesame *gw = connect_provisioned(&sim, &p_ssms_env->ssm, secret_a);
+  int64_t count = gw->cipher.encrypt.count;
+
+  // 2セグメントのメッセージの2つ目が届かない
+  uint8_t long_tag[30];
+  memset(long_tag, 't', sizeof(long_tag));
+  sim.fail_write_segment = 2;
+  ssm_unlock(gw, long_tag, sizeof(long_tag));
+  sesame_sim_pump();
+  CHECK_EQ(count, gw->cipher.encrypt.count);
+  CHECK_EQ(SSM_LOCKED, gw->device_status);
+
+  // SESAMEは組み立て途中のものを捨て、次のメッセージを同じカウンタで復号する
+  ssm_unlock(gw, NULL, 0);
+  sesame_sim_pump();
+  CHECK_EQ(1, sim.partial_dropped);
+  CHECK_EQ(0, sim.auth_failures);
+  CHECK_EQ(SSM_UNLOCKED, gw->device_status);
+  CHECK_EQ(sim.decrypt.count, gw->cipher.encrypt.count);
+}
+
+#define SENDERS 4
+#define SENDS_PER_THREAD 50
+
+static void *sender(void *arg) {
+  sesame *gw = arg;
+  uint8_t tag[24];
+  memset(tag, 's', sizeof(tag)); // 2セグメントになる長さ
+  for (int i = 0; i < SENDS_PER_THREAD; i++) {
+    switch (i % 3) {
+    case 0:
+      ssm_unlock(gw, tag, sizeof(tag));
+      break;
+    case 1:
+      ssm_lock(gw, tag, sizeof(tag));
+      break;
+    default:
+      send_time_cmd_to_ssm(gw, 1700000000 + i);
+      break;
+    }
+  }
+  return NULL;
+}
+
+static volatile int senders_done;
+
+static void *pumper(void *arg) {
+  while (!senders_done)
+    sesame_sim_pump();
+  return NULL;
+}
+
+static void test_concurrent_senders(void) {
+  sesame_sim_setup();
+  static sesame_sim_t sim;
+  sesame *gw = connect_provisioned(&sim, &p_ssms_env->ssm, secret_a);
+  uint32_t commands = sim.commands;
+
+  // コマンド、スケジューラ、LANの受付の各タスクと通知の処理が同時に送る
+  pthread_t threads[SENDERS], pump_thread;
+  senders_done = 0;
+  pthread_create(&pump_thread, NULL, pumper, NULL);
+  for (int i = 0; i < SENDERS; i++)
+    pthread_create(&threads[i], NULL, sender, gw);
+  for (int i = 0; i < SENDERS; i++)
+    pthread_join(threads[i], NULL);
+  senders_done = 1;
+  pthread_join(pump_thread, NULL);
+  sesame_sim_pump();
+
+  // セグメントが混ざらず、全てのメッセージを順に復号できる
+  CHECK_EQ(SENDERS * SENDS_PER_THREAD, sim.commands - commands);
+  CHECK_EQ(0, sim.auth_failures);
+  CHECK_EQ(0, sim.partial_dropped);
+  CHECK_EQ(0, sim.notify_overflows);
+  CHECK_EQ(sim.decrypt.count, gw->cipher.encrypt.count);
+  CHECK_EQ(sim.encrypt.count, gw->cipher.decrypt.count);
+}
+
+static void test_interleaved_reassembly(void) {
+  sesame_sim_setup();
+  static sesame_sim_t sim_a, sim_b;
+  sesame *gw_a = connect_provisioned(&sim_a, &p_ssms_env->ssm, secret_a);
+  sesame *gw_b = connect_provisioned(&sim_b, sesame_sim_new_gateway_sesame(1),
+                                     secret_b);
+  CHECK_EQ(SSM_LOCKED, gw_b->device_status);
+  double failures = counter("ccm_auth_failures");
+
+  char tag[32];
+  for (int i = 0; i < 20; i++) {
+    snprintf(tag, sizeof(tag), "A-%02d-abcdefghijklmnopqrstuv", i);
+    sesame_sim_add_history(&sim_a, 1, tag);
+    snprintf(tag, sizeof(tag), "B-%02d-abcdefghijklmnopqrstuv", i);
+    sesame_sim_add_history(&sim_b, 2, tag);
+  }
+  // 2台の3セグメントの応答が1セグメントずつ交互に届く
+  send_read_history_cmd_to_ssm(gw_a);
+  send_read_history_cmd_to_ssm(gw_b);
+  sesame_sim_pump();
+
+  CHECK_EQ(40, sim_gw.records_len);
+  CHECK_EQ(failures, counter("ccm_auth_failures"));
+  int next_a = 0, next_b = 0;
+  for (int i = 0; i < sim_gw.records_len; i++) {
+    const ssm_history_record_t *rec = &sim_gw.records[i];
+    int *next = rec->tag[0] == 'A' ? &next_a : &next_b;
+    snprintf(tag, sizeof(tag), "%c-%02d-abcdefghijklmnopqrstuv", rec->tag[0],
+             *next);
+    CHECK_EQ(1 + *next, rec->record_id);
+    CHECK_EQ(rec->tag[0] == 'A' ? 1 : 2, rec->type);
+    CHECK_EQ(strlen(tag), rec->tag_len);
+    CHECK(memcmp(rec->tag, tag, rec->tag_len) == 0);
+    (*next)++;
+  }
+  CHECK_EQ(20, next_a);
+  CHECK_EQ(20, next_b);
+}
+
+/* ベンチマーク */
+
+static int compare_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+#define BENCH_COMMANDS 2000
+
+static void bench_lock_unlock(void) {
+  sesame_sim_setup();
+  static sesame_sim_t sim;
+  sesame *gw = connect_provisioned(&sim, &p_ssms_env->ssm, secret_a);
+  static int64_t latency_ns[BENCH_COMMANDS];
+  uint32_t up = sim.write_segments, down = sim.notify_segments;
+
+  int64_t start = bench_now_ns();
+  for (int i = 0; i < BENCH_COMMANDS; i++) {
+    int64_t t0 = bench_now_ns();
+    uint32_t events = sim_gw.mech_status_events;
+    if (i % 2)
+      ssm_lock(gw, NULL, 0);
+    else
+      ssm_unlock(gw, NULL, 0);
+    sesame_sim_pump(); // 応答とMECH_STATUSまで
+    latency_ns[i] = bench_now_ns() - t0;
+    CHECK_EQ(events + 1, sim_gw.mech_status_events);
+  }
+  int64_t elapsed = bench_now_ns() - start;
+  qsort(latency_ns, BENCH_COMMANDS, sizeof(latency_ns[0]), compare_i64);
+  printf("lock/unlock round trip (write, response, MECH_STATUS)\n");
+  printf("  %.0f commands/s, p50 %.1f us, p99 %.1f us\n",
+         BENCH_COMMANDS * 1e9 / elapsed,
+         latency_ns[BENCH_COMMANDS / 2] / 1000.0,
+         latency_ns[BENCH_COMMANDS * 99 / 100] / 1000.0);
+  printf("  segments per command: %.1f written, %.1f notified\n",
+         (double)(sim.write_segments - up) / BENCH_COMMANDS,
+         (double)(sim.notify_segments - down) / BENCH_COMMANDS);
+  CHECK_EQ(0, sim.auth_failures);
+}
+
+#define BENCH_RECORDS 60
+
+static void bench_interleaved_history(int num) {
+  static const uint8_t *secrets[] = {secret_a, secret_b, secret_a, secret_b};
+  static sesame_sim_t sims[SIM_MAX_SESAMES];
+  sesame *gws[SIM_MAX_SESAMES];
+  sesame_sim_setup();
+  for (int i = 0; i < num; i++) {
+    sesame *gw = i == 0 ? &p_ssms_env->ssm : sesame_sim_new_gateway_sesame(i);
+    gws[i] = connect_provisioned(&sims[i], gw, secrets[i]);
+    for (int r = 0; r < BENCH_RECORDS; r++)
+      sesame_sim_add_history(&sims[i], 1, "history-tag-0123456789abcdef");
+  }
+
+  int64_t start = bench_now_ns();
+  for (int i = 0; i < num; i++)
+    send_read_history_cmd_to_ssm(gws[i]);
+  int segments = sesame_sim_pump();
+  int64_t elapsed = bench_now_ns() - start;
+  printf("  %d sesame(s): %6.0f records/s, %4d notified segments\n", num,
+         sim_gw.records_len * 1e9 / elapsed, segments);
+  CHECK_EQ(num * BENCH_RECORDS, sim_gw.records_len);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    bench_lock_unlock();
+    printf("history read with interleaved notifications\n");
+    bench_interleaved_history(1);
+    bench_interleaved_history(2);
+    bench_interleaved_history(4);
+    return TEST_RESULT();
+  }
+  RUN_TEST(test_registration);
+  RUN_TEST(test_login);
+  RUN_TEST(test_lock_unlock);
+  RUN_TEST(test_time_and_mech_setting);
+  RUN_TEST(test_history);
+  RUN_TEST(test_resync_after_missed_notification);
+  RUN_TEST(test_reconnect_after_auth_failures);
+  RUN_TEST(test_write_failure_rolls_back_counter);
+  RUN_TEST(test_concurrent_senders);
+  RUN_TEST(test_interleaved_reassembly);
+  return TEST_RESULT();
+}
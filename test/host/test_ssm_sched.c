@@ -0,0 +1,327 @@
+// sesame/ssm_sched.cの送る順番(優先度と到着順、sesameごとのラウンドロビン)、
+// 期限切れ、取り消し、応答待ちのタイムアウト、IDの世代、背景の書き込みを確かめる
+// ssm_lock/ssm_unlockは送った順に記録するだけの偽物にし、MECH_STATUSの
+// 受信はdevice_statusを変えてssm_sched_on_statusを呼ぶことで模す
+// (応答待ちのタイムアウトはSSM_SCHED_CONFIRM_TIMEOUT_MSで短くしてある)
+
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "ssm_cmd.h"
+#include "ssm_sched.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <string.h>
+
+#define DEVICES 3
+#define WAIT_MS 1000 // 送信や結果を待つ最大時間
+#define LOG_MAX 64
+
+typedef struct {
+  sesame *ssm;
+  ssm_sched_cmd_t cmd;
+} sent_t;
+
+static sesame devices[DEVICES];
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static sent_t sent[LOG_MAX];
+static int num_sent;
+
+static void record(sesame *ssm, ssm_sched_cmd_t cmd) {
+  pthread_mutex_lock(&log_lock);
+  if (num_sent < LOG_MAX)
+    sent[num_sent] = (sent_t){.ssm = ssm, .cmd = cmd};
+  num_sent++;
+  pthread_mutex_unlock(&log_lock);
+}
+
+void ssm_lock(sesame *ssm, uint8_t *tag, uint8_t tag_length) {
+  record(ssm, SSM_SCHED_CMD_LOCK);
+}
+
+void ssm_unlock(sesame *ssm, uint8_t *tag, uint8_t tag_length) {
+  record(ssm, SSM_SCHED_CMD_UNLOCK);
+}
+
+static void write_stub(sesame *ssm) { record(ssm, SSM_SCHED_CMD_WRITE); }
+
+static int sent_count(void) {
+  pthread_mutex_lock(&log_lock);
+  int num = num_sent;
+  pthread_mutex_unlock(&log_lock);
+  return num;
+}
+
+// n件目(0始まり)が送られるまで待ち、その内容を返す
+static sent_t wait_sent(int n) {
+  sent_t entry = {0};
+  for (int waited = 0; sent_count() <= n && waited < WAIT_MS; waited++)
+    vTaskDelay(1);
+  pthread_mutex_lock(&log_lock);
+  if (n < num_sent)
+    entry = sent[n];
+  pthread_mutex_unlock(&log_lock);
+  return entry;
+}
+
+// 送られたコマンドに応じてSESAMEの状態が変わったことを通知する
+static void confirm(sesame *ssm, ssm_sched_cmd_t cmd) {
+  ssm->device_status = cmd == SSM_SCHED_CMD_LOCK ? SSM_LOCKED : SSM_UNLOCKED;
+  ssm_sched_on_status(ssm);
+}
+
+static uint32_t submit(sesame *ssm, ssm_sched_cmd_t cmd, ssm_sched_prio_t prio,
+                       uint32_t deadline_ms) {
+  uint32_t id = 0;
+  CHECK_EQ(ESP_OK, ssm_sched_submit(ssm, cmd, prio, deadline_ms, &id));
+  CHECK(id != 0);
+  return id;
+}
+
+static void reset(void) {
+  CHECK(!ssm_sched_is_busy());
+  for (int i = 0; i < DEVICES; i++)
+    devices[i].device_status = SSM_LOCKED;
+  pthread_mutex_lock(&log_lock);
+  num_sent = 0;
+  pthread_mutex_unlock(&log_lock);
+}
+
+// 送信済みの間は同じsesameの次を送らず、完了後は優先度順(同じ優先度は
+// 到着順)に送る
+static void test_priority_and_arrival_order(void) {
+  reset();
+  sesame *a = &devices[0];
+  uint32_t first = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  CHECK(wait_sent(0).cmd == SSM_SCHED_CMD_UNLOCK);
+  CHECK(ssm_sched_is_busy());
+
+  uint32_t bg = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_BACKGROUND, 0);
+  uint32_t normal1 = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  uint32_t normal2 = submit(a, SSM_SCHED_CMD_LOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  uint32_t emergency =
+      submit(a, SSM_SCHED_CMD_LOCK, SSM_SCHED_PRIO_EMERGENCY, 0);
+  vTaskDelay(20);
+  CHECK_EQ(1, sent_count());
+
+  // 状態が交互に変わるように並べてあるので、全て実際に送られる
+  const uint32_t order[] = {first, emergency, normal1, normal2, bg};
+  const ssm_sched_cmd_t cmds[] = {SSM_SCHED_CMD_UNLOCK, SSM_SCHED_CMD_LOCK,
+                                  SSM_SCHED_CMD_UNLOCK, SSM_SCHED_CMD_LOCK,
+                                  SSM_SCHED_CMD_UNLOCK};
+  for (int i = 0; i < 5; i++) {
+    CHECK(wait_sent(i).cmd == cmds[i]);
+    confirm(a, cmds[i]);
+    CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(order[i], 0));
+    for (int j = i + 1; j < 5; j++)
+      CHECK_EQ(SSM_SCHED_PENDING, ssm_sched_wait(order[j], 0));
+  }
+  CHECK_EQ(5, sent_count());
+}
+
+// 応答を待っているsesameがあっても、他のsesameへは待たずに送る
+static void test_round_robin_across_devices(void) {
+  reset();
+  sesame *a = &devices[0], *b = &devices[1], *c = &devices[2];
+  uint32_t a1 = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  CHECK(wait_sent(0).ssm == a);
+  uint32_t a2 = submit(a, SSM_SCHED_CMD_LOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  uint32_t b1 = submit(b, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  uint32_t c1 = submit(c, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  CHECK(wait_sent(1).ssm != a);
+  CHECK(wait_sent(2).ssm != a);
+  vTaskDelay(20);
+  CHECK_EQ(3, sent_count());
+
+  // b, cの完了はaの待ちに影響しない
+  confirm(b, SSM_SCHED_CMD_UNLOCK);
+  confirm(c, SSM_SCHED_CMD_UNLOCK);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(b1, 0));
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(c1, 0));
+  vTaskDelay(20);
+  CHECK_EQ(3, sent_count());
+
+  confirm(a, SSM_SCHED_CMD_UNLOCK);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(a1, 0));
+  sent_t next = wait_sent(3);
+  CHECK(next.ssm == a && next.cmd == SSM_SCHED_CMD_LOCK);
+  confirm(a, SSM_SCHED_CMD_LOCK);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(a2, 0));
+}
+
+// 既に目的の状態なら送らずに成功、ログインしていなければ送らずに失敗
+static void test_dispatch_without_sending(void) {
+  reset();
+  sesame *a = &devices[0];
+  uint32_t id = submit(a, SSM_SCHED_CMD_LOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(id, pdMS_TO_TICKS(WAIT_MS)));
+
+  a->device_status = SSM_CONNECTED;
+  id = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  CHECK_EQ(SSM_SCHED_NOT_LOGGED_IN, ssm_sched_wait(id, pdMS_TO_TICKS(WAIT_MS)));
+  CHECK_EQ(0, sent_count());
+}
+
+// 期限までに送れなかったものは送らずに打ち切る
+static void test_deadline_expiry(void) {
+  reset();
+  sesame *a = &devices[0];
+  uint32_t first = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  wait_sent(0);
+  int64_t t0 = esp_timer_get_time();
+  uint32_t late = submit(a, SSM_SCHED_CMD_LOCK, SSM_SCHED_PRIO_NORMAL, 50);
+  CHECK_EQ(SSM_SCHED_EXPIRED, ssm_sched_wait(late, pdMS_TO_TICKS(WAIT_MS)));
+  int64_t elapsed_ms = (esp_timer_get_time() - t0) / 1000;
+  CHECK(elapsed_ms >= 50 && elapsed_ms < SSM_SCHED_CONFIRM_TIMEOUT_MS);
+
+  confirm(a, SSM_SCHED_CMD_UNLOCK);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(first, 0));
+  vTaskDelay(20);
+  CHECK_EQ(1, sent_count());
+}
+
+// 送信前のものだけ取り消せる
+static void test_cancel(void) {
+  reset();
+  sesame *a = &devices[0];
+  uint32_t first = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  wait_sent(0);
+  uint32_t queued = submit(a, SSM_SCHED_CMD_LOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  CHECK(!ssm_sched_cancel(first)); // 送信済み
+  CHECK(ssm_sched_cancel(queued));
+  CHECK(!ssm_sched_cancel(queued));
+  CHECK_EQ(SSM_SCHED_CANCELLED, ssm_sched_wait(queued, 0));
+
+  confirm(a, SSM_SCHED_CMD_UNLOCK);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(first, 0));
+  vTaskDelay(20);
+  CHECK_EQ(1, sent_count());
+}
+
+// MECH_STATUSが来なければ応答待ちのタイムアウトで失敗にし、次を送る
+static void test_confirm_timeout(void) {
+  reset();
+  sesame *a = &devices[0];
+  int64_t t0 = esp_timer_get_time();
+  uint32_t lost = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  uint32_t next = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  TickType_t half = pdMS_TO_TICKS(SSM_SCHED_CONFIRM_TIMEOUT_MS / 2);
+  CHECK_EQ(SSM_SCHED_PENDING, ssm_sched_wait(lost, half));
+  CHECK_EQ(SSM_SCHED_FAILED,
+           ssm_sched_wait(lost, pdMS_TO_TICKS(SSM_SCHED_CONFIRM_TIMEOUT_MS)));
+  CHECK((esp_timer_get_time() - t0) / 1000 >= SSM_SCHED_CONFIRM_TIMEOUT_MS);
+
+  CHECK(wait_sent(1).cmd == SSM_SCHED_CMD_UNLOCK);
+  confirm(a, SSM_SCHED_CMD_UNLOCK);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(next, 0));
+
+  // 切断された場合はタイムアウトを待たない
+  uint32_t dropped = submit(a, SSM_SCHED_CMD_LOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  wait_sent(2);
+  a->device_status = SSM_DISCONNECTED;
+  ssm_sched_on_status(a);
+  CHECK_EQ(SSM_SCHED_FAILED, ssm_sched_wait(dropped, 0));
+}
+
+// 解放したIDはスロットが再利用されても別の要求を指さない
+static void test_slot_generation(void) {
+  reset();
+  sesame *a = &devices[0];
+  uint32_t old = submit(a, SSM_SCHED_CMD_LOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(old, pdMS_TO_TICKS(WAIT_MS)));
+  CHECK_EQ(SSM_SCHED_FAILED, ssm_sched_wait(old, 0));
+
+  uint32_t reused = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  CHECK_EQ(old & 0xff, reused & 0xff); // 同じスロット
+  CHECK(reused != old);
+  CHECK(!ssm_sched_cancel(old));
+  CHECK_EQ(SSM_SCHED_FAILED, ssm_sched_wait(old, 0));
+  wait_sent(0);
+  confirm(a, SSM_SCHED_CMD_UNLOCK);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(reused, 0));
+
+  // 世代が一周しても0にならない
+  for (int i = 0; i < 300; i++) {
+    uint32_t id = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+    CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(id, pdMS_TO_TICKS(WAIT_MS)));
+  }
+
+  // 結果を待たない要求は完了後に自動で解放される
+  CHECK_EQ(ESP_OK, ssm_sched_submit(a, SSM_SCHED_CMD_UNLOCK,
+                                    SSM_SCHED_PRIO_BACKGROUND, 0, NULL));
+  for (int waited = 0; ssm_sched_is_busy() && waited < WAIT_MS; waited++)
+    vTaskDelay(1);
+  CHECK(!ssm_sched_is_busy());
+}
+
+// 時刻や角度の書き込みは施錠/開錠の応答待ちの後に送り、送った時点で完了する
+static void test_background_write(void) {
+  reset();
+  sesame *a = &devices[0];
+  uint32_t lock = submit(a, SSM_SCHED_CMD_UNLOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  wait_sent(0);
+  uint32_t write;
+  CHECK_EQ(ESP_OK, ssm_sched_submit_write(
+                       a, write_stub, SSM_SCHED_PRIO_BACKGROUND, 0, &write));
+  uint32_t relock = submit(a, SSM_SCHED_CMD_LOCK, SSM_SCHED_PRIO_NORMAL, 0);
+  vTaskDelay(20);
+  CHECK_EQ(1, sent_count());
+
+  confirm(a, SSM_SCHED_CMD_UNLOCK);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(lock, 0));
+  CHECK(wait_sent(1).cmd == SSM_SCHED_CMD_LOCK);
+  confirm(a, SSM_SCHED_CMD_LOCK);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(relock, 0));
+  CHECK(wait_sent(2).cmd == SSM_SCHED_CMD_WRITE);
+  CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(write, pdMS_TO_TICKS(WAIT_MS)));
+
+  // ログインしていなければ書き込まない
+  a->device_status = SSM_CONNECTED;
+  CHECK_EQ(ESP_OK, ssm_sched_submit_write(
+                       a, write_stub, SSM_SCHED_PRIO_BACKGROUND, 0, &write));
+  CHECK_EQ(SSM_SCHED_NOT_LOGGED_IN,
+           ssm_sched_wait(write, pdMS_TO_TICKS(WAIT_MS)));
+  CHECK_EQ(3, sent_count());
+
+  CHECK_EQ(ESP_ERR_INVALID_ARG,
+           ssm_sched_submit(a, SSM_SCHED_CMD_WRITE, SSM_SCHED_PRIO_BACKGROUND,
+                            0, NULL));
+  CHECK_EQ(ESP_ERR_INVALID_ARG,
+           ssm_sched_submit_write(a, NULL, SSM_SCHED_PRIO_BACKGROUND, 0, NULL));
+}
+
+// 保持できる数を超えた要求は受け付けない
+static void test_queue_full(void) {
+  reset();
+  sesame *a = &devices[0];
+  uint32_t ids[SSM_SCHED_MAX_REQUESTS];
+  ssm_sched_cmd_t cmd = SSM_SCHED_CMD_UNLOCK;
+  for (int i = 0; i < SSM_SCHED_MAX_REQUESTS; i++) {
+    ids[i] = submit(a, cmd, SSM_SCHED_PRIO_NORMAL, 0);
+    cmd = cmd == SSM_SCHED_CMD_LOCK ? SSM_SCHED_CMD_UNLOCK : SSM_SCHED_CMD_LOCK;
+  }
+  uint32_t id;
+  CHECK_EQ(ESP_ERR_NO_MEM, ssm_sched_submit(a, SSM_SCHED_CMD_LOCK,
+                                            SSM_SCHED_PRIO_EMERGENCY, 0, &id));
+  for (int i = 0; i < SSM_SCHED_MAX_REQUESTS; i++) {
+    sent_t entry = wait_sent(i);
+    confirm(a, entry.cmd);
+    CHECK_EQ(SSM_SCHED_SUCCESS, ssm_sched_wait(ids[i], 0));
+  }
+}
+
+int main(void) {
+  CHECK_EQ(ESP_ERR_INVALID_STATE,
+           ssm_sched_submit(&devices[0], SSM_SCHED_CMD_LOCK,
+                            SSM_SCHED_PRIO_NORMAL, 0, NULL));
+  CHECK_EQ(ESP_OK, ssm_sched_init());
+  RUN_TEST(test_priority_and_arrival_order);
+  RUN_TEST(test_round_robin_across_devices);
+  RUN_TEST(test_dispatch_without_sending);
+  RUN_TEST(test_deadline_expiry);
+  RUN_TEST(test_cancel);
+  RUN_TEST(test_confirm_timeout);
+  RUN_TEST(test_slot_generation);
+  RUN_TEST(test_background_write);
+  RUN_TEST(test_queue_full);
+  return TEST_RESULT();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// ホストのテストで使う確認用のマクロ
+// 失敗しても続けて全ての結果を表示し、mainはTEST_RESULT()を返す
+
+#include <stdint.h>
+#include <stdio.h>
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      test_failures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(expected, actual)                                             \
+  do {                                                                         \
+    long long e_ = (long long)(expected), a_ = (long long)(actual);            \
+    if (e_ != a_) {                                                            \
+      fprintf(stderr, "%s:%d: %s: expected %lld, got %lld\n", __FILE__,        \
+              __LINE__, #actual, e_, a_);                                      \
+      test_failures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+#define RUN_TEST(fn)                                                           \
+  do {                                                                         \
+    int before_ = test_failures;                                               \
+    fn();                                                                      \
+    printf("%-40s %s\n", #fn, test_failures == before_ ? "ok" : "FAILED");     \
+  } while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? 0 : 1)